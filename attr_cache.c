@@ -0,0 +1,240 @@
+// Copyright (c) 2015-2021, NVIDIA CORPORATION.
+// SPDX-License-Identifier: Apache-2.0
+
+// Client-side inode attribute cache; see attr_cache.h.
+//
+// A chained hash table finds entries by inode number and a TAILQ keeps them
+// in LRU order, most recently used first. One mutex protects the whole
+// cache; every operation is a handful of pointer updates.
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/queue.h>
+
+#include "debug.h"
+#include "attr_cache.h"
+
+typedef struct attr_cache_entry_s {
+    uint64_t                          inode_number;
+    int64_t                           expires_ns;
+    proxyfs_stat_t                    stat;
+    LIST_ENTRY(attr_cache_entry_s)    hash_entry;
+    TAILQ_ENTRY(attr_cache_entry_s)   lru_entry;
+} attr_cache_entry_t;
+
+LIST_HEAD(attr_cache_bucket_s, attr_cache_entry_s);
+
+struct attr_cache_s {
+    pthread_mutex_t                   lock;
+    int64_t                           ttl_ns;
+    size_t                            max_entries;
+    size_t                            num_entries;
+    size_t                            num_buckets;    // power of two
+    struct attr_cache_bucket_s        *buckets;
+    TAILQ_HEAD(attr_cache_lru_s, attr_cache_entry_s) lru;
+    uint64_t                          generation;     // bumped by every invalidation
+    proxyfs_attr_cache_stats_t        stats;
+};
+
+static int64_t attr_cache_now_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static struct attr_cache_bucket_s* attr_cache_bucket(attr_cache_t* cache, uint64_t inode_number)
+{
+    // Inode numbers are often sequential; mix them so they spread over the buckets
+    uint64_t h = inode_number * 0x9e3779b97f4a7c15ULL;
+    return &cache->buckets[(h >> 32) & (cache->num_buckets - 1)];
+}
+
+static attr_cache_entry_t* attr_cache_find_locked(attr_cache_t* cache, uint64_t inode_number)
+{
+    attr_cache_entry_t* entry;
+    LIST_FOREACH(entry, attr_cache_bucket(cache, inode_number), hash_entry) {
+        if (entry->inode_number == inode_number) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static void attr_cache_remove_locked(attr_cache_t* cache, attr_cache_entry_t* entry)
+{
+    LIST_REMOVE(entry, hash_entry);
+    TAILQ_REMOVE(&cache->lru, entry, lru_entry);
+    cache->num_entries--;
+    free(entry);
+}
+
+attr_cache_t* attr_cache_create(uint64_t ttl_ms, size_t max_entries)
+{
+    if ((ttl_ms == 0) || (max_entries == 0)) {
+        return NULL;
+    }
+
+    attr_cache_t* cache = (attr_cache_t*)calloc(1, sizeof(attr_cache_t));
+    if (cache == NULL) {
+        return NULL;
+    }
+
+    cache->ttl_ns      = (int64_t)ttl_ms * 1000000LL;
+    cache->max_entries = max_entries;
+    cache->num_buckets = 1;
+    while (cache->num_buckets < max_entries) {
+        cache->num_buckets <<= 1;
+    }
+    cache->buckets = (struct attr_cache_bucket_s*)calloc(cache->num_buckets, sizeof(struct attr_cache_bucket_s));
+    if (cache->buckets == NULL) {
+        free(cache);
+        return NULL;
+    }
+    TAILQ_INIT(&cache->lru);
+    pthread_mutex_init(&cache->lock, NULL);
+
+    return cache;
+}
+
+void attr_cache_destroy(attr_cache_t* cache)
+{
+    if (cache == NULL) {
+        return;
+    }
+
+    attr_cache_invalidate_all(cache);
+    pthread_mutex_destroy(&cache->lock);
+    free(cache->buckets);
+    free(cache);
+}
+
+bool attr_cache_lookup(attr_cache_t* cache, uint64_t inode_number, proxyfs_stat_t* out_stat)
+{
+    if (cache == NULL) {
+        return false;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    attr_cache_entry_t* entry = attr_cache_find_locked(cache, inode_number);
+    if ((entry != NULL) && (entry->expires_ns <= attr_cache_now_ns())) {
+        attr_cache_remove_locked(cache, entry);
+        cache->stats.expirations++;
+        entry = NULL;
+    }
+
+    if (entry == NULL) {
+        cache->stats.misses++;
+        pthread_mutex_unlock(&cache->lock);
+        return false;
+    }
+
+    *out_stat = entry->stat;
+    TAILQ_REMOVE(&cache->lru, entry, lru_entry);
+    TAILQ_INSERT_HEAD(&cache->lru, entry, lru_entry);
+    cache->stats.hits++;
+    pthread_mutex_unlock(&cache->lock);
+    return true;
+}
+
+uint64_t attr_cache_generation(attr_cache_t* cache)
+{
+    if (cache == NULL) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    uint64_t generation = cache->generation;
+    pthread_mutex_unlock(&cache->lock);
+    return generation;
+}
+
+void attr_cache_insert(attr_cache_t* cache, const proxyfs_stat_t* stat, uint64_t generation)
+{
+    if (cache == NULL) {
+        return;
+    }
+
+    // Allocate outside the lock; usually this is a new entry
+    attr_cache_entry_t* new_entry = (attr_cache_entry_t*)malloc(sizeof(attr_cache_entry_t));
+    if (new_entry == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    if (generation != cache->generation) {
+        // Something was invalidated while these attributes were being
+        // fetched, so they may predate a local change
+        cache->stats.stale_insertions++;
+        pthread_mutex_unlock(&cache->lock);
+        free(new_entry);
+        return;
+    }
+
+    attr_cache_entry_t* entry = attr_cache_find_locked(cache, stat->ino);
+    if (entry != NULL) {
+        TAILQ_REMOVE(&cache->lru, entry, lru_entry);
+        free(new_entry);
+    } else {
+        entry = new_entry;
+        entry->inode_number = stat->ino;
+        LIST_INSERT_HEAD(attr_cache_bucket(cache, stat->ino), entry, hash_entry);
+        cache->num_entries++;
+    }
+    entry->stat       = *stat;
+    entry->expires_ns = attr_cache_now_ns() + cache->ttl_ns;
+    TAILQ_INSERT_HEAD(&cache->lru, entry, lru_entry);
+    cache->stats.insertions++;
+
+    while (cache->num_entries > cache->max_entries) {
+        attr_cache_remove_locked(cache, TAILQ_LAST(&cache->lru, attr_cache_lru_s));
+        cache->stats.evictions++;
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void attr_cache_invalidate(attr_cache_t* cache, uint64_t inode_number)
+{
+    if (cache == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    cache->generation++;
+    attr_cache_entry_t* entry = attr_cache_find_locked(cache, inode_number);
+    if (entry != NULL) {
+        attr_cache_remove_locked(cache, entry);
+        cache->stats.invalidations++;
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void attr_cache_invalidate_all(attr_cache_t* cache)
+{
+    if (cache == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    cache->generation++;
+    while (!TAILQ_EMPTY(&cache->lru)) {
+        attr_cache_remove_locked(cache, TAILQ_FIRST(&cache->lru));
+        cache->stats.invalidations++;
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void attr_cache_get_stats(attr_cache_t* cache, proxyfs_attr_cache_stats_t* out_stats)
+{
+    if (cache == NULL) {
+        bzero(out_stats, sizeof(*out_stats));
+        return;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    *out_stats = cache->stats;
+    out_stats->entries = cache->num_entries;
+    pthread_mutex_unlock(&cache->lock);
+}
@@ -0,0 +1,42 @@
+// Copyright (c) 2015-2021, NVIDIA CORPORATION.
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef __PFS_ATTR_CACHE_H__
+#define __PFS_ATTR_CACHE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <proxyfs.h>
+
+// Client-side cache of inode attributes, one per mount.
+//
+// Entries are keyed by inode number, expire ttl_ms after they were stored,
+// and the least recently used entry is evicted once max_entries are cached.
+// Every function accepts a NULL cache and then does nothing (lookups miss),
+// which is how a mount with caching turned off is represented.
+//
+// Callers keep entries coherent with what this client does: anything that
+// changes an inode's attributes must invalidate (or replace) its entry.
+// Changes made by other clients are only picked up once the entry expires.
+
+attr_cache_t* attr_cache_create(uint64_t ttl_ms, size_t max_entries);
+void          attr_cache_destroy(attr_cache_t* cache);
+
+// Copy the cached attributes of inode_number to out_stat. Returns false if
+// they aren't cached or have expired.
+bool          attr_cache_lookup(attr_cache_t* cache, uint64_t inode_number, proxyfs_stat_t* out_stat);
+
+// Cache stat under stat->ino, replacing any previous entry.
+//
+// generation is attr_cache_generation() from before the attributes were
+// requested from the server. If anything has been invalidated since, the
+// attributes may predate a local change and are not cached.
+uint64_t      attr_cache_generation(attr_cache_t* cache);
+void          attr_cache_insert(attr_cache_t* cache, const proxyfs_stat_t* stat, uint64_t generation);
+
+void          attr_cache_invalidate(attr_cache_t* cache, uint64_t inode_number);
+void          attr_cache_invalidate_all(attr_cache_t* cache);
+
+void          attr_cache_get_stats(attr_cache_t* cache, proxyfs_attr_cache_stats_t* out_stats);
+
+#endif // __PFS_ATTR_CACHE_H__
@@ -5,8 +5,16 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "base64.h"
 #include "debug.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BASE64_X86
+#endif
+
 
 // Base64 encode/decode
 const char base64_encode_table[] = {
@@ -16,60 +24,41 @@ const char base64_encode_table[] = {
     'w', 'x', 'y', 'z', '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', '+', '/'
 };
 
-char *encode_binary(const uint8_t *inbuf, size_t inbuf_size)
+// Encode whole groups of three bytes and then the padded tail
+static void encode_scalar(const uint8_t *inbuf, size_t inbuf_size, char *outbuf)
 {
-    int       inbuf_pos;
-    uint32_t  inbuf_uint24;
-    char     *outbuf;
-    size_t    outbuf_len;
-    int       outbuf_pos;
-    int       trailing_equals_count;
-
-    outbuf_len = (inbuf_size + 2) / 3;
-    outbuf_len = outbuf_len * 4;
-
-    trailing_equals_count = inbuf_size % 3;
-    if (0 != trailing_equals_count) {
-        trailing_equals_count = 3 - trailing_equals_count;
-    }
-
-    outbuf = (char *)malloc(outbuf_len + 1);
+    uint32_t inbuf_uint24;
 
-    if ((char *)0 != outbuf) {
-        for (outbuf_pos = 0; outbuf_pos < outbuf_len; outbuf_pos += 4) {
-            inbuf_pos = outbuf_pos / 4;
-            inbuf_pos = inbuf_pos  * 3;
+    while (inbuf_size >= 3) {
+        inbuf_uint24 = (inbuf[0] << 16) + (inbuf[1] << 8) + inbuf[2];
 
-            inbuf_uint24 = (inbuf[inbuf_pos] << 16) + (inbuf[inbuf_pos + 1] << 8) + inbuf[inbuf_pos + 2];
+        outbuf[0] = base64_encode_table[(inbuf_uint24 >> 18) & 0b111111];
+        outbuf[1] = base64_encode_table[(inbuf_uint24 >> 12) & 0b111111];
+        outbuf[2] = base64_encode_table[(inbuf_uint24 >>  6) & 0b111111];
+        outbuf[3] = base64_encode_table[(inbuf_uint24 >>  0) & 0b111111];
 
-            outbuf[outbuf_pos + 0] = base64_encode_table[(inbuf_uint24 >> 18) & 0b111111];
-            outbuf[outbuf_pos + 1] = base64_encode_table[(inbuf_uint24 >> 12) & 0b111111];
-            outbuf[outbuf_pos + 2] = base64_encode_table[(inbuf_uint24 >>  6) & 0b111111];
-            outbuf[outbuf_pos + 3] = base64_encode_table[(inbuf_uint24 >>  0) & 0b111111];
-        }
-
-        if (2 == trailing_equals_count) {
-            inbuf_uint24 = inbuf[inbuf_size - 1] << 16;
+        inbuf      += 3;
+        inbuf_size -= 3;
+        outbuf     += 4;
+    }
 
-            outbuf[outbuf_len - 4] = base64_encode_table[(inbuf_uint24 >> 18) & 0b111111];
-            outbuf[outbuf_len - 3] = base64_encode_table[(inbuf_uint24 >> 12) & 0b111111];
-            outbuf[outbuf_len - 2] = '=';
-            outbuf[outbuf_len - 1] = '=';
-         }
+    if (1 == inbuf_size) {
+        inbuf_uint24 = inbuf[0] << 16;
 
-        if (1 == trailing_equals_count) {
-            inbuf_uint24 = (inbuf[inbuf_size - 2] << 16) + (inbuf[inbuf_size - 1] << 8);
+        outbuf[0] = base64_encode_table[(inbuf_uint24 >> 18) & 0b111111];
+        outbuf[1] = base64_encode_table[(inbuf_uint24 >> 12) & 0b111111];
+        outbuf[2] = '=';
+        outbuf[3] = '=';
+    }
 
-            outbuf[outbuf_len - 4] = base64_encode_table[(inbuf_uint24 >> 18) & 0b111111];
-            outbuf[outbuf_len - 3] = base64_encode_table[(inbuf_uint24 >> 12) & 0b111111];
-            outbuf[outbuf_len - 2] = base64_encode_table[(inbuf_uint24 >>  6) & 0b111111];
-            outbuf[outbuf_len - 1] = '=';
-        }
+    if (2 == inbuf_size) {
+        inbuf_uint24 = (inbuf[0] << 16) + (inbuf[1] << 8);
 
-        outbuf[outbuf_len] = '\0';
+        outbuf[0] = base64_encode_table[(inbuf_uint24 >> 18) & 0b111111];
+        outbuf[1] = base64_encode_table[(inbuf_uint24 >> 12) & 0b111111];
+        outbuf[2] = base64_encode_table[(inbuf_uint24 >>  6) & 0b111111];
+        outbuf[3] = '=';
     }
-
-    return outbuf;
 }
 
 const uint8_t base64_decode_table[] = {
@@ -107,55 +96,346 @@ const uint8_t base64_decode_table[] = {
     0b11000000, 0b11000000, 0b11000000, 0b11000000, 0b11000000, 0b11000000, 0b11000000, 0b11000000  // ---, ---, ---, ---, ---, ---, ---, ---
 };
 
-void decode_binary(const char *inbuf, uint8_t *outbuf, size_t outbuf_size, size_t *bytes_written)
+
+// Decode groups of four characters, the last of which may be padded.
+// inbuf_len is a multiple of four.
+static int decode_scalar(const char *inbuf, size_t inbuf_len, uint8_t *outbuf, size_t outbuf_size,
+                         size_t *bytes_written)
 {
-    int      inbuf_len;
-    int      inbuf_pos;
+    uint8_t  a, b, c, d;
     uint32_t inbuf_uint24;
-    int      outbuf_pos;
+    size_t   outbuf_pos = 0;
+    size_t   out_len;
+
+    for (; inbuf_len > 0; inbuf += 4, inbuf_len -= 4) {
+        a = base64_decode_table[(uint8_t)inbuf[0]];
+        b = base64_decode_table[(uint8_t)inbuf[1]];
+        c = base64_decode_table[(uint8_t)inbuf[2]];
+        d = base64_decode_table[(uint8_t)inbuf[3]];
+
+        // Padding ('=' maps to 0b10000000) may only end the last group
+        out_len = 3;
+        if ((4 == inbuf_len) && ('=' == inbuf[3])) {
+            out_len = ('=' == inbuf[2]) ? 1 : 2;
+            d = 0;
+            if (1 == out_len) {
+                c = 0;
+            }
+        }
+        if ((a | b | c | d) & 0b11000000) {
+            *bytes_written = outbuf_pos;
+            return EINVAL;
+        }
+        if (outbuf_pos + out_len > outbuf_size) {
+            *bytes_written = outbuf_pos;
+            return EOVERFLOW;
+        }
+
+        inbuf_uint24 = (a << 18) + (b << 12) + (c << 6) + d;
 
-    inbuf_len = strlen(inbuf);
+        outbuf[outbuf_pos + 0] = inbuf_uint24 >> 16 & 0b11111111;
+        if (out_len > 1) {
+            outbuf[outbuf_pos + 1] = inbuf_uint24 >>  8 & 0b11111111;
+        }
+        if (out_len > 2) {
+            outbuf[outbuf_pos + 2] = inbuf_uint24 >>  0 & 0b11111111;
+        }
+        outbuf_pos += out_len;
+    }
 
-    inbuf_pos  = 0;
-    outbuf_pos = 0;
+    *bytes_written = outbuf_pos;
+    return 0;
+}
 
-    while (1) {
-        outbuf_pos = inbuf_pos  / 4;
-        outbuf_pos = outbuf_pos * 3;
+#ifdef BASE64_X86
+
+// Vector versions, after Wojciech Muła's and Alfred Klomp's SIMD base64
+// work. They only handle whole blocks of plain base64 and leave the rest
+// (the tail, padding and anything invalid) to the scalar code, so they stay
+// simple: each returns how much of its input it consumed.
+
+// The vector code is the same for SSE and AVX2 apart from the names of the
+// types and intrinsics: V is the vector type, P the intrinsic prefix (_mm or
+// _mm256) and W the width suffix (128 or 256).
+
+// Spread 12 bytes over 16, then move each 6-bit index into its own byte
+#define ENCODE_RESHUFFLE(V, P, W, in, out) do {                                   \
+    V t0 = P##_and_si##W(in, P##_set1_epi32(0x0fc0fc00));                         \
+    V t1 = P##_mulhi_epu16(t0, P##_set1_epi32(0x04000040));                       \
+    V t2 = P##_and_si##W(in, P##_set1_epi32(0x003f03f0));                         \
+    V t3 = P##_mullo_epi16(t2, P##_set1_epi32(0x01000010));                       \
+    out  = P##_or_si##W(t1, t3);                                                  \
+} while (0)
+
+// Turn 6-bit indices into characters by adding an offset per range
+#define ENCODE_TRANSLATE(V, P, W, lut, indices, out) do {                         \
+    V range = P##_subs_epu8(indices, P##_set1_epi8(51));                          \
+    V less  = P##_cmpgt_epi8(P##_set1_epi8(26), indices);                         \
+    range   = P##_or_si##W(range, P##_and_si##W(less, P##_set1_epi8(13)));        \
+    out     = P##_add_epi8(P##_shuffle_epi8(lut, range), indices);                \
+} while (0)
+
+#define ENCODE_SHUFFLE   10, 11,  9, 10,  7,  8,  6,  7,  4,  5,  3,  4,  1,  2,  0,  1
+#define ENCODE_OFFSETS   0, 0, 'A', '/' - 63, '+' - 62, '0' - 52, '0' - 52, '0' - 52, \
+                         '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, 'a' - 26
+
+// Validation and translation tables indexed by nibble; see DECODE_BLOCK
+#define DECODE_LUT_LO    0x1a, 0x1b, 0x1b, 0x1b, 0x1a, 0x13, 0x11, 0x11, \
+                         0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x15
+#define DECODE_LUT_HI    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, \
+                         0x08, 0x04, 0x08, 0x04, 0x02, 0x01, 0x10, 0x10
+#define DECODE_LUT_ROLL  0, 0, 0, 0, 0, 0, 0, 0, -71, -71, -65, -65, 4, 19, 16, 0
+#define DECODE_SHUFFLE   -1, -1, -1, -1, 12, 13, 14, 8, 9, 10, 4, 5, 6, 0, 1, 2
+
+__attribute__((target("sse4.1")))
+static size_t encode_blocks_sse41(const uint8_t *inbuf, size_t inbuf_size, char *outbuf)
+{
+    const __m128i shuffle = _mm_set_epi8(ENCODE_SHUFFLE);
+    const __m128i lut     = _mm_set_epi8(ENCODE_OFFSETS);
+    size_t        used    = 0;
+
+    // Each load reads 16 bytes and uses 12
+    while (inbuf_size - used >= 16) {
+        __m128i in = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(inbuf + used)), shuffle);
+        __m128i indices, out;
+        ENCODE_RESHUFFLE(__m128i, _mm, 128, in, indices);
+        ENCODE_TRANSLATE(__m128i, _mm, 128, lut, indices, out);
+        _mm_storeu_si128((__m128i*)outbuf, out);
+
+        used   += 12;
+        outbuf += 16;
+    }
+    return used;
+}
 
-        if ('\0' == inbuf[inbuf_pos]) {
-            *bytes_written = (size_t)(outbuf_pos + 0);
+__attribute__((target("avx2")))
+static size_t encode_blocks_avx2(const uint8_t *inbuf, size_t inbuf_size, char *outbuf)
+{
+    const __m256i shuffle = _mm256_set_epi8(ENCODE_SHUFFLE, ENCODE_SHUFFLE);
+    const __m256i lut     = _mm256_set_epi8(ENCODE_OFFSETS, ENCODE_OFFSETS);
+    size_t        used    = 0;
+
+    // 24 bytes per iteration, 12 in each lane; the second load reads 4
+    // bytes past those
+    while (inbuf_size - used >= 28) {
+        __m256i in = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(inbuf + used))),
+            _mm_loadu_si128((const __m128i*)(inbuf + used + 12)), 1);
+        __m256i indices, out;
+        in = _mm256_shuffle_epi8(in, shuffle);
+        ENCODE_RESHUFFLE(__m256i, _mm256, 256, in, indices);
+        ENCODE_TRANSLATE(__m256i, _mm256, 256, lut, indices, out);
+        _mm256_storeu_si256((__m256i*)outbuf, out);
+
+        used   += 24;
+        outbuf += 32;
+    }
+    return used + encode_blocks_sse41(inbuf + used, inbuf_size - used, outbuf);
+}
 
-            return;
+// Characters are checked by looking up bit masks for their low and high
+// nibbles; a character is valid if the two masks have no bit in common.
+// '/' is the one character whose offset isn't determined by its high
+// nibble, so it gets its own entry in the roll table.
+#define DECODE_BLOCK(V, P, W, str, valid, out) do {                              \
+    const V mask_2f    = P##_set1_epi8(0x2f);                                     \
+    V       hi_nibbles = P##_and_si##W(P##_srli_epi32(str, 4), mask_2f);          \
+    V       lo_nibbles = P##_and_si##W(str, mask_2f);                             \
+    V       lo         = P##_shuffle_epi8(lut_lo, lo_nibbles);                    \
+    V       hi         = P##_shuffle_epi8(lut_hi, hi_nibbles);                    \
+    V       eq_2f      = P##_cmpeq_epi8(str, mask_2f);                            \
+    V       roll       = P##_shuffle_epi8(lut_roll, P##_add_epi8(eq_2f, hi_nibbles)); \
+    valid = P##_testz_si##W(lo, hi);                                              \
+    /* Now 6-bit values; pack each four into three bytes */                       \
+    str = P##_add_epi8(str, roll);                                                \
+    str = P##_maddubs_epi16(str, P##_set1_epi32(0x01400140));                     \
+    str = P##_madd_epi16(str, P##_set1_epi32(0x00011000));                        \
+    out = P##_shuffle_epi8(str, shuffle);                                         \
+} while (0)
+
+__attribute__((target("sse4.1")))
+static size_t decode_blocks_sse41(const char *inbuf, size_t inbuf_len, uint8_t *outbuf, size_t outbuf_size)
+{
+    const __m128i lut_lo   = _mm_set_epi8(DECODE_LUT_LO);
+    const __m128i lut_hi   = _mm_set_epi8(DECODE_LUT_HI);
+    const __m128i lut_roll = _mm_set_epi8(DECODE_LUT_ROLL);
+    const __m128i shuffle  = _mm_set_epi8(DECODE_SHUFFLE);
+    size_t        used     = 0;
+
+    // Each store writes 16 bytes, 12 of them decoded
+    while ((inbuf_len - used >= 16) && (outbuf_size >= 16)) {
+        __m128i str = _mm_loadu_si128((const __m128i*)(inbuf + used));
+        __m128i out;
+        int     valid;
+        DECODE_BLOCK(__m128i, _mm, 128, str, valid, out);
+        if (!valid) {
+            break;
         }
+        _mm_storeu_si128((__m128i*)outbuf, out);
 
-        inbuf_uint24 = base64_decode_table[inbuf[inbuf_pos + 0]] & 0b111111;
-        inbuf_uint24 = (inbuf_uint24 << 6) + (base64_decode_table[inbuf[inbuf_pos + 1]] & 0b111111);
-        inbuf_uint24 = (inbuf_uint24 << 6) + (base64_decode_table[inbuf[inbuf_pos + 2]] & 0b111111);
-        inbuf_uint24 = (inbuf_uint24 << 6) + (base64_decode_table[inbuf[inbuf_pos + 3]] & 0b111111);
- 
-        if ('=' == inbuf[inbuf_pos + 2]) {
-            outbuf[outbuf_pos + 0] = inbuf_uint24 >> 16 & 0b11111111;
-
-            *bytes_written = (size_t)(outbuf_pos + 1);
+        used        += 16;
+        outbuf      += 12;
+        outbuf_size -= 12;
+    }
+    return used;
+}
 
-            return;
+__attribute__((target("avx2")))
+static size_t decode_blocks_avx2(const char *inbuf, size_t inbuf_len, uint8_t *outbuf, size_t outbuf_size)
+{
+    const __m256i lut_lo   = _mm256_set_epi8(DECODE_LUT_LO, DECODE_LUT_LO);
+    const __m256i lut_hi   = _mm256_set_epi8(DECODE_LUT_HI, DECODE_LUT_HI);
+    const __m256i lut_roll = _mm256_set_epi8(DECODE_LUT_ROLL, DECODE_LUT_ROLL);
+    const __m256i shuffle  = _mm256_set_epi8(DECODE_SHUFFLE, DECODE_SHUFFLE);
+    const __m256i pack     = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7);
+    size_t        used     = 0;
+
+    // Each store writes 32 bytes, 24 of them decoded
+    while ((inbuf_len - used >= 32) && (outbuf_size >= 32)) {
+        __m256i str = _mm256_loadu_si256((const __m256i*)(inbuf + used));
+        __m256i out;
+        int     valid;
+        DECODE_BLOCK(__m256i, _mm256, 256, str, valid, out);
+        if (!valid) {
+            break;
         }
+        _mm256_storeu_si256((__m256i*)outbuf, _mm256_permutevar8x32_epi32(out, pack));
 
-        if ('=' == inbuf[inbuf_pos + 3]) {
-            outbuf[outbuf_pos + 0] = inbuf_uint24 >> 16 & 0b11111111;
-            outbuf[outbuf_pos + 1] = inbuf_uint24 >>  8 & 0b11111111;
+        used        += 32;
+        outbuf      += 24;
+        outbuf_size -= 24;
+    }
+    return used + decode_blocks_sse41(inbuf + used, inbuf_len - used, outbuf, outbuf_size);
+}
+
+#endif // BASE64_X86
+
+typedef struct {
+    const char* name;
+    size_t    (*encode_blocks)(const uint8_t *inbuf, size_t inbuf_size, char *outbuf);
+    size_t    (*decode_blocks)(const char *inbuf, size_t inbuf_len, uint8_t *outbuf, size_t outbuf_size);
+} base64_codec_t;
+
+static const base64_codec_t base64_codecs[] = {
+    [BASE64_IMPL_SCALAR] = { "scalar", NULL,                NULL },
+#ifdef BASE64_X86
+    [BASE64_IMPL_SSE41]  = { "sse4.1", encode_blocks_sse41, decode_blocks_sse41 },
+    [BASE64_IMPL_AVX2]   = { "avx2",   encode_blocks_avx2,  decode_blocks_avx2 },
+#else
+    [BASE64_IMPL_SSE41]  = { "sse4.1", NULL,                NULL },
+    [BASE64_IMPL_AVX2]   = { "avx2",   NULL,                NULL },
+#endif
+};
 
-            *bytes_written = (size_t)(outbuf_pos + 2);
+static pthread_once_t        base64_once  = PTHREAD_ONCE_INIT;
+static const base64_codec_t* base64_codec = &base64_codecs[BASE64_IMPL_SCALAR];
 
-            return;
+static bool base64_impl_supported(base64_impl_t impl)
+{
+    switch (impl) {
+        case BASE64_IMPL_SCALAR:
+            return true;
+#ifdef BASE64_X86
+        case BASE64_IMPL_SSE41:
+            return __builtin_cpu_supports("sse4.1");
+        case BASE64_IMPL_AVX2:
+            return __builtin_cpu_supports("avx2");
+#endif
+        default:
+            return false;
+    }
+}
+
+// Use the fastest implementation this CPU supports
+static void base64_init()
+{
+#ifdef BASE64_X86
+    __builtin_cpu_init();
+#endif
+    base64_impl_t impl;
+    for (impl = BASE64_IMPL_AVX2; impl > BASE64_IMPL_SCALAR; impl--) {
+        if (base64_impl_supported(impl)) {
+            break;
         }
+    }
+    base64_codec = &base64_codecs[impl];
+}
 
-        outbuf[outbuf_pos + 0] = inbuf_uint24 >> 16 & 0b11111111;
-        outbuf[outbuf_pos + 1] = inbuf_uint24 >>  8 & 0b11111111;
-        outbuf[outbuf_pos + 2] = inbuf_uint24 >>  0 & 0b11111111;
+base64_impl_t base64_get_impl()
+{
+    pthread_once(&base64_once, base64_init);
+    return (base64_impl_t)(base64_codec - base64_codecs);
+}
+
+const char* base64_impl_name(base64_impl_t impl)
+{
+    return base64_codecs[impl].name;
+}
+
+bool base64_set_impl(base64_impl_t impl)
+{
+    pthread_once(&base64_once, base64_init);
+    if (!base64_impl_supported(impl)) {
+        return false;
+    }
+    base64_codec = &base64_codecs[impl];
+    return true;
+}
+
+size_t base64_encoded_len(size_t inbuf_size)
+{
+    return (inbuf_size + 2) / 3 * 4;
+}
+
+void base64_encode(const uint8_t *inbuf, size_t inbuf_size, char *outbuf)
+{
+    size_t used = 0;
 
-        inbuf_pos += 4;
+    pthread_once(&base64_once, base64_init);
+    if (base64_codec->encode_blocks != NULL) {
+        used = base64_codec->encode_blocks(inbuf, inbuf_size, outbuf);
     }
+    encode_scalar(inbuf + used, inbuf_size - used, outbuf + used / 3 * 4);
 }
 
+int base64_decode(const char *inbuf, size_t inbuf_len, uint8_t *outbuf, size_t outbuf_size, size_t *bytes_written)
+{
+    size_t used = 0;
+    size_t tail_written;
+    int    err;
+
+    *bytes_written = 0;
+    if (0 != inbuf_len % 4) {
+        return EINVAL;
+    }
+
+    pthread_once(&base64_once, base64_init);
+    if (base64_codec->decode_blocks != NULL) {
+        used = base64_codec->decode_blocks(inbuf, inbuf_len, outbuf, outbuf_size);
+    }
+    err = decode_scalar(inbuf + used, inbuf_len - used, outbuf + used / 4 * 3, outbuf_size - used / 4 * 3,
+                        &tail_written);
+    *bytes_written = used / 4 * 3 + tail_written;
+    return err;
+}
+
+char *encode_binary(const uint8_t *inbuf, size_t inbuf_size)
+{
+    size_t  outbuf_len = base64_encoded_len(inbuf_size);
+    char   *outbuf     = (char *)malloc(outbuf_len + 1);
+
+    if ((char *)0 != outbuf) {
+        base64_encode(inbuf, inbuf_size, outbuf);
+        outbuf[outbuf_len] = '\0';
+    }
+
+    return outbuf;
+}
+
+void decode_binary(const char *inbuf, uint8_t *outbuf, size_t outbuf_size, size_t *bytes_written)
+{
+    int err = base64_decode(inbuf, strlen(inbuf), outbuf, outbuf_size, bytes_written);
+    if (err != 0) {
+        DPRINTF("Error %d decoding base64, decoded %zu bytes.\n", err, *bytes_written);
+    }
+}
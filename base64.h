@@ -4,9 +4,47 @@
 #ifndef __PFS_BASE64_H__
 #define __PFS_BASE64_H__
 
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
 // Base64-related encode and decode functions
+//
+// These use SSE4.1 or AVX2 when the CPU has them, chosen at runtime, with a
+// scalar version for everything else.
+
+// Return a malloc'ed, null terminated encoding of inbuf
 char *encode_binary(const uint8_t *inbuf, size_t inbuf_size);
+
+// Decode the null terminated string inbuf; see base64_decode
 void decode_binary(const char *inbuf, uint8_t *outbuf, size_t outbuf_size, size_t *bytes_written);
 
+// Length of the encoding of inbuf_size bytes, not counting a terminator
+size_t base64_encoded_len(size_t inbuf_size);
+
+// Encode inbuf into base64_encoded_len(inbuf_size) characters at outbuf,
+// without a null terminator
+void base64_encode(const uint8_t *inbuf, size_t inbuf_size, char *outbuf);
+
+// Decode inbuf_len characters of padded base64. Returns EINVAL if the input
+// isn't valid base64 and EOVERFLOW if it doesn't fit in outbuf_size bytes;
+// either way *bytes_written is how much was decoded. All of outbuf may be
+// written to, even past the decoded data.
+int base64_decode(const char *inbuf, size_t inbuf_len, uint8_t *outbuf, size_t outbuf_size,
+                  size_t *bytes_written);
+
+// Implementations, for testing and benchmarking
+typedef enum {
+    BASE64_IMPL_SCALAR = 0,
+    BASE64_IMPL_SSE41,
+    BASE64_IMPL_AVX2,
+    BASE64_IMPL_COUNT,
+} base64_impl_t;
+
+base64_impl_t base64_get_impl();
+const char*   base64_impl_name(base64_impl_t impl);
+
+// Switch implementation; false if this CPU doesn't support impl
+bool          base64_set_impl(base64_impl_t impl);
 
 #endif
@@ -0,0 +1,100 @@
+// Copyright (c) 2015-2021, NVIDIA CORPORATION.
+// SPDX-License-Identifier: Apache-2.0
+
+#include <stdbool.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "futex.h"
+#include "completion.h"
+
+#define COMPLETION_PENDING  0
+#define COMPLETION_DONE     1
+#define COMPLETION_SLEEPING 2   // pending, and the waiter is (about to be) asleep
+
+// A spin costs a pause instruction, tens of nanoseconds; this bounds it at
+// roughly the sub-50us round trip of a fast network
+#define COMPLETION_MAX_SPIN  2048
+#define COMPLETION_MIN_SPIN  16
+
+// How long waiters spin before sleeping. It adapts, like glibc's adaptive
+// mutexes, towards twice the spins the waits that ended while spinning took,
+// and shrinks when spinning doesn't pay off. With one CPU the signaller
+// can't run while we spin, so there's no spinning at all.
+static uint32_t       completion_max_spin = COMPLETION_MAX_SPIN;
+static uint32_t       completion_spin     = COMPLETION_MIN_SPIN;
+static pthread_once_t completion_once     = PTHREAD_ONCE_INIT;
+
+static void completion_setup()
+{
+    if (sysconf(_SC_NPROCESSORS_ONLN) <= 1) {
+        completion_max_spin = 0;
+        completion_spin     = 0;
+    }
+}
+
+void completion_init(completion_t* done)
+{
+    __atomic_store_n(&done->state, COMPLETION_PENDING, __ATOMIC_RELAXED);
+}
+
+bool completion_is_done(completion_t* done)
+{
+    return __atomic_load_n(&done->state, __ATOMIC_ACQUIRE) == COMPLETION_DONE;
+}
+
+uint32_t completion_get_max_spin()
+{
+    pthread_once(&completion_once, completion_setup);
+    return __atomic_load_n(&completion_max_spin, __ATOMIC_RELAXED);
+}
+
+void completion_set_max_spin(uint32_t max_spin)
+{
+    pthread_once(&completion_once, completion_setup);
+    __atomic_store_n(&completion_max_spin, max_spin, __ATOMIC_RELAXED);
+    __atomic_store_n(&completion_spin, (max_spin < COMPLETION_MIN_SPIN) ? max_spin : COMPLETION_MIN_SPIN,
+                     __ATOMIC_RELAXED);
+}
+
+void completion_wait(completion_t* done)
+{
+    pthread_once(&completion_once, completion_setup);
+
+    uint32_t spin     = __atomic_load_n(&completion_spin, __ATOMIC_RELAXED);
+    uint32_t max_spin = __atomic_load_n(&completion_max_spin, __ATOMIC_RELAXED);
+    uint32_t i;
+
+    // The updates to completion_spin race with other waiters', which only
+    // costs some accuracy
+    for (i = 0; i < spin; i++) {
+        if (completion_is_done(done)) {
+            uint32_t target = (2 * i < max_spin) ? 2 * i : max_spin;
+            target = (target > COMPLETION_MIN_SPIN) ? target : COMPLETION_MIN_SPIN;
+            __atomic_store_n(&completion_spin, spin + ((int32_t)(target - spin) / 8), __ATOMIC_RELAXED);
+            return;
+        }
+        cpu_relax();
+    }
+    if (spin > COMPLETION_MIN_SPIN) {
+        __atomic_store_n(&completion_spin, spin - spin / 8, __ATOMIC_RELAXED);
+    }
+
+    // Say we're going to sleep, unless it's done already, and sleep until
+    // it is; futex_wait returns at once if the state is no longer SLEEPING
+    uint32_t state = COMPLETION_PENDING;
+    __atomic_compare_exchange_n(&done->state, &state, COMPLETION_SLEEPING, false,
+                                __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE);
+    while (!completion_is_done(done)) {
+        futex_wait(&done->state, COMPLETION_SLEEPING);
+    }
+}
+
+void completion_signal(completion_t* done)
+{
+    // The waiter may return, and reuse or free done, as soon as this is
+    // seen; waking an address that has moved on only makes its futex
+    // waiters recheck their state
+    if (__atomic_exchange_n(&done->state, COMPLETION_DONE, __ATOMIC_RELEASE) == COMPLETION_SLEEPING) {
+        futex_wake(&done->state, 1);
+    }
+}
@@ -0,0 +1,32 @@
+// Copyright (c) 2015-2021, NVIDIA CORPORATION.
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef __PFS_COMPLETION_H__
+#define __PFS_COMPLETION_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// A one-shot event that one thread waits for and another signals, such as
+// the response to a blocking RPC arriving.
+//
+// It's a single word: waiting spins briefly, then sleeps on a futex, and
+// signalling only makes a system call if someone is asleep. Everything the
+// signalling thread wrote before completion_signal() is visible to the
+// waiter after completion_wait(). A completion can be reset and reused once
+// its waiter has returned; it needs no cleanup.
+typedef struct {
+    uint32_t state;
+} completion_t;
+
+void completion_init(completion_t* done);
+void completion_wait(completion_t* done);
+void completion_signal(completion_t* done);
+bool completion_is_done(completion_t* done);
+
+// How many times at most a waiter spins before sleeping (0 with only one
+// CPU), and changing that, for testing
+uint32_t completion_get_max_spin();
+void     completion_set_max_spin(uint32_t max_spin);
+
+#endif
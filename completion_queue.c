@@ -0,0 +1,262 @@
+// Copyright (c) 2015-2021, NVIDIA CORPORATION.
+// SPDX-License-Identifier: Apache-2.0
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include "debug.h"
+#include "mpmc_queue.h"
+#include "completion_queue.h"
+
+typedef struct completion_queue_s {
+    bool         open;
+    bool         closing;     // no more requests may be sent to it
+    int          fd;          // eventfd
+    mpmc_queue_t ring;
+    uint32_t     capacity;
+    uint32_t     pending;     // requests sent and not yet reaped, at most capacity
+    uint32_t     signaled;    // fd written since the last reap that emptied the ring
+    uint32_t     completing;  // threads sending to it, pushing onto ring or signaling fd
+} completion_queue_t;
+
+// Queues are looked up without the lock, and their slots are reused rather than freed, so that the thread
+// completing a request can still be pushing onto the ring when the request has been reaped; closing waits
+// for it to finish.
+static completion_queue_t completion_queues[COMPLETION_QUEUES_LIMIT];
+static pthread_mutex_t    completion_queues_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static completion_queue_t *completion_queue_find(int fd)
+{
+    int i;
+
+    if (fd < 0) {
+        return NULL;
+    }
+    for (i = 0; i < COMPLETION_QUEUES_LIMIT; i++) {
+        completion_queue_t *cq = &completion_queues[i];
+        if (__atomic_load_n(&cq->open, __ATOMIC_ACQUIRE) && (__atomic_load_n(&cq->fd, __ATOMIC_RELAXED) == fd)) {
+            return cq;
+        }
+    }
+    return NULL;
+}
+
+// Find the queue and keep it from being torn down until completion_queue_release()
+static completion_queue_t *completion_queue_hold(int fd)
+{
+    completion_queue_t *cq = completion_queue_find(fd);
+
+    if (cq == NULL) {
+        return NULL;
+    }
+    __atomic_add_fetch(&cq->completing, 1, __ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&cq->open, __ATOMIC_SEQ_CST) || (__atomic_load_n(&cq->fd, __ATOMIC_RELAXED) != fd)) {
+        // Closed in the meantime
+        __atomic_sub_fetch(&cq->completing, 1, __ATOMIC_SEQ_CST);
+        return NULL;
+    }
+    return cq;
+}
+
+static void completion_queue_release(completion_queue_t *cq)
+{
+    __atomic_sub_fetch(&cq->completing, 1, __ATOMIC_SEQ_CST);
+}
+
+// Make the descriptor readable, unless it already is
+static void completion_queue_signal(completion_queue_t *cq)
+{
+    uint64_t one = 1;
+
+    if (__atomic_load_n(&cq->signaled, __ATOMIC_SEQ_CST) != 0) {
+        return;
+    }
+    if (__atomic_exchange_n(&cq->signaled, 1, __ATOMIC_SEQ_CST) == 0) {
+        if (write(cq->fd, &one, sizeof(one)) != sizeof(one)) {
+            DPRINTF("Failed to signal completion queue fd %d: errno %d\n", cq->fd, errno);
+        }
+    }
+}
+
+int proxyfs_completion_queue_open(int capacity, int *out_fd)
+{
+    completion_queue_t *cq = NULL;
+    int                fd, i;
+
+    if (out_fd == NULL) {
+        return EINVAL;
+    }
+
+    pthread_mutex_lock(&completion_queues_lock);
+    for (i = 0; i < COMPLETION_QUEUES_LIMIT; i++) {
+        if (!completion_queues[i].open) {
+            cq = &completion_queues[i];
+            break;
+        }
+    }
+    if (cq == NULL) {
+        pthread_mutex_unlock(&completion_queues_lock);
+        return EMFILE;
+    }
+
+    fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd < 0) {
+        int err = errno;
+        pthread_mutex_unlock(&completion_queues_lock);
+        return err;
+    }
+    if (mpmc_queue_init(&cq->ring, (capacity > 0) ? capacity : COMPLETION_QUEUE_SIZE_DEFAULT) != 0) {
+        pthread_mutex_unlock(&completion_queues_lock);
+        close(fd);
+        return ENOMEM;
+    }
+    cq->capacity = (capacity > 0) ? capacity : COMPLETION_QUEUE_SIZE_DEFAULT;
+    cq->pending  = 0;
+    cq->signaled = 0;
+    cq->closing  = false;
+    __atomic_store_n(&cq->fd, fd, __ATOMIC_RELAXED);
+    __atomic_store_n(&cq->open, true, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&completion_queues_lock);
+
+    *out_fd = fd;
+    return 0;
+}
+
+int proxyfs_reap_completions(int fd, proxyfs_io_request_t **out_reqs, int max, int *out_count)
+{
+    completion_queue_t   *cq = completion_queue_find(fd);
+    proxyfs_io_request_t *req;
+    uint64_t             count;
+    int                  n = 0;
+
+    if ((out_reqs == NULL) || (out_count == NULL) || (max < 0)) {
+        return EINVAL;
+    }
+    if (cq == NULL) {
+        return EBADF;
+    }
+
+    while ((n < max) && ((req = (proxyfs_io_request_t *)mpmc_queue_try_pop(&cq->ring)) != NULL)) {
+        out_reqs[n++] = req;
+    }
+
+    if (n < max) {
+        // Empty: clear the descriptor and have the next push write it again, then look once more for
+        // what was pushed before that push could see it cleared
+        if (read(cq->fd, &count, sizeof(count)) < 0) {
+            // EAGAIN: it wasn't readable
+        }
+        __atomic_store_n(&cq->signaled, 0, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        while ((n < max) && ((req = (proxyfs_io_request_t *)mpmc_queue_try_pop(&cq->ring)) != NULL)) {
+            out_reqs[n++] = req;
+        }
+        if (n == max) {
+            // There may be more, and nobody to say so
+            completion_queue_signal(cq);
+        }
+    }
+
+    __atomic_sub_fetch(&cq->pending, n, __ATOMIC_SEQ_CST);
+    *out_count = n;
+    return 0;
+}
+
+int proxyfs_completion_queue_close(int fd)
+{
+    pthread_mutex_lock(&completion_queues_lock);
+    completion_queue_t *cq = completion_queue_find(fd);
+    if (cq == NULL) {
+        pthread_mutex_unlock(&completion_queues_lock);
+        return EBADF;
+    }
+
+    // Nothing more sent to it, and once those being sent are counted, not closed with any left to reap:
+    // they would have nowhere to go
+    __atomic_store_n(&cq->closing, true, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&cq->completing, __ATOMIC_SEQ_CST) != 0) {
+        sched_yield();
+    }
+    if (__atomic_load_n(&cq->pending, __ATOMIC_SEQ_CST) != 0) {
+        __atomic_store_n(&cq->closing, false, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&completion_queues_lock);
+        return EBUSY;
+    }
+
+    // No new completions, then wait for any still pushing or signaling
+    __atomic_store_n(&cq->open, false, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&cq->completing, __ATOMIC_SEQ_CST) != 0) {
+        sched_yield();
+    }
+
+    mpmc_queue_destroy(&cq->ring);
+    close(fd);
+    pthread_mutex_unlock(&completion_queues_lock);
+    return 0;
+}
+
+bool io_req_has_completion(proxyfs_io_request_t *req)
+{
+    return (req->done_cb != NULL) || (completion_queue_find(req->done_cb_fd) != NULL);
+}
+
+int io_req_reserve_completion(proxyfs_io_request_t *req)
+{
+    if (req->done_cb != NULL) {
+        return 0;
+    }
+
+    completion_queue_t *cq = completion_queue_hold(req->done_cb_fd);
+    if (cq == NULL) {
+        return EINVAL;
+    }
+    int err = 0;
+    if (__atomic_load_n(&cq->closing, __ATOMIC_SEQ_CST)) {
+        err = EINVAL;
+    } else if (__atomic_add_fetch(&cq->pending, 1, __ATOMIC_SEQ_CST) > cq->capacity) {
+        __atomic_sub_fetch(&cq->pending, 1, __ATOMIC_SEQ_CST);
+        err = EAGAIN;
+    }
+    completion_queue_release(cq);
+    return err;
+}
+
+void io_req_cancel_completion(proxyfs_io_request_t *req)
+{
+    if (req->done_cb != NULL) {
+        return;
+    }
+
+    // Can't be closed while the request is counted
+    completion_queue_t *cq = completion_queue_find(req->done_cb_fd);
+    if (cq != NULL) {
+        __atomic_sub_fetch(&cq->pending, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+void io_req_complete(proxyfs_io_request_t *req)
+{
+    if (req->done_cb != NULL) {
+        req->done_cb(req);
+        return;
+    }
+
+    // The fd is read before the push, since the request may be reaped and reused as soon as it's pushed
+    int                fd = req->done_cb_fd;
+    completion_queue_t *cq = completion_queue_hold(fd);
+    if (cq == NULL) {
+        // Can't be closed while a request sent to it is pending, so this one was never counted
+        DPRINTF("Request %p finished for completion queue fd %d, which isn't open\n", req, fd);
+        return;
+    }
+
+    // Never waits: the ring holds every request counted against the queue
+    mpmc_queue_push(&cq->ring, req);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    completion_queue_signal(cq);
+    completion_queue_release(cq);
+}
@@ -0,0 +1,39 @@
+// Copyright (c) 2015-2021, NVIDIA CORPORATION.
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef __PFS_COMPLETION_QUEUE_H__
+#define __PFS_COMPLETION_QUEUE_H__
+
+#include <stdbool.h>
+#include <proxyfs.h>
+
+// Completion queues (proxyfs_completion_queue_open in proxyfs.h): finished
+// requests go onto a lock-free ring that any number of I/O threads push to
+// and the owner reaps from. The eventfd is written only by the first push
+// after a reap that found the ring empty, so a burst of completions costs
+// one system call and one wake-up.
+//
+// Requests are counted against the queue from when they're sent until
+// they're reaped, and no more are sent than it holds, so a finished
+// request always finds room and I/O threads never wait for the reaper.
+
+// Most completion queues open at once
+#define COMPLETION_QUEUES_LIMIT         64
+#define COMPLETION_QUEUE_SIZE_DEFAULT   4096
+
+// True if the request says how it's to be completed: a done_cb, or the descriptor of an open
+// completion queue
+bool io_req_has_completion(proxyfs_io_request_t *req);
+
+// Count a request about to be sent against its completion queue: 0, EAGAIN if as many as it holds are
+// already sent and not yet reaped, or EINVAL if it has neither a done_cb nor an open queue. Requests with
+// a done_cb aren't counted.
+int io_req_reserve_completion(proxyfs_io_request_t *req);
+
+// Undo io_req_reserve_completion() for a request that wasn't sent after all
+void io_req_cancel_completion(proxyfs_io_request_t *req);
+
+// Hand back a finished request: call its done_cb, or put it on its completion queue
+void io_req_complete(proxyfs_io_request_t *req);
+
+#endif
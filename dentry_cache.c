@@ -0,0 +1,369 @@
+// Copyright (c) 2015-2021, NVIDIA CORPORATION.
+// SPDX-License-Identifier: Apache-2.0
+
+// Client-side directory entry cache; see dentry_cache.h.
+//
+// Laid out like the attribute cache: a chained hash table finds entries by
+// (directory inode, name), a TAILQ keeps them in LRU order, most recently
+// used first, and one mutex protects the whole cache. Names are stored
+// inline at the end of each entry.
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/queue.h>
+
+#include "debug.h"
+#include "dentry_cache.h"
+
+typedef struct dentry_cache_entry_s {
+    uint64_t                            dir_inode_number;
+    uint64_t                            hash;
+    uint64_t                            inode_number;   // unused if negative
+    bool                                negative;
+    int64_t                             expires_ns;
+    LIST_ENTRY(dentry_cache_entry_s)    hash_entry;
+    TAILQ_ENTRY(dentry_cache_entry_s)   lru_entry;
+    char                                name[];
+} dentry_cache_entry_t;
+
+LIST_HEAD(dentry_cache_bucket_s, dentry_cache_entry_s);
+
+struct dentry_cache_s {
+    pthread_mutex_t                     lock;
+    int64_t                             ttl_ns;
+    int64_t                             negative_ttl_ns;  // 0: negative entries aren't kept
+    size_t                              max_entries;
+    size_t                              num_entries;
+    size_t                              num_buckets;      // power of two
+    struct dentry_cache_bucket_s        *buckets;
+    TAILQ_HEAD(dentry_cache_lru_s, dentry_cache_entry_s) lru;
+    uint64_t                            generation;       // bumped by every local change
+    proxyfs_dentry_cache_stats_t        stats;
+};
+
+static int64_t dentry_cache_now_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static uint64_t dentry_cache_hash(uint64_t dir_inode_number, const char* name)
+{
+    // FNV-1a over the name, seeded with the (mixed) directory inode number
+    uint64_t h = 0xcbf29ce484222325ULL ^ (dir_inode_number * 0x9e3779b97f4a7c15ULL);
+    for (; *name != '\0'; name++) {
+        h ^= (uint8_t)*name;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static struct dentry_cache_bucket_s* dentry_cache_bucket(dentry_cache_t* cache, uint64_t hash)
+{
+    return &cache->buckets[(hash >> 32) & (cache->num_buckets - 1)];
+}
+
+static dentry_cache_entry_t* dentry_cache_find_locked(dentry_cache_t* cache, uint64_t dir_inode_number,
+                                                      const char* name, uint64_t hash)
+{
+    dentry_cache_entry_t* entry;
+    LIST_FOREACH(entry, dentry_cache_bucket(cache, hash), hash_entry) {
+        if ((entry->hash == hash) && (entry->dir_inode_number == dir_inode_number) &&
+            (strcmp(entry->name, name) == 0)) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static void dentry_cache_remove_locked(dentry_cache_t* cache, dentry_cache_entry_t* entry)
+{
+    LIST_REMOVE(entry, hash_entry);
+    TAILQ_REMOVE(&cache->lru, entry, lru_entry);
+    cache->num_entries--;
+    free(entry);
+}
+
+static dentry_cache_entry_t* dentry_cache_alloc(uint64_t dir_inode_number, const char* name, uint64_t hash)
+{
+    size_t                name_len = strlen(name);
+    dentry_cache_entry_t* entry    = (dentry_cache_entry_t*)malloc(sizeof(dentry_cache_entry_t) + name_len + 1);
+    if (entry == NULL) {
+        return NULL;
+    }
+
+    entry->dir_inode_number = dir_inode_number;
+    entry->hash             = hash;
+    memcpy(entry->name, name, name_len + 1);
+    return entry;
+}
+
+// Store (or refresh) an entry. new_entry was allocated by the caller outside
+// the lock and is used, or freed if the name was already cached.
+static void dentry_cache_store_locked(dentry_cache_t* cache, dentry_cache_entry_t* new_entry, bool negative,
+                                      uint64_t inode_number)
+{
+    dentry_cache_entry_t* entry = dentry_cache_find_locked(cache, new_entry->dir_inode_number, new_entry->name,
+                                                           new_entry->hash);
+    if (entry != NULL) {
+        TAILQ_REMOVE(&cache->lru, entry, lru_entry);
+        free(new_entry);
+    } else {
+        entry = new_entry;
+        LIST_INSERT_HEAD(dentry_cache_bucket(cache, entry->hash), entry, hash_entry);
+        cache->num_entries++;
+    }
+    entry->negative     = negative;
+    entry->inode_number = negative ? 0 : inode_number;
+    entry->expires_ns   = dentry_cache_now_ns() + (negative ? cache->negative_ttl_ns : cache->ttl_ns);
+    TAILQ_INSERT_HEAD(&cache->lru, entry, lru_entry);
+    if (negative) {
+        cache->stats.negative_insertions++;
+    } else {
+        cache->stats.insertions++;
+    }
+
+    while (cache->num_entries > cache->max_entries) {
+        dentry_cache_remove_locked(cache, TAILQ_LAST(&cache->lru, dentry_cache_lru_s));
+        cache->stats.evictions++;
+    }
+}
+
+static void dentry_cache_invalidate_locked(dentry_cache_t* cache, uint64_t dir_inode_number, const char* name,
+                                           uint64_t hash)
+{
+    dentry_cache_entry_t* entry = dentry_cache_find_locked(cache, dir_inode_number, name, hash);
+    if (entry != NULL) {
+        dentry_cache_remove_locked(cache, entry);
+        cache->stats.invalidations++;
+    }
+}
+
+dentry_cache_t* dentry_cache_create(uint64_t ttl_ms, uint64_t negative_ttl_ms, size_t max_entries)
+{
+    if ((ttl_ms == 0) || (max_entries == 0)) {
+        return NULL;
+    }
+
+    dentry_cache_t* cache = (dentry_cache_t*)calloc(1, sizeof(dentry_cache_t));
+    if (cache == NULL) {
+        return NULL;
+    }
+
+    cache->ttl_ns          = (int64_t)ttl_ms * 1000000LL;
+    cache->negative_ttl_ns = (int64_t)negative_ttl_ms * 1000000LL;
+    cache->max_entries     = max_entries;
+    cache->num_buckets     = 1;
+    while (cache->num_buckets < max_entries) {
+        cache->num_buckets <<= 1;
+    }
+    cache->buckets = (struct dentry_cache_bucket_s*)calloc(cache->num_buckets, sizeof(struct dentry_cache_bucket_s));
+    if (cache->buckets == NULL) {
+        free(cache);
+        return NULL;
+    }
+    TAILQ_INIT(&cache->lru);
+    pthread_mutex_init(&cache->lock, NULL);
+
+    return cache;
+}
+
+void dentry_cache_destroy(dentry_cache_t* cache)
+{
+    if (cache == NULL) {
+        return;
+    }
+
+    dentry_cache_invalidate_all(cache);
+    pthread_mutex_destroy(&cache->lock);
+    free(cache->buckets);
+    free(cache);
+}
+
+dentry_cache_result_t dentry_cache_lookup(dentry_cache_t* cache, uint64_t dir_inode_number, const char* name,
+                                          uint64_t* out_inode_number)
+{
+    if (cache == NULL) {
+        return DENTRY_CACHE_MISS;
+    }
+
+    uint64_t hash = dentry_cache_hash(dir_inode_number, name);
+
+    pthread_mutex_lock(&cache->lock);
+    dentry_cache_entry_t* entry = dentry_cache_find_locked(cache, dir_inode_number, name, hash);
+    if ((entry != NULL) && (entry->expires_ns <= dentry_cache_now_ns())) {
+        dentry_cache_remove_locked(cache, entry);
+        cache->stats.expirations++;
+        entry = NULL;
+    }
+
+    if (entry == NULL) {
+        cache->stats.misses++;
+        pthread_mutex_unlock(&cache->lock);
+        return DENTRY_CACHE_MISS;
+    }
+
+    dentry_cache_result_t result = DENTRY_CACHE_NEGATIVE;
+    if (entry->negative) {
+        cache->stats.negative_hits++;
+    } else {
+        *out_inode_number = entry->inode_number;
+        cache->stats.hits++;
+        result = DENTRY_CACHE_HIT;
+    }
+    TAILQ_REMOVE(&cache->lru, entry, lru_entry);
+    TAILQ_INSERT_HEAD(&cache->lru, entry, lru_entry);
+    pthread_mutex_unlock(&cache->lock);
+    return result;
+}
+
+bool dentry_cache_peek(dentry_cache_t* cache, uint64_t dir_inode_number, const char* name,
+                       uint64_t* out_inode_number)
+{
+    if (cache == NULL) {
+        return false;
+    }
+
+    uint64_t hash  = dentry_cache_hash(dir_inode_number, name);
+    bool     found = false;
+
+    pthread_mutex_lock(&cache->lock);
+    dentry_cache_entry_t* entry = dentry_cache_find_locked(cache, dir_inode_number, name, hash);
+    if ((entry != NULL) && !entry->negative && (entry->expires_ns > dentry_cache_now_ns())) {
+        *out_inode_number = entry->inode_number;
+        found = true;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return found;
+}
+
+uint64_t dentry_cache_generation(dentry_cache_t* cache)
+{
+    if (cache == NULL) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    uint64_t generation = cache->generation;
+    pthread_mutex_unlock(&cache->lock);
+    return generation;
+}
+
+static void dentry_cache_insert1(dentry_cache_t* cache, uint64_t dir_inode_number, const char* name,
+                                 bool negative, uint64_t inode_number, uint64_t generation)
+{
+    if ((cache == NULL) || (negative && (cache->negative_ttl_ns == 0))) {
+        return;
+    }
+
+    // Allocate outside the lock; usually this is a new entry
+    dentry_cache_entry_t* new_entry = dentry_cache_alloc(dir_inode_number, name,
+                                                         dentry_cache_hash(dir_inode_number, name));
+    if (new_entry == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    if (generation != cache->generation) {
+        // Something changed locally while the server was being asked, so
+        // its answer may predate that change
+        cache->stats.stale_insertions++;
+        pthread_mutex_unlock(&cache->lock);
+        free(new_entry);
+        return;
+    }
+    dentry_cache_store_locked(cache, new_entry, negative, inode_number);
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void dentry_cache_insert(dentry_cache_t* cache, uint64_t dir_inode_number, const char* name,
+                         uint64_t inode_number, uint64_t generation)
+{
+    dentry_cache_insert1(cache, dir_inode_number, name, false, inode_number, generation);
+}
+
+void dentry_cache_insert_negative(dentry_cache_t* cache, uint64_t dir_inode_number, const char* name,
+                                  uint64_t generation)
+{
+    dentry_cache_insert1(cache, dir_inode_number, name, true, 0, generation);
+}
+
+static void dentry_cache_update1(dentry_cache_t* cache, uint64_t dir_inode_number, const char* name,
+                                 bool negative, uint64_t inode_number)
+{
+    if (cache == NULL) {
+        return;
+    }
+
+    uint64_t              hash      = dentry_cache_hash(dir_inode_number, name);
+    dentry_cache_entry_t* new_entry = NULL;
+    if (!negative || (cache->negative_ttl_ns != 0)) {
+        new_entry = dentry_cache_alloc(dir_inode_number, name, hash);
+    }
+
+    // Lookups already on their way to the server must not overwrite this
+    pthread_mutex_lock(&cache->lock);
+    cache->generation++;
+    if (new_entry != NULL) {
+        dentry_cache_store_locked(cache, new_entry, negative, inode_number);
+    } else {
+        dentry_cache_invalidate_locked(cache, dir_inode_number, name, hash);
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void dentry_cache_update(dentry_cache_t* cache, uint64_t dir_inode_number, const char* name,
+                         uint64_t inode_number)
+{
+    dentry_cache_update1(cache, dir_inode_number, name, false, inode_number);
+}
+
+void dentry_cache_remove(dentry_cache_t* cache, uint64_t dir_inode_number, const char* name)
+{
+    dentry_cache_update1(cache, dir_inode_number, name, true, 0);
+}
+
+void dentry_cache_invalidate(dentry_cache_t* cache, uint64_t dir_inode_number, const char* name)
+{
+    if (cache == NULL) {
+        return;
+    }
+
+    uint64_t hash = dentry_cache_hash(dir_inode_number, name);
+
+    pthread_mutex_lock(&cache->lock);
+    cache->generation++;
+    dentry_cache_invalidate_locked(cache, dir_inode_number, name, hash);
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void dentry_cache_invalidate_all(dentry_cache_t* cache)
+{
+    if (cache == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    cache->generation++;
+    while (!TAILQ_EMPTY(&cache->lru)) {
+        dentry_cache_remove_locked(cache, TAILQ_FIRST(&cache->lru));
+        cache->stats.invalidations++;
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void dentry_cache_get_stats(dentry_cache_t* cache, proxyfs_dentry_cache_stats_t* out_stats)
+{
+    if (cache == NULL) {
+        bzero(out_stats, sizeof(*out_stats));
+        return;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    *out_stats = cache->stats;
+    out_stats->entries = cache->num_entries;
+    pthread_mutex_unlock(&cache->lock);
+}
@@ -0,0 +1,66 @@
+// Copyright (c) 2015-2021, NVIDIA CORPORATION.
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef __PFS_DENTRY_CACHE_H__
+#define __PFS_DENTRY_CACHE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <proxyfs.h>
+
+// Client-side cache of directory entries, one per mount.
+//
+// Entries map (directory inode, name) to the child's inode number, or record
+// that the name does not exist (a negative entry). Positive entries expire
+// ttl_ms after they were stored and negative ones after negative_ttl_ms; the
+// least recently used entry is evicted once max_entries are cached. Every
+// function accepts a NULL cache and then does nothing (lookups miss), which
+// is how a mount with caching turned off is represented.
+//
+// Callers keep entries coherent with what this client does: anything that
+// adds, removes or renames a name must update or invalidate its entry.
+// Changes made by other clients are only picked up once the entry expires.
+
+typedef enum {
+    DENTRY_CACHE_MISS = 0,
+    DENTRY_CACHE_HIT,            // *out_inode_number is set
+    DENTRY_CACHE_NEGATIVE,       // the name is known not to exist
+} dentry_cache_result_t;
+
+dentry_cache_t*       dentry_cache_create(uint64_t ttl_ms, uint64_t negative_ttl_ms, size_t max_entries);
+void                  dentry_cache_destroy(dentry_cache_t* cache);
+
+dentry_cache_result_t dentry_cache_lookup(dentry_cache_t* cache, uint64_t dir_inode_number, const char* name,
+                                          uint64_t* out_inode_number);
+
+// Like dentry_cache_lookup() for a positive entry, but without counting a hit
+// or miss or refreshing its LRU position. For finding the inode a local
+// change is about to affect.
+bool                  dentry_cache_peek(dentry_cache_t* cache, uint64_t dir_inode_number, const char* name,
+                                        uint64_t* out_inode_number);
+
+// Cache the result of asking the server about name, replacing any previous
+// entry.
+//
+// generation is dentry_cache_generation() from before the server was asked.
+// If anything has changed locally since, the answer may predate that change
+// and is not cached.
+uint64_t              dentry_cache_generation(dentry_cache_t* cache);
+void                  dentry_cache_insert(dentry_cache_t* cache, uint64_t dir_inode_number, const char* name,
+                                          uint64_t inode_number, uint64_t generation);
+void                  dentry_cache_insert_negative(dentry_cache_t* cache, uint64_t dir_inode_number,
+                                                   const char* name, uint64_t generation);
+
+// Record a local change: name was created as (or now links to) inode_number,
+// or name was removed.
+void                  dentry_cache_update(dentry_cache_t* cache, uint64_t dir_inode_number, const char* name,
+                                          uint64_t inode_number);
+void                  dentry_cache_remove(dentry_cache_t* cache, uint64_t dir_inode_number, const char* name);
+
+// Forget name, e.g. after a local change whose outcome isn't known.
+void                  dentry_cache_invalidate(dentry_cache_t* cache, uint64_t dir_inode_number, const char* name);
+void                  dentry_cache_invalidate_all(dentry_cache_t* cache);
+
+void                  dentry_cache_get_stats(dentry_cache_t* cache, proxyfs_dentry_cache_stats_t* out_stats);
+
+#endif // __PFS_DENTRY_CACHE_H__
@@ -0,0 +1,109 @@
+// Copyright (c) 2015-2021, NVIDIA CORPORATION.
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef __PFS_EVENTCOUNT_H__
+#define __PFS_EVENTCOUNT_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <time.h>
+#include "futex.h"
+
+// Lets threads sleep until lock-free producers have something for them,
+// without the producers making a system call unless someone is asleep.
+//
+// A consumer that found nothing calls eventcount_prepare(), looks again and
+// only then calls eventcount_wait() with the key it got. A producer calls
+// eventcount_notify() after publishing. The fences in the two make sure that
+// either the consumer's second look sees the work, or the producer sees the
+// consumer and wakes it.
+//
+// The producer that wakes a sleeper takes it off the count, so producers
+// that follow before it gets to run don't wake it again. A consumer that
+// prepares and then finds work after all stays counted, and some later
+// notify makes one wake-up call too many; that's cheaper than knowing
+// whether it was already taken off.
+
+typedef struct {
+    uint32_t seq;         // futex word; bumped by every wake-up
+    uint32_t sleepers;    // consumers (going) to sleep, not yet woken
+} eventcount_t;
+
+static inline void eventcount_init(eventcount_t* ec)
+{
+    ec->seq      = 0;
+    ec->sleepers = 0;
+}
+
+static inline uint32_t eventcount_prepare(eventcount_t* ec)
+{
+    uint32_t key = __atomic_load_n(&ec->seq, __ATOMIC_SEQ_CST);
+
+    __atomic_add_fetch(&ec->sleepers, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return key;
+}
+
+// Sleep unless there was a wake-up since key was taken, until the deadline
+// (CLOCK_MONOTONIC) if there is one. Returns false if the deadline passed.
+static inline bool eventcount_wait(eventcount_t* ec, uint32_t key, const struct timespec* deadline)
+{
+    struct timespec now;
+    struct timespec timeout;
+
+    if (deadline == NULL) {
+        futex_wait(&ec->seq, key);
+        return true;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    timeout.tv_sec  = deadline->tv_sec - now.tv_sec;
+    timeout.tv_nsec = deadline->tv_nsec - now.tv_nsec;
+    if (timeout.tv_nsec < 0) {
+        timeout.tv_sec--;
+        timeout.tv_nsec += 1000000000;
+    }
+    if (timeout.tv_sec < 0) {
+        return false;
+    }
+    futex_wait_timeout(&ec->seq, key, &timeout);
+    return true;
+}
+
+// Wake one sleeper, if there is one
+static inline void eventcount_notify(eventcount_t* ec)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    uint32_t sleepers = __atomic_load_n(&ec->sleepers, __ATOMIC_RELAXED);
+    while (sleepers > 0) {
+        if (__atomic_compare_exchange_n(&ec->sleepers, &sleepers, sleepers - 1, true,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            __atomic_add_fetch(&ec->seq, 1, __ATOMIC_SEQ_CST);
+            futex_wake(&ec->seq, 1);
+            break;
+        }
+    }
+}
+
+// Wake everyone, e.g. to have them notice a shutdown
+static inline void eventcount_notify_all(eventcount_t* ec)
+{
+    __atomic_add_fetch(&ec->seq, 1, __ATOMIC_SEQ_CST);
+    futex_wake(&ec->seq, INT_MAX);
+}
+
+// A deadline timeout_ms from now, for eventcount_wait()
+static inline void eventcount_deadline(struct timespec* deadline, int64_t timeout_ms)
+{
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec  += timeout_ms / 1000;
+    deadline->tv_nsec += (timeout_ms % 1000) * 1000000;
+    if (deadline->tv_nsec >= 1000000000) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000;
+    }
+}
+
+#endif
@@ -0,0 +1,514 @@
+// Copyright (c) 2015-2021, NVIDIA CORPORATION.
+// SPDX-License-Identifier: Apache-2.0
+
+// Pipelined fast-path reads and writes using tagged requests.
+//
+// Each connection has a fixed number of request slots (the queue depth). A
+// request's tag is its slot index plus a generation count, so a stale or
+// corrupted tag in a response is detected rather than completing the wrong
+// request. Senders write whole requests under the connection's send lock;
+// one receiver thread per connection reads responses in whatever order the
+// server produces them and completes each request (see io_req_complete).
+//
+// If a connection fails, every request outstanding on it completes with EIO
+// and the connection is reopened by the next submit.
+
+// API:
+// int fastpath_start(char *server, int port, int conn_count, int depth);
+// void fastpath_stop();
+// bool fastpath_enabled();
+// int fastpath_submit(proxyfs_io_request_t *req);
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "socket.h"
+#include "ioworker.h"
+#include "debug.h"
+#include "fault_inj.h"
+#include "attr_cache.h"
+#include "fastpath.h"
+#include "completion_queue.h"
+
+typedef struct fastpath_slot_s {
+    proxyfs_io_request_t *req;         // NULL if the slot is free
+    uint32_t             generation;   // bumped every time the slot is used
+} fastpath_slot_t;
+
+typedef struct fastpath_conn_s {
+    int              index;
+    int              fd;
+
+    pthread_mutex_t  lock;            // protects fd, slots and free_slots
+    pthread_cond_t   slot_cv;
+    pthread_mutex_t  send_lock;       // serializes writers on fd
+
+    fastpath_slot_t  *slots;
+    int              *free_slots;     // stack of free slot indices
+    int              num_free;
+} fastpath_conn_t;
+
+typedef struct fastpath_config_s {
+    char             *server;
+    int              port;
+    int              conn_count;
+    int              depth;
+    fastpath_conn_t  *conns;
+    uint32_t         next_conn;
+
+    pthread_mutex_t  receivers_lock;
+    pthread_cond_t   receivers_cv;
+    int              receivers_running;
+} fastpath_config_t;
+
+fastpath_config_t *fastpath_config = NULL;
+
+void *fastpath_receiver(void *arg);
+
+// Responses are read through a per-connection buffer so that a burst of
+// small responses (headers, and the data for small reads) is picked up with
+// one recv(). Read data bigger than FASTPATH_RX_DIRECT that isn't already
+// buffered goes straight from the socket to the caller's buffer instead.
+#define FASTPATH_RX_BUF_SIZE  (64 * 1024)
+#define FASTPATH_RX_DIRECT    (16 * 1024)
+
+typedef struct fastpath_rx_s {
+    char    *buf;
+    size_t  start;   // first unconsumed byte
+    size_t  end;     // end of received data
+} fastpath_rx_t;
+
+// Make sure at least want bytes are buffered, reading whatever else has
+// arrived along with them. Returns 0 or an errno.
+int fastpath_rx_fill(int fd, fastpath_rx_t *rx, size_t want)
+{
+    if (rx->end - rx->start >= want) {
+        return 0;
+    }
+
+    memmove(rx->buf, rx->buf + rx->start, rx->end - rx->start);
+    rx->end  -= rx->start;
+    rx->start = 0;
+
+    while (rx->end < want) {
+        ssize_t ret = recv(fd, rx->buf + rx->end, FASTPATH_RX_BUF_SIZE - rx->end, 0);
+        if (ret < 0) {
+            if ((errno == EINTR) || (errno == EAGAIN)) {
+                continue;
+            }
+            return errno;
+        }
+        if (ret == 0) {
+            return EPIPE;
+        }
+        rx->end += ret;
+    }
+    return 0;
+}
+
+// Receive length bytes of read data into the request's buffer or segments
+int fastpath_rx_data(int fd, fastpath_rx_t *rx, proxyfs_io_request_t *req, size_t length)
+{
+    struct iovec        data_iov = { .iov_base = req->data, .iov_len = req->length };
+    const struct iovec *iov      = (req->iov != NULL) ? req->iov : &data_iov;
+    int                 iovcnt   = (req->iov != NULL) ? req->iovcnt : 1;
+
+    if (length <= FASTPATH_RX_DIRECT) {
+        int ret = fastpath_rx_fill(fd, rx, length);
+        if (ret != 0) {
+            return ret;
+        }
+    }
+
+    size_t buffered = rx->end - rx->start;
+    if (buffered > length) {
+        buffered = length;
+    }
+    (void)sock_iov_copy_in(iov, iovcnt, 0, rx->buf + rx->start, buffered);
+    rx->start += buffered;
+
+    if (buffered < length) {
+        return sock_recv_iov(fd, iov, iovcnt, buffered, length - buffered);
+    }
+    return 0;
+}
+
+// Open the connection's socket and start its receiver.
+// Must be called with conn->lock held.
+int fastpath_conn_open_locked(fastpath_conn_t *conn)
+{
+    conn->fd = sock_open(fastpath_config->server, fastpath_config->port);
+    if (conn->fd < 0) {
+        DPRINTF("fastpath: failed to open connection %d to %s:%d\n", conn->index, fastpath_config->server, fastpath_config->port);
+        return (errno != 0) ? errno : EIO;
+    }
+
+    pthread_mutex_lock(&fastpath_config->receivers_lock);
+    fastpath_config->receivers_running++;
+    pthread_mutex_unlock(&fastpath_config->receivers_lock);
+
+    pthread_t thread_id;
+    int ret = pthread_create(&thread_id, NULL, &fastpath_receiver, conn);
+    if (ret != 0) {
+        DPRINTF("fastpath: failed to create receiver for connection %d: %d\n", conn->index, ret);
+
+        pthread_mutex_lock(&fastpath_config->receivers_lock);
+        fastpath_config->receivers_running--;
+        pthread_mutex_unlock(&fastpath_config->receivers_lock);
+
+        sock_close(conn->fd);
+        conn->fd = -1;
+        return ret;
+    }
+    pthread_detach(thread_id);
+
+    return 0;
+}
+
+int fastpath_start(char *server, int port, int conn_count, int depth)
+{
+    // Like io_workers_start(), assumes it is called from a single thread
+    if (fastpath_config != NULL) {
+        return 0; // already initialized..
+    }
+
+    if ((conn_count < 1) || (depth < 1)) {
+        return EINVAL;
+    }
+
+    fastpath_config_t *config = (fastpath_config_t *)malloc(sizeof(fastpath_config_t));
+    if (config == NULL) {
+        return ENOMEM;
+    }
+    bzero(config, sizeof(fastpath_config_t));
+
+    config->server     = strdup(server);
+    config->port       = port;
+    config->conn_count = conn_count;
+    config->depth      = depth;
+    config->conns      = (fastpath_conn_t *)malloc(sizeof(fastpath_conn_t) * conn_count);
+    if ((config->server == NULL) || (config->conns == NULL)) {
+        free(config->server);
+        free(config->conns);
+        free(config);
+        return ENOMEM;
+    }
+    bzero(config->conns, sizeof(fastpath_conn_t) * conn_count);
+    pthread_mutex_init(&config->receivers_lock, NULL);
+    pthread_cond_init(&config->receivers_cv, NULL);
+
+    int i, j;
+    for (i = 0; i < conn_count; i++) {
+        fastpath_conn_t *conn = &config->conns[i];
+
+        conn->index      = i;
+        conn->fd         = -1;
+        conn->slots      = (fastpath_slot_t *)malloc(sizeof(fastpath_slot_t) * depth);
+        conn->free_slots = (int *)malloc(sizeof(int) * depth);
+        if ((conn->slots == NULL) || (conn->free_slots == NULL)) {
+            PANIC("fastpath_start(): could not malloc %d request slots", depth);
+        }
+        bzero(conn->slots, sizeof(fastpath_slot_t) * depth);
+        for (j = 0; j < depth; j++) {
+            conn->free_slots[j] = depth - 1 - j;
+        }
+        conn->num_free = depth;
+
+        pthread_mutex_init(&conn->lock, NULL);
+        pthread_cond_init(&conn->slot_cv, NULL);
+        pthread_mutex_init(&conn->send_lock, NULL);
+    }
+
+    fastpath_config = config;
+
+    // Open the connections now so that a bad address is reported here
+    for (i = 0; i < conn_count; i++) {
+        fastpath_conn_t *conn = &config->conns[i];
+
+        pthread_mutex_lock(&conn->lock);
+        int ret = fastpath_conn_open_locked(conn);
+        pthread_mutex_unlock(&conn->lock);
+
+        if (ret != 0) {
+            fastpath_stop();
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+void fastpath_stop()
+{
+    fastpath_config_t *config = fastpath_config;
+    if (config == NULL) {
+        return;
+    }
+
+    // Wake the receivers; they fail whatever is outstanding and exit
+    int i;
+    for (i = 0; i < config->conn_count; i++) {
+        fastpath_conn_t *conn = &config->conns[i];
+
+        pthread_mutex_lock(&conn->lock);
+        if (conn->fd >= 0) {
+            shutdown(conn->fd, SHUT_RDWR);
+        }
+        pthread_mutex_unlock(&conn->lock);
+    }
+
+    pthread_mutex_lock(&config->receivers_lock);
+    while (config->receivers_running > 0) {
+        pthread_cond_wait(&config->receivers_cv, &config->receivers_lock);
+    }
+    pthread_mutex_unlock(&config->receivers_lock);
+
+    fastpath_config = NULL;
+
+    for (i = 0; i < config->conn_count; i++) {
+        fastpath_conn_t *conn = &config->conns[i];
+
+        free(conn->slots);
+        free(conn->free_slots);
+        pthread_mutex_destroy(&conn->lock);
+        pthread_cond_destroy(&conn->slot_cv);
+        pthread_mutex_destroy(&conn->send_lock);
+    }
+
+    pthread_mutex_destroy(&config->receivers_lock);
+    pthread_cond_destroy(&config->receivers_cv);
+    free(config->conns);
+    free(config->server);
+    free(config);
+}
+
+bool fastpath_enabled()
+{
+    return (fastpath_config != NULL);
+}
+
+// True if slot still holds req under the given tag.
+bool fastpath_slot_is(fastpath_conn_t *conn, int slot, uint64_t tag, proxyfs_io_request_t *req)
+{
+    pthread_mutex_lock(&conn->lock);
+    bool ours = ((conn->slots[slot].req == req) && ((uint32_t)(tag >> 32) == conn->slots[slot].generation));
+    pthread_mutex_unlock(&conn->lock);
+    return ours;
+}
+
+// Release a slot. Must be called with conn->lock held.
+void fastpath_free_slot_locked(fastpath_conn_t *conn, int slot)
+{
+    conn->slots[slot].req = NULL;
+    conn->free_slots[conn->num_free++] = slot;
+    pthread_cond_signal(&conn->slot_cv);
+}
+
+int fastpath_submit(proxyfs_io_request_t *req)
+{
+    if ((req == NULL) || (req->mount_handle == NULL) || !io_req_has_buffer(req) || !io_req_has_completion(req)) {
+        return EINVAL;
+    }
+    if ((req->op != IO_READ) && (req->op != IO_WRITE)) {
+        return EINVAL;
+    }
+    if (fastpath_config == NULL) {
+        return ENODEV;
+    }
+
+    if ( fail(WRITE_BROKEN_PIPE_FAULT) ) {
+        req->error = ENODEV;
+        req->out_size = 0;
+        io_req_complete(req);
+        return 0;
+    }
+
+    uint32_t        conn_index = __sync_fetch_and_add(&fastpath_config->next_conn, 1) % fastpath_config->conn_count;
+    fastpath_conn_t *conn      = &fastpath_config->conns[conn_index];
+
+    // Claim a slot, reopening the connection if it has failed
+    pthread_mutex_lock(&conn->lock);
+    while (1) {
+        if (conn->fd < 0) {
+            int ret = fastpath_conn_open_locked(conn);
+            if (ret != 0) {
+                pthread_mutex_unlock(&conn->lock);
+                return ret;
+            }
+        }
+        if (conn->num_free > 0) {
+            break;
+        }
+        pthread_cond_wait(&conn->slot_cv, &conn->lock);
+    }
+
+    int slot = conn->free_slots[--conn->num_free];
+    conn->slots[slot].req = req;
+    conn->slots[slot].generation++;
+
+    uint64_t tag = ((uint64_t)conn->slots[slot].generation << 32) | (uint64_t)slot;
+    int      fd  = conn->fd;
+    pthread_mutex_unlock(&conn->lock);
+
+    io_tagged_req_hdr_t req_hdr = {
+            .op_type      = (req->op == IO_READ) ? FASTPATH_OP_TAGGED_READ : FASTPATH_OP_TAGGED_WRITE,
+            .tag          = tag,
+            .inode_number = req->inode_number,
+            .offset       = req->offset,
+            .length       = req->length,
+    };
+    (void)memcpy(req_hdr.mount_id, req->mount_handle->mount_id_as_bytes, MOUNT_ID_SIZE);
+
+    // Header and write data (contiguous or the caller's segments) go out in one system call
+    struct iovec        data_iov = { .iov_base = req->data, .iov_len = req->length };
+    const struct iovec *iov      = (req->iov != NULL) ? req->iov : &data_iov;
+    int                 iovcnt   = (req->iov != NULL) ? req->iovcnt : 1;
+    if (req->op != IO_WRITE) {
+        iovcnt = 0;
+    }
+
+    // The receiver fails outstanding requests and closes fd while holding
+    // send_lock, so if the slot is still ours here fd is still open.
+    int ret = 0;
+    pthread_mutex_lock(&conn->send_lock);
+
+    if (fastpath_slot_is(conn, slot, tag, req)) {
+        ret = sock_send_iov(fd, &req_hdr, sizeof(req_hdr), iov, iovcnt);
+        if (ret != 0) {
+            DPRINTF("fastpath: error %d sending on connection %d\n", ret, conn->index);
+
+            // Take the request back and have the receiver reset the
+            // connection, since part of a request may be on the wire.
+            pthread_mutex_lock(&conn->lock);
+            fastpath_free_slot_locked(conn, slot);
+            pthread_mutex_unlock(&conn->lock);
+
+            shutdown(fd, SHUT_RDWR);
+        }
+    }
+    // else the connection failed first and the request was already completed with EIO
+
+    pthread_mutex_unlock(&conn->send_lock);
+
+    return ret;
+}
+
+// Connection receiver: complete requests as their responses arrive.
+void *fastpath_receiver(void *arg)
+{
+    fastpath_conn_t   *conn   = (fastpath_conn_t *)arg;
+    fastpath_config_t *config = fastpath_config;
+    int               fd      = conn->fd;
+    int               depth   = config->depth;
+
+    DPRINTF("fastpath: receiver for connection %d started on fd %d\n", conn->index, fd);
+
+    fastpath_rx_t rx = { .buf = (char *)malloc(FASTPATH_RX_BUF_SIZE), .start = 0, .end = 0 };
+
+    while (rx.buf != NULL) {
+        io_tagged_resp_hdr_t resp_hdr;
+
+        if (fastpath_rx_fill(fd, &rx, sizeof(resp_hdr)) != 0) {
+            break;
+        }
+        memcpy(&resp_hdr, rx.buf + rx.start, sizeof(resp_hdr));
+        rx.start += sizeof(resp_hdr);
+
+        // Unsigned, so that no tag from the server indexes outside the slots
+        uint32_t slot       = (uint32_t)(resp_hdr.tag & 0xffffffff);
+        uint32_t generation = (uint32_t)(resp_hdr.tag >> 32);
+
+        pthread_mutex_lock(&conn->lock);
+        proxyfs_io_request_t *req = NULL;
+        if ((slot < (uint32_t)depth) && (conn->slots[slot].generation == generation)) {
+            req = conn->slots[slot].req;
+        }
+        pthread_mutex_unlock(&conn->lock);
+
+        if (req == NULL) {
+            PRINTF("fastpath: response with unknown tag 0x%lx on connection %d\n", resp_hdr.tag, conn->index);
+            break;
+        }
+
+        // Only this thread reads from fd, so the data can be read without the lock
+        if ((req->op == IO_READ) && (resp_hdr.io_size > 0)) {
+            if (resp_hdr.io_size > req->length) {
+                PRINTF("fastpath: read response of %lu bytes for a %lu byte request\n", resp_hdr.io_size, req->length);
+                break;
+            }
+            if (fastpath_rx_data(fd, &rx, req, resp_hdr.io_size) != 0) {
+                break;
+            }
+        }
+
+        req->error    = (int)resp_hdr.error;
+        req->out_size = resp_hdr.io_size;
+
+        // Special handling for read/write/flush: translate ENOENT to EBADF
+        if (req->error == ENOENT) {
+            req->error = EBADF;
+        }
+
+        if (req->op == IO_WRITE) {
+            attr_cache_invalidate(req->mount_handle->attr_cache, req->inode_number);
+        }
+
+        pthread_mutex_lock(&conn->lock);
+        fastpath_free_slot_locked(conn, slot);
+        pthread_mutex_unlock(&conn->lock);
+
+        io_req_complete(req);
+    }
+
+    DPRINTF("fastpath: connection %d on fd %d failed; failing outstanding requests\n", conn->index, fd);
+
+    // Take every outstanding request off the connection, then complete them
+    // without the lock held since a callback may submit more I/O.
+    proxyfs_io_request_t **failed     = (proxyfs_io_request_t **)malloc(sizeof(proxyfs_io_request_t *) * depth);
+    int                  num_failed   = 0;
+    int                  i;
+
+    // Unblock any sender stuck in writev(), then keep senders out while the
+    // socket is closed.
+    shutdown(fd, SHUT_RDWR);
+    pthread_mutex_lock(&conn->send_lock);
+    pthread_mutex_lock(&conn->lock);
+    for (i = 0; i < depth; i++) {
+        if (conn->slots[i].req != NULL) {
+            if (failed != NULL) {
+                failed[num_failed++] = conn->slots[i].req;
+            }
+            fastpath_free_slot_locked(conn, i);
+        }
+    }
+    pthread_cond_broadcast(&conn->slot_cv);
+    if (conn->fd == fd) {
+        conn->fd = -1;
+    }
+    sock_close(fd);
+    pthread_mutex_unlock(&conn->lock);
+    pthread_mutex_unlock(&conn->send_lock);
+
+    for (i = 0; i < num_failed; i++) {
+        if (failed[i]->op == IO_WRITE) {
+            attr_cache_invalidate(failed[i]->mount_handle->attr_cache, failed[i]->inode_number);
+        }
+        failed[i]->error    = EIO;
+        failed[i]->out_size = 0;
+        io_req_complete(failed[i]);
+    }
+    free(failed);
+    free(rx.buf);
+
+    pthread_mutex_lock(&config->receivers_lock);
+    config->receivers_running--;
+    pthread_cond_broadcast(&config->receivers_cv);
+    pthread_mutex_unlock(&config->receivers_lock);
+
+    return NULL;
+}
@@ -0,0 +1,71 @@
+// Copyright (c) 2015-2021, NVIDIA CORPORATION.
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef __PFS_FASTPATH_H__
+#define __PFS_FASTPATH_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <proxyfs.h>
+
+// Fast-path read/write protocol, and its tagged variant.
+//
+// The original protocol (io_req_hdr_t/io_resp_hdr_t) is a strict
+// request/response exchange, so a connection carries one I/O at a
+// time. Tagged requests carry a caller-chosen tag that the server echoes in
+// the response, which lets many reads and writes be outstanding on one
+// connection and complete in any order.
+//
+// Wire format, all fields in host byte order:
+//   request:  io_req_hdr_t or io_tagged_req_hdr_t, followed by <length> bytes for a write
+//   response: io_resp_hdr_t or io_tagged_resp_hdr_t, followed by <io_size> bytes for a read
+//
+#define FASTPATH_OP_WRITE         1001
+#define FASTPATH_OP_READ          1002
+#define FASTPATH_OP_TAGGED_WRITE  1003
+#define FASTPATH_OP_TAGGED_READ   1004
+
+typedef struct {
+    uint64_t   op_type;
+    uint8_t    mount_id[MOUNT_ID_SIZE];
+    uint64_t   inode_number;
+    uint64_t   offset;
+    uint64_t   length;
+} io_req_hdr_t;
+
+typedef struct {
+    uint64_t   error;
+    uint64_t   io_size;
+} io_resp_hdr_t;
+
+typedef struct {
+    uint64_t   op_type;
+    uint64_t   tag;
+    uint8_t    mount_id[MOUNT_ID_SIZE];
+    uint64_t   inode_number;
+    uint64_t   offset;
+    uint64_t   length;
+} io_tagged_req_hdr_t;
+
+typedef struct {
+    uint64_t   tag;
+    uint64_t   error;
+    uint64_t   io_size;
+} io_tagged_resp_hdr_t;
+
+// Open conn_count connections to server:port, each allowing up to depth
+// outstanding requests. Returns 0 or an errno.
+int fastpath_start(char *server, int port, int conn_count, int depth);
+
+// Fail any outstanding requests with EIO and close the connections.
+void fastpath_stop();
+
+// True once fastpath_start() has succeeded.
+bool fastpath_enabled();
+
+// Send an IO_READ or IO_WRITE request and return without waiting; req->done_cb
+// is called from a receiver thread when the response arrives. Blocks only if
+// every connection already has depth requests outstanding.
+int fastpath_submit(proxyfs_io_request_t *req);
+
+#endif
@@ -0,0 +1,39 @@
+// Copyright (c) 2015-2021, NVIDIA CORPORATION.
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef __PFS_FUTEX_H__
+#define __PFS_FUTEX_H__
+
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+// Sleep while *addr is expected (returning at once if it isn't), and wake up
+// to count threads sleeping on addr. Both are process-private.
+
+static inline void futex_wait(uint32_t* addr, uint32_t expected)
+{
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+// As futex_wait, giving up after timeout (relative, CLOCK_MONOTONIC)
+static inline void futex_wait_timeout(uint32_t* addr, uint32_t expected, const struct timespec* timeout)
+{
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, expected, timeout, NULL, 0);
+}
+
+static inline void futex_wake(uint32_t* addr, int count)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+static inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+#endif
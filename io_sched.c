@@ -0,0 +1,266 @@
+// Copyright (c) 2015-2021, NVIDIA CORPORATION.
+// SPDX-License-Identifier: Apache-2.0
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "io_sched.h"
+
+void io_sched_init(io_sched_t *sched)
+{
+    bzero(sched, sizeof(*sched));
+}
+
+void io_sched_destroy(io_sched_t *sched)
+{
+    int cls, i;
+
+    for (cls = 0; cls < IO_CLASSES; cls++) {
+        for (i = 0; i < sched->classes[cls].num_flows; i++) {
+            free(sched->classes[cls].flows[i].entries);
+        }
+        free(sched->classes[cls].flows);
+    }
+    bzero(sched, sizeof(*sched));
+}
+
+io_class_t io_sched_class_of(proxyfs_io_request_t *req, bool request_classes)
+{
+    if (request_classes && (req->io_class > IO_CLASS_DEFAULT) && (req->io_class < IO_CLASSES)) {
+        return req->io_class;
+    }
+    switch (req->op) {
+    case IO_FLUSH: return IO_CLASS_FLUSH;
+    case IO_READ:  return IO_CLASS_INTERACTIVE;
+    default:       return IO_CLASS_BULK;
+    }
+}
+
+static int64_t io_sched_cost(proxyfs_io_request_t *req)
+{
+    return (req->length > IO_SCHED_MIN_COST) ? (int64_t)req->length : IO_SCHED_MIN_COST;
+}
+
+// Index of the flow of mount_handle in class, or -1 if it has none
+static int io_sched_find_flow(io_sched_class_t *class, mount_handle_t *mount_handle)
+{
+    int i;
+
+    for (i = 0; i < class->num_flows; i++) {
+        if (class->flows[i].mount_handle == mount_handle) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Index of the flow of mount_handle in class, added last in turn if it has none. -1 if there's no memory.
+static int io_sched_flow(io_sched_class_t *class, mount_handle_t *mount_handle)
+{
+    int i = io_sched_find_flow(class, mount_handle);
+    if (i >= 0) {
+        return i;
+    }
+
+    if (class->num_flows == class->max_flows) {
+        int       max_flows = (class->max_flows > 0) ? 2 * class->max_flows : 4;
+        io_flow_t *flows    = (io_flow_t *)realloc(class->flows, max_flows * sizeof(io_flow_t));
+        if (flows == NULL) {
+            return -1;
+        }
+        class->flows     = flows;
+        class->max_flows = max_flows;
+    }
+
+    io_flow_t *flow = &class->flows[class->num_flows];
+    bzero(flow, sizeof(*flow));
+    flow->mount_handle = mount_handle;
+    return class->num_flows++;
+}
+
+// Drop an empty flow. Those after it move down, keeping their turns; if it had the turn, the next one
+// gets it.
+static void io_sched_drop_flow(io_sched_class_t *class, int index)
+{
+    free(class->flows[index].entries);
+    memmove(&class->flows[index], &class->flows[index + 1], (class->num_flows - index - 1) * sizeof(io_flow_t));
+    class->num_flows--;
+    if (index < class->cursor) {
+        class->cursor--;
+    }
+    if (class->cursor >= class->num_flows) {
+        class->cursor = 0;
+    }
+}
+
+// A class set in the request has been settled on by the caller
+int io_sched_add(io_sched_t *sched, proxyfs_io_request_t *req, bool fair)
+{
+    io_sched_class_t *class = &sched->classes[fair ? io_sched_class_of(req, true) : IO_CLASS_BULK];
+    int              index  = io_sched_flow(class, fair ? req->mount_handle : NULL);
+
+    if (index < 0) {
+        return ENOMEM;
+    }
+
+    io_flow_t *flow = &class->flows[index];
+    if (flow->count == flow->size) {
+        uint32_t         size     = (flow->size > 0) ? 2 * flow->size : 16;
+        io_sched_entry_t *entries = (io_sched_entry_t *)malloc(size * sizeof(io_sched_entry_t));
+        uint32_t         i;
+
+        if (entries == NULL) {
+            if (flow->count == 0) {
+                io_sched_drop_flow(class, index);
+            }
+            return ENOMEM;
+        }
+        for (i = 0; i < flow->count; i++) {
+            entries[i] = flow->entries[(flow->head + i) % flow->size];
+        }
+        free(flow->entries);
+        flow->entries = entries;
+        flow->size    = size;
+        flow->head    = 0;
+    }
+
+    io_sched_entry_t *entry = &flow->entries[(flow->head + flow->count) % flow->size];
+    entry->req = req;
+    entry->seq = sched->seq++;
+    flow->count++;
+    class->queued++;
+    __atomic_store_n(&sched->queued, sched->queued + 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+// Take the request at position pos of the flow ref names and charge for it, dropping the flow if that
+// empties it
+static proxyfs_io_request_t *io_sched_take(io_sched_t *sched, io_flow_ref_t *ref, uint32_t pos)
+{
+    io_sched_class_t     *class = &sched->classes[ref->cls];
+    io_flow_t            *flow  = &class->flows[ref->flow];
+    proxyfs_io_request_t *req   = flow->entries[(flow->head + pos) % flow->size].req;
+    uint32_t             i;
+
+    for (i = pos; i > 0; i--) {
+        flow->entries[(flow->head + i) % flow->size] = flow->entries[(flow->head + i - 1) % flow->size];
+    }
+    flow->head = (flow->head + 1) % flow->size;
+    flow->count--;
+    flow->deficit -= io_sched_cost(req);
+    if (flow->count == 0) {
+        io_sched_drop_flow(class, ref->flow);
+    }
+
+    class->queued--;
+    __atomic_store_n(&sched->queued, sched->queued - 1, __ATOMIC_RELAXED);
+    return req;
+}
+
+// If a write to the file of flush, queued before it, is still waiting in another class, point ref and
+// *pos at the first one. Writes in the flush's own flow are ahead of it there already.
+static bool io_sched_write_before(io_sched_t *sched, io_sched_entry_t *flush, io_flow_ref_t *ref,
+                                  uint32_t *pos)
+{
+    proxyfs_io_request_t *req       = flush->req;
+    uint64_t             first     = flush->seq;
+    int                  flush_cls = ref->cls;
+    int                  cls;
+    bool                 found     = false;
+
+    for (cls = IO_CLASS_DEFAULT + 1; cls < IO_CLASSES; cls++) {
+        io_sched_class_t *class = &sched->classes[cls];
+        int              index  = (cls != flush_cls) ? io_sched_find_flow(class, req->mount_handle) : -1;
+        io_flow_t        *flow;
+        uint32_t         i;
+
+        if (index < 0) {
+            continue;
+        }
+        flow = &class->flows[index];
+        for (i = 0; i < flow->count; i++) {
+            io_sched_entry_t *entry = &flow->entries[(flow->head + i) % flow->size];
+
+            if (entry->seq >= first) {
+                break;
+            }
+            if ((entry->req->op == IO_WRITE) && (entry->req->inode_number == req->inode_number)) {
+                first     = entry->seq;
+                ref->cls  = cls;
+                ref->flow = index;
+                *pos      = i;
+                found     = true;
+                break;
+            }
+        }
+    }
+    return found;
+}
+
+proxyfs_io_request_t *io_sched_next(io_sched_t *sched, io_flow_ref_t *ref)
+{
+    int cls, pick = -1;
+
+    if (sched->queued == 0) {
+        return NULL;
+    }
+
+    // Highest class with requests, unless a lower one has waited long enough
+    for (cls = IO_CLASS_DEFAULT + 1; cls < IO_CLASSES; cls++) {
+        if (sched->classes[cls].queued == 0) {
+            continue;
+        }
+        if (pick < 0) {
+            pick = cls;
+        } else if (++sched->classes[cls].passed > IO_SCHED_STARVE_LIMIT) {
+            pick = cls;
+            break;
+        }
+    }
+
+    // Deficit round robin over its mounts, all of which have requests; each gets a request in after
+    // enough turns
+    io_sched_class_t *class = &sched->classes[pick];
+    class->passed = 0;
+    for (;;) {
+        io_flow_t        *flow = &class->flows[class->cursor];
+        io_sched_entry_t *head = &flow->entries[flow->head];
+        uint32_t         pos   = 0;
+
+        if (!flow->in_turn) {
+            flow->deficit += IO_SCHED_QUANTUM;
+            flow->in_turn  = true;
+        }
+        if (io_sched_cost(head->req) <= flow->deficit) {
+            ref->cls          = pick;
+            ref->flow         = class->cursor;
+            ref->mount_handle = flow->mount_handle;
+            if (head->req->op == IO_FLUSH) {
+                io_sched_write_before(sched, head, ref, &pos);
+            }
+            return io_sched_take(sched, ref, pos);
+        }
+        flow->in_turn = false;
+        class->cursor = (class->cursor + 1) % class->num_flows;
+    }
+}
+
+proxyfs_io_request_t *io_sched_take_if(io_sched_t *sched, io_flow_ref_t *ref, int limit,
+                                       bool (*match)(proxyfs_io_request_t *req, void *arg), void *arg)
+{
+    io_sched_class_t *class = &sched->classes[ref->cls];
+    io_flow_t        *flow;
+    uint32_t         pos;
+
+    // Gone if it was emptied since
+    if ((ref->flow >= class->num_flows) || (class->flows[ref->flow].mount_handle != ref->mount_handle)) {
+        return NULL;
+    }
+    flow = &class->flows[ref->flow];
+    for (pos = 0; (pos < flow->count) && (pos < (uint32_t)limit); pos++) {
+        if (match(flow->entries[(flow->head + pos) % flow->size].req, arg)) {
+            return io_sched_take(sched, ref, pos);
+        }
+    }
+    return NULL;
+}
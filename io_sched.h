@@ -0,0 +1,98 @@
+// Copyright (c) 2015-2021, NVIDIA CORPORATION.
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef __PFS_IO_SCHED_H__
+#define __PFS_IO_SCHED_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <proxyfs.h>
+
+// The order in which I/O workers take the requests waiting in one queue.
+//
+// Requests are served by class, flushes first and bulk last, except that a
+// class passed over more than IO_SCHED_STARVE_LIMIT times in a row while it
+// had requests goes next. Within a class each mount has a FIFO of its own,
+// and the mounts take turns by deficit round robin: a turn adds
+// IO_SCHED_QUANTUM bytes to what the mount may send, and it is served while
+// its next request fits. A mount sending 1 MiB writes so gets the same
+// bandwidth as one sending 4 KiB reads, not 256 times as many requests.
+// A mount's FIFO is dropped once it is empty, so only mounts with requests
+// waiting are looked through.
+//
+// A flush goes ahead of other mounts and classes, but not of writes to its
+// own file queued before it: while one of those is waiting, it is served in
+// the flush's place. (Writes already handed to a worker, or waiting in
+// another scheduler, are the caller's to wait for.)
+//
+// Without fairness everything goes to one FIFO, as it used to.
+//
+// Not thread safe; the caller serializes calls on one scheduler. Only
+// io_sched_queued() may be called without that.
+
+#define IO_SCHED_QUANTUM       (256 * 1024)
+#define IO_SCHED_MIN_COST      4096    // of flushes and tiny requests
+#define IO_SCHED_STARVE_LIMIT  8
+
+typedef struct {
+    proxyfs_io_request_t *req;
+    uint64_t             seq;         // when it was added, over the whole scheduler
+} io_sched_entry_t;
+
+// One mount's requests of one class
+typedef struct io_flow_s {
+    mount_handle_t       *mount_handle;
+    io_sched_entry_t     *entries;    // ring of size entries, count from head
+    uint32_t             size;
+    uint32_t             head;
+    uint32_t             count;
+    int64_t              deficit;     // bytes it may still send this turn
+    bool                 in_turn;
+} io_flow_t;
+
+typedef struct io_sched_class_s {
+    io_flow_t *flows;       // mounts with requests waiting, in turn order
+    int       num_flows;
+    int       max_flows;
+    int       cursor;       // flow whose turn it is
+    uint64_t  queued;
+    int       passed;       // picks that went to a higher class while this one waited
+} io_sched_class_t;
+
+typedef struct io_sched_s {
+    io_sched_class_t classes[IO_CLASSES];     // IO_CLASS_DEFAULT unused
+    uint64_t         queued;
+    uint64_t         seq;
+} io_sched_t;
+
+// Where a request came from, to take more from the same FIFO. The mount tells whether the flow is still
+// there, since flows move when one before them is dropped.
+typedef struct {
+    int            cls;
+    int            flow;
+    mount_handle_t *mount_handle;
+} io_flow_ref_t;
+
+void io_sched_init(io_sched_t *sched);
+void io_sched_destroy(io_sched_t *sched);
+
+// The class the request is served in: by op, or its own io_class if request_classes and it has set one
+io_class_t io_sched_class_of(proxyfs_io_request_t *req, bool request_classes);
+
+// Queue a request, by class and mount if fair, else in arrival order. ENOMEM if it can't be.
+int io_sched_add(io_sched_t *sched, proxyfs_io_request_t *req, bool fair);
+
+// The next request to serve, or NULL if there are none
+proxyfs_io_request_t *io_sched_next(io_sched_t *sched, io_flow_ref_t *ref);
+
+// The first of the (up to) limit requests at the head of the FIFO ref names that match accepts, taken
+// out of the FIFO; charged to the mount like one from io_sched_next(). NULL if none of them does.
+proxyfs_io_request_t *io_sched_take_if(io_sched_t *sched, io_flow_ref_t *ref, int limit,
+                                       bool (*match)(proxyfs_io_request_t *req, void *arg), void *arg);
+
+static inline uint64_t io_sched_queued(io_sched_t *sched)
+{
+    return __atomic_load_n(&sched->queued, __ATOMIC_RELAXED);
+}
+
+#endif
@@ -3,54 +3,142 @@
 
 // Worker threads to handle aio requests from file server. Each worker will do synchronous request to
 // proxyfs file server. That means the max outstanding concurrent request will be equal to thread pool size.
+//
+// The pool starts with min_workers threads. A submission that finds more requests waiting than there are
+// idle workers adds one, up to max_workers; a worker that has had nothing to do for idle_timeout_ms exits,
+// as long as min_workers remain. Each worker has its own fast-port connection, so idle mounts keep few.
+//
+// Requests are queued in shards, by default one per CPU, and go to the shard of the CPU they were submitted
+// on. Workers belong to a shard, and can be pinned to its CPUs; they take from their own shard first, then
+// steal from others, those on the same NUMA node first. Idle workers of all shards sleep on one
+// eventcount, so a request never waits while some worker sleeps.
+//
+// Submitters only push onto a shard's lock-free ring. Workers move what's there into the shard's scheduler
+// (io_sched.h) under the shard lock and take the next request from it: by class, flushes first, and by
+// deficit round robin between the mounts within a class.
+//
+// A worker that picks up a read or write also takes the contiguous reads or writes of the same file
+// waiting behind it, and sends them as a single request whose segments are the original buffers. When it
+// completes, each original request gets its share of the result and is completed on its own.
 
 // API:
-// int io_workers_start(char *server, int port, int count);
+// int io_workers_start(char *server, int port, int min_workers, int max_workers, int idle_timeout_ms,
+//                      int shards, bool pin);
 // int io_workers_stop();
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
 #include <errno.h>
 #include <string.h>
+#include <inttypes.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <unistd.h>
-#include <sys/queue.h>
+#include <sched.h>
+#include <dirent.h>
+#include <limits.h>
 
 #include "socket.h"
 #include "debug.h"
 #include "pool.h"
 #include "proxyfs.h"
 #include "ioworker.h"
+#include "mpmc_queue.h"
+#include "io_sched.h"
+#include "completion_queue.h"
+
+// Requests waiting for a worker, over all shards. Submitting one doesn't allocate or take a lock; if a
+// shard is full it goes to another, and if they all are the submit fails with EAGAIN.
+#define IO_WORKER_QUEUE_SIZE        4096
+#define IO_WORKER_SHARD_QUEUE_MIN   256
+
+// Requests waiting longer than this for a worker, on average, let the pool grow before the queue is
+// deeper than the number of workers
+#define IO_WORKERS_GROW_WAIT_US     200
+
+// Most requests merged into one, how far back in the queue to look for them, and most segments in a
+// merged request
+#define IO_MERGE_BATCH      16
+#define IO_MERGE_MAX_SEGS   64
+
+// See io_workers_set_merge(), io_workers_set_fair_queuing() and io_workers_set_request_classes()
+static uint64_t io_merge_max_bytes = IO_MERGE_MAX_BYTES_DEFAULT;
+static int      io_merge_window_us = 0;
+static bool     io_fair_queuing    = true;
+static bool     io_request_classes = false;
+
+typedef enum io_worker_slot_state_e {
+    SLOT_FREE,
+    SLOT_ACTIVE,
+    SLOT_EXITED,    // thread has retired, not yet joined
+} io_worker_slot_state_t;
 
 typedef struct io_worker_s {
     pthread_t thread_id;
+    io_worker_slot_state_t slot_state;
+    int shard;
     int num_ops_started;
     int num_ops_finished;
 } io_worker_t;
 
+typedef struct io_worker_shard_s {
+    mpmc_queue_t queue;         // submitted, not yet seen by a worker
+
+    // Requests workers have taken off queue, in the order they will be served
+    pthread_mutex_t      lock;
+    io_sched_t           sched;
+    proxyfs_io_request_t *overflow;   // one that sched had no memory for; served first
+
+    int          node;          // NUMA node of its CPUs
+    int          *steal_order;  // the other shards, those on the same node first
+    cpu_set_t    cpus;          // whose submissions it takes; empty if more shards than CPUs
+} io_worker_shard_t;
+
+// Sent in place of several contiguous requests; io_merged_done() completes them
+typedef struct io_merged_req_s {
+    proxyfs_io_request_t req;
+    int                  num_parts;
+    proxyfs_io_request_t *parts[IO_MERGE_BATCH];   // in offset order
+    struct iovec         iov[IO_MERGE_MAX_SEGS];
+} io_merged_req_t;
+
 typedef enum io_workers_state_e {
     RUNNING,
     STOPPED,
 } io_workers_state_t;
 
-typedef struct io_worker_req_s {
-    proxyfs_io_request_t *req;
-    TAILQ_ENTRY(io_worker_req_s) request_queue_entry;
-} io_worker_req_t;
-
 typedef struct io_worker_config_s {
     char *server;
     int  port;
-    int  worker_count;
+    int  min_workers;
+    int  max_workers;
+    int  idle_timeout_ms;
 
     io_workers_state_t state;
 
-    pthread_mutex_t request_queue_lock;
-    pthread_cond_t  request_queue_cv;
-    TAILQ_HEAD(, io_worker_req_s) request_queue;
-
-    io_worker_t *worker_pool;
+    int               num_shards;
+    io_worker_shard_t *shards;
+    int               num_cpus;      // entries in cpu_shard
+    int               *cpu_shard;
+    bool              pin;
+    size_t            shard_capacity;  // of each ring, and most requests a scheduler takes from it
+    eventcount_t      work_available;  // shared by the shard queues
+    uint64_t          steals;
+    uint64_t          merged_ios;    // merged requests sent
+    uint64_t          merged;        // requests that went out as part of one
+    io_class_stats_t  classes[IO_CLASSES];
+    uint64_t          recent_wait_us;  // moving average of the time requests wait for a worker
+
+    // Taken only to add or retire workers, not per request
+    pthread_mutex_t pool_lock;
+    int             live_workers;
+    int             idle_workers;    // waiting for a request
+    int             hwm_workers;
+    uint64_t        spawned;
+    uint64_t        retired;
+
+    io_worker_t *worker_pool;    // max_workers slots
 } io_worker_config_t;
 
 io_worker_config_t *worker_config = NULL;
@@ -64,11 +152,11 @@ int hwm_conc_workers = 0;
 
 int times_inc = 0;
 int times_dec = 0;
-int times_enter[128] = {0};
-int times_exit[128]  = {0};
+int times_enter[IO_WORKERS_LIMIT + 1] = {0};
+int times_exit[IO_WORKERS_LIMIT + 1]  = {0};
 
-int64_t         concDurationUs[128] = {0};
-struct timespec concStartTime[128];
+int64_t         concDurationUs[IO_WORKERS_LIMIT + 1] = {0};
+struct timespec concStartTime[IO_WORKERS_LIMIT + 1];
 struct timespec zeroTime = (struct timespec){ 0 };
 
 bool timeIsZero(struct timespec theTime)
@@ -149,7 +237,21 @@ void dump_running_workers()
     PRINTF("running_workers: %d, max running_workers: %d\n", num_conc_workers, hwm_conc_workers);
     if (worker_config == NULL) return;
 
-    for (i = 0; i < worker_config->worker_count; i++) {
+    PRINTF("  worker threads: %d (%d-%d), most at once: %d, started: %" PRIu64 ", retired: %" PRIu64 "\n",
+           worker_config->live_workers, worker_config->min_workers, worker_config->max_workers,
+           worker_config->hwm_workers, worker_config->spawned, worker_config->retired);
+    PRINTF("  shards: %d%s, requests stolen from another shard: %" PRIu64 "\n", worker_config->num_shards,
+           worker_config->pin ? " (pinned)" : "", worker_config->steals);
+    PRINTF("  requests merged: %" PRIu64 " into %" PRIu64 "\n", worker_config->merged, worker_config->merged_ios);
+    for (i = IO_CLASS_DEFAULT + 1; i < IO_CLASSES; i++) {
+        io_class_stats_t *class = &worker_config->classes[i];
+
+        PRINTF("  class %d: queued %" PRIu64 ", served %" PRIu64 ", waited %" PRIu64 " us on average, %" PRIu64
+               " us at most\n", i, class->queued, class->dispatched,
+               (class->dispatched > 0) ? class->wait_us / class->dispatched : 0, class->max_wait_us);
+    }
+
+    for (i = 0; i <= worker_config->max_workers; i++) {
         if (concDurationUs[i] > 0) {
             timeMs       = concDurationUs[i]/1000;
             totalTimeMs += i * timeMs;
@@ -159,14 +261,14 @@ void dump_running_workers()
     PRINTF("  total worker-thread runtime: %ld ms\n", totalTimeMs);
 
     PRINTF("  times inc called: %d dec called: %d\n", times_inc, times_dec);
-    for (i = 0; i < worker_config->worker_count; i++) {
+    for (i = 0; i <= worker_config->max_workers; i++) {
         if (times_enter[i] > 0) {
             PRINTF("  level %d enter: %d exit %d\n", i, times_enter[i], times_exit[i]);
         }
     }
 
 #if 0
-    for (i = 0; i < worker_config->worker_count; i++) {
+    for (i = 0; i < worker_config->max_workers; i++) {
         io_worker_t* worker = &worker_config->worker_pool[i];
 
         if (worker->num_ops_started == worker->num_ops_finished) {
@@ -179,50 +281,350 @@ void dump_running_workers()
 #endif
 }
 
-// Return an array of pipe write file descriptors: The worker pool will be blocked on reading a request address from the caller.
-int io_workers_start(char *server, int port, int count)
+// Start a worker for shard in a free slot; false if there's none or the thread can't be created
+static bool spawn_worker_locked(int shard)
+{
+    int i;
+
+    for (i = 0; i < worker_config->max_workers; i++) {
+        io_worker_t *worker = &worker_config->worker_pool[i];
+
+        if (worker->slot_state == SLOT_ACTIVE) {
+            continue;
+        }
+        if (worker->slot_state == SLOT_EXITED) {
+            // It has already given up the lock for good, so this is quick
+            pthread_join(worker->thread_id, NULL);
+            worker->slot_state = SLOT_FREE;
+        }
+
+        worker->slot_state = SLOT_ACTIVE;
+        worker->shard      = shard;
+        int ret = pthread_create(&worker->thread_id, NULL, &io_worker, worker);
+        if (ret != 0) {
+            DPRINTF("Failed to create io worker thread #%d: error: %d\n", i, ret);
+            worker->slot_state = SLOT_FREE;
+            return false;
+        }
+
+        __atomic_add_fetch(&worker_config->live_workers, 1, __ATOMIC_RELAXED);
+        worker_config->spawned++;
+        if (worker_config->live_workers > worker_config->hwm_workers) {
+            worker_config->hwm_workers = worker_config->live_workers;
+        }
+        return true;
+    }
+    return false;
+}
+
+static uint64_t shard_depth(int shard)
+{
+    return mpmc_queue_depth(&worker_config->shards[shard].queue) +
+           io_sched_queued(&worker_config->shards[shard].sched);
+}
+
+// Add a worker to shard if requests are waiting there that no idle worker will pick up, and either
+// there are more of them than workers or requests have lately been waiting longer than
+// IO_WORKERS_GROW_WAIT_US. A few requests behind busy workers that are keeping up don't need another
+// thread. Workers still running a done callback don't count as idle: inc_running_worker() covers the
+// callback, and it can take a while.
+static void grow_workers_if_needed(int shard)
+{
+    int live = __atomic_load_n(&worker_config->live_workers, __ATOMIC_RELAXED);
+    if (live >= worker_config->max_workers) {
+        return;
+    }
+
+    int      idle  = __atomic_load_n(&worker_config->idle_workers, __ATOMIC_RELAXED);
+    uint64_t depth = shard_depth(shard);
+    if (depth <= (uint64_t)idle) {
+        return;
+    }
+    if ((depth <= (uint64_t)live) &&
+        (__atomic_load_n(&worker_config->recent_wait_us, __ATOMIC_RELAXED) < IO_WORKERS_GROW_WAIT_US)) {
+        return;
+    }
+
+    pthread_mutex_lock(&worker_config->pool_lock);
+    if ((worker_config->state == RUNNING) && (worker_config->live_workers < worker_config->max_workers)) {
+        spawn_worker_locked(shard);
+    }
+    pthread_mutex_unlock(&worker_config->pool_lock);
+}
+
+static uint64_t queued_requests()
+{
+    uint64_t depth = 0;
+    int      i;
+
+    for (i = 0; i < worker_config->num_shards; i++) {
+        depth += shard_depth(i);
+    }
+    return depth;
+}
+
+// Called by a worker that timed out waiting for work. Returns true if it should exit: the pool is above
+// min_workers and nothing has arrived in the meantime.
+static bool retire_worker(io_worker_t *worker)
+{
+    bool retire = false;
+
+    pthread_mutex_lock(&worker_config->pool_lock);
+    if ((worker_config->live_workers > worker_config->min_workers) && (queued_requests() == 0)) {
+        __atomic_sub_fetch(&worker_config->live_workers, 1, __ATOMIC_RELAXED);
+        worker_config->retired++;
+        worker->slot_state = SLOT_EXITED;
+        retire = true;
+    }
+    pthread_mutex_unlock(&worker_config->pool_lock);
+
+    return retire;
+}
+
+// NUMA node of each CPU, from sysfs; all 0 if it can't be read
+static void read_cpu_nodes(int *cpu_node, int num_cpus)
+{
+    DIR           *dir = opendir("/sys/devices/system/node");
+    struct dirent *entry;
+
+    if (dir == NULL) {
+        return;
+    }
+    while ((entry = readdir(dir)) != NULL) {
+        int  node;
+        char path[PATH_MAX];
+        char list[4096];
+
+        if (sscanf(entry->d_name, "node%d", &node) != 1) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "/sys/devices/system/node/%s/cpulist", entry->d_name);
+        FILE *file = fopen(path, "r");
+        if (file == NULL) {
+            continue;
+        }
+        if (fgets(list, sizeof(list), file) != NULL) {
+            // e.g. "0-3,8-11"
+            char *range = strtok(list, ",\n");
+            while (range != NULL) {
+                int first, last, cpu;
+                int fields = sscanf(range, "%d-%d", &first, &last);
+                if (fields == 1) {
+                    last = first;
+                }
+                for (cpu = first; (fields >= 1) && (cpu <= last) && (cpu < num_cpus); cpu++) {
+                    cpu_node[cpu] = node;
+                }
+                range = strtok(NULL, ",\n");
+            }
+        }
+        fclose(file);
+    }
+    closedir(dir);
+}
+
+// Split the CPUs into num_shards shards of neighbouring CPUs on the same node where possible, and have each
+// shard steal from those on its own node first
+static int place_shards(int num_shards)
+{
+    int num_cpus = sysconf(_SC_NPROCESSORS_CONF);
+    int i, j, k;
+
+    if (num_cpus < 1) {
+        num_cpus = 1;
+    }
+    if (num_cpus > CPU_SETSIZE) {
+        num_cpus = CPU_SETSIZE;
+    }
+
+    int *cpu_node = (int *)calloc(num_cpus, sizeof(int));
+    int *by_node  = (int *)malloc(num_cpus * sizeof(int));
+    worker_config->cpu_shard = (int *)calloc(num_cpus, sizeof(int));
+    if ((cpu_node == NULL) || (by_node == NULL) || (worker_config->cpu_shard == NULL)) {
+        free(cpu_node);
+        free(by_node);
+        return ENOMEM;
+    }
+    worker_config->num_cpus = num_cpus;
+    read_cpu_nodes(cpu_node, num_cpus);
+
+    // CPUs in node order, then ranked into shards
+    k = 0;
+    for (i = 0; k < num_cpus; i++) {
+        for (j = 0; j < num_cpus; j++) {
+            if (cpu_node[j] == i) {
+                by_node[k++] = j;
+            }
+        }
+    }
+    for (i = 0; i < num_shards; i++) {
+        CPU_ZERO(&worker_config->shards[i].cpus);
+        worker_config->shards[i].node = cpu_node[by_node[i % num_cpus]];
+    }
+    for (k = 0; k < num_cpus; k++) {
+        int cpu   = by_node[k];
+        int shard = (num_shards <= num_cpus) ? (int)((int64_t)k * num_shards / num_cpus) : k;
+
+        worker_config->cpu_shard[cpu] = shard;
+        CPU_SET(cpu, &worker_config->shards[shard].cpus);
+        if (k == 0 || worker_config->cpu_shard[by_node[k - 1]] != shard) {
+            worker_config->shards[shard].node = cpu_node[cpu];
+        }
+    }
+
+    for (i = 0; i < num_shards; i++) {
+        io_worker_shard_t *shard = &worker_config->shards[i];
+
+        shard->steal_order = (int *)malloc(num_shards * sizeof(int));
+        if (shard->steal_order == NULL) {
+            free(cpu_node);
+            free(by_node);
+            return ENOMEM;
+        }
+        k = 0;
+        for (j = 1; j < num_shards; j++) {
+            int other = (i + j) % num_shards;
+            if (worker_config->shards[other].node == shard->node) {
+                shard->steal_order[k++] = other;
+            }
+        }
+        for (j = 1; j < num_shards; j++) {
+            int other = (i + j) % num_shards;
+            if (worker_config->shards[other].node != shard->node) {
+                shard->steal_order[k++] = other;
+            }
+        }
+    }
+
+    free(cpu_node);
+    free(by_node);
+    return 0;
+}
+
+static void free_shards()
+{
+    int i;
+
+    if (worker_config->shards != NULL) {
+        for (i = 0; i < worker_config->num_shards; i++) {
+            mpmc_queue_destroy(&worker_config->shards[i].queue);
+            io_sched_destroy(&worker_config->shards[i].sched);
+            pthread_mutex_destroy(&worker_config->shards[i].lock);
+            free(worker_config->shards[i].steal_order);
+        }
+    }
+    free(worker_config->shards);
+    free(worker_config->cpu_shard);
+}
+
+static int create_shards(int num_shards)
+{
+    int i;
+
+    if (num_shards <= 0) {
+        num_shards = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (num_shards > IO_WORKER_SHARDS_LIMIT) {
+        num_shards = IO_WORKER_SHARDS_LIMIT;
+    }
+    if (num_shards < 1) {
+        num_shards = 1;
+    }
+
+    size_t capacity = IO_WORKER_QUEUE_SIZE / num_shards;
+    if (capacity < IO_WORKER_SHARD_QUEUE_MIN) {
+        capacity = IO_WORKER_SHARD_QUEUE_MIN;
+    }
+
+    eventcount_init(&worker_config->work_available);
+    worker_config->shards = (io_worker_shard_t *)calloc(num_shards, sizeof(io_worker_shard_t));
+    if (worker_config->shards == NULL) {
+        return ENOMEM;
+    }
+    for (i = 0; i < num_shards; i++) {
+        if (mpmc_queue_init(&worker_config->shards[i].queue, capacity) != 0) {
+            break;
+        }
+        mpmc_queue_share_eventcount(&worker_config->shards[i].queue, &worker_config->work_available);
+        io_sched_init(&worker_config->shards[i].sched);
+        pthread_mutex_init(&worker_config->shards[i].lock, NULL);
+    }
+    worker_config->shard_capacity = capacity;
+    worker_config->num_shards = i;
+    if (i < num_shards) {
+        return ENOMEM;
+    }
+
+    return place_shards(num_shards);
+}
+
+int io_workers_start(char *server, int port, int min_workers, int max_workers, int idle_timeout_ms,
+                     int shards, bool pin)
 {
     // Note this needs to be done holding a lock, for now we are assuming it is okay to do it in a single thread:
     if (worker_config != NULL) {
         return 0; // already initialized..
     }
 
+    if (max_workers > IO_WORKERS_LIMIT) {
+        max_workers = IO_WORKERS_LIMIT;
+    }
+    if (max_workers < 1) {
+        max_workers = 1;
+    }
+    if (min_workers < 1) {
+        min_workers = 1;
+    }
+    if (min_workers > max_workers) {
+        min_workers = max_workers;
+    }
+
     worker_config = (io_worker_config_t *)malloc(sizeof(io_worker_config_t));
     if (worker_config == NULL) {
         return ENOMEM;
     }
     bzero(worker_config, sizeof(io_worker_config_t));
 
-    worker_config->worker_pool = (io_worker_t *)malloc(sizeof(io_worker_t) * count);
+    worker_config->worker_pool = (io_worker_t *)malloc(sizeof(io_worker_t) * max_workers);
     if (worker_config->worker_pool == NULL) {
         free(worker_config);
+        worker_config = NULL;
+        return ENOMEM;
+    }
+    if (create_shards(shards) != 0) {
+        free_shards();
+        free(worker_config->worker_pool);
+        free(worker_config);
+        worker_config = NULL;
         return ENOMEM;
     }
-    bzero(worker_config->worker_pool, sizeof(io_worker_t) * count);
+    bzero(worker_config->worker_pool, sizeof(io_worker_t) * max_workers);
 
     worker_config->server = strdup(server);
     worker_config->port = port;
-    worker_config->worker_count = count;
-
-    pthread_mutex_init(&worker_config->request_queue_lock, NULL);
-    pthread_cond_init(&worker_config->request_queue_cv, NULL);
-    TAILQ_INIT(&worker_config->request_queue);
+    worker_config->min_workers = min_workers;
+    worker_config->max_workers = max_workers;
+    worker_config->idle_timeout_ms = idle_timeout_ms;
+    worker_config->pin = pin;
+    pthread_mutex_init(&worker_config->pool_lock, NULL);
 
     worker_config->state = RUNNING;
 
     int i;
-    for (i = 0; i < count; i++) {
-
+    for (i = 0; i <= max_workers; i++) {
         concDurationUs[i] = 0;
+    }
 
-        int ret = pthread_create(&worker_config->worker_pool[i].thread_id, NULL, &io_worker, &worker_config->worker_pool[i]);
-        if (ret != 0) {
-            DPRINTF("Failed to create io worker thread #%d: error: %d\n", i, ret);
-            free(worker_config->worker_pool);
-            free(worker_config);
-            return ret; // TODO cleanup
+    // Spread the first workers over the shards
+    pthread_mutex_lock(&worker_config->pool_lock);
+    for (i = 0; i < min_workers; i++) {
+        if (!spawn_worker_locked((int)((int64_t)i * worker_config->num_shards / min_workers))) {
+            pthread_mutex_unlock(&worker_config->pool_lock);
+            io_workers_stop();
+            return EAGAIN;
         }
     }
+    pthread_mutex_unlock(&worker_config->pool_lock);
 
     return 0;
 }
@@ -238,13 +640,23 @@ void io_workers_stop()
         return;
     }
 
-    pthread_mutex_lock(&worker_config->request_queue_lock);
+    // No more workers get added; the ones there are exit once they've drained the queues
+    int i;
+    pthread_mutex_lock(&worker_config->pool_lock);
     worker_config->state = STOPPED;
-    pthread_cond_broadcast(&worker_config->request_queue_cv);
-    pthread_mutex_unlock(&worker_config->request_queue_lock);
+    pthread_mutex_unlock(&worker_config->pool_lock);
+    for (i = 0; i < worker_config->num_shards; i++) {
+        mpmc_queue_close(&worker_config->shards[i].queue);
+    }
+
+    for (i = 0; i < worker_config->max_workers; i++) {
+        pthread_mutex_lock(&worker_config->pool_lock);
+        bool started = (worker_config->worker_pool[i].slot_state != SLOT_FREE);
+        pthread_mutex_unlock(&worker_config->pool_lock);
+        if (!started) {
+            continue;
+        }
 
-    int i;
-    for (i = 0; i < worker_config->worker_count; i++) {
         int ret = pthread_join(worker_config->worker_pool[i].thread_id, NULL);
         if (ret != 0) {
             DPRINTF("Failed to stop the io worker thread - thread index %d\n", i);
@@ -254,8 +666,8 @@ void io_workers_stop()
     free(worker_config->worker_pool);
     free(worker_config->server);
 
-    pthread_mutex_destroy(&worker_config->request_queue_lock);
-    pthread_cond_destroy(&worker_config->request_queue_cv);
+    free_shards();
+    pthread_mutex_destroy(&worker_config->pool_lock);
     free(worker_config);
 
     worker_config = NULL;
@@ -263,83 +675,467 @@ void io_workers_stop()
     return;
 }
 
-void *io_worker(void *arg)
+void io_workers_get_stats(io_workers_stats_t *stats)
 {
-    io_worker_t *worker = (io_worker_t *)arg;
+    int i;
 
-    // Init number of ops handled by this worker to zero
-    worker->num_ops_started  = 0;
-    worker->num_ops_finished = 0;
+    bzero(stats, sizeof(*stats));
+    if (worker_config == NULL) {
+        return;
+    }
 
-    int sock_fd = -1;
-    pthread_mutex_lock(&worker_config->request_queue_lock);
-    while (1) {
-        if (TAILQ_EMPTY(&worker_config->request_queue)) {
-            // We check if we are unmounting and exit only after draining the queue.
-            if (worker_config->state != RUNNING) {
-                break;
-            }
+    pthread_mutex_lock(&worker_config->pool_lock);
+    stats->workers     = worker_config->live_workers;
+    stats->hwm_workers = worker_config->hwm_workers;
+    stats->spawned     = worker_config->spawned;
+    stats->retired     = worker_config->retired;
+    stats->queued      = queued_requests();
+    pthread_mutex_unlock(&worker_config->pool_lock);
+    stats->shards      = worker_config->num_shards;
+    stats->steals      = __atomic_load_n(&worker_config->steals, __ATOMIC_RELAXED);
+    stats->merged_ios  = __atomic_load_n(&worker_config->merged_ios, __ATOMIC_RELAXED);
+    stats->merged      = __atomic_load_n(&worker_config->merged, __ATOMIC_RELAXED);
+    stats->recent_wait_us = __atomic_load_n(&worker_config->recent_wait_us, __ATOMIC_RELAXED);
+    for (i = 0; i < IO_CLASSES; i++) {
+        io_class_stats_t *class = &worker_config->classes[i];
+
+        stats->classes[i].queued      = __atomic_load_n(&class->queued, __ATOMIC_RELAXED);
+        stats->classes[i].dispatched  = __atomic_load_n(&class->dispatched, __ATOMIC_RELAXED);
+        stats->classes[i].wait_us     = __atomic_load_n(&class->wait_us, __ATOMIC_RELAXED);
+        stats->classes[i].max_wait_us = __atomic_load_n(&class->max_wait_us, __ATOMIC_RELAXED);
+    }
+
+    pthread_mutex_lock(&concurrent_worker_lock);
+    stats->busy        = num_conc_workers;
+    pthread_mutex_unlock(&concurrent_worker_lock);
+}
+
+static uint64_t io_now_ns()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// Account for a request leaving the queues for a worker
+static void note_dispatched(proxyfs_io_request_t *req)
+{
+    io_class_stats_t *class  = &worker_config->classes[req->io_class];
+    uint64_t         wait_us = (io_now_ns() - req->queued_ns) / 1000;
+    uint64_t         max_us  = __atomic_load_n(&class->max_wait_us, __ATOMIC_RELAXED);
+
+    __atomic_sub_fetch(&class->queued, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&class->dispatched, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&class->wait_us, wait_us, __ATOMIC_RELAXED);
+    while ((wait_us > max_us) && !__atomic_compare_exchange_n(&class->max_wait_us, &max_us, wait_us, true,
+                                                              __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+
+    // Weighs this wait 1/8th. Racing workers can lose an update, which a moving average can afford.
+    uint64_t recent = __atomic_load_n(&worker_config->recent_wait_us, __ATOMIC_RELAXED);
+    __atomic_store_n(&worker_config->recent_wait_us, recent - recent / 8 + wait_us / 8, __ATOMIC_RELAXED);
+}
+
+// Move what has been submitted to shard into its scheduler, as far as it will take it. Called with the
+// shard lock held.
+static void drain_submitted(io_worker_shard_t *shard)
+{
+    bool fair = __atomic_load_n(&io_fair_queuing, __ATOMIC_RELAXED);
+
+    while ((shard->overflow == NULL) && (io_sched_queued(&shard->sched) < worker_config->shard_capacity)) {
+        proxyfs_io_request_t *req = (proxyfs_io_request_t *)mpmc_queue_try_pop(&shard->queue);
+        if (req == NULL) {
+            break;
+        }
+        if (io_sched_add(&shard->sched, req, fair) != 0) {
+            shard->overflow = req;
+        }
+    }
+}
+
+// The next request of shard to serve, or NULL if it has none; *ref is set to where it came from, with
+// a cls of -1 if that isn't a queue to merge from
+static proxyfs_io_request_t *shard_next(int index, io_flow_ref_t *ref)
+{
+    io_worker_shard_t    *shard = &worker_config->shards[index];
+    proxyfs_io_request_t *req;
+
+    if ((mpmc_queue_depth(&shard->queue) == 0) && (io_sched_queued(&shard->sched) == 0)) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&shard->lock);
+    req = shard->overflow;
+    if (req != NULL) {
+        shard->overflow = NULL;
+        ref->cls        = -1;
+    } else {
+        drain_submitted(shard);
+        req = io_sched_next(&shard->sched, ref);
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    if (req != NULL) {
+        note_dispatched(req);
+    }
+    return req;
+}
+
+// A request from the worker's own shard, or else one stolen from another; *from is set to its shard,
+// *ref to its queue there
+static proxyfs_io_request_t *find_work(io_worker_t *worker, int *from, io_flow_ref_t *ref)
+{
+    io_worker_shard_t    *shard = &worker_config->shards[worker->shard];
+    proxyfs_io_request_t *req   = shard_next(worker->shard, ref);
+    int                  i;
+
+    *from = worker->shard;
+    for (i = 0; (req == NULL) && (i < worker_config->num_shards - 1); i++) {
+        req = shard_next(shard->steal_order[i], ref);
+        if (req != NULL) {
+            __atomic_add_fetch(&worker_config->steals, 1, __ATOMIC_RELAXED);
+            *from = shard->steal_order[i];
+        }
+    }
+    return req;
+}
+
+// Sleeps until there's a request in any shard; NULL once we are unmounting and the queues have been
+// drained, or after idle_timeout_ms without work
+static proxyfs_io_request_t *wait_for_work(io_worker_t *worker, int *from, io_flow_ref_t *ref)
+{
+    struct timespec      deadline;
+    struct timespec      *until  = NULL;
+    proxyfs_io_request_t *req;
+    bool                 yielded = false;
+
+    if (worker_config->idle_timeout_ms > 0) {
+        eventcount_deadline(&deadline, worker_config->idle_timeout_ms);
+        until = &deadline;
+    }
+
+    for (;;) {
+        req = find_work(worker, from, ref);
+        if (req != NULL) {
+            return req;
+        }
+
+        // Let submitters run once before sleeping, as mpmc_queue_pop does
+        if (!yielded) {
+            yielded = true;
+            sched_yield();
+            continue;
+        }
+
+        uint32_t key = eventcount_prepare(&worker_config->work_available);
+        req = find_work(worker, from, ref);
+        if ((req != NULL) || mpmc_queue_closed(&worker_config->shards[worker->shard].queue)) {
+            return req;
+        }
+        if (!eventcount_wait(&worker_config->work_available, key, until)) {
+            return find_work(worker, from, ref);
+        }
+    }
+}
+
+void io_workers_set_merge(uint64_t max_bytes, int window_us)
+{
+    __atomic_store_n(&io_merge_max_bytes, max_bytes, __ATOMIC_RELAXED);
+    __atomic_store_n(&io_merge_window_us, (window_us > 0) ? window_us : 0, __ATOMIC_RELAXED);
+}
+
+void io_workers_set_fair_queuing(bool enable)
+{
+    __atomic_store_n(&io_fair_queuing, enable, __ATOMIC_RELAXED);
+}
+
+void io_workers_set_request_classes(bool enable)
+{
+    __atomic_store_n(&io_request_classes, enable, __ATOMIC_RELAXED);
+}
+
+static int io_req_segments(proxyfs_io_request_t *req)
+{
+    return (req->iov != NULL) ? req->iovcnt : 1;
+}
 
-           pthread_cond_wait(&worker_config->request_queue_cv, &worker_config->request_queue_lock);
-           continue;
+static void io_merged_done(proxyfs_io_request_t *req);
+
+static bool io_req_mergeable(proxyfs_io_request_t *req)
+{
+    return ((req->op == IO_READ) || (req->op == IO_WRITE)) && (req->length > 0) && io_req_has_buffer(req) &&
+           (req->done_cb != io_merged_done);
+}
+
+// True if next picks up where req leaves off
+static bool io_req_follows(proxyfs_io_request_t *req, proxyfs_io_request_t *next)
+{
+    return (next->op == req->op) && (next->mount_handle == req->mount_handle) &&
+           (next->inode_number == req->inode_number) && (next->offset == req->offset + req->length);
+}
+
+// Hand each part its share of the merged result: bytes in order, so past a short read or write the
+// later parts get none, and the same error
+static void io_merged_done(proxyfs_io_request_t *req)
+{
+    io_merged_req_t *merged    = (io_merged_req_t *)req->done_cb_arg;
+    uint64_t        remaining  = req->out_size;
+    int             i;
+
+    for (i = 0; i < merged->num_parts; i++) {
+        proxyfs_io_request_t *part = merged->parts[i];
+
+        part->error    = req->error;
+        part->out_size = (part->length < remaining) ? part->length : remaining;
+        remaining     -= part->out_size;
+    }
+    for (i = 0; i < merged->num_parts; i++) {
+        io_req_complete(merged->parts[i]);
+    }
+    free(merged);
+}
+
+// One request for the parts, or NULL if it can't be allocated
+static proxyfs_io_request_t *io_merge_parts(proxyfs_io_request_t **parts, int num_parts)
+{
+    io_merged_req_t *merged = (io_merged_req_t *)malloc(sizeof(io_merged_req_t));
+    int             i, j, segs = 0;
+
+    if (merged == NULL) {
+        return NULL;
+    }
+    bzero(&merged->req, sizeof(merged->req));
+    merged->req.op           = parts[0]->op;
+    merged->req.mount_handle = parts[0]->mount_handle;
+    merged->req.inode_number = parts[0]->inode_number;
+    merged->req.offset       = parts[0]->offset;
+    merged->req.done_cb      = io_merged_done;
+    merged->req.done_cb_arg  = merged;
+    merged->req.iov          = merged->iov;
+    merged->num_parts        = num_parts;
+
+    for (i = 0; i < num_parts; i++) {
+        proxyfs_io_request_t *part = parts[i];
+
+        merged->parts[i]     = part;
+        merged->req.length  += part->length;
+        if (part->iov != NULL) {
+            for (j = 0; j < part->iovcnt; j++) {
+                merged->iov[segs++] = part->iov[j];
+            }
+        } else {
+            merged->iov[segs].iov_base = part->data;
+            merged->iov[segs].iov_len  = part->length;
+            segs++;
         }
+    }
+    merged->req.iovcnt = segs;
 
-        worker->num_ops_started++;
-        inc_running_worker();
+    __atomic_add_fetch(&worker_config->merged_ios, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&worker_config->merged, num_parts, __ATOMIC_RELAXED);
+    return &merged->req;
+}
 
-        io_worker_req_t *worker_req = TAILQ_FIRST(&worker_config->request_queue);
-        TAILQ_REMOVE(&worker_config->request_queue, worker_req, request_queue_entry);
-        pthread_mutex_unlock(&worker_config->request_queue_lock);
-        proxyfs_io_request_t *req = worker_req->req;
-        free(worker_req);
+// Contiguous requests being collected for merging
+typedef struct {
+    proxyfs_io_request_t *parts[IO_MERGE_BATCH];    // in offset order
+    int                  num_parts;
+    int                  segs;
+    uint64_t             bytes;
+    uint64_t             max_bytes;
+} io_merge_run_t;
+
+// True if req can go at either end of the run
+static bool io_merge_extends(proxyfs_io_request_t *req, void *arg)
+{
+    io_merge_run_t *run = (io_merge_run_t *)arg;
 
-        if (sock_fd < 0) {
-            sock_fd = sock_open(worker_config->server, worker_config->port);
-            if (sock_fd < 0) {
-                DPRINTF("Failed to open the socket, exiting ..\n");
-                // io should fail:
-                req->error = EIO;
-                goto callback;
+    if (!io_req_mergeable(req) || (run->bytes + req->length > run->max_bytes) ||
+        (run->segs + io_req_segments(req) > IO_MERGE_MAX_SEGS)) {
+        return false;
+    }
+    return io_req_follows(run->parts[run->num_parts - 1], req) || io_req_follows(req, run->parts[0]);
+}
+
+// Take the requests that continue req, or lead up to it, among the first IO_MERGE_BATCH waiting in the
+// queue ref names (for up to io_merge_window_us while there are none), and return the request to send
+// for them all
+static proxyfs_io_request_t *merge_queued(proxyfs_io_request_t *req, int index, io_flow_ref_t *ref)
+{
+    io_worker_shard_t    *shard    = &worker_config->shards[index];
+    int                  window_us = __atomic_load_n(&io_merge_window_us, __ATOMIC_RELAXED);
+    io_merge_run_t       run;
+    proxyfs_io_request_t *next;
+    struct timespec      start, now;
+
+    run.max_bytes = __atomic_load_n(&io_merge_max_bytes, __ATOMIC_RELAXED);
+    if ((run.max_bytes == 0) || (ref->cls < 0) || !io_req_mergeable(req)) {
+        return req;
+    }
+    run.parts[0]  = req;
+    run.num_parts = 1;
+    run.segs      = io_req_segments(req);
+    run.bytes     = req->length;
+
+    if (window_us > 0) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+    }
+    for (;;) {
+        pthread_mutex_lock(&shard->lock);
+        drain_submitted(shard);
+        while ((run.num_parts < IO_MERGE_BATCH) &&
+               ((next = io_sched_take_if(&shard->sched, ref, IO_MERGE_BATCH, io_merge_extends, &run)) != NULL)) {
+            if (io_req_follows(run.parts[run.num_parts - 1], next)) {
+                run.parts[run.num_parts] = next;
+            } else {
+                memmove(&run.parts[1], &run.parts[0], run.num_parts * sizeof(run.parts[0]));
+                run.parts[0] = next;
             }
+            run.num_parts++;
+            run.segs  += io_req_segments(next);
+            run.bytes += next->length;
+            note_dispatched(next);
         }
+        pthread_mutex_unlock(&shard->lock);
 
-        int ret = 0;
-        switch (req->op) {
-        case IO_READ: ret = proxyfs_read_req(req, sock_fd);
-                 break;
-        case IO_WRITE: ret = proxyfs_write_req(req, sock_fd);
-                 break;
-        case IO_FLUSH: req->error = proxyfs_flush(req->mount_handle, req->inode_number);
-                 break;
-        default: req->error = EINVAL;
+        if ((run.num_parts > 1) || (window_us == 0)) {
+            break;
         }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if ((now.tv_sec - start.tv_sec) * 1000000 + (now.tv_nsec - start.tv_nsec) / 1000 >= window_us) {
+            break;
+        }
+        sched_yield();
+    }
 
-        if (ret != 0) {
-            DPRINTF("Socket communication to proxyfs server failed\n");
-            sock_close(sock_fd);
-            sock_fd = -1;
+    if (run.num_parts == 1) {
+        return req;
+    }
+    next = io_merge_parts(run.parts, run.num_parts);
+    if (next == NULL) {
+        // No memory to merge; the first goes out now, the rest are queued again, or fail if there's no
+        // room for them
+        int i;
+        for (i = 0; i < run.num_parts; i++) {
+            if ((run.parts[i] != req) && (schedule_io_work(run.parts[i]) != 0)) {
+                run.parts[i]->error    = EAGAIN;
+                run.parts[i]->out_size = 0;
+                io_req_complete(run.parts[i]);
+            }
         }
+        return req;
+    }
+    return next;
+}
+
+// Send one request on the worker's connection, opening it if need be, and complete it
+static void handle_request(io_worker_t *worker, proxyfs_io_request_t *req, int *sock_fd)
+{
+    worker->num_ops_started++;
+    inc_running_worker();
+
+    if (*sock_fd < 0) {
+        *sock_fd = sock_open(worker_config->server, worker_config->port);
+        if (*sock_fd < 0) {
+            DPRINTF("Failed to open the socket, exiting ..\n");
+            // io should fail:
+            req->error = EIO;
+            goto callback;
+        }
+    }
+
+    int ret = 0;
+    switch (req->op) {
+    case IO_READ: ret = proxyfs_read_req(req, *sock_fd);
+             break;
+    case IO_WRITE: ret = proxyfs_write_req(req, *sock_fd);
+             break;
+    case IO_FLUSH: req->error = proxyfs_flush(req->mount_handle, req->inode_number);
+             break;
+    default: req->error = EINVAL;
+    }
+
+    if (ret != 0) {
+        DPRINTF("Socket communication to proxyfs server failed\n");
+        sock_close(*sock_fd);
+        *sock_fd = -1;
+    }
 
 callback:
-        req->done_cb(req);
-        worker->num_ops_finished++;
-        dec_running_worker();
+    io_req_complete(req);
+    worker->num_ops_finished++;
+    dec_running_worker();
+}
+
+void *io_worker(void *arg)
+{
+    io_worker_t *worker = (io_worker_t *)arg;
+
+    // Init number of ops handled by this worker to zero
+    worker->num_ops_started  = 0;
+    worker->num_ops_finished = 0;
 
-        pthread_mutex_lock(&worker_config->request_queue_lock);
+    // Run on the shard's CPUs; the fast-port socket, opened from here, follows with receive flow steering
+    io_worker_shard_t *shard = &worker_config->shards[worker->shard];
+    if (worker_config->pin && (CPU_COUNT(&shard->cpus) > 0)) {
+        int ret = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &shard->cpus);
+        if (ret != 0) {
+            DPRINTF("Failed to pin io worker to shard %d: error: %d\n", worker->shard, ret);
+        }
     }
 
-    pthread_mutex_unlock(&worker_config->request_queue_lock);
+    int sock_fd = -1;
+    while (1) {
+        io_flow_ref_t ref;
+        int           from;
+
+        __atomic_add_fetch(&worker_config->idle_workers, 1, __ATOMIC_RELAXED);
+        proxyfs_io_request_t *req = wait_for_work(worker, &from, &ref);
+        __atomic_sub_fetch(&worker_config->idle_workers, 1, __ATOMIC_RELAXED);
+        if (req == NULL) {
+            if (mpmc_queue_closed(&shard->queue) || retire_worker(worker)) {
+                break;
+            }
+            continue;
+        }
+
+        handle_request(worker, merge_queued(req, from, &ref), &sock_fd);
+    }
+
+    if (sock_fd >= 0) {
+        sock_close(sock_fd);
+    }
     return NULL;
 }
 
 int schedule_io_work(proxyfs_io_request_t *req)
 {
-    io_worker_req_t *worker_req = (io_worker_req_t *)malloc(sizeof(io_worker_req_t));
-    worker_req->req = req;
-    pthread_mutex_lock(&worker_config->request_queue_lock);
-    TAILQ_INSERT_TAIL(&worker_config->request_queue, worker_req, request_queue_entry);
-    pthread_cond_signal(&worker_config->request_queue_cv);
-    pthread_mutex_unlock(&worker_config->request_queue_lock);
+    req->io_class  = io_sched_class_of(req, __atomic_load_n(&io_request_classes, __ATOMIC_RELAXED));
+    req->queued_ns = io_now_ns();
+    __atomic_add_fetch(&worker_config->classes[req->io_class].queued, 1, __ATOMIC_RELAXED);
+
+    // The shard of the CPU we're on, or the first one with room
+    int                cpu   = sched_getcpu();
+    int                shard = (cpu >= 0) ? worker_config->cpu_shard[cpu % worker_config->num_cpus] : 0;
+    io_worker_shard_t  *own  = &worker_config->shards[shard];
+    int                i;
+
+    // With every queue full, the workers are as far behind as we let them get; waiting here for room
+    // would hold up the submitter (which may be a completion callback on a worker) indefinitely
+    if (!mpmc_queue_try_push(&own->queue, req)) {
+        for (i = 0; i < worker_config->num_shards - 1; i++) {
+            if (mpmc_queue_try_push(&worker_config->shards[own->steal_order[i]].queue, req)) {
+                break;
+            }
+        }
+        if (i == worker_config->num_shards - 1) {
+            __atomic_sub_fetch(&worker_config->classes[req->io_class].queued, 1, __ATOMIC_RELAXED);
+            grow_workers_if_needed(shard);
+            return EAGAIN;
+        }
+    }
+    grow_workers_if_needed(shard);
 
     return 0;
 }
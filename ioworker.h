@@ -8,11 +8,64 @@
 #include <stdlib.h>
 #include <proxyfs.h>
 
-int io_workers_start(char *server, int port, int count);
+// Most workers a pool can have, and most request queues
+#define IO_WORKERS_LIMIT        1024
+#define IO_WORKER_SHARDS_LIMIT  256
+
+// Start the pool with min_workers threads. It adds threads, up to max_workers, while requests are waiting
+// for a worker, and retires those that had nothing to do for idle_timeout_ms (0: never) down to min_workers.
+//
+// Requests are queued in shards (0: one per online CPU) by the CPU they are submitted on; a worker serves
+// its own shard first and steals from the others when that's empty. With pin, workers only run on the
+// CPUs of their shard.
+int io_workers_start(char *server, int port, int min_workers, int max_workers, int idle_timeout_ms,
+                     int shards, bool pin);
 void io_workers_stop();
+
+// Queue a request for the workers. Returns 0, or EAGAIN without queueing it if every shard's queue is full.
 int schedule_io_work(proxyfs_io_request_t *req);
 
+// Send contiguous reads or writes of a file that are waiting together as one request of up to max_bytes
+// (0: never merge), waiting up to window_us for more to arrive when a worker finds only one. Takes effect
+// immediately, whether or not the pool is running.
+#define IO_MERGE_MAX_BYTES_DEFAULT  (1024 * 1024)
+void io_workers_set_merge(uint64_t max_bytes, int window_us);
+
+// Serve waiting requests by class and, within a class, fairly between mounts (the default), or in the
+// order they were submitted. Takes effect immediately.
+void io_workers_set_fair_queuing(bool enable);
+
+// Serve requests in the io_class they set rather than the one their op gets (off by default, since
+// callers that don't use classes may leave it uninitialized). Takes effect immediately.
+void io_workers_set_request_classes(bool enable);
+
+typedef struct {
+    uint64_t queued;         // waiting now
+    uint64_t dispatched;     // handed to a worker
+    uint64_t wait_us;        // time those waited, in total
+    uint64_t max_wait_us;
+} io_class_stats_t;
+
+typedef struct {
+    int      workers;        // threads now
+    int      busy;           // of those, handling a request
+    int      hwm_workers;    // most threads at once
+    uint64_t spawned;        // threads started, including the first min_workers
+    uint64_t retired;        // threads that exited for being idle
+    uint64_t queued;         // requests waiting for a worker
+    int      shards;
+    uint64_t steals;         // requests a worker took from another shard
+    uint64_t merged_ios;     // requests sent for several merged ones
+    uint64_t merged;         // requests that went out as part of one
+    uint64_t recent_wait_us; // moving average of the time requests wait for a worker
+    io_class_stats_t classes[IO_CLASSES];    // by io_class_t
+} io_workers_stats_t;
+
+// All zero if the pool isn't running
+void io_workers_get_stats(io_workers_stats_t *stats);
+
 int proxyfs_read_req(proxyfs_io_request_t *req, int sock_fd);
 int proxyfs_write_req(proxyfs_io_request_t *req, int sock_fd);
+bool io_req_has_buffer(proxyfs_io_request_t *req);
 
 #endif
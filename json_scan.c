@@ -0,0 +1,405 @@
+// Copyright (c) 2015-2021, NVIDIA CORPORATION.
+// SPDX-License-Identifier: Apache-2.0
+
+// In-place JSON scanning; see json_scan.h.
+
+#include <string.h>
+#include <sys/types.h>
+
+#include "json_scan.h"
+
+// Nesting beyond this is treated as malformed; responses are a few levels deep
+#define JSON_SCAN_MAX_DEPTH  64
+
+static const char* skip_ws(const char* p, const char* end)
+{
+    while ((p < end) && ((*p == ' ') || (*p == '\t') || (*p == '\n') || (*p == '\r'))) {
+        p++;
+    }
+    return p;
+}
+
+// p is at the opening quote; returns the position after the closing one.
+// memchr does the searching, since most of a response is in its strings.
+static const char* skip_str(const char* p, const char* end)
+{
+    for (p++; (p = memchr(p, '"', end - p)) != NULL; p++) {
+        // The quote is escaped if an odd number of backslashes precede it;
+        // the opening quote stops the count
+        const char* q = p;
+        while (*(q - 1) == '\\') {
+            q--;
+        }
+        if (((p - q) % 2) == 0) {
+            return p + 1;
+        }
+    }
+    return NULL;
+}
+
+// Characters that end a number or literal
+static const bool delimiter[256] = {
+    [','] = true, [':'] = true, [']'] = true, ['}'] = true, ['['] = true, ['{'] = true, ['"'] = true,
+    [' '] = true, ['\t'] = true, ['\n'] = true, ['\r'] = true,
+};
+
+// Skip the value at p, which has no leading whitespace
+static const char* skip_value(const char* p, const char* end)
+{
+    int depth = 0;
+
+    if (p >= end) {
+        return NULL;
+    }
+    if (*p == '"') {
+        return skip_str(p, end);
+    }
+    if ((*p != '{') && (*p != '[')) {
+        // A number or literal: runs up to the next delimiter
+        while ((p < end) && !delimiter[(uint8_t)*p]) {
+            p++;
+        }
+        return p;
+    }
+
+    // Within an object or array only strings and brackets matter
+    for (; p < end; p++) {
+        switch (*p) {
+            case '"':
+                p = skip_str(p, end);
+                if (p == NULL) {
+                    return NULL;
+                }
+                p--;
+                break;
+            case '{':
+            case '[':
+                if (++depth > JSON_SCAN_MAX_DEPTH) {
+                    return NULL;
+                }
+                break;
+            case '}':
+            case ']':
+                if (--depth == 0) {
+                    return p + 1;
+                }
+                break;
+        }
+    }
+    return NULL;
+}
+
+bool json_scan_value(const char* start, const char* end, json_span_t* out_value)
+{
+    const char* p = skip_ws(start, end);
+    const char* value_end = skip_value(p, end);
+    if ((value_end == NULL) || (value_end == p)) {
+        return false;
+    }
+    out_value->start = p;
+    out_value->end   = value_end;
+    return true;
+}
+
+static bool scan_begin(json_scan_t* scan, json_span_t value, char open)
+{
+    if ((value.end - value.start < 2) || (*value.start != open)) {
+        return false;
+    }
+    scan->p   = value.start + 1;
+    scan->end = value.end;
+    return true;
+}
+
+// Move past the separator after an element
+static void scan_separator(json_scan_t* scan)
+{
+    scan->p = skip_ws(scan->p, scan->end);
+    if ((scan->p < scan->end) && (*scan->p == ',')) {
+        scan->p++;
+    }
+}
+
+// Whether scan is at the closing bracket; if so, move past it and its separator
+static bool scan_close(json_scan_t* scan, char close)
+{
+    scan->p = skip_ws(scan->p, scan->end);
+    if ((scan->p < scan->end) && (*scan->p != close)) {
+        return false;
+    }
+    if (scan->p < scan->end) {
+        scan->p++;
+        scan_separator(scan);
+    }
+    return true;
+}
+
+bool json_scan_object_begin(json_scan_t* scan, json_span_t value)
+{
+    return scan_begin(scan, value, '{');
+}
+
+bool json_scan_object_next(json_scan_t* scan, json_span_t* out_key, json_span_t* out_value)
+{
+    if (scan_close(scan, '}')) {
+        return false;
+    }
+
+    const char* p = scan->p;
+    if (*p != '"') {
+        return false;
+    }
+    const char* key_end = skip_str(p, scan->end);
+    if (key_end == NULL) {
+        return false;
+    }
+    out_key->start = p + 1;
+    out_key->end   = key_end - 1;
+
+    p = skip_ws(key_end, scan->end);
+    if ((p >= scan->end) || (*p != ':')) {
+        return false;
+    }
+    if (!json_scan_value(p + 1, scan->end, out_value)) {
+        return false;
+    }
+    scan->p = out_value->end;
+    scan_separator(scan);
+    return true;
+}
+
+bool json_scan_array_begin(json_scan_t* scan, json_span_t value)
+{
+    return scan_begin(scan, value, '[');
+}
+
+bool json_scan_array_next(json_scan_t* scan, json_span_t* out_value)
+{
+    if (scan_close(scan, ']')) {
+        return false;
+    }
+    if (!json_scan_value(scan->p, scan->end, out_value)) {
+        return false;
+    }
+    scan->p = out_value->end;
+    scan_separator(scan);
+    return true;
+}
+
+bool json_scan_array_next_object(json_scan_t* scan)
+{
+    if (scan_close(scan, ']') || (*scan->p != '{')) {
+        return false;
+    }
+    scan->p++;
+    return true;
+}
+
+bool json_span_key_is(json_span_t key_span, const char* key)
+{
+    size_t len = key_span.end - key_span.start;
+    return (strncmp(key_span.start, key, len) == 0) && (key[len] == '\0');
+}
+
+bool json_scan_find(json_span_t object, const char* key, json_span_t* out_value)
+{
+    json_scan_t scan;
+    json_span_t member_key;
+
+    if (!json_scan_object_begin(&scan, object)) {
+        return false;
+    }
+    while (json_scan_object_next(&scan, &member_key, out_value)) {
+        if (json_span_key_is(member_key, key)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool json_span_is_null(json_span_t value)
+{
+    return (value.end - value.start == 4) && (memcmp(value.start, "null", 4) == 0);
+}
+
+bool json_span_int64(json_span_t value, int64_t* out)
+{
+    const char* p        = value.start;
+    bool        negative = false;
+    uint64_t    result   = 0;
+
+    if ((p < value.end) && (*p == '-')) {
+        negative = true;
+        p++;
+    }
+    if ((p >= value.end) || (*p < '0') || (*p > '9')) {
+        return false;
+    }
+    while ((p < value.end) && (*p >= '0') && (*p <= '9')) {
+        if (__builtin_mul_overflow(result, 10, &result) || __builtin_add_overflow(result, *p - '0', &result)) {
+            return false;
+        }
+        p++;
+    }
+
+    // Nothing may follow the digits: no fraction or exponent
+    if (p != value.end) {
+        return false;
+    }
+
+    // A negative value has to fit in int64_t; a positive one in uint64_t
+    if (negative && (result > (uint64_t)INT64_MAX + 1)) {
+        return false;
+    }
+
+    *out = negative ? (int64_t)(0 - result) : (int64_t)result;
+    return true;
+}
+
+bool json_span_bool(json_span_t value, bool* out)
+{
+    size_t len = value.end - value.start;
+
+    if ((len == 4) && (memcmp(value.start, "true", 4) == 0)) {
+        *out = true;
+        return true;
+    }
+    if ((len == 5) && (memcmp(value.start, "false", 5) == 0)) {
+        *out = false;
+        return true;
+    }
+    return false;
+}
+
+bool json_span_raw_str(json_span_t value, json_span_t* out_chars)
+{
+    if ((value.end - value.start < 2) || (*value.start != '"')) {
+        return false;
+    }
+    if (memchr(value.start + 1, '\\', value.end - value.start - 2) != NULL) {
+        return false;
+    }
+    out_chars->start = value.start + 1;
+    out_chars->end   = value.end - 1;
+    return true;
+}
+
+static int hex_digit(char c)
+{
+    if ((c >= '0') && (c <= '9')) {
+        return c - '0';
+    }
+    if ((c >= 'a') && (c <= 'f')) {
+        return c - 'a' + 10;
+    }
+    if ((c >= 'A') && (c <= 'F')) {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+// The four hex digits of a \u escape at p; -1 if they aren't there
+static int32_t hex4(const char* p, const char* end)
+{
+    int32_t code = 0;
+    int     i;
+
+    if (end - p < 4) {
+        return -1;
+    }
+    for (i = 0; i < 4; i++) {
+        int digit = hex_digit(p[i]);
+        if (digit < 0) {
+            return -1;
+        }
+        code = (code << 4) | digit;
+    }
+    return code;
+}
+
+ssize_t json_span_str(json_span_t value, char* out, size_t out_size)
+{
+    if ((value.end - value.start < 2) || (*value.start != '"')) {
+        return -1;
+    }
+
+    const char* p   = value.start + 1;
+    const char* end = value.end - 1;
+    size_t      len = 0;
+
+#define PUT(c)  do { if (len + 1 < out_size) { out[len] = (c); } len++; } while (0)
+
+    while (p < end) {
+        // Copy up to the next escape in one go
+        const char* escape = memchr(p, '\\', end - p);
+        const char* run_end = (escape != NULL) ? escape : end;
+        size_t      run     = run_end - p;
+        if (len + 1 < out_size) {
+            memcpy(out + len, p, (len + run < out_size) ? run : out_size - 1 - len);
+        }
+        len += run;
+        p    = run_end;
+        if (escape == NULL) {
+            break;
+        }
+
+        p++;
+        if (p >= end) {
+            break;
+        }
+        char c = *p++;
+        switch (c) {
+            case 'b': PUT('\b'); break;
+            case 'f': PUT('\f'); break;
+            case 'n': PUT('\n'); break;
+            case 'r': PUT('\r'); break;
+            case 't': PUT('\t'); break;
+            case 'u': {
+                int32_t code = hex4(p, end);
+                if (code < 0) {
+                    PUT('u');
+                    break;
+                }
+                p += 4;
+
+                // A surrogate pair makes up one code point
+                if ((code >= 0xd800) && (code < 0xdc00) && (end - p >= 6) && (p[0] == '\\') && (p[1] == 'u')) {
+                    int32_t low = hex4(p + 2, end);
+                    if ((low >= 0xdc00) && (low < 0xe000)) {
+                        code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+                        p += 6;
+                    }
+                }
+
+                // UTF-8
+                if (code < 0x80) {
+                    PUT(code);
+                } else if (code < 0x800) {
+                    PUT(0xc0 | (code >> 6));
+                    PUT(0x80 | (code & 0x3f));
+                } else if (code < 0x10000) {
+                    PUT(0xe0 | (code >> 12));
+                    PUT(0x80 | ((code >> 6) & 0x3f));
+                    PUT(0x80 | (code & 0x3f));
+                } else {
+                    PUT(0xf0 | (code >> 18));
+                    PUT(0x80 | ((code >> 12) & 0x3f));
+                    PUT(0x80 | ((code >> 6) & 0x3f));
+                    PUT(0x80 | (code & 0x3f));
+                }
+                break;
+            }
+            default:
+                // \" \\ \/ and anything unexpected stand for themselves
+                PUT(c);
+                break;
+        }
+    }
+
+#undef PUT
+
+    if (out_size > 0) {
+        out[(len < out_size) ? len : out_size - 1] = '\0';
+    }
+    return len;
+}
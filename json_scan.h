@@ -0,0 +1,75 @@
+// Copyright (c) 2015-2021, NVIDIA CORPORATION.
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef __PFS_JSON_SCAN_H__
+#define __PFS_JSON_SCAN_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+// Scanning JSON text in place, without building json-c objects.
+//
+// The scanner walks objects and arrays and decodes numbers and strings
+// straight out of the text. It never allocates and never modifies the text.
+// It checks only as much syntax as it needs to find its way, since the text
+// comes from the server; malformed input makes a call fail rather than read
+// outside the span.
+
+// A run of JSON text: a whole value, or the characters of an object key
+// between its quotes (escapes left as they are)
+typedef struct {
+    const char* start;
+    const char* end;    // one past the last character
+} json_span_t;
+
+// Position while iterating over the members of an object or an array
+typedef struct {
+    const char* p;
+    const char* end;
+} json_scan_t;
+
+// The JSON value that starts at (or after whitespace at) start, ending no
+// later than end. Returns false if there isn't a well-formed one.
+bool   json_scan_value(const char* start, const char* end, json_span_t* out_value);
+
+// Iterate over an object's members or an array's elements. begin returns
+// false if value isn't an object (or array); next returns false after the
+// last one, or on malformed input.
+bool   json_scan_object_begin(json_scan_t* scan, json_span_t value);
+bool   json_scan_object_next(json_scan_t* scan, json_span_t* out_key, json_span_t* out_value);
+bool   json_scan_array_begin(json_scan_t* scan, json_span_t value);
+bool   json_scan_array_next(json_scan_t* scan, json_span_t* out_value);
+
+// Step into the next element of an array, which has to be an object, so that
+// json_scan_object_next() on the same scan iterates over its members; once
+// they are done, the scan carries on with the array. This saves going over
+// each element twice, once to find its end and again to look inside it.
+bool   json_scan_array_next_object(json_scan_t* scan);
+
+// Find key among the members of object
+bool   json_scan_find(json_span_t object, const char* key, json_span_t* out_value);
+
+// Whether a key span is exactly key
+bool   json_span_key_is(json_span_t key_span, const char* key);
+
+bool   json_span_is_null(json_span_t value);
+
+// An integer value, as int64_t (or, above INT64_MAX, the same bits as
+// uint64_t). Returns false for anything but a plain integer in
+// [INT64_MIN, UINT64_MAX]: fractions, exponents, booleans, and strings.
+bool   json_span_int64(json_span_t value, int64_t* out);
+
+// true or false
+bool   json_span_bool(json_span_t value, bool* out);
+
+// A string value without its quotes, if it contains no escapes
+bool   json_span_raw_str(json_span_t value, json_span_t* out_chars);
+
+// Unescape a string value into out, truncating to out_size-1 bytes and null
+// terminating (out may be NULL if out_size is 0). Returns the full unescaped
+// length, or -1 if value isn't a string.
+ssize_t json_span_str(json_span_t value, char* out, size_t out_size);
+
+#endif // __PFS_JSON_SCAN_H__
@@ -9,6 +9,7 @@
 #include <base64.h>
 #include <json_utils.h>
 #include <json_utils_internal.h>
+#include <json_scan.h>
 #include <debug.h>
 
 
@@ -38,125 +39,419 @@ struct json_object * find_something(json_object *jobj, const char *key) {
     return tmp;
 }
 
-void jsonrpc_set_req_method(jsonrpc_request_t* req, const char* method)
+// Request rendering
+//
+// Requests are written straight into a buffer as JSON text instead of being
+// built as json-c objects and then rendered. The text is exactly what
+// json_object_to_json_string_ext(JSON_C_TO_STRING_PLAIN) made of the objects,
+// down to escaping '/' as "\/", except that base64 buffers are written as they
+// are. Keys (ptable[] entries) are plain identifiers and are copied without
+// escaping.
+//
+// Every thread has one request buffer, which grows to fit the largest request
+// it has rendered and is then reused, so building a request allocates
+// nothing. A request takes the buffer in jsonrpc_set_req_method() and gives it
+// back in jsonrpc_release_req(), once it has been sent (or closed unsent). If
+// a thread starts a second request before giving the buffer back, the second
+// one gets a buffer of its own, which it keeps as a spare once released
+// (unless it grew large) so that the next time doesn't allocate either.
+//
+// A request can outlive the thread that started it (e.g. one opened on a
+// thread that exits before it is sent). A thread's buffer that is still out
+// when the thread exits is orphaned instead of freed, and freed by the
+// release that gives it back.
+
+#define REQ_BUF_INITIAL_SIZE  4096
+#define REQ_BUF_SPARE_MAX     (64 * 1024)
+
+static uint64_t req_buf_alloc_count = 0;
+
+typedef enum {
+    REQ_BUF_IDLE = 0,
+    REQ_BUF_BUSY,         // held by a request
+    REQ_BUF_ORPHANED,     // held by a request, and the thread has exited
+} req_buf_state_t;
+
+struct jsonrpc_req_buf_s {
+    char*   buf;
+    size_t  size;
+    int     state;        // req_buf_state_t
+};
+
+static pthread_key_t  req_buf_key;
+static pthread_once_t req_buf_once = PTHREAD_ONCE_INIT;
+
+// Thread exit; if a request still holds the buffer, it is freed when the request gives it back
+static void req_buf_free(void* arg)
+{
+    jsonrpc_req_buf_t* thread_buf = (jsonrpc_req_buf_t*)arg;
+    if (__atomic_exchange_n(&thread_buf->state, REQ_BUF_ORPHANED, __ATOMIC_ACQ_REL) != REQ_BUF_IDLE) {
+        return;
+    }
+    free(thread_buf->buf);
+    free(thread_buf);
+}
+
+static void req_buf_init()
+{
+    pthread_key_create(&req_buf_key, req_buf_free);
+}
+
+static void req_buf_acquire(jsonrpc_request_t* req)
+{
+    req->buf    = NULL;
+    req->len    = 0;
+    req->size   = 0;
+    req->failed = false;
+    req->owner  = NULL;
+
+    pthread_once(&req_buf_once, req_buf_init);
+    jsonrpc_req_buf_t* thread_buf = (jsonrpc_req_buf_t*)pthread_getspecific(req_buf_key);
+    if (thread_buf == NULL) {
+        thread_buf = (jsonrpc_req_buf_t*)calloc(1, sizeof(jsonrpc_req_buf_t));
+        if ((thread_buf == NULL) || (pthread_setspecific(req_buf_key, thread_buf) != 0)) {
+            free(thread_buf);
+            return;
+        }
+    }
+
+    // Only this thread marks its buffer busy, so checking first is enough
+    if (__atomic_load_n(&thread_buf->state, __ATOMIC_ACQUIRE) == REQ_BUF_IDLE) {
+        __atomic_store_n(&thread_buf->state, REQ_BUF_BUSY, __ATOMIC_RELAXED);
+        req->owner       = thread_buf;
+        req->buf         = thread_buf->buf;
+        req->size        = thread_buf->size;
+    } else if (req->spare != NULL) {
+        req->buf         = req->spare;
+        req->size        = req->spare_size;
+        req->spare       = NULL;
+        req->spare_size  = 0;
+    }
+}
+
+void jsonrpc_release_req(jsonrpc_request_t* req)
+{
+    if (req->owner != NULL) {
+        // The owning thread may have exited, leaving the buffer to us
+        if (__atomic_exchange_n(&req->owner->state, REQ_BUF_IDLE, __ATOMIC_ACQ_REL) == REQ_BUF_ORPHANED) {
+            free(req->owner->buf);
+            free(req->owner);
+        }
+    } else if ((req->spare == NULL) && (req->size <= REQ_BUF_SPARE_MAX)) {
+        req->spare      = req->buf;
+        req->spare_size = req->size;
+    } else {
+        free(req->buf);
+    }
+    req->buf   = NULL;
+    req->len   = 0;
+    req->size  = 0;
+    req->owner = NULL;
+}
+
+void jsonrpc_free_req(jsonrpc_request_t* req)
+{
+    jsonrpc_release_req(req);
+    free(req->spare);
+    req->spare      = NULL;
+    req->spare_size = 0;
+}
+
+uint64_t jsonrpc_req_buf_allocs()
+{
+    return req_buf_alloc_count;
+}
+
+// Make room for more bytes; false (and req->failed) if that's not possible
+static bool req_reserve(jsonrpc_request_t* req, size_t more)
+{
+    if (req->len + more <= req->size) {
+        return true;
+    }
+    if (req->failed) {
+        return false;
+    }
+
+    size_t new_size = (req->size > 0) ? req->size : REQ_BUF_INITIAL_SIZE;
+    while (new_size < req->len + more) {
+        new_size *= 2;
+    }
+    char* new_buf = (char*)realloc(req->buf, new_size);
+    if (new_buf == NULL) {
+        DPRINTF("Error, unable to grow request buffer to %ld bytes.\n", new_size);
+        req->failed = true;
+        return false;
+    }
+    req->buf  = new_buf;
+    req->size = new_size;
+    __sync_fetch_and_add(&req_buf_alloc_count, 1);
+
+    // Keep the thread's buffer pointing at the grown one
+    if (req->owner != NULL) {
+        req->owner->buf  = new_buf;
+        req->owner->size = new_size;
+    }
+    return true;
+}
+
+static void req_append(jsonrpc_request_t* req, const char* text, size_t len)
+{
+    if (req_reserve(req, len)) {
+        memcpy(req->buf + req->len, text, len);
+        req->len += len;
+    }
+}
+
+#define req_append_const(req, text)  req_append((req), (text), sizeof(text) - 1)
+
+static void req_append_int64(jsonrpc_request_t* req, int64_t value)
 {
-    char full_method[80];
-    sprintf(full_method,"%s.%s",method_prefix,method);
+    char     digits[20];
+    int      num_digits = 0;
+    uint64_t magnitude  = (value < 0) ? -(uint64_t)value : (uint64_t)value;
+
+    do {
+        digits[num_digits++] = '0' + (magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude != 0);
 
-    // Add the top-level key-value pairs
-    json_object_object_add(req->request, ID_KEY, json_object_new_int(req->request_id));
-    json_object_object_add(req->request, METHOD_KEY, json_object_new_string(full_method));
-    json_object_object_add(req->request, JSONRPC_KEY, json_object_new_string(JSONRPC_VAL));
+    if (!req_reserve(req, num_digits + 1)) {
+        return;
+    }
+    if (value < 0) {
+        req->buf[req->len++] = '-';
+    }
+    while (num_digits > 0) {
+        req->buf[req->len++] = digits[--num_digits];
+    }
+}
 
-    // Create the params array, which will consist of key-value pairs
-    // but for now is empty
-    json_object* pobj = json_object_new_array();
-    json_object* params_obj  = json_object_new_object();
-    json_object_array_add(pobj,params_obj);
+// A quoted, escaped string the way json-c escapes it
+static void req_append_str(jsonrpc_request_t* req, const char* value, size_t value_len)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    // Worst case every byte becomes \u00XX
+    if (!req_reserve(req, value_len * 6 + 2)) {
+        return;
+    }
+
+    char* out = req->buf + req->len;
+    *out++ = '"';
+    size_t i;
+    for (i = 0; i < value_len; i++) {
+        unsigned char c = (unsigned char)value[i];
+        switch (c) {
+            case '"':  *out++ = '\\'; *out++ = '"';  break;
+            case '\\': *out++ = '\\'; *out++ = '\\'; break;
+            case '/':  *out++ = '\\'; *out++ = '/';  break;
+            case '\b': *out++ = '\\'; *out++ = 'b';  break;
+            case '\f': *out++ = '\\'; *out++ = 'f';  break;
+            case '\n': *out++ = '\\'; *out++ = 'n';  break;
+            case '\r': *out++ = '\\'; *out++ = 'r';  break;
+            case '\t': *out++ = '\\'; *out++ = 't';  break;
+            default:
+                if (c < ' ') {
+                    *out++ = '\\'; *out++ = 'u'; *out++ = '0'; *out++ = '0';
+                    *out++ = hex[c >> 4];
+                    *out++ = hex[c & 0xf];
+                } else {
+                    *out++ = c;
+                }
+                break;
+        }
+    }
+    *out++ = '"';
+    req->len = out - req->buf;
+}
+
+// Start a parameter: separator, key and colon
+static void req_append_key(jsonrpc_request_t* req, const char* key)
+{
+    size_t key_len = strlen(key);
+    if (!req_reserve(req, key_len + 4)) {
+        return;
+    }
+
+    // The params object is opened by jsonrpc_set_req_method
+    if (req->buf[req->len - 1] != '{') {
+        req->buf[req->len++] = ',';
+    }
+    req->buf[req->len++] = '"';
+    memcpy(req->buf + req->len, key, key_len);
+    req->len += key_len;
+    req->buf[req->len++] = '"';
+    req->buf[req->len++] = ':';
+}
+
+void jsonrpc_set_req_method(jsonrpc_request_t* req, const char* method)
+{
+    req_buf_acquire(req);
+
+    // The top-level key-value pairs (ID_KEY, METHOD_KEY, JSONRPC_KEY) and
+    // the opening of PARAMS_KEY, an array holding one object of key-value
+    // pairs that the jsonrpc_set_req_param_* calls fill in
+    req_append_const(req, "{\"id\":");
+    req_append_int64(req, (int64_t)req->request_id);
+    req_append_const(req, ",\"method\":\"");
+    req_append(req, method_prefix, sizeof(method_prefix) - 1);
+    req_append_const(req, ".");
+    req_append(req, method, strlen(method));
+    req_append_const(req, "\",\"jsonrpc\":\"2.0\",\"params\":[{");
+}
 
-    // Save params_obj in the req to make it easier to add params later
-    req->request_params = params_obj;
+const char* jsonrpc_finish_req(jsonrpc_request_t* req, size_t* out_len)
+{
+    // Close params and the request, and terminate the text without counting
+    // any of it in req->len, so that more params could still be added
+    if (!req_reserve(req, 4) || req->failed) {
+        return NULL;
+    }
+    memcpy(req->buf + req->len, "}]}", 4);
 
-    // Add the params array to the top-level object
-    json_object_object_add(req->request, PARAMS_KEY, pobj);
+    *out_len = req->len + 3;
+    return req->buf;
 }
 
 void jsonrpc_set_req_param_str(jsonrpc_context_t* ctx, char* key, char* value)
 {
-    json_object_object_add(ctx->req.request_params, key, json_object_new_string(value));
+    req_append_key(&ctx->req, key);
+    if (value == NULL) {
+        req_append_const(&ctx->req, "null");
+    } else {
+        req_append_str(&ctx->req, value, strlen(value));
+    }
 }
 
 void jsonrpc_set_req_param_int(jsonrpc_context_t* ctx, char* key, int value)
 {
-    json_object_object_add(ctx->req.request_params, key, json_object_new_int(value));
+    req_append_key(&ctx->req, key);
+    req_append_int64(&ctx->req, value);
 }
 
 void jsonrpc_set_req_param_int64(jsonrpc_context_t* ctx, char* key, int64_t value)
 {
-    json_object_object_add(ctx->req.request_params, key, json_object_new_int64(value));
+    req_append_key(&ctx->req, key);
+    req_append_int64(&ctx->req, value);
 }
 
 void jsonrpc_set_req_param_uint64(jsonrpc_context_t* ctx, char* key, uint64_t value)
 {
-    json_object_object_add(ctx->req.request_params, key, json_object_new_int64((int64_t)value));
+    // Sent as a signed value, as it always has been
+    req_append_key(&ctx->req, key);
+    req_append_int64(&ctx->req, (int64_t)value);
 }
 
 void jsonrpc_set_req_param_buf(jsonrpc_context_t* ctx, char* key, uint8_t* buf, size_t buf_size)
 {
-    // Encode binary data as a base64 string
-    char* encoded_data = encode_binary(buf, buf_size);
+    jsonrpc_request_t* req         = &ctx->req;
+    size_t             encoded_len = base64_encoded_len(buf_size);
 
-    // Set the encoded string in the request header
-    json_object_object_add(ctx->req.request_params, key, json_object_new_string(encoded_data));
-
-    // Free the temporary encoded string; it's been copied into the json header
-    free(encoded_data);
+    // Base64 never needs escaping, so encode straight into the request
+    req_append_key(req, key);
+    if (!req_reserve(req, encoded_len + 2)) {
+        return;
+    }
+    req->buf[req->len++] = '"';
+    base64_encode(buf, buf_size, req->buf + req->len);
+    req->len += encoded_len;
+    req->buf[req->len++] = '"';
 }
 
-int jsonrpc_get_resp_id(jsonrpc_response_t* resp)
+// Pick the errno out of an error string made up of "key: value" lines
+static int resp_error_errno(char* error_string)
 {
-    json_object* obj = find_something(resp->response, ID_KEY);
+    int rtnVal = -1;
 
-    enum json_type type = json_object_get_type(obj);
-    if (type != json_type_int) {
-        DPRINTF("Error, id field is not an int (type=%d)!\n",type);
-        return -1;
+    // Look for key: value lines
+    char* bufPtr = error_string;
+    char *line, *key, *value, *brkb = NULL;
+    while (line = strtok_r(bufPtr, "\n", &bufPtr))
+    {
+        // Get this line's key and value
+        key   = strtok_r(line, ": ", &brkb);
+        value = (key != NULL) ? strtok_r(NULL, ": ", &brkb) : NULL;
+        if ((key == NULL) || (value == NULL)) {
+            continue;
+        }
+
+        // Look for errno
+        if (strcmp(key, "errno") == 0) {
+            // Found the errno
+            rtnVal = atoi(value);
+        }
     }
 
-    return json_object_get_int(obj);
+    return rtnVal;
 }
 
-int jsonrpc_get_resp_error(jsonrpc_response_t* resp, const char** error_string)
+// Scan the envelope of the response in resp->readBuf: set its id, its error
+// (0 for a null error) and where its result is, without parsing the result.
+void jsonrpc_parse_response(jsonrpc_response_t* resp)
 {
-    json_object* obj = NULL;
-    int rtnVal = -1;
-
-    if (json_object_object_get_ex(resp->response, ERROR_KEY, &obj)) {
-        // key was found, as it should be
-        enum json_type type = json_object_get_type(obj);
-        if (type == json_type_string) {
-            // Found an error
-            *error_string = json_object_get_string(obj);
-
-            //DPRINTF("error=%s was returned.\n",*error_string);
+    json_span_t response;
+    json_span_t key;
+    json_span_t value;
+    json_scan_t scan;
+    bool        have_error = false;
+
+    resp->response_id  = JSONRPC_NO_ID;
+    resp->rsp_err      = -1;
+    resp->result.start = NULL;
+    resp->result.end   = NULL;
+
+    const char* text = resp->readBuf;
+    if (!json_scan_value(text, text + strlen(text), &response) || !json_scan_object_begin(&scan, response)) {
+        DPRINTF("Error, response is not a json object!\n");
+        return;
+    }
 
-            // Convert error string to errno
+    while (json_scan_object_next(&scan, &key, &value)) {
+        if (json_span_key_is(key, ID_KEY)) {
+            int64_t id;
+            if (json_span_int64(value, &id)) {
+                resp->response_id = (uint64_t)id;
+            } else {
+                DPRINTF("Error, id field is not an int!\n");
+            }
 
-            // Look for key: value lines
-            char* bufPtr = (char*)*error_string;
-            char *line, *key, *value, *brkt, *brkb = NULL;
-            while (line = strtok_r(bufPtr, "\n", &bufPtr))
-            {
-                //printf("Line: %s\n", line);
+        } else if (json_span_key_is(key, RESULT_KEY)) {
+            resp->result = value;
 
-                // Get this line's key and value
-                key = strtok_r(line, ": ", &brkb);
-                if (key != NULL) {
-                    value = strtok_r(NULL, ": ", &brkb);
-                }
+        } else if (json_span_key_is(key, ERROR_KEY)) {
+            have_error = true;
 
-                // Look for errno
-                if (strcmp(key, "errno") == 0) {
-                    // Found the errno
-                    rtnVal = atoi(value);
-                    //printf("Errno is %d\n", rtnVal);
+            if (json_span_is_null(value)) {
+                // Error field present but is null. This means success.
+                resp->rsp_err = 0;
+                continue;
+            }
 
-                // Look for HTTP status
-                } else if (strcmp(key, "httpStatus") == 0) {
-                    // Found the http status
-                    //printf("HTTP status is %s\n", value);
+            // Found an error; convert the error string to errno
+            char    local_string[256];
+            char*   error_string = local_string;
+            ssize_t len          = json_span_str(value, NULL, 0);
+            if (len >= (ssize_t)sizeof(local_string)) {
+                error_string = malloc(len + 1);
+                if (error_string == NULL) {
+                    resp->rsp_err = ENOMEM;
+                    continue;
                 }
             }
-        } else {
-            // Error field present but is null. This means success.
-            rtnVal = 0;
+            if (len >= 0) {
+                json_span_str(value, error_string, len + 1);
+                DPRINTF("error=%s was returned.\n", error_string);
+                resp->rsp_err = resp_error_errno(error_string);
+            }
+            if (error_string != local_string) {
+                free(error_string);
+            }
         }
-    } else {
-        DPRINTF("Error field not found in response!\n");
     }
 
-    //DPRINTF("Returning %d\n", rtnVal);
-    return rtnVal;
+    if (!have_error) {
+        DPRINTF("Error field not found in response!\n");
+    }
 }
 
 int jsonrpc_get_resp_status(jsonrpc_context_t* ctx)
@@ -164,10 +459,56 @@ int jsonrpc_get_resp_status(jsonrpc_context_t* ctx)
     return ctx->resp.rsp_err;
 }
 
+// The result as json-c objects, for the getters that hand out pointers into
+// them. It's parsed from the response text the first time it's needed; most
+// responses are only ever scanned.
+static json_object* resp_result_obj(jsonrpc_context_t* ctx)
+{
+    jsonrpc_response_t* resp = &ctx->resp;
+
+    if ((resp->response == NULL) && (resp->result.start != NULL)) {
+        // Parsed from a terminated copy, since the text after the result
+        // in readBuf is still the response's
+        size_t len  = resp->result.end - resp->result.start;
+        char*  text = (char*)malloc(len + 1);
+        if (text != NULL) {
+            memcpy(text, resp->result.start, len);
+            text[len] = '\0';
+            resp->response = json_tokener_parse(text);
+            free(text);
+        }
+        resp->response_result = resp->response;
+    }
+    return resp->response_result;
+}
+
+// Find key in the result
+static bool resp_find(json_span_t object, const char* key, json_span_t* out_value)
+{
+    if (!json_scan_find(object, key, out_value)) {
+        DPRINTF("%s field not found in response!\n",key);
+        return false;
+    }
+    return true;
+}
+
+// An integer field; -1 if it's missing and 0 if it isn't a number
+static int64_t resp_int64(json_span_t object, const char* key)
+{
+    json_span_t value;
+    int64_t     result = 0;
+
+    if (!resp_find(object, key, &value)) {
+        return -1;
+    }
+    json_span_int64(value, &result);
+    return result;
+}
+
 const char* jsonrpc_get_resp_str(jsonrpc_context_t* ctx, char* key)
 {
     json_object* obj = NULL;
-    if (!json_object_object_get_ex(ctx->resp.response_result, key, &obj)) {
+    if (!json_object_object_get_ex(resp_result_obj(ctx), key, &obj)) {
         DPRINTF("%s field not found in response!\n",key);
         return NULL;
     }
@@ -177,81 +518,100 @@ const char* jsonrpc_get_resp_str(jsonrpc_context_t* ctx, char* key)
     return value;
 }
 
-int jsonrpc_get_resp_int(jsonrpc_context_t* ctx, char* key)
+char* jsonrpc_get_resp_strdup(jsonrpc_context_t* ctx, char* key)
 {
-    json_object* obj = NULL;
-    if (!json_object_object_get_ex(ctx->resp.response_result, key, &obj)) {
-        DPRINTF("%s field not found in response!\n",key);
-        return -1;
+    json_span_t value;
+    if (!resp_find(ctx->resp.result, key, &value)) {
+        return NULL;
     }
 
-    int value = json_object_get_int(obj);
+    ssize_t len = json_span_str(value, NULL, 0);
+    if (len < 0) {
+        DPRINTF("%s field is not a string!\n",key);
+        return NULL;
+    }
+
+    char* str = malloc(len + 1);
+    if (str != NULL) {
+        json_span_str(value, str, len + 1);
+        DPRINTF("Returned %s: %s\n", key, str);
+    }
+    return str;
+}
+
+int jsonrpc_get_resp_int(jsonrpc_context_t* ctx, char* key)
+{
+    int value = (int)resp_int64(ctx->resp.result, key);
     DPRINTF("Returned %s: %d\n", key, value);
     return value;
 }
 
 uint64_t jsonrpc_get_resp_uint64(jsonrpc_context_t* ctx, char* key)
 {
-    json_object* obj = NULL;
-    if (!json_object_object_get_ex(ctx->resp.response_result, key, &obj)) {
-        DPRINTF("%s field not found in response!\n",key);
-        return -1;
-    }
-
-    uint64_t value = (uint64_t)json_object_get_int64(obj);
+    uint64_t value = (uint64_t)resp_int64(ctx->resp.result, key);
     DPRINTF("Returned %s: %" PRIu64 "\n", key, value);
     return value;
 }
 
 int64_t jsonrpc_get_resp_int64(jsonrpc_context_t* ctx, char* key)
 {
-    json_object* obj = NULL;
-    if (!json_object_object_get_ex(ctx->resp.response_result, key, &obj)) {
-        DPRINTF("%s field not found in response!\n",key);
-        return -1;
-    }
-
-    int64_t value = json_object_get_int64(obj);
+    int64_t value = resp_int64(ctx->resp.result, key);
     DPRINTF("Returned %s: %" PRId64 "\n", key, value);
     return value;
 }
 
 bool jsonrpc_get_resp_bool(jsonrpc_context_t* ctx, char* key)
 {
-    json_object* obj = NULL;
-    if (!json_object_object_get_ex(ctx->resp.response_result, key, &obj)) {
-        DPRINTF("%s field not found in response!\n",key);
-        return -1;
-    }
+    json_span_t span;
+    bool        value = false;
 
-    bool value = json_object_get_boolean(obj);
+    if (resp_find(ctx->resp.result, key, &span) && !json_span_bool(span, &value)) {
+        // The way json-c reads a number as a bool
+        int64_t number = 0;
+        value = json_span_int64(span, &number) && (number != 0);
+    }
     DPRINTF("Returned %s: %s\n", key, (value?"true":"false"));
     return value;
 }
 
-void jsonrpc_get_resp_buf(jsonrpc_context_t* ctx, char* key, uint8_t* buf, size_t buf_size, size_t* bytes_written)
+int jsonrpc_get_resp_buf(jsonrpc_context_t* ctx, char* key, uint8_t* buf, size_t buf_size, size_t* bytes_written)
 {
     // Init return values
     *bytes_written = 0;
 
-    json_object* obj = NULL;
-    if (!json_object_object_get_ex(ctx->resp.response_result, key, &obj)) {
-        DPRINTF("%s field not found in response!\n",key);
-        return;
+    json_span_t value;
+    json_span_t chars;
+    if (!resp_find(ctx->resp.result, key, &value)) {
+        return ENOENT;
+    }
+    if (json_span_is_null(value)) {
+        return 0;
     }
 
-    const char* value = json_object_get_string(obj);
-    //DPRINTF("Returned %s: %s\n", key, value);
-
-    // Decode from base64 into binary
-    decode_binary(value, buf, buf_size, bytes_written);
+    int err;
+    if (json_span_raw_str(value, &chars)) {
+        // Base64 never needs escaping, so decode straight out of the text
+        err = base64_decode(chars.start, chars.end - chars.start, buf, buf_size, bytes_written);
+    } else {
+        json_object* obj = NULL;
+        if (!json_object_object_get_ex(resp_result_obj(ctx), key, &obj) || (obj == NULL)) {
+            return EINVAL;
+        }
+        err = base64_decode(json_object_get_string(obj), json_object_get_string_len(obj), buf, buf_size,
+                            bytes_written);
+    }
+    if (err != 0) {
+        DPRINTF("Error %d decoding %s, decoded %zu bytes\n", err, key, *bytes_written);
+        return err;
+    }
     DPRINTF("Decoded %s: %p, len=%zu\n", key, buf, *bytes_written);
+    return 0;
 }
 
 json_object* jsonrpc_get_resp_obj(jsonrpc_context_t* ctx, char* key)
 {
     json_object* obj = NULL;
-    if (!json_object_object_get_ex(ctx->resp.response_result, key, &obj)) {
+    if (!json_object_object_get_ex(resp_result_obj(ctx), key, &obj)) {
         DPRINTF("%s field not found in response!\n",key);
         return NULL;
     }
@@ -260,9 +620,98 @@ json_object* jsonrpc_get_resp_obj(jsonrpc_context_t* ctx, char* key)
     return obj;
 }
 
-json_object* get_jrpc_result(json_object* jobj)
+// Store one field's value
+static void store_field(const jsonrpc_field_t* field, json_span_t value, void* out)
+{
+    uint8_t* dst    = (uint8_t*)out + field->offset;
+    int64_t  number = 0;
+
+    switch (field->type) {
+        case JSONRPC_FIELD_INT:
+            json_span_int64(value, &number);
+            switch (field->size) {
+                case sizeof(uint8_t):  *(uint8_t*)dst  = (uint8_t)number;  break;
+                case sizeof(uint16_t): *(uint16_t*)dst = (uint16_t)number; break;
+                case sizeof(uint32_t): *(uint32_t*)dst = (uint32_t)number; break;
+                case sizeof(uint64_t): *(uint64_t*)dst = (uint64_t)number; break;
+            }
+            break;
+
+        case JSONRPC_FIELD_NSEC:
+            json_span_int64(value, &number);
+            ((uint64_t*)dst)[0] = (uint64_t)number / 1000000000ULL;
+            ((uint64_t*)dst)[1] = (uint64_t)number % 1000000000ULL;
+            break;
+
+        case JSONRPC_FIELD_STR:
+            if (json_span_str(value, (char*)dst, field->size) < 0) {
+                dst[0] = '\0';
+            }
+            break;
+    }
+}
+
+// Decode the members of the object scan is in that are in fields into out
+static int decode_fields(json_scan_t* scan, const jsonrpc_field_t* fields, int num_fields, void* out)
+{
+    json_span_t key;
+    json_span_t value;
+    int         next  = 0;
+    int         found = 0;
+
+    while (json_scan_object_next(scan, &key, &value)) {
+        // Members usually come in the order the table lists them, so start
+        // looking just after the last one found
+        int i;
+        for (i = 0; i < num_fields; i++) {
+            int f = (next + i) % num_fields;
+            if (json_span_key_is(key, *fields[f].key)) {
+                store_field(&fields[f], value, out);
+                next = f + 1;
+                found++;
+                break;
+            }
+        }
+    }
+
+    return found;
+}
+
+int jsonrpc_get_resp_fields(jsonrpc_context_t*     ctx,
+                            const jsonrpc_field_t* fields,
+                            int                    num_fields,
+                            void*                  out)
 {
-    return find_something(jobj, RESULT_KEY);
+    json_scan_t scan;
+
+    if (!json_scan_object_begin(&scan, ctx->resp.result)) {
+        return 0;
+    }
+    return decode_fields(&scan, fields, num_fields, out);
+}
+
+int jsonrpc_get_resp_array_fields(jsonrpc_context_t*     ctx,
+                                  char*                  array_key,
+                                  const jsonrpc_field_t* fields,
+                                  int                    num_fields,
+                                  void*                  out,
+                                  size_t                 out_stride,
+                                  int                    max_entries)
+{
+    json_span_t array;
+    json_scan_t scan;
+    int         num_entries = 0;
+
+    if (!resp_find(ctx->resp.result, array_key, &array) || !json_scan_array_begin(&scan, array)) {
+        return 0;
+    }
+
+    while ((num_entries < max_entries) && json_scan_array_next_object(&scan)) {
+        decode_fields(&scan, fields, num_fields, (uint8_t*)out + num_entries * out_stride);
+        num_entries++;
+    }
+
+    return num_entries;
 }
 
 json_object* get_jrpc_resp_array_elem(jsonrpc_context_t* ctx, char* array_key, int index)
@@ -411,10 +860,17 @@ int jsonrpc_get_resp_array_length(jsonrpc_context_t *ctx,
         return 0;
     }
 
-    json_object* dobj = jsonrpc_get_resp_obj(ctx, array_key);
+    json_span_t array;
+    json_span_t entry;
+    json_scan_t scan;
+    int         num_entries = 0;
 
-    int num_entries = json_object_array_length(dobj);
+    if (!resp_find(ctx->resp.result, array_key, &array) || !json_scan_array_begin(&scan, array)) {
+        return 0;
+    }
+    while (json_scan_array_next(&scan, &entry)) {
+        num_entries++;
+    }
 
     return num_entries;
-
-}
\ No newline at end of file
+}
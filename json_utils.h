@@ -5,6 +5,8 @@
 #define __PFS_JSON_UTILS_H__
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 // Struct magic so that we don't have to expose the internals of
 // our context structure into proxyfs_api.c
@@ -27,11 +29,13 @@ void jsonrpc_set_req_param_buf(jsonrpc_context_t* ctx, char* key, uint8_t* buf,
 // Response-related
 int         jsonrpc_get_resp_status(jsonrpc_context_t* ctx);
 const char* jsonrpc_get_resp_str(jsonrpc_context_t* ctx, char* key);
+char*       jsonrpc_get_resp_strdup(jsonrpc_context_t* ctx, char* key);
 int         jsonrpc_get_resp_int(jsonrpc_context_t* ctx, char* key);
 uint64_t    jsonrpc_get_resp_uint64(jsonrpc_context_t* ctx, char* key);
 int64_t     jsonrpc_get_resp_int64(jsonrpc_context_t* ctx, char* key);
 bool        jsonrpc_get_resp_bool(jsonrpc_context_t* ctx, char* key);
-void        jsonrpc_get_resp_buf(jsonrpc_context_t* ctx, char* key, uint8_t* buf, size_t buf_size, size_t* bytes_written);
+// Decode base64 into buf; 0, or an errno if it's missing, malformed or doesn't fit
+int         jsonrpc_get_resp_buf(jsonrpc_context_t* ctx, char* key, uint8_t* buf, size_t buf_size, size_t* bytes_written);
 uint64_t    jsonrpc_get_resp_array_uint64(jsonrpc_context_t* ctx, char* array_key, int index, char* key);
 int64_t     jsonrpc_get_resp_array_int64(jsonrpc_context_t* ctx, char* array_key, int index, char* key);
 int         jsonrpc_get_resp_array_int(jsonrpc_context_t* ctx, char* array_key, int index, char* key);
@@ -39,6 +43,35 @@ const char* jsonrpc_get_resp_array_str(jsonrpc_context_t* ctx, char* array_key,
 const char* jsonrpc_get_resp_array_str_value(jsonrpc_context_t* ctx, char* array_key, int index);
 int         jsonrpc_get_resp_array_length(jsonrpc_context_t *ctx, char *array_key);
 
+// Decoding known response shapes straight into a struct, in one pass over
+// the response text. A table of fields says which key goes where; key points
+// at where the key's name is kept, so that tables can be static. Members not
+// in the table are skipped, and fields missing from the response are left
+// alone.
+typedef enum {
+    JSONRPC_FIELD_INT,       // integer of size bytes
+    JSONRPC_FIELD_NSEC,      // nanoseconds, into two uint64_t: seconds, then nanoseconds
+    JSONRPC_FIELD_STR,       // char[size], truncated and null-terminated
+} jsonrpc_field_type_t;
+
+typedef struct {
+    char* const*         key;
+    jsonrpc_field_type_t type;
+    size_t               offset;
+    size_t               size;
+} jsonrpc_field_t;
+
+#define JSONRPC_FIELD(key, type, struct_type, member) \
+    { (key), (type), offsetof(struct_type, member), sizeof(((struct_type*)0)->member) }
+
+// Returns how many fields were found
+int         jsonrpc_get_resp_fields(jsonrpc_context_t* ctx, const jsonrpc_field_t* fields, int num_fields, void* out);
+
+// Decode up to max_entries objects of the array array_key into out, out_stride
+// bytes apart. Returns how many were decoded.
+int         jsonrpc_get_resp_array_fields(jsonrpc_context_t* ctx, char* array_key, const jsonrpc_field_t* fields,
+                                          int num_fields, void* out, size_t out_stride, int max_entries);
+
 // Callbacks
 typedef void (*jsonrpc_done_callback_t)(void* in_cookie);
 typedef void (*jsonrpc_internal_callback_t)(jsonrpc_context_t* ctx);
@@ -4,23 +4,44 @@
 #ifndef __PFS_JSON_UTILS_INTERNAL_H__
 #define __PFS_JSON_UTILS_INTERNAL_H__
 
+#include <stdbool.h>
 #include <json-c/json.h>
 #include <time_utils.h>
+#include <json_scan.h>
+#include <completion.h>
 
 
-// json object for request context
+// A thread's reusable request buffer, see json_utils.c
+struct jsonrpc_req_buf_s;
+typedef struct jsonrpc_req_buf_s jsonrpc_req_buf_t;
+
+// Request ids are never this; a response without an id gets it
+#define JSONRPC_NO_ID  UINT64_MAX
+
+// Request context; the request is rendered as JSON text as it is built
 typedef struct {
-    int               request_id;
-    json_object*      request;
-    json_object*      request_params;
+    uint64_t           request_id;
+    char*              buf;       // request text so far, not terminated
+    size_t             len;
+    size_t             size;
+    bool               failed;    // ran out of memory while rendering
+    jsonrpc_req_buf_t* owner;     // thread buf belongs to, NULL if it is ours;
+                                  // outlives the thread until released
+
+    // A buffer of our own from an earlier request, kept for when the
+    // thread's buffer is busy; see jsonrpc_release_req
+    char*              spare;
+    size_t             spare_size;
 } jsonrpc_request_t;
 
-// json object for response context
+// Response context. The response text in readBuf is scanned in place; the
+// result is only parsed into json objects if a getter needs them.
 typedef struct jsonrpc_response {
-    int               response_id;
-    json_object*      response;
+    uint64_t          response_id;
+    json_object*      response;         // parsed result, NULL until needed
     json_object*      response_result;
     int               rsp_err;
+    json_span_t       result;           // the result in readBuf
 
     // stuff for deferred response handling
     char*             readBuf;
@@ -47,13 +68,6 @@ typedef struct {
 
 } jsonrpc_user_callback_info_t;
 
-// user cv context
-typedef struct {
-    pthread_mutex_t mutex;
-    pthread_cond_t  got_resp;
-    bool            have_response;
-} jsonrpc_cv_info_t;
-
 // json object for request and response in context, use context to request fields
 struct jsonrpc_internal_t {
     jsonrpc_handle_t* rpc_handle;
@@ -61,20 +75,36 @@ struct jsonrpc_internal_t {
     jsonrpc_request_t  req;
     jsonrpc_response_t resp;
 
-    // For blocking calls
-    jsonrpc_cv_info_t  cv_info;
+    // For blocking calls, signalled when the response is in
+    completion_t       response_done;
+
+    // Socket pool generation the request was sent in, 0 until it is; see
+    // jsonrpc_fail_requests
+    uint64_t           sock_generation;
 
     // For non-blocking calls
     jsonrpc_user_callback_info_t user_callback;
     jsonrpc_internal_callback_t  internal_callback;
 
-    struct jsonrpc_internal_t* next;
-
     // For timing profiling
     profiler_t* profiler;
+
+    // Next free context in the pool, see proxyfs_req_resp.c
+    struct jsonrpc_internal_t* pool_next;
 };
 
-// Get result object
-json_object* get_jrpc_result(json_object* jobj);
+// Scan the response in resp->readBuf for its id, error and result
+void jsonrpc_parse_response(jsonrpc_response_t* resp);
+
+// Request rendering, in json_utils.c
+//
+// jsonrpc_set_req_method starts the request (req->request_id must be set);
+// jsonrpc_finish_req returns the complete, null-terminated text, or NULL if
+// rendering ran out of memory; jsonrpc_release_req gives the buffer back.
+// jsonrpc_free_req frees the spare buffer a released request may keep.
+void        jsonrpc_set_req_method(jsonrpc_request_t* req, const char* method);
+const char* jsonrpc_finish_req(jsonrpc_request_t* req, size_t* out_len);
+void        jsonrpc_release_req(jsonrpc_request_t* req);
+void        jsonrpc_free_req(jsonrpc_request_t* req);
 
 #endif
@@ -0,0 +1,655 @@
+// Copyright (c) 2015-2021, NVIDIA CORPORATION.
+// SPDX-License-Identifier: Apache-2.0
+
+// Local stand-in for the ProxyFS fast port and RPC server; see mock_server.h.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <errno.h>
+#include <string.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <json-c/json.h>
+
+#include "fastpath.h"
+#include "mock_server.h"
+
+// Untagged request and response headers, as the client sends and receives them
+typedef io_req_hdr_t  mock_req_hdr_t;
+typedef io_resp_hdr_t mock_resp_hdr_t;
+
+#define MOCK_MAX_CLIENTS  1024
+#define MOCK_MAX_REORDER  256
+
+// Returned by RpcMountByVolumeName: MOUNT_ID_SIZE zero bytes, base64 encoded
+#define MOCK_MOUNT_ID        "AAAAAAAAAAAAAAAAAAAAAA=="
+#define MOCK_ROOT_DIR_INODE  1
+#define MOCK_DIR_FIRST_INODE 1000
+
+typedef struct {
+    uint64_t   op_type;
+    uint64_t   tag;
+    uint64_t   inode_number;
+    uint64_t   offset;
+    uint64_t   error;
+    uint64_t   io_size;
+} mock_pending_t;
+
+typedef struct {
+    int              listen_fd;
+    int              port;
+    int              reorder;
+    pthread_t        listen_thread;
+
+    pthread_mutex_t  lock;          // protects files and the client list
+    uint8_t          *files[MOCK_NUM_INODES];
+    int              client_fds[MOCK_MAX_CLIENTS];
+    pthread_t        client_threads[MOCK_MAX_CLIENTS];
+    int              num_clients;
+    int              reordered;
+    uint64_t         dir_inode_number;  // the directory served by the readdir RPCs
+    int              dir_num_entries;
+    uint64_t         rpcs;
+    uint64_t         ios;
+    uint64_t         tag_xor;           // applied to the tags of responses
+    uint64_t         read_extra;        // added to the size of untagged read responses
+} mock_server_t;
+
+static mock_server_t *mock = NULL;
+
+static int mock_read_full(int fd, void *buf, size_t length)
+{
+    size_t total = 0;
+    while (total < length) {
+        ssize_t ret = read(fd, (char *)buf + total, length - total);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (ret == 0) {
+            return -1;
+        }
+        total += ret;
+    }
+    return 0;
+}
+
+static int mock_write_full(int fd, const void *buf, size_t length)
+{
+    size_t total = 0;
+    while (total < length) {
+        ssize_t ret = send(fd, (const char *)buf + total, length - total, MSG_NOSIGNAL);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        total += ret;
+    }
+    return 0;
+}
+
+static uint8_t *mock_file(uint64_t inode_number)
+{
+    return mock->files[inode_number % MOCK_NUM_INODES];
+}
+
+// Apply a write (reading its data off the socket) or size up a read.
+// Returns -1 if the connection failed.
+static int mock_do_io(int fd, uint64_t op_type, uint64_t inode_number, uint64_t offset, uint64_t length,
+                      uint64_t *error, uint64_t *io_size)
+{
+    bool     is_write = ((op_type == FASTPATH_OP_WRITE) || (op_type == FASTPATH_OP_TAGGED_WRITE));
+    uint64_t avail    = (offset < MOCK_FILE_SIZE) ? (MOCK_FILE_SIZE - offset) : 0;
+
+    *error   = 0;
+    *io_size = (length < avail) ? length : avail;
+
+    pthread_mutex_lock(&mock->lock);
+    mock->ios++;
+    pthread_mutex_unlock(&mock->lock);
+
+    if (!is_write) {
+        return 0;
+    }
+
+    uint8_t *data = malloc(length > 0 ? length : 1);
+    if ((data == NULL) || (mock_read_full(fd, data, length) != 0)) {
+        free(data);
+        return -1;
+    }
+
+    if (*io_size < length) {
+        *error   = EFBIG;
+        *io_size = 0;
+    } else {
+        pthread_mutex_lock(&mock->lock);
+        memcpy(mock_file(inode_number) + offset, data, length);
+        pthread_mutex_unlock(&mock->lock);
+    }
+    free(data);
+    return 0;
+}
+
+// Send a response header followed by read data, if any
+static int mock_respond(int fd, void *hdr, size_t hdr_len, uint64_t op_type, uint64_t inode_number, uint64_t offset,
+                        uint64_t io_size)
+{
+    bool is_read = ((op_type == FASTPATH_OP_READ) || (op_type == FASTPATH_OP_TAGGED_READ));
+
+    if (!is_read || (io_size == 0)) {
+        return mock_write_full(fd, hdr, hdr_len);
+    }
+
+    uint8_t *buf = malloc(hdr_len + io_size);
+    if (buf == NULL) {
+        return -1;
+    }
+    memcpy(buf, hdr, hdr_len);
+    pthread_mutex_lock(&mock->lock);
+    memcpy(buf + hdr_len, mock_file(inode_number) + offset, io_size);
+    pthread_mutex_unlock(&mock->lock);
+
+    int ret = mock_write_full(fd, buf, hdr_len + io_size);
+    free(buf);
+    return ret;
+}
+
+// Send held-back tagged responses, newest first
+static int mock_flush(int fd, mock_pending_t *pending, int *num_pending)
+{
+    int i;
+
+    pthread_mutex_lock(&mock->lock);
+    uint64_t tag_xor = mock->tag_xor;
+    pthread_mutex_unlock(&mock->lock);
+
+    for (i = *num_pending - 1; i >= 0; i--) {
+        io_tagged_resp_hdr_t resp_hdr = {
+                .tag     = pending[i].tag ^ tag_xor,
+                .error   = pending[i].error,
+                .io_size = pending[i].io_size,
+        };
+        if (mock_respond(fd, &resp_hdr, sizeof(resp_hdr), pending[i].op_type, pending[i].inode_number,
+                         pending[i].offset, pending[i].io_size) != 0) {
+            return -1;
+        }
+    }
+
+    if (*num_pending > 1) {
+        pthread_mutex_lock(&mock->lock);
+        mock->reordered += *num_pending - 1;
+        pthread_mutex_unlock(&mock->lock);
+    }
+    *num_pending = 0;
+    return 0;
+}
+
+// JSON-RPC
+//
+// Requests arrive back to back with no separator, the way the client's
+// socket pool sends them; each response is a single line.
+
+static void mock_rpc_dirent(json_object *dirents, json_object *statents, int i)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "entry%07d", i);
+
+    json_object *ent = json_object_new_object();
+    json_object_object_add(ent, "InodeNumber",     json_object_new_int64(MOCK_DIR_FIRST_INODE + i));
+    json_object_object_add(ent, "Basename",        json_object_new_string(name));
+    json_object_object_add(ent, "FileType",        json_object_new_int(DT_REG));
+    json_object_object_add(ent, "NextDirLocation", json_object_new_int64(i));
+    json_object_array_add(dirents, ent);
+
+    if (statents != NULL) {
+        json_object *st = json_object_new_object();
+        json_object_object_add(st, "FileMode",        json_object_new_int(S_IFREG | 0644));
+        json_object_object_add(st, "StatInodeNumber", json_object_new_int64(MOCK_DIR_FIRST_INODE + i));
+        json_object_object_add(st, "NumLinks",        json_object_new_int64(1));
+        json_object_object_add(st, "UserID",          json_object_new_int(0));
+        json_object_object_add(st, "GroupID",         json_object_new_int(0));
+        json_object_object_add(st, "Size",            json_object_new_int64(i));
+        json_object_object_add(st, "CTimeNs",         json_object_new_int64(0));
+        json_object_object_add(st, "CRTimeNs",        json_object_new_int64(0));
+        json_object_object_add(st, "MTimeNs",         json_object_new_int64(0));
+        json_object_object_add(st, "ATimeNs",         json_object_new_int64(0));
+        json_object_array_add(statents, st);
+    }
+}
+
+static int64_t mock_rpc_param(json_object *params, const char *key, int64_t dflt)
+{
+    json_object *obj;
+    return json_object_object_get_ex(params, key, &obj) ? json_object_get_int64(obj) : dflt;
+}
+
+// Fill in result for one request; returns 0 or the errno to send back
+static int mock_rpc_call(const char *method, json_object *params, json_object *result)
+{
+    if (strcmp(method, "Server.RpcMountByVolumeName") == 0) {
+        json_object_object_add(result, "MountID",            json_object_new_string(MOCK_MOUNT_ID));
+        json_object_object_add(result, "RootDirInodeNumber", json_object_new_int64(MOCK_ROOT_DIR_INODE));
+        return 0;
+    }
+
+    if ((strcmp(method, "Server.RpcReaddirByLoc") == 0) || (strcmp(method, "Server.RpcReaddirPlusByLoc") == 0)) {
+        bool     plus        = (strstr(method, "Plus") != NULL);
+        uint64_t inode       = mock_rpc_param(params, "InodeNumber", 0);
+        int64_t  max_entries = mock_rpc_param(params, "MaxEntries", 1);
+        int64_t  max_bufsize = mock_rpc_param(params, "MaxBufsize", 0);
+        int64_t  prev        = mock_rpc_param(params, "PrevDirEntLocation", -1);
+
+        pthread_mutex_lock(&mock->lock);
+        uint64_t dir_inode   = mock->dir_inode_number;
+        int      num_entries = mock->dir_num_entries;
+        pthread_mutex_unlock(&mock->lock);
+
+        if (inode != dir_inode) {
+            return ENOTDIR;
+        }
+
+        json_object *dirents  = json_object_new_array();
+        json_object *statents = plus ? json_object_new_array() : NULL;
+        int64_t      used     = 0;
+        int64_t      i;
+        for (i = prev + 1; (i < num_entries) && (i - (prev + 1) < max_entries); i++) {
+            // Roughly what an entry costs the real server against MaxBufsize
+            used += plus ? 192 : 64;
+            if ((max_bufsize > 0) && (used > max_bufsize) && (i > prev + 1)) {
+                break;
+            }
+            mock_rpc_dirent(dirents, statents, i);
+        }
+        json_object_object_add(result, "DirEnts", dirents);
+        if (plus) {
+            json_object_object_add(result, "StatEnts", statents);
+        }
+        return 0;
+    }
+
+    return ENOSYS;
+}
+
+// Answer one request; returns -1 if the connection failed
+static int mock_rpc_request(int fd, const char *text)
+{
+    json_object *request = json_tokener_parse(text);
+    json_object *obj;
+    const char  *method  = "";
+    json_object *params  = NULL;
+    int64_t      id      = -1;
+
+    if (json_object_object_get_ex(request, "id", &obj)) {
+        id = json_object_get_int64(obj);
+    }
+    if (json_object_object_get_ex(request, "method", &obj)) {
+        method = json_object_get_string(obj);
+    }
+    if (json_object_object_get_ex(request, "params", &obj)) {
+        params = json_object_array_get_idx(obj, 0);
+    }
+
+    json_object *result = json_object_new_object();
+    int          err    = mock_rpc_call(method, params, result);
+
+    json_object *response = json_object_new_object();
+    json_object_object_add(response, "id", json_object_new_int64(id));
+    if (err == 0) {
+        json_object_object_add(response, "result", result);
+        json_object_object_add(response, "error",  NULL);
+    } else {
+        char error[64];
+        snprintf(error, sizeof(error), "errno: %d", err);
+        json_object_put(result);
+        json_object_object_add(response, "result", NULL);
+        json_object_object_add(response, "error",  json_object_new_string(error));
+    }
+
+    pthread_mutex_lock(&mock->lock);
+    mock->rpcs++;
+    pthread_mutex_unlock(&mock->lock);
+
+    // One write for the line and its newline; a separate write for the
+    // newline would sit behind Nagle until the client's delayed ACK
+    const char *reply = json_object_to_json_string_ext(response, JSON_C_TO_STRING_PLAIN);
+    size_t      len   = strlen(reply);
+    char       *line  = (char *)malloc(len + 1);
+    int         ret   = -1;
+    if (line != NULL) {
+        memcpy(line, reply, len);
+        line[len] = '\n';
+        ret = mock_write_full(fd, line, len + 1);
+        free(line);
+    }
+    json_object_put(response);
+    json_object_put(request);
+    return ret;
+}
+
+static void mock_rpc_client(int fd)
+{
+    size_t size  = 64 * 1024;
+    size_t len   = 0;     // bytes in buf
+    size_t scan  = 0;     // bytes of buf already scanned
+    int    depth = 0;
+    bool   in_string = false;
+    bool   escaped   = false;
+    char   *buf  = malloc(size);
+
+    while (buf != NULL) {
+        if (len == size) {
+            size *= 2;
+            buf = realloc(buf, size);
+            if (buf == NULL) {
+                break;
+            }
+        }
+        ssize_t ret = read(fd, buf + len, size - len);
+        if ((ret < 0) && (errno == EINTR)) {
+            continue;
+        }
+        if (ret <= 0) {
+            break;
+        }
+        len += ret;
+
+        // Answer every complete top-level object received so far
+        size_t start = 0;
+        for (; scan < len; scan++) {
+            char c = buf[scan];
+            if (in_string) {
+                if (escaped) {
+                    escaped = false;
+                } else if (c == '\\') {
+                    escaped = true;
+                } else if (c == '"') {
+                    in_string = false;
+                }
+            } else if (c == '"') {
+                in_string = true;
+            } else if (c == '{') {
+                depth++;
+            } else if ((c == '}') && (--depth == 0)) {
+                char *text = strndup(buf + start, scan + 1 - start);
+                if ((text == NULL) || (mock_rpc_request(fd, text) != 0)) {
+                    free(text);
+                    goto done;
+                }
+                free(text);
+                start = scan + 1;
+            }
+        }
+        memmove(buf, buf + start, len - start);
+        len  -= start;
+        scan -= start;
+    }
+
+done:
+    free(buf);
+}
+
+static void *mock_client(void *arg)
+{
+    int            fd          = (int)(intptr_t)arg;
+    int            reorder     = mock->reorder;
+    int            num_pending = 0;
+    mock_pending_t pending[MOCK_MAX_REORDER];
+
+    // JSON-RPC clients share the port; their requests start with '{'
+    char first;
+    if ((recv(fd, &first, 1, MSG_PEEK) == 1) && (first == '{')) {
+        mock_rpc_client(fd);
+        shutdown(fd, SHUT_RDWR);
+        return NULL;
+    }
+
+    while (1) {
+        // Nothing more queued up by the client; answer what we're holding
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        if ((num_pending > 0) && (poll(&pfd, 1, 0) == 0)) {
+            if (mock_flush(fd, pending, &num_pending) != 0) {
+                break;
+            }
+        }
+
+        uint64_t op_type;
+        if (mock_read_full(fd, &op_type, sizeof(op_type)) != 0) {
+            break;
+        }
+
+        if ((op_type == FASTPATH_OP_TAGGED_READ) || (op_type == FASTPATH_OP_TAGGED_WRITE)) {
+            io_tagged_req_hdr_t req_hdr;
+            req_hdr.op_type = op_type;
+            if (mock_read_full(fd, (char *)&req_hdr + sizeof(op_type), sizeof(req_hdr) - sizeof(op_type)) != 0) {
+                break;
+            }
+
+            mock_pending_t *p = &pending[num_pending++];
+            p->op_type      = op_type;
+            p->tag          = req_hdr.tag;
+            p->inode_number = req_hdr.inode_number;
+            p->offset       = req_hdr.offset;
+            if (mock_do_io(fd, op_type, req_hdr.inode_number, req_hdr.offset, req_hdr.length,
+                           &p->error, &p->io_size) != 0) {
+                break;
+            }
+
+            if (num_pending >= reorder) {
+                if (mock_flush(fd, pending, &num_pending) != 0) {
+                    break;
+                }
+            }
+
+        } else if ((op_type == FASTPATH_OP_READ) || (op_type == FASTPATH_OP_WRITE)) {
+            mock_req_hdr_t req_hdr;
+            req_hdr.op_type = op_type;
+            if (mock_read_full(fd, (char *)&req_hdr + sizeof(op_type), sizeof(req_hdr) - sizeof(op_type)) != 0) {
+                break;
+            }
+
+            mock_resp_hdr_t resp_hdr;
+            if (mock_do_io(fd, op_type, req_hdr.inode_number, req_hdr.offset, req_hdr.length,
+                           &resp_hdr.error, &resp_hdr.io_size) != 0) {
+                break;
+            }
+            if ((op_type == FASTPATH_OP_READ) && (resp_hdr.io_size > 0)) {
+                pthread_mutex_lock(&mock->lock);
+                uint64_t extra = mock->read_extra;
+                pthread_mutex_unlock(&mock->lock);
+                if (req_hdr.offset + resp_hdr.io_size + extra <= MOCK_FILE_SIZE) {
+                    resp_hdr.io_size += extra;
+                }
+            }
+            if (mock_respond(fd, &resp_hdr, sizeof(resp_hdr), op_type, req_hdr.inode_number, req_hdr.offset,
+                             resp_hdr.io_size) != 0) {
+                break;
+            }
+
+        } else {
+            fprintf(stderr, "mock server: unknown op_type %lu, dropping connection\n", op_type);
+            break;
+        }
+    }
+
+    shutdown(fd, SHUT_RDWR);
+    return NULL;
+}
+
+static void *mock_listener(void *arg)
+{
+    while (1) {
+        int fd = accept(mock->listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;  // listener was shut down
+        }
+
+        pthread_mutex_lock(&mock->lock);
+        if (mock->num_clients == MOCK_MAX_CLIENTS) {
+            pthread_mutex_unlock(&mock->lock);
+            close(fd);
+            continue;
+        }
+        int i = mock->num_clients++;
+        mock->client_fds[i] = fd;
+        pthread_create(&mock->client_threads[i], NULL, &mock_client, (void *)(intptr_t)fd);
+        pthread_mutex_unlock(&mock->lock);
+    }
+    return NULL;
+}
+
+int mock_fastpath_server_start(int reorder)
+{
+    if (mock != NULL) {
+        return mock->port;
+    }
+
+    mock = (mock_server_t *)calloc(1, sizeof(mock_server_t));
+    if (mock == NULL) {
+        return -1;
+    }
+    mock->reorder = (reorder < 1) ? 1 : ((reorder > MOCK_MAX_REORDER) ? MOCK_MAX_REORDER : reorder);
+    pthread_mutex_init(&mock->lock, NULL);
+
+    int i;
+    for (i = 0; i < MOCK_NUM_INODES; i++) {
+        mock->files[i] = (uint8_t *)calloc(1, MOCK_FILE_SIZE);
+        if (mock->files[i] == NULL) {
+            goto errout;
+        }
+    }
+
+    struct sockaddr_in addr;
+    socklen_t          addr_len = sizeof(addr);
+    bzero(&addr, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port        = 0;
+
+    mock->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if ((mock->listen_fd < 0) ||
+        (bind(mock->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) ||
+        (listen(mock->listen_fd, MOCK_MAX_CLIENTS) != 0) ||
+        (getsockname(mock->listen_fd, (struct sockaddr *)&addr, &addr_len) != 0)) {
+        goto errout;
+    }
+    mock->port = ntohs(addr.sin_port);
+
+    if (pthread_create(&mock->listen_thread, NULL, &mock_listener, NULL) != 0) {
+        goto errout;
+    }
+
+    return mock->port;
+
+errout:
+    if (mock->listen_fd > 0) {
+        close(mock->listen_fd);
+    }
+    for (i = 0; i < MOCK_NUM_INODES; i++) {
+        free(mock->files[i]);
+    }
+    free(mock);
+    mock = NULL;
+    return -1;
+}
+
+void mock_fastpath_server_stop()
+{
+    if (mock == NULL) {
+        return;
+    }
+
+    shutdown(mock->listen_fd, SHUT_RDWR);
+    pthread_join(mock->listen_thread, NULL);
+    close(mock->listen_fd);
+
+    int i;
+    for (i = 0; i < mock->num_clients; i++) {
+        shutdown(mock->client_fds[i], SHUT_RDWR);
+        pthread_join(mock->client_threads[i], NULL);
+        close(mock->client_fds[i]);
+    }
+
+    for (i = 0; i < MOCK_NUM_INODES; i++) {
+        free(mock->files[i]);
+    }
+    pthread_mutex_destroy(&mock->lock);
+    free(mock);
+    mock = NULL;
+}
+
+void mock_fastpath_server_set_tag_xor(uint64_t tag_xor)
+{
+    if (mock == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&mock->lock);
+    mock->tag_xor = tag_xor;
+    pthread_mutex_unlock(&mock->lock);
+}
+
+void mock_fastpath_server_set_read_extra(uint64_t extra)
+{
+    if (mock == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&mock->lock);
+    mock->read_extra = extra;
+    pthread_mutex_unlock(&mock->lock);
+}
+
+int mock_fastpath_server_reordered()
+{
+    return (mock == NULL) ? 0 : mock->reordered;
+}
+
+void mock_server_set_dir(uint64_t inode_number, int num_entries)
+{
+    if (mock == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&mock->lock);
+    mock->dir_inode_number = inode_number;
+    mock->dir_num_entries  = num_entries;
+    pthread_mutex_unlock(&mock->lock);
+}
+
+uint64_t mock_server_rpcs()
+{
+    if (mock == NULL) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&mock->lock);
+    uint64_t rpcs = mock->rpcs;
+    pthread_mutex_unlock(&mock->lock);
+    return rpcs;
+}
+
+uint64_t mock_fastpath_server_ios()
+{
+    if (mock == NULL) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&mock->lock);
+    uint64_t ios = mock->ios;
+    pthread_mutex_unlock(&mock->lock);
+    return ios;
+}
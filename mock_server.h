@@ -0,0 +1,57 @@
+// Copyright (c) 2015-2021, NVIDIA CORPORATION.
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef __PFS_MOCK_SERVER_H__
+#define __PFS_MOCK_SERVER_H__
+
+#include <stdint.h>
+
+/*******************************************************************
+ Local stand-in for the ProxyFS fast port, for client-side tests that
+ should not depend on a real server. Only linked into the test binary.
+
+ It keeps a small in-memory file per inode number (modulo
+ MOCK_NUM_INODES) and serves both the untagged and the tagged read/write
+ protocols. Tagged responses are held back in batches of up to
+ <reorder> and sent newest first, so clients see out-of-order completion.
+
+ Connections that start with a JSON object are served as the RPC port
+ instead, so the same port can be passed as both ports to
+ rpc_config_set(). Only mounting and the by-location readdir RPCs are
+ implemented, against one generated directory (see mock_server_set_dir);
+ anything else fails with ENOSYS.
+
+ NOTE: The library treats a lost RPC connection as fatal, so don't stop
+       the server once a mount has been made through it.
+ *******************************************************************/
+
+#define MOCK_NUM_INODES  16
+#define MOCK_FILE_SIZE   (1024 * 1024)
+
+// Start listening on an ephemeral 127.0.0.1 port. Returns the port, or -1.
+int  mock_fastpath_server_start(int reorder);
+
+// Stop listening and disconnect any clients.
+void mock_fastpath_server_stop();
+
+// Number of tagged responses sent in a different order than their requests arrived
+int  mock_fastpath_server_reordered();
+
+// Flip these bits in the tag of every tagged response from now on, to send
+// tags the client never handed out
+void mock_fastpath_server_set_tag_xor(uint64_t tag_xor);
+
+// Send extra more bytes than were asked for with every untagged read
+// response from now on, as a server that got the length wrong would
+void mock_fastpath_server_set_read_extra(uint64_t extra);
+
+// Serve a directory with num_entries regular files as inode_number
+void mock_server_set_dir(uint64_t inode_number, int num_entries);
+
+// Number of JSON-RPC requests answered
+uint64_t mock_server_rpcs();
+
+// Number of fast-port reads and writes served, tagged or not
+uint64_t mock_fastpath_server_ios();
+
+#endif // __PFS_MOCK_SERVER_H__
@@ -0,0 +1,187 @@
+// Copyright (c) 2015-2021, NVIDIA CORPORATION.
+// SPDX-License-Identifier: Apache-2.0
+
+// Bounded lock-free MPMC queue; see mpmc_queue.h.
+
+#include <stdlib.h>
+#include <errno.h>
+#include <sched.h>
+#include "mpmc_queue.h"
+
+#define MPMC_POP_YIELDS  1
+
+int mpmc_queue_init(mpmc_queue_t* queue, size_t capacity)
+{
+    size_t size = 2;
+    size_t i;
+
+    while (size < capacity) {
+        size *= 2;
+    }
+
+    queue->cells = (mpmc_cell_t*)malloc(size * sizeof(mpmc_cell_t));
+    if (queue->cells == NULL) {
+        return ENOMEM;
+    }
+    for (i = 0; i < size; i++) {
+        queue->cells[i].seq  = i;
+        queue->cells[i].item = NULL;
+    }
+    queue->mask        = size - 1;
+    queue->enqueue_pos = 0;
+    queue->dequeue_pos = 0;
+    queue->ec          = &queue->waiters;
+    queue->closed      = false;
+    eventcount_init(&queue->waiters);
+    return 0;
+}
+
+void mpmc_queue_destroy(mpmc_queue_t* queue)
+{
+    free(queue->cells);
+    queue->cells = NULL;
+}
+
+void mpmc_queue_share_eventcount(mpmc_queue_t* queue, eventcount_t* ec)
+{
+    queue->ec = ec;
+}
+
+bool mpmc_queue_try_push(mpmc_queue_t* queue, void* item)
+{
+    mpmc_cell_t* cell;
+    uint64_t     pos = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED);
+
+    for (;;) {
+        cell = &queue->cells[pos & queue->mask];
+        uint64_t seq  = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        int64_t  diff = (int64_t)seq - (int64_t)pos;
+
+        if (diff == 0) {
+            // The slot is free on this lap; claim it
+            if (__atomic_compare_exchange_n(&queue->enqueue_pos, &pos, pos + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // Still holding an item from the last lap: full
+            return false;
+        } else {
+            pos = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    cell->item = item;
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+
+    eventcount_notify(queue->ec);
+    return true;
+}
+
+void* mpmc_queue_try_pop(mpmc_queue_t* queue)
+{
+    mpmc_cell_t* cell;
+    uint64_t     pos = __atomic_load_n(&queue->dequeue_pos, __ATOMIC_RELAXED);
+
+    for (;;) {
+        cell = &queue->cells[pos & queue->mask];
+        uint64_t seq  = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        int64_t  diff = (int64_t)seq - (int64_t)(pos + 1);
+
+        if (diff == 0) {
+            // Filled on this lap; claim it
+            if (__atomic_compare_exchange_n(&queue->dequeue_pos, &pos, pos + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // Not filled yet: empty
+            return NULL;
+        } else {
+            pos = __atomic_load_n(&queue->dequeue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    void* item = cell->item;
+    __atomic_store_n(&cell->seq, pos + queue->mask + 1, __ATOMIC_RELEASE);
+    return item;
+}
+
+void mpmc_queue_push(mpmc_queue_t* queue, void* item)
+{
+    while (!mpmc_queue_try_push(queue, item)) {
+        sched_yield();
+    }
+}
+
+static void* queue_pop(mpmc_queue_t* queue, const struct timespec* deadline)
+{
+    void* item;
+    int   yields = 0;
+
+    for (;;) {
+        item = mpmc_queue_try_pop(queue);
+        if (item != NULL) {
+            return item;
+        }
+
+        // Let producers run once before sleeping: a consumer woken for one
+        // item would otherwise often take it, find the queue empty again and
+        // go back to sleep, costing two context switches per item
+        if (yields < MPMC_POP_YIELDS) {
+            yields++;
+            sched_yield();
+            continue;
+        }
+
+        // Announce that we're going to sleep, then look again
+        uint32_t key = eventcount_prepare(queue->ec);
+
+        item = mpmc_queue_try_pop(queue);
+        if ((item == NULL) && !__atomic_load_n(&queue->closed, __ATOMIC_ACQUIRE)) {
+            if (!eventcount_wait(queue->ec, key, deadline)) {
+                return mpmc_queue_try_pop(queue);
+            }
+        }
+
+        if (item != NULL) {
+            return item;
+        }
+        if (__atomic_load_n(&queue->closed, __ATOMIC_ACQUIRE)) {
+            return mpmc_queue_try_pop(queue);
+        }
+    }
+}
+
+void* mpmc_queue_pop(mpmc_queue_t* queue)
+{
+    return queue_pop(queue, NULL);
+}
+
+void* mpmc_queue_pop_timed(mpmc_queue_t* queue, int64_t timeout_ms)
+{
+    struct timespec deadline;
+
+    eventcount_deadline(&deadline, timeout_ms);
+    return queue_pop(queue, &deadline);
+}
+
+void mpmc_queue_close(mpmc_queue_t* queue)
+{
+    __atomic_store_n(&queue->closed, true, __ATOMIC_RELEASE);
+    eventcount_notify_all(queue->ec);
+}
+
+bool mpmc_queue_closed(mpmc_queue_t* queue)
+{
+    return __atomic_load_n(&queue->closed, __ATOMIC_ACQUIRE);
+}
+
+uint64_t mpmc_queue_depth(mpmc_queue_t* queue)
+{
+    // Consumers never get ahead of producers, so read them first
+    uint64_t dequeue_pos = __atomic_load_n(&queue->dequeue_pos, __ATOMIC_ACQUIRE);
+    uint64_t enqueue_pos = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_ACQUIRE);
+
+    return enqueue_pos - dequeue_pos;
+}
@@ -0,0 +1,72 @@
+// Copyright (c) 2015-2021, NVIDIA CORPORATION.
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef __PFS_MPMC_QUEUE_H__
+#define __PFS_MPMC_QUEUE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "eventcount.h"
+
+// A bounded, lock-free, multi-producer multi-consumer FIFO of pointers
+// (Dmitry Vyukov's design). Each slot carries a sequence number that says
+// whether it's ready to be filled or emptied on the current lap, so
+// producers and consumers only contend on their own position counter.
+//
+// On top of that, consumers that find it empty sleep on an eventcount (see
+// eventcount.h) until something arrives or the queue is closed. Several
+// queues can share one eventcount, for consumers that take from any of them.
+
+#define MPMC_CACHE_LINE  64
+
+typedef struct {
+    uint64_t seq;
+    void*    item;
+} mpmc_cell_t;
+
+typedef struct {
+    // Producers' and consumers' positions, on cache lines of their own
+    uint64_t     enqueue_pos;
+    char         pad1[MPMC_CACHE_LINE - sizeof(uint64_t)];
+    uint64_t     dequeue_pos;
+    char         pad2[MPMC_CACHE_LINE - sizeof(uint64_t)];
+
+    mpmc_cell_t* cells;
+    uint64_t     mask;        // capacity - 1
+
+    eventcount_t  waiters;
+    eventcount_t* ec;         // &waiters unless shared
+    bool          closed;
+} mpmc_queue_t;
+
+// capacity is rounded up to a power of two. Returns 0 or ENOMEM.
+int   mpmc_queue_init(mpmc_queue_t* queue, size_t capacity);
+void  mpmc_queue_destroy(mpmc_queue_t* queue);
+
+// Wake consumers waiting on ec instead of the queue's own eventcount. Set it
+// before anything is pushed.
+void  mpmc_queue_share_eventcount(mpmc_queue_t* queue, eventcount_t* ec);
+
+// Without waiting: push returns false if the queue is full, pop returns NULL
+// if it's empty. Items must not be NULL.
+bool  mpmc_queue_try_push(mpmc_queue_t* queue, void* item);
+void* mpmc_queue_try_pop(mpmc_queue_t* queue);
+
+// push waits (yielding the CPU) while the queue is full; pop sleeps while
+// it's empty, and returns NULL once it's closed and empty
+void  mpmc_queue_push(mpmc_queue_t* queue, void* item);
+void* mpmc_queue_pop(mpmc_queue_t* queue);
+
+// As mpmc_queue_pop, but also returns NULL if nothing arrived within
+// timeout_ms; mpmc_queue_closed() tells the two apart
+void* mpmc_queue_pop_timed(mpmc_queue_t* queue, int64_t timeout_ms);
+
+// Wake every sleeping consumer; the items left can still be popped
+void  mpmc_queue_close(mpmc_queue_t* queue);
+bool  mpmc_queue_closed(mpmc_queue_t* queue);
+
+// Items pushed and not yet popped; only a snapshot while others are at work
+uint64_t mpmc_queue_depth(mpmc_queue_t* queue);
+
+#endif
@@ -2,13 +2,29 @@
 // SPDX-License-Identifier: Apache-2.0
 
 // Create and manage a pool of sockets - useful for concurrent operations that need to send data over sockets concurrently.
+//
+// Connections are pipelined: each one carries up to inflight_window requests
+// at once, and responses come back in whatever order the server finishes
+// them. A "get" reserves one request slot on the least loaded connection and
+// the matching "put" releases it when the response has been read.
+//
+// When a socket breaks all of them are closed at once, and the requests
+// outstanding on them are lost. Slots are tagged with the pool's generation,
+// which the close bumps, so that late puts and sends for the old sockets are
+// recognized and never touch the new ones.
 
 // APIs:
 /*
- * sock_pool_t *sock_pool_create(char *server, int port, int count);
- * int sock_pool_get(sock_pool_t *pool);
- * void sock_pool_put(sock_pool_t *pool, int sock_fd);
- * void sock_pool_put_badfd(sock_pool_t *pool, int sock_fd);
+ * sock_pool_t *sock_pool_create(char *server, int port, int count, int inflight_window);
+ * int sock_pool_get(sock_pool_t *pool, uint64_t *generation);
+ * void sock_pool_put(sock_pool_t *pool, int sock_fd, uint64_t generation);
+ * void sock_pool_put_badfd(sock_pool_t *pool, int sock_fd, uint64_t generation);
+ * int sock_pool_send(sock_pool_t *pool, int sock_fd, uint64_t generation, const char *buf, size_t len);
+ * sock_conn_t *sock_pool_conn(sock_pool_t *pool, int sock_fd);
+ * sock_conn_t *sock_pool_lock_rx(sock_pool_t *pool, int sock_fd, uint64_t *generation);
+ * void sock_pool_unlock_rx(sock_conn_t *conn);
+ * uint64_t sock_pool_generation(sock_pool_t *pool);
+ * void sock_pool_rearm(sock_pool_t *pool, int sock_fd);
  * int sock_pool_select(sock_pool_t *pool);
  * int sock_pool_destroy(sock_pool_t *pool);
  */
@@ -19,6 +35,8 @@
 #include <string.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
 #include <unistd.h>
 
 #include "socket.h"
@@ -26,13 +44,57 @@
 #include "pool.h"
 #include "fault_inj.h"
 
-void sock_list_free(sock_info_t *list);
+void sock_pool_close_all_locked(sock_pool_t *pool);
 
-// sock_pool_create: Create a socket pool with the specified (count) number of sockets. Later the caller
-//                   can request a socket from the pool and put back after use, via Get()/Put().
-sock_pool_t *sock_pool_create(char *server, int port, int count)
+// Readiness of the pool's sockets is tracked with an epoll set so that any
+// number of receiver threads can wait in sock_pool_select() at once.
+//
+// Sockets are registered edge-triggered and one-shot: data arriving wakes
+// exactly one receiver thread, and the socket stays disarmed until that
+// thread has drained it and calls sock_pool_rearm(). Re-arming with
+// EPOLL_CTL_MOD re-evaluates readiness, so data that arrives in between is
+// not lost.
+#define SOCK_POOL_EPOLL_EVENTS (EPOLLIN | EPOLLET | EPOLLONESHOT)
+
+void sock_pool_watch(sock_pool_t *pool, int sock_fd)
 {
-    DPRINTF("sock_pool_create: pool size %d\n", count);
+    struct epoll_event ev;
+    bzero(&ev, sizeof(ev));
+    ev.events  = SOCK_POOL_EPOLL_EVENTS;
+    ev.data.fd = sock_fd;
+
+    if (epoll_ctl(pool->epoll_fd, EPOLL_CTL_ADD, sock_fd, &ev) < 0) {
+        PANIC("sock_pool_watch(): epoll_ctl(ADD) of fd %d failed: %s", sock_fd, strerror(errno));
+    }
+}
+
+void sock_pool_rearm(sock_pool_t *pool, int sock_fd)
+{
+    struct epoll_event ev;
+    bzero(&ev, sizeof(ev));
+    ev.events  = SOCK_POOL_EPOLL_EVENTS;
+    ev.data.fd = sock_fd;
+
+    // ENOENT means the socket was closed by sock_pool_put_badfd() in the
+    // meantime; there is nothing left to arm.
+    if ((epoll_ctl(pool->epoll_fd, EPOLL_CTL_MOD, sock_fd, &ev) < 0) && (errno != ENOENT)) {
+        DPRINTF("sock_pool_rearm(): epoll_ctl(MOD) of fd %d failed: %s\n", sock_fd, strerror(errno));
+    }
+}
+
+void sock_pool_unwatch(sock_pool_t *pool, int sock_fd)
+{
+    // Closing the socket would remove it from the epoll set anyway; do it
+    // explicitly so a reused fd number never inherits a stale registration.
+    (void)epoll_ctl(pool->epoll_fd, EPOLL_CTL_DEL, sock_fd, NULL);
+}
+
+// sock_pool_create: Create a socket pool with the specified (count) number of sockets, each of which
+//                   may carry up to inflight_window outstanding requests. Later the caller can reserve
+//                   a request slot on a socket and release it after use, via Get()/Put().
+sock_pool_t *sock_pool_create(char *server, int port, int count, int inflight_window)
+{
+    DPRINTF("sock_pool_create: pool size %d, window %d\n", count, inflight_window);
 
     // Create the socket
     if ( fail(RPC_CONNECT_FAULT) ) {
@@ -41,6 +103,10 @@ sock_pool_t *sock_pool_create(char *server, int port, int count)
         return NULL;
     }
 
+    if (inflight_window < 1) {
+        inflight_window = 1;
+    }
+
     sock_pool_t *pool = (sock_pool_t *)malloc(sizeof(sock_pool_t));
     if (pool == NULL) {
         PANIC("sock_pool_create(): could not malloc memory for sock_pool_t");
@@ -54,61 +120,54 @@ sock_pool_t *sock_pool_create(char *server, int port, int count)
     }
     pool->port = port;
     pool->pool_count = count;
+    pool->inflight_window = inflight_window;
+    pool->generation = 1;
     pthread_mutex_init(&pool->pool_lock, NULL);
     pthread_cond_init(&pool->pool_cv, NULL);
-    pool->available_count = count;
-    pool->busy_pool = NULL;
-    pool->free_pool = NULL;
-    pool->fd_list = (int *)malloc(sizeof(int) * count);
-    if (pool->fd_list == NULL) {
-        PANIC("sock_pool_create(): could not malloc memory for %d file descriptors", count);
+    pool->available_count = count * inflight_window;
+    pool->conns = (sock_conn_t *)malloc(sizeof(sock_conn_t) * count);
+    if (pool->conns == NULL) {
+        PANIC("sock_pool_create(): could not malloc memory for %d connections", count);
+    }
+    bzero(pool->conns, sizeof(sock_conn_t) * count);
+
+    pool->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (pool->epoll_fd < 0) {
+        PANIC("sock_pool_create(): could not create epoll set: %s", strerror(errno));
     }
-    bzero(pool->fd_list, sizeof(int) * count);
 
     int i = 0;
     for (i = 0; i < pool->pool_count; i++) {
-        sock_info_t *sock_info = (sock_info_t *)malloc(sizeof(sock_info_t));
-        if (sock_info == NULL) {
-            PANIC("sock_pool_create(): could not malloc memory for sock_info_t number %d", i);
-        }
-        bzero(sock_info, sizeof(sock_info_t));
-
-        sock_info->sock_idx = i;
-        pool->fd_list[i] = -1;
-
-        if (i == 0) {
-            pool->free_pool = sock_info;
-            sock_info->next = NULL;
-        } else {
-            sock_info->next = pool->free_pool;
-            pool->free_pool = sock_info;
-        }
+        pool->conns[i].fd = -1;
+        pthread_mutex_init(&pool->conns[i].send_lock, NULL);
+        pthread_mutex_init(&pool->conns[i].rx_lock, NULL);
     }
 
     // verify we can open a connection
-    int         fd = sock_pool_get(pool);
+    uint64_t    generation;
+    int         fd = sock_pool_get(pool, &generation);
     if (fd < 0) {
         goto errout;
     }
-    sock_pool_put(pool, fd);
+    sock_pool_put(pool, fd, generation);
 
     return pool;
 
 errout:
     // close any open sockets (this can't really happen)
-    if (pool->fd_list != NULL) {
-        int     i;
-        for (i = 0; i < pool->pool_count; i++) {
-            if (pool->fd_list[i] >= 0) {
-                close(pool->fd_list[i]);
-                pool->fd_list[i] = -1;
-            }
+    for (i = 0; i < pool->pool_count; i++) {
+        if (pool->conns[i].fd >= 0) {
+            close(pool->conns[i].fd);
         }
+        free(pool->conns[i].rx_buf);
+        pthread_mutex_destroy(&pool->conns[i].send_lock);
+        pthread_mutex_destroy(&pool->conns[i].rx_lock);
     }
 
-    // its OK to call free() or sock_list_free() with a NULL pointer
-    sock_list_free(pool->free_pool);
-    free(pool->fd_list);
+    close(pool->epoll_fd);
+
+    // its OK to call free() with a NULL pointer
+    free(pool->conns);
     free(pool->server);
     free(pool->network);
     free(pool);
@@ -119,11 +178,15 @@ errout:
     return NULL;
 }
 
-// sock_pool_get: Will return a socket fd from the free pool. If there is no socket in the free pool, this
-//                routine will block until a socket becomes available.
+// sock_pool_get: Will reserve a request slot on the connection with the fewest outstanding requests and
+//                return its fd, and the generation the slot belongs to. If every connection's window is
+//                full, this routine will block until a response frees a slot.
+//
+// The generation is stored (atomically, with pool_lock held) before the slot can be used, so that whoever
+// closes the sockets can tell afterwards whether a request went out on them.
 //
 // If a socket cannot be opened, -1 is returned.
-int sock_pool_get(sock_pool_t *pool)
+int sock_pool_get(sock_pool_t *pool, uint64_t *generation)
 {
     if (pool == NULL) {
         errno = EBADF;
@@ -131,57 +194,74 @@ int sock_pool_get(sock_pool_t *pool)
     }
 
     pthread_mutex_lock(&pool->pool_lock);
-    while (pool->available_count <= 0 || pool->pool_blocked) {
+    while (pool->available_count <= 0) {
         pthread_cond_wait(&pool->pool_cv, &pool->pool_lock);
     }
 
     // If the first socket is not open then all of them must be closed -- open
-    // all of them.  This is necessary because sock_pool_select() is not
-    // informed when we open a new socket, so it will not be in the list of fd
-    // passed to select(2) and sock_pool_select() will not find out a packet
-    // arrived on the new socket until the next time out or a packet arrives on
-    // a different socket.
-    if (pool->fd_list[0] < 0) {
+    // all of them.  Each socket is added to the epoll set as soon as it is
+    // opened, so receiver threads already blocked in sock_pool_select() see
+    // responses on it right away.
+    if (pool->conns[0].fd < 0) {
 
         DPRINTF("sock_pool_get(): opening sockets");
         int     i;
         for (i = 0; i < pool->pool_count; i++) {
-            if (pool->fd_list[i] >= 0) {
+            if (pool->conns[i].fd >= 0) {
                 PANIC("sock_pool_get(): found an unexpected open socket at index %d", i);
             }
 
-            pool->fd_list[i] = sock_open(pool->server, pool->port);
+            __atomic_store_n(&pool->conns[i].fd, sock_open(pool->server, pool->port), __ATOMIC_RELAXED);
 
             // if an open failed, close them all and leave
-            if (pool->fd_list[i] < 0) {
+            if (pool->conns[i].fd < 0) {
                 int     errno_save = errno;
                 DPRINTF("sock_pool_get(): open of socket %d failed: %s", i, strerror(errno_save));
 
-                int     j;
-                for (j = 0; j < i; j++) {
-                    sock_close(pool->fd_list[j]);
-                    pool->fd_list[j] = -1;
-                }
+                sock_pool_close_all_locked(pool);
 
+                pthread_mutex_unlock(&pool->pool_lock);
                 errno = errno_save;
                 return -1;
             }
+
+            pool->conns[i].inflight = 0;
+            pool->conns[i].rx_len   = 0;
+            sock_pool_watch(pool, pool->conns[i].fd);
         }
     }
 
+    // Pick the least loaded connection that still has room in its window
+    sock_conn_t *conn = NULL;
+    int         i;
+    for (i = 0; i < pool->pool_count; i++) {
+        sock_conn_t *candidate = &pool->conns[i];
+        if (candidate->inflight >= pool->inflight_window) {
+            continue;
+        }
+        if ((conn == NULL) || (candidate->inflight < conn->inflight)) {
+            conn = candidate;
+        }
+    }
+    if (conn == NULL) {
+        PANIC("sock_pool_get(): %d slots available but every connection window is full", pool->available_count);
+    }
+
+    conn->inflight++;
     pool->available_count--;
-    sock_info_t *sock_info = pool->free_pool;
-    pool->free_pool = sock_info->next;
-    sock_info->next = pool->busy_pool;
-    pool->busy_pool = sock_info;
+    __atomic_store_n(generation, pool->generation, __ATOMIC_RELAXED);
 
+    int fd = conn->fd;
     pthread_mutex_unlock(&pool->pool_lock);
 
-    return pool->fd_list[sock_info->sock_idx];
+    return fd;
 }
 
-// sock_pool_put: Put back the socket into free pool. Will wakeup if anyone is waiting for a socket.
-void sock_pool_put(sock_pool_t *pool, int sock_fd)
+// sock_pool_put: Release a request slot on the socket. Will wakeup if anyone is waiting for a slot.
+//
+// A slot from before the sockets were last closed went with them, so there is nothing to release; the fd may
+// even have been reused by one of the new sockets.
+void sock_pool_put(sock_pool_t *pool, int sock_fd, uint64_t generation)
 {
     if (pool == NULL) {
         return;
@@ -189,143 +269,188 @@ void sock_pool_put(sock_pool_t *pool, int sock_fd)
 
     pthread_mutex_lock(&pool->pool_lock);
 
-    sock_info_t *prev = pool->busy_pool;
-    sock_info_t *head = pool->busy_pool;
-
-    while (head != NULL) {
-        if (pool->fd_list[head->sock_idx] != sock_fd) {
-            prev = head;
-            head = head->next;
-            continue;
-        }
-
-        if (pool->busy_pool == head) {
-            pool->busy_pool = head->next;
-        } else {
-            prev->next = head->next;
-        }
-
-        head->next = pool->free_pool;
-        pool->free_pool = head;
-
+    sock_conn_t *conn = sock_pool_conn(pool, sock_fd);
+    if ((generation == pool->generation) && (conn != NULL) && (conn->inflight > 0)) {
+        conn->inflight--;
         pool->available_count++;
 
-        pthread_cond_signal(&pool->pool_cv);
-
-        break;
+        pthread_cond_broadcast(&pool->pool_cv);
     }
 
     pthread_mutex_unlock(&pool->pool_lock);
 }
 
-// sock_pool_put_badfd: Put a socket back to the pool after a read() or write()
+// sock_pool_put_badfd: Release a request slot after a read() or write()
 // on the socket failed.
 //
-// This code assumes that all the connections in the pool are bad so it blocks
-// new get requests, returns the socket to the pool and waits until all other
-// outstanding sockets are returned.  Then it closes all the sockets, unblocks
-// the pool and lets callers to sock_pool_get() try to re-open them.
-void sock_pool_put_badfd(sock_pool_t *pool, int sock_fd)
+// This code assumes that all the connections in the pool are bad, so it
+// closes all the sockets right away and lets callers to sock_pool_get()
+// re-open them. It doesn't wait for the requests outstanding on them: their
+// responses will never arrive, so their slots are dropped with the sockets
+// and it is up to the caller to fail them, by the generation they were sent
+// in (see sock_pool_generation). Only the first caller for a generation
+// closes anything.
+void sock_pool_put_badfd(sock_pool_t *pool, int sock_fd, uint64_t generation)
 {
-    pthread_mutex_lock(&pool->pool_lock);
-
-    // the first thread to notice will clean things up
-    if (pool->pool_blocked) {
-        pthread_mutex_unlock(&pool->pool_lock);
-        sock_pool_put(pool, sock_fd);
+    if (pool == NULL) {
         return;
     }
 
-    // block any new get requests
-    pool->pool_blocked = true;
-    pthread_mutex_unlock(&pool->pool_lock);
+    pthread_mutex_lock(&pool->pool_lock);
 
-    sock_pool_put(pool, sock_fd);
+    if (generation == pool->generation) {
+        DPRINTF("sock_pool_put_badfd(): closing all sockets after fd %d failed\n", sock_fd);
+        sock_pool_close_all_locked(pool);
 
-    // wait until all fd are released
-    pthread_mutex_lock(&pool->pool_lock);
-    while (pool->available_count < pool->pool_count) {
-        pthread_cond_wait(&pool->pool_cv, &pool->pool_lock);
+        // wake anyone waiting for a slot
+        pthread_cond_broadcast(&pool->pool_cv);
     }
 
-    // close all the file descriptors
-    //
-    // TODO: what if one of the fd was good and there's an outstanding request
-    // on it?
-    int         i;
-    for (i = 0; i < pool->pool_count; i++) {
-        if (pool->fd_list[i] >= 0) {
-            close(pool->fd_list[i]);
-            pool->fd_list[i] = -1;
-        }
+    pthread_mutex_unlock(&pool->pool_lock);
+}
+
+// sock_pool_generation: The current generation; requests sent in an earlier one were lost with its sockets.
+uint64_t sock_pool_generation(sock_pool_t *pool)
+{
+    if (pool == NULL) {
+        return 0;
     }
 
-    // unblock the pool and wake any waiters
     pthread_mutex_lock(&pool->pool_lock);
-    pool->pool_blocked = false;
-    pthread_cond_broadcast(&pool->pool_cv);
+    uint64_t generation = pool->generation;
     pthread_mutex_unlock(&pool->pool_lock);
+
+    return generation;
 }
 
-// sock_pool_select: Will return a fd that has data to read. If a non-zero timeout value is specified,
-//                   select will wait for the timeout period and if no data to read will return 0.
+// sock_pool_send: Write a whole request to the socket. Writers on the same socket are serialized so
+//                 that concurrent requests are never interleaved on the wire.
 //
-// NOTE: if something is blocked on this select call and other code calls
-//       sock_pool_destroy()/_create() sock_pool_put_badfd(), the sock fds will
-//       have changed out from under the select. In that case, the select may
-//       time out or return an error. The next select will succeed. This
-//       manifests as unexpected 5-second (or whatever the timeout) delays in
-//       getting responses from ProxyFS.
-int sock_pool_select(sock_pool_t *pool, int timeout_in_secs)
+// Returns 0 on success, otherwise errno is set and -1 is returned. A slot from before the sockets were last
+// closed fails with EPIPE without writing anything.
+int sock_pool_send(sock_pool_t *pool, int sock_fd, uint64_t generation, const char *buf, size_t len)
 {
     if (pool == NULL) {
+        errno = EBADF;
         return -1;
     }
 
-    DPRINTF("pool_count=%d pool[0]=%d pool[1]=%d timeout=%d\n", pool->pool_count, pool->fd_list[0], pool->fd_list[1], timeout_in_secs);
-    struct timeval tv;
-    struct timeval *tvptr = NULL;
-    if (timeout_in_secs != 0) {
-        tv.tv_sec = timeout_in_secs;
-        tv.tv_usec = 0;
-        tvptr = &tv;
+    sock_conn_t *conn = sock_pool_conn(pool, sock_fd);
+    if (conn == NULL) {
+        errno = EBADF;
+        return -1;
     }
 
-    fd_set set;
-    FD_ZERO(&set);
+    pthread_mutex_lock(&conn->send_lock);
 
-    int i = 0;
-    int high_fd = 0;
-    for (i = 0; i < pool->pool_count; i++) {
-        if (pool->fd_list[i] > 0) {
-            FD_SET(pool->fd_list[i], &set);
+    // The generation is bumped before any socket is closed, and they are closed with send_lock held. So if
+    // it hasn't changed, this is still the socket the slot was reserved on, and it stays open until we let go.
+    if (__atomic_load_n(&pool->generation, __ATOMIC_ACQUIRE) != generation) {
+        pthread_mutex_unlock(&conn->send_lock);
+        errno = EPIPE;
+        return -1;
+    }
+
+    size_t sent = 0;
+    int    rtn  = 0;
+
+    while (sent < len) {
+        ssize_t n = write(sock_fd, buf + sent, len - sent);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            rtn = -1;
+            break;
         }
-        if (pool->fd_list[i] > high_fd) {
-            high_fd = pool->fd_list[i];
+        if (n == 0) {
+            errno = EPIPE;
+            rtn = -1;
+            break;
         }
+        sent += n;
     }
+    pthread_mutex_unlock(&conn->send_lock);
 
-    tvptr = &tv;
-    int ret = select(high_fd + 1, &set, NULL, NULL, tvptr); // Will wait indefinitely if tvptr == NULL.
+    return rtn;
+}
 
-    if (ret <= 0) {
-        return ret;
+// sock_pool_lock_rx: Return the connection that owns sock_fd with its rx_lock held, or NULL if the socket
+//                    isn't (or is no longer) in the pool. The socket stays open, and its receive buffer is
+//                    ours, until sock_pool_unlock_rx(). Also returns the generation, for sock_pool_put().
+sock_conn_t *sock_pool_lock_rx(sock_pool_t *pool, int sock_fd, uint64_t *generation)
+{
+    if (pool == NULL) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&pool->pool_lock);
+    sock_conn_t *conn = sock_pool_conn(pool, sock_fd);
+    if (conn != NULL) {
+        pthread_mutex_lock(&conn->rx_lock);
+        *generation = pool->generation;
+    }
+    pthread_mutex_unlock(&pool->pool_lock);
+
+    return conn;
+}
+
+void sock_pool_unlock_rx(sock_conn_t *conn)
+{
+    pthread_mutex_unlock(&conn->rx_lock);
+}
+
+// sock_pool_conn: Return the connection that owns sock_fd, or NULL if it isn't (or is no longer) in the pool.
+//                 Without pool_lock held, the fd may have been closed and reused by then; check the
+//                 generation once the connection is locked, as sock_pool_send() does.
+sock_conn_t *sock_pool_conn(sock_pool_t *pool, int sock_fd)
+{
+    if ((pool == NULL) || (sock_fd < 0)) {
+        return NULL;
     }
 
+    int i;
     for (i = 0; i < pool->pool_count; i++) {
-        if (pool->fd_list[i] < 0) {
-            continue;
-        }
-        if (FD_ISSET(pool->fd_list[i], &set)) {
-            return pool->fd_list[i];
+        if (__atomic_load_n(&pool->conns[i].fd, __ATOMIC_RELAXED) == sock_fd) {
+            return &pool->conns[i];
         }
     }
+    return NULL;
+}
+
+// sock_pool_select: Will return a fd that has data to read. If a non-zero timeout value is specified,
+//                   waits for the timeout period and if no data to read will return 0.
+//
+// Any number of threads may wait here at once; each ready socket is handed
+// to exactly one of them and is not reported again until that thread calls
+// sock_pool_rearm(). Sockets opened or reopened by sock_pool_get() are added
+// to the epoll set as they are opened, so a waiter never has to time out to
+// notice them.
+int sock_pool_select(sock_pool_t *pool, int timeout_in_secs)
+{
+    if (pool == NULL) {
+        return -1;
+    }
+
+    DPRINTF("pool_count=%d epoll_fd=%d timeout=%d\n", pool->pool_count, pool->epoll_fd, timeout_in_secs);
+
+    int timeout_in_ms = -1; // Wait indefinitely
+    if (timeout_in_secs != 0) {
+        timeout_in_ms = timeout_in_secs * 1000;
+    }
+
+    struct epoll_event ev;
+    int ret = epoll_wait(pool->epoll_fd, &ev, 1, timeout_in_ms);
+    if (ret <= 0) {
+        // 0 is a timeout; EINTR is treated like one
+        return ((ret < 0) && (errno != EINTR)) ? -1 : 0;
+    }
 
-    return -1; // ERROR: select said there is atleast 1 fd to read, but no bit is set in FD_SET.
+    return ev.data.fd;
 }
 
-// sock_pool_destroy: Will close all the sockets and destroy the pool. If force is set to true, will close the sockets in
-//                    both free and busy pool, otherwise, will return EBUSY if busy pool is not empty.
+// sock_pool_destroy: Will close all the sockets and destroy the pool. If force is set to true, will close the sockets
+//                    even with requests outstanding, otherwise, will return EBUSY if any request is outstanding.
 int sock_pool_destroy(sock_pool_t *pool, bool force)
 {
     if (pool == NULL) {
@@ -336,30 +461,27 @@ int sock_pool_destroy(sock_pool_t *pool, bool force)
 
     pthread_mutex_lock(&pool->pool_lock);
 
-    if ((force != true) && (pool->busy_pool != NULL)) {
+    if ((force != true) && (pool->available_count < pool->pool_count * pool->inflight_window)) {
         // Can't destroy the pool when there are outstanding requests.
         pthread_mutex_unlock(&pool->pool_lock);
         return EBUSY;
     }
 
-    sock_list_free(pool->busy_pool);
-    sock_list_free(pool->free_pool);
+    sock_pool_close_all_locked(pool);
 
     pthread_cond_destroy(&pool->pool_cv);
     pthread_mutex_unlock(&pool->pool_lock);
     pthread_mutex_destroy(&pool->pool_lock);
 
-    if (pool->fd_list != NULL) {
-        int     i;
-        for (i = 0; i < pool->pool_count; i++) {
-            if (pool->fd_list[i] >= 0) {
-                close(pool->fd_list[i]);
-                pool->fd_list[i] = -1;
-            }
-        }
-
-        free(pool->fd_list);
+    int i;
+    for (i = 0; i < pool->pool_count; i++) {
+        free(pool->conns[i].rx_buf);
+        pthread_mutex_destroy(&pool->conns[i].send_lock);
+        pthread_mutex_destroy(&pool->conns[i].rx_lock);
     }
+    free(pool->conns);
+
+    close(pool->epoll_fd);
 
     if (pool->network != NULL) {
         free(pool->network);
@@ -374,11 +496,38 @@ int sock_pool_destroy(sock_pool_t *pool, bool force)
     return 0;
 }
 
-void sock_list_free(sock_info_t *list)
+// Close every open socket in the pool and drop any partially received data.
+// Must be called with pool_lock held.
+void sock_pool_close_all_locked(sock_pool_t *pool)
 {
-    while (list) {
-        sock_info_t *head = list;
-        list = head->next;
-        free(head);
+    int i;
+
+    // Requests outstanding on the sockets will never be answered; their slots
+    // go with them
+    pool->available_count = pool->pool_count * pool->inflight_window;
+    __atomic_store_n(&pool->generation, pool->generation + 1, __ATOMIC_RELEASE);
+
+    // Shut the sockets down first, so that a sender blocked in write() on one
+    // lets go of its send_lock
+    for (i = 0; i < pool->pool_count; i++) {
+        if (pool->conns[i].fd >= 0) {
+            (void)shutdown(pool->conns[i].fd, SHUT_RDWR);
+        }
+    }
+
+    for (i = 0; i < pool->pool_count; i++) {
+        sock_conn_t *conn = &pool->conns[i];
+
+        pthread_mutex_lock(&conn->send_lock);
+        pthread_mutex_lock(&conn->rx_lock);
+        if (conn->fd >= 0) {
+            sock_pool_unwatch(pool, conn->fd);
+            sock_close(conn->fd);
+            __atomic_store_n(&conn->fd, -1, __ATOMIC_RELAXED);
+        }
+        conn->inflight = 0;
+        conn->rx_len   = 0;
+        pthread_mutex_unlock(&conn->rx_lock);
+        pthread_mutex_unlock(&conn->send_lock);
     }
 }
@@ -5,31 +5,58 @@
 #define __PFS_POOL_H__
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
 
-typedef struct sock_info_s {
-    int sock_idx;
-    struct sock_info_s *next;
-} sock_info_t;
+// One pooled connection. Several requests may be outstanding on it at once;
+// responses are matched to requests by their JSON RPC id.
+//
+// fd and inflight are guarded by the pool's pool_lock. fd is also only
+// closed with send_lock and rx_lock held, after the pool's generation has
+// been bumped, so whoever holds either of those for the current generation
+// (see sock_pool_send and sock_pool_lock_rx) can use it until they let go.
+typedef struct sock_conn_s {
+    int             fd;
+    int             inflight;   // requests sent and not yet answered
+    pthread_mutex_t send_lock;  // serializes writers so requests don't interleave
+
+    // Bytes received but not yet returned by sock_read(), normally the
+    // beginning of a response whose end hasn't arrived yet
+    pthread_mutex_t rx_lock;
+    char            *rx_buf;
+    size_t          rx_len;
+    size_t          rx_size;
+} sock_conn_t;
 
 typedef struct sock_pool_s {
     char            *server;
     int             port;
     char            *network;
     int             pool_count;
+    int             inflight_window;  // max outstanding requests per connection
     pthread_mutex_t pool_lock;
     pthread_cond_t  pool_cv;
 
-    int             available_count;
-    bool            pool_blocked;
-    int             *fd_list;
-    sock_info_t     *free_pool;
-    sock_info_t     *busy_pool;
+    int             available_count;  // free request slots across all connections
+    sock_conn_t     *conns;
+    int             epoll_fd;
+
+    // Bumped each time the sockets are closed. A request slot belongs to the
+    // generation it was reserved in, and goes away with its sockets.
+    uint64_t        generation;
 } sock_pool_t;
 
-sock_pool_t *sock_pool_create(char *server, int port, int count);
-int sock_pool_get(sock_pool_t *pool);
-void sock_pool_put(sock_pool_t *pool, int sock_fd);
-void sock_pool_put_badfd(sock_pool_t *pool, int sock_fd);
+sock_pool_t *sock_pool_create(char *server, int port, int count, int inflight_window);
+int sock_pool_get(sock_pool_t *pool, uint64_t *generation);
+void sock_pool_put(sock_pool_t *pool, int sock_fd, uint64_t generation);
+void sock_pool_put_badfd(sock_pool_t *pool, int sock_fd, uint64_t generation);
+int sock_pool_send(sock_pool_t *pool, int sock_fd, uint64_t generation, const char *buf, size_t len);
+sock_conn_t *sock_pool_conn(sock_pool_t *pool, int sock_fd);
+sock_conn_t *sock_pool_lock_rx(sock_pool_t *pool, int sock_fd, uint64_t *generation);
+void sock_pool_unlock_rx(sock_conn_t *conn);
+uint64_t sock_pool_generation(sock_pool_t *pool);
+void sock_pool_rearm(sock_pool_t *pool, int sock_fd);
 int sock_pool_select(sock_pool_t *pool, int timeout_in_secs);
 int sock_pool_destroy(sock_pool_t *pool, bool force);
 
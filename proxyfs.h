@@ -13,6 +13,7 @@
 #include <stdbool.h>
 #include <dirent.h>
 #include <sys/statvfs.h>
+#include <sys/uio.h>
 #include <errno.h>
 #include <fcntl.h>
 
@@ -20,11 +21,89 @@
 void rpc_config_set(const char *set_rpc_server, int set_rpc_port, int set_rpc_fast_port);
 void rpc_config_parse(const char *rpc_config_string);
 
+// Set the number of threads that receive and dispatch JSON RPC responses.
+// 0 (the default) is one per pooled socket, a negative count is one per
+// online CPU. Takes effect when the first request is sent.
+void rpc_config_set_response_threads(int count);
+
+// Set how many JSON RPC requests may be outstanding at once on each
+// connection to the server (default 64). 1 restores the old behavior of one
+// request per connection. Takes effect when the connections are created.
+void rpc_config_set_inflight_window(int window);
+
+// Send async reads and writes (proxyfs_async_send) as tagged requests over
+// <connections> fast-port connections, each with up to <depth> requests
+// outstanding, instead of handing them to the I/O worker threads. Requires
+// a server that understands the tagged ops; 0 connections (the default)
+// keeps the worker pool. Takes effect when the connections are opened.
+void rpc_config_set_tagged_io(int connections, int depth);
+
+// Size the pool of I/O worker threads that serve async reads and writes when
+// tagged I/O is off. It starts with <min_workers> (default 4) and adds one,
+// up to <max_workers> (default 128), whenever a request has to wait because
+// every worker is busy. Workers that have been idle for <idle_timeout_ms>
+// (default 30000; 0 keeps them) exit, down to <min_workers>. Each worker
+// opens its own fast-port connection when it first has work. Takes effect
+// when the pool is started.
+void rpc_config_set_io_workers(int min_workers, int max_workers, int idle_timeout_ms);
+
+// Queue async requests for the I/O workers in <shards> queues, each serving
+// a group of neighbouring CPUs on one NUMA node, instead of a single queue
+// they all contend on. 0 (the default) is one per online CPU. Requests go to
+// the queue of the CPU they are submitted on, and are served by workers of
+// that queue unless they're all busy and another is idle. With
+// <pin_workers>, workers only run on the CPUs of their queue (off by
+// default). Takes effect when the pool is started.
+void rpc_config_set_io_worker_shards(int shards, bool pin_workers);
+
+// Have an I/O worker that finds contiguous async reads, or writes, of one
+// file waiting together send them as a single fast-port request of up to
+// <max_bytes> (default 1 MiB; 0 turns this off), each caller still getting
+// its own done_cb. With <window_us> (default 0) a worker that finds only
+// one request waits that long for more before sending it. Takes effect
+// immediately.
+void rpc_config_set_io_merge(uint64_t max_bytes, int window_us);
+
+// Serve the async requests waiting for an I/O worker by class, and within a
+// class give each mount a fair share of the bytes sent (deficit round
+// robin), so one mount's burst of large writes doesn't hold up another's
+// reads and flushes. On by default; off, requests are served in the order
+// they were queued. Takes effect immediately.
+void rpc_config_set_io_fair_queuing(bool enable);
+
+// Let async requests pick their class in io_class. Off by default: every
+// request is classed by its op, and io_class is ignored, so callers that
+// don't set it needn't zero it. Takes effect immediately.
+void rpc_config_set_io_request_classes(bool enable);
+
+// Serve async reads and writes from <threads> threads driving io_uring,
+// each keeping up to <connections> fast-port connections busy, instead of
+// one blocking I/O worker thread per request in flight. Flushes, and every
+// request on a kernel without io_uring, still go to the worker pool; tagged
+// I/O, if configured, takes precedence. 0 threads (the default) keeps the
+// pool. Takes effect when the engine is started.
+//
+// The engine sends requests as they come: it doesn't merge them
+// (rpc_config_set_io_merge) or serve them by class and mount
+// (rpc_config_set_io_fair_queuing, rpc_config_set_io_request_classes). And
+// since a flush goes to the pool, it may reach the server before writes
+// still in flight on the engine: wait for a file's writes to complete
+// before sending its flush.
+void rpc_config_set_io_uring(int threads, int connections);
+
 // Forward declaration so that we don't have to include the real definition
 // of jsonrpc_handle_t.
 struct rpc_handle_t;
 typedef struct rpc_handle_t jsonrpc_handle_t;
 
+// Per-mount attribute cache, opaque to callers; see proxyfs_set_attr_cache().
+struct attr_cache_s;
+typedef struct attr_cache_s attr_cache_t;
+
+// Per-mount directory entry cache, opaque to callers; see proxyfs_set_dentry_cache().
+struct dentry_cache_s;
+typedef struct dentry_cache_s dentry_cache_t;
+
 #define MAX_VOL_NAME_LENGTH  128
 #define MAX_USER_NAME_LENGTH 128
 
@@ -40,6 +119,8 @@ typedef struct {
     uint64_t          auth_user_id;
     uint64_t          auth_group_id;
     char              auth_user[MAX_USER_NAME_LENGTH];
+    attr_cache_t*     attr_cache;
+    dentry_cache_t*   dentry_cache;
 } mount_handle_t;
 
 // NOTE: Both CIFS and NFS need stats to be in sys/stat.h format, i.e. like
@@ -111,6 +192,16 @@ typedef enum io_op_e {
     IO_FLUSH,
 } io_op_t;
 
+// Which requests the I/O workers serve first: flushes, then interactive
+// requests, then bulk ones (see rpc_config_set_io_fair_queuing)
+typedef enum io_class_e {
+    IO_CLASS_DEFAULT = 0,   // by op: flushes IO_CLASS_FLUSH, reads interactive, writes bulk
+    IO_CLASS_FLUSH,
+    IO_CLASS_INTERACTIVE,
+    IO_CLASS_BULK,
+    IO_CLASSES,
+} io_class_t;
+
 typedef struct proxyfs_io_request_s {
     io_op_t         op;
     mount_handle_t  *mount_handle;
@@ -121,17 +212,55 @@ typedef struct proxyfs_io_request_s {
     int             error;
     uint64_t        out_size;
 
+    // Called on an I/O thread when the request has finished. Leave it NULL
+    // to have the request put on the completion queue done_cb_fd instead
+    // (see proxyfs_completion_queue_open).
     void            (*done_cb)(struct proxyfs_io_request_s *req);
     void            *done_cb_arg;
     int             done_cb_fd;
+
+    // Scatter-gather alternative to data: if iov is set, data is ignored and
+    // the request reads into (or writes from) the iovcnt segments, which
+    // must add up to exactly length bytes (EINVAL otherwise). Leave NULL for
+    // a contiguous buffer.
+    const struct iovec *iov;
+    int             iovcnt;
+
+    // Scheduling class, read only with rpc_config_set_io_request_classes()
+    // on; IO_CLASS_DEFAULT picks it by op. Set to the class used when the
+    // request is queued, so set it again before reusing the request.
+    io_class_t      io_class;
+
+    // Set by proxyfs_async_send when queueing the request, for wait times
+    uint64_t        queued_ns;
 } proxyfs_io_request_t;
 
-// API to send async read/write
+// API to send async read/write. Returns 0 once the request is queued, after
+// which it is always completed; otherwise it wasn't sent and won't be.
+// EAGAIN means too many requests are already waiting, or its completion
+// queue is full: try again once some have completed (or been reaped).
 int proxyfs_async_send(proxyfs_io_request_t *req);
 
 // API to send sync (blocking) read/write
 int proxyfs_sync_io(proxyfs_io_request_t *req);
 
+// Completion queues, for event loops that would rather collect finished
+// async requests in batches than have done_cb called on I/O threads.
+// Requests sent with done_cb NULL and done_cb_fd set to the queue's
+// descriptor are put on it when they finish. The descriptor (an eventfd) is
+// readable while there may be requests to reap; it's written once however
+// many finish before the next reap. The queue holds <capacity> requests (0:
+// 4096), counted from when they're sent until they're reaped: with that
+// many outstanding, proxyfs_async_send returns EAGAIN for more.
+int proxyfs_completion_queue_open(int capacity, int *out_fd);
+
+// Take up to max finished requests off the queue, without blocking
+int proxyfs_reap_completions(int fd, proxyfs_io_request_t **out_reqs, int max, int *out_count);
+
+// Once every request sent to it has been reaped; EBUSY, leaving it open,
+// while some haven't
+int proxyfs_completion_queue_close(int fd);
+
 
 // NOTE:
 //   In order to conform to the proxyfs FS APIs, all of these functions require
@@ -192,6 +321,79 @@ int proxyfs_flock(mount_handle_t* in_mount_handle,
 int proxyfs_flush(mount_handle_t* in_mount_handle,
                   uint64_t        in_inode_number);
 
+// Client-side attribute cache
+//
+// When enabled, proxyfs_get_stat answers from a per-mount cache of up to
+// max_entries inodes, filled by get_stat, get_stat_path, readdir_plus and
+// plus directory streams.
+// Entries expire ttl_ms after they were fetched. Changes made through this
+// client (chmod, chown, setstat, settime, resize, write, flush, create,
+// mkdir, link, symlink, unlink, rmdir, rename) drop the affected entries, but
+// changes made by other clients of the volume can be missed for up to
+// ttl_ms. A ttl_ms of 0 (the default) turns caching off.
+//
+// Takes effect for mounts made after the call.
+//
+void proxyfs_set_attr_cache(uint64_t ttl_ms, size_t max_entries);
+
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;              // includes expired entries
+    uint64_t expirations;
+    uint64_t insertions;
+    uint64_t stale_insertions;    // not cached: raced with a local change
+    uint64_t evictions;           // dropped to stay within max_entries
+    uint64_t invalidations;       // dropped because of a local change
+    uint64_t entries;             // currently cached
+} proxyfs_attr_cache_stats_t;
+
+// Attribute cache counters for a mount; all zero if caching is off.
+int proxyfs_get_attr_cache_stats(mount_handle_t*             in_mount_handle,
+                                 proxyfs_attr_cache_stats_t* out_stats);
+
+// When enabled, proxyfs_lookup answers from a per-mount cache of up to
+// max_entries (directory inode, name) pairs, filled by lookup, readdir_plus
+// and directory streams. Names that were found are kept for ttl_ms; names
+// the server reported as missing (ENOENT) are kept for negative_ttl_ms,
+// which is usually much shorter. Changes made through this client (create,
+// mkdir, link, symlink, rename, unlink, rmdir) update the affected entries,
+// but names added or removed by other clients of the volume can be missed
+// for up to ttl_ms (or negative_ttl_ms). A ttl_ms of 0 (the default) turns
+// caching off; a negative_ttl_ms of 0 only caches names that exist.
+//
+// Takes effect for mounts made after the call.
+//
+void proxyfs_set_dentry_cache(uint64_t ttl_ms, uint64_t negative_ttl_ms, size_t max_entries);
+
+typedef struct {
+    uint64_t hits;
+    uint64_t negative_hits;       // answered ENOENT without asking the server
+    uint64_t misses;              // includes expired entries
+    uint64_t expirations;
+    uint64_t insertions;
+    uint64_t negative_insertions;
+    uint64_t stale_insertions;    // not cached: raced with a local change
+    uint64_t evictions;           // dropped to stay within max_entries
+    uint64_t invalidations;       // dropped because of a local change
+    uint64_t entries;             // currently cached
+} proxyfs_dentry_cache_stats_t;
+
+// Directory entry cache counters for a mount; all zero if caching is off.
+int proxyfs_get_dentry_cache_stats(mount_handle_t*               in_mount_handle,
+                                   proxyfs_dentry_cache_stats_t* out_stats);
+
+// When enabled, the *_path calls resolve their path(s) on the client, one
+// proxyfs_lookup per component starting at the mount's root directory, and
+// then issue the equivalent inode-based RPC instead of having the server walk
+// the path on every call. Pair it with the dentry cache, which answers those
+// lookups locally. Paths containing "..", or that go through a symlink to a
+// directory, are still sent to the server as is. A trailing symlink is not
+// followed: the call applies to the symlink itself.
+//
+// Off by default. Takes effect immediately, for all mounts.
+//
+void proxyfs_set_path_walk(bool enable);
+
 // Inode-based get_stat
 //
 // NOTE: Caller must free the memory returned in out_stat once done with it.
@@ -319,6 +521,20 @@ int proxyfs_read(mount_handle_t* in_mount_handle,
                  size_t          in_bufsize,
                  size_t*         out_bufsize);
 
+// Inode-based vectored read
+//
+// Like proxyfs_read, but fills the caller's iovcnt segments in order instead of a
+// single buffer; the read length is the total size of the segments. The number of bytes
+// read is returned in out_size. For an async vectored read, set iov and iovcnt in
+// a proxyfs_io_request_t and call proxyfs_async_send.
+//
+int proxyfs_readv(mount_handle_t*     in_mount_handle,
+                  uint64_t            in_inode_number,
+                  uint64_t            in_offset,
+                  const struct iovec* in_iov,
+                  int                 in_iovcnt,
+                  size_t*             out_size);
+
 // Inode-based async read
 //
 // Caller allocates a buffer to be filled in and passes the buffer pointer and buffer
@@ -400,6 +616,52 @@ int proxyfs_readdir_plus_by_loc(mount_handle_t*  in_mount_handle,
                                 struct dirent**  out_dir_ent,
                                 proxyfs_stat_t** out_dir_ent_stats);
 
+// Directory streams
+//
+// A stream reads a directory in batches of entries and hands them out one
+// at a time, so listing a directory costs one round trip per batch instead
+// of one per entry. A plus stream also returns each entry's attributes.
+// Every batch primes the mount's caches, so that a proxyfs_lookup or
+// proxyfs_get_stat of an entry that was just listed doesn't need the server:
+// names go into the dentry cache (see proxyfs_set_dentry_cache()) and, for a
+// plus stream, attributes into the attribute cache (proxyfs_set_attr_cache()).
+//
+// Batches hold up to max_entries entries and, if max_bufsize is not 0, are
+// limited by the server to about max_bufsize bytes. The defaults are 256
+// entries and no size limit. Takes effect for streams opened after the call.
+//
+void proxyfs_set_readdir_batch(uint64_t max_entries, uint64_t max_bufsize);
+
+// With prefetching on (the default), a stream asks for its next batch as
+// soon as the current one arrives, so the next round trip overlaps with
+// the caller working through the current batch. Each stream then has up to
+// one request outstanding. Takes effect for streams opened after the call.
+//
+void proxyfs_set_readdir_prefetch(bool enable);
+
+struct proxyfs_dir_s;
+typedef struct proxyfs_dir_s proxyfs_dir_t;
+
+// NOTE: Caller must close the stream with proxyfs_closedir once done with it.
+int proxyfs_opendir(mount_handle_t* in_mount_handle,
+                    uint64_t        in_inode_number,
+                    bool            in_plus,
+                    proxyfs_dir_t** out_dir);
+
+// Copy the next entry to out_dir_ent and, for a plus stream, its attributes
+// to out_dir_ent_stat (may be NULL otherwise). Returns ENOENT once all
+// entries have been returned.
+int proxyfs_readdir_next(proxyfs_dir_t*  in_dir,
+                         struct dirent*  out_dir_ent,
+                         proxyfs_stat_t* out_dir_ent_stat);
+
+// Continue after the entry at in_prev_dir_ent_loc (its d_off), or from the
+// start if -1, like proxyfs_readdir_by_loc.
+int proxyfs_seekdir(proxyfs_dir_t* in_dir,
+                    int64_t        in_prev_dir_ent_loc);
+
+int proxyfs_closedir(proxyfs_dir_t* in_dir);
+
 // Inode-based read_symlink
 //
 // NOTE: Caller must free the memory returned in out_target once done with it.
@@ -568,6 +830,19 @@ int proxyfs_write(mount_handle_t* in_mount_handle,
                   size_t          in_bufsize,
                   uint64_t*       out_size);
 
+// Inode-based vectored write
+//
+// Like proxyfs_write, but writes the caller's iovcnt segments in order as one
+// request. For an async vectored write, set iov and iovcnt in a
+// proxyfs_io_request_t and call proxyfs_async_send.
+//
+int proxyfs_writev(mount_handle_t*     in_mount_handle,
+                   uint64_t            in_inode_number,
+                   uint64_t            in_offset,
+                   const struct iovec* in_iov,
+                   int                 in_iovcnt,
+                   uint64_t*           out_size);
+
 // Inode-based async write
 //
 // Caller passes the write buffer pointer and buffer size in in_bufptr and in_bufsize,
@@ -5,10 +5,16 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/uio.h>
+#include <sys/socket.h>
 #include <proxyfs.h>
 #include <fcntl.h>
 
 #include <ioworker.h>
+#include <fastpath.h>
+#include <uring.h>
+#include <completion_queue.h>
+#include <attr_cache.h>
+#include <dentry_cache.h>
 #include <proxyfs_jsonrpc.h>
 #include <json_utils.h>
 #include <debug.h>
@@ -23,18 +29,43 @@
 bool use_fastpath_for_read  = true;
 bool use_fastpath_for_write = true;
 
-typedef struct {
-    uint64_t   op_type;
-    uint8_t    mount_id[MOUNT_ID_SIZE];
-    uint64_t   inode_number;
-    uint64_t   offset;
-    uint64_t   length;
-} io_req_hdr_t;
+// Attribute cache settings for new mounts, see proxyfs_set_attr_cache().
+// Off by default.
+uint64_t attr_cache_ttl_ms      = 0;
+size_t   attr_cache_max_entries = 0;
 
-typedef struct {
-    uint64_t   error;
-    uint64_t   io_size;
-} io_resp_hdr_t;
+// Directory entry cache settings for new mounts, see proxyfs_set_dentry_cache().
+// Off by default.
+uint64_t dentry_cache_ttl_ms          = 0;
+uint64_t dentry_cache_negative_ttl_ms = 0;
+size_t   dentry_cache_max_entries     = 0;
+
+// Batch size for directory streams, see proxyfs_set_readdir_batch()
+uint64_t readdir_batch_max_entries = 256;
+uint64_t readdir_batch_max_bufsize = 0;
+
+// Whether directory streams prefetch their next batch, see
+// proxyfs_set_readdir_prefetch(). On by default.
+bool readdir_prefetch_enabled = true;
+
+// If set, *_path calls resolve the path on the client and then use the
+// inode-based RPC, see proxyfs_set_path_walk(). Off by default.
+bool path_walk_enabled = false;
+
+// If set, fast-path requests and responses move their header and data
+// together in one system call instead of one call each
+bool coalesce_fastpath_io = true;
+
+void proxyfs_test_set_io_coalescing(bool enable)
+{
+    coalesce_fastpath_io = enable;
+}
+
+// Payload size of a read response, for sock_recv_hdr_iov()
+size_t io_resp_read_size(const void *hdr)
+{
+    return ((const io_resp_hdr_t *)hdr)->io_size;
+}
 
 void proxyfs_set_rw_fastpath()
 {
@@ -247,6 +278,93 @@ void handle_rsp_error(const char* callingFunc, int* rsp_err, mount_handle_t* mou
     }
 }
 
+// Returned by path_walk_resolve() and path_walk_resolve_parent() when the
+// path should be left to the server's path-based RPC
+#define PATH_WALK_SKIPPED  (-1)
+
+// Resolve in_fullpath (or, if in_parent is set, the directory holding its
+// last component) on the client, with one proxyfs_lookup per component
+// starting at the mount's root directory. Lookups are answered from the
+// dentry cache when it is enabled.
+//
+// Returns PATH_WALK_SKIPPED if path walking is off or the path should be
+// left to the server: it contains "..", goes through something that isn't a
+// directory (e.g. a symlink), or a lookup failed with anything but ENOENT.
+// Otherwise returns 0 or ENOENT and, on success, sets *out_inode_number and
+// (for in_parent) *out_basename, which points into in_fullpath.
+static int path_walk(mount_handle_t* in_mount_handle,
+                     char*           in_fullpath,
+                     bool            in_parent,
+                     uint64_t*       out_inode_number,
+                     char**          out_basename)
+{
+    if (!path_walk_enabled || (in_mount_handle == NULL) || (in_fullpath == NULL)) {
+        return PATH_WALK_SKIPPED;
+    }
+
+    size_t walk_len = strlen(in_fullpath);
+    char*  basename = NULL;
+    if (in_parent) {
+        basename = strrchr(in_fullpath, '/');
+        basename = (basename == NULL) ? in_fullpath : basename + 1;
+        if ((*basename == '\0') || (strcmp(basename, ".") == 0) || (strcmp(basename, "..") == 0)) {
+            return PATH_WALK_SKIPPED;
+        }
+        walk_len = basename - in_fullpath;
+    }
+
+    char* path = strndup(in_fullpath, walk_len);
+    if (path == NULL) {
+        return PATH_WALK_SKIPPED;
+    }
+
+    uint64_t inode_number = in_mount_handle->root_dir_inode_num;
+    int      status       = 0;
+    char*    saveptr      = NULL;
+    char*    component;
+    for (component = strtok_r(path, "/", &saveptr); component != NULL; component = strtok_r(NULL, "/", &saveptr)) {
+        if (strcmp(component, ".") == 0) {
+            continue;
+        }
+        if (strcmp(component, "..") == 0) {
+            status = PATH_WALK_SKIPPED;
+            break;
+        }
+        status = proxyfs_lookup(in_mount_handle, inode_number, component, &inode_number);
+        if (status != 0) {
+            status = (status == ENOENT) ? ENOENT : PATH_WALK_SKIPPED;
+            break;
+        }
+    }
+    free(path);
+
+    if (status == 0) {
+        *out_inode_number = inode_number;
+        if (in_parent) {
+            *out_basename = basename;
+        }
+    }
+    return status;
+}
+
+// The inode in_fullpath names, for a *_path call to hand to its inode-based
+// variant. Returns 0, ENOENT, or PATH_WALK_SKIPPED to send the path to the
+// server instead.
+static int path_walk_resolve(mount_handle_t* in_mount_handle, char* in_fullpath, uint64_t* out_inode_number)
+{
+    return path_walk(in_mount_handle, in_fullpath, false, out_inode_number, NULL);
+}
+
+// Like path_walk_resolve(), for the directory holding in_fullpath's last
+// component, which is returned in *out_basename
+static int path_walk_resolve_parent(mount_handle_t* in_mount_handle,
+                                    char*           in_fullpath,
+                                    uint64_t*       out_dir_inode_number,
+                                    char**          out_basename)
+{
+    return path_walk(in_mount_handle, in_fullpath, true, out_dir_inode_number, out_basename);
+}
+
 int proxyfs_chmod(mount_handle_t* in_mount_handle,
                   uint64_t        in_inode_number,
                   mode_t          in_mode)
@@ -265,6 +383,9 @@ int proxyfs_chmod(mount_handle_t* in_mount_handle,
 
     // Call RPC
     int rsp_status = jsonrpc_exec_request_blocking(ctx);
+
+    // The inode's attributes have changed
+    attr_cache_invalidate(in_mount_handle->attr_cache, in_inode_number);
     if (rsp_status != 0) {
         handle_rsp_error(__FUNCTION__, &rsp_status, in_mount_handle);
     }
@@ -283,6 +404,13 @@ int proxyfs_chmod_path(mount_handle_t* in_mount_handle,
         return EINVAL;
     }
 
+    // Resolved on the client if path walking is on
+    uint64_t inode_number;
+    int      walk_status = path_walk_resolve(in_mount_handle, in_fullpath, &inode_number);
+    if (walk_status != PATH_WALK_SKIPPED) {
+        return (walk_status == 0) ? proxyfs_chmod(in_mount_handle, inode_number, in_mode) : walk_status;
+    }
+
     // Get context and set the method
     jsonrpc_context_t* ctx = jsonrpc_open(in_mount_handle->rpc_handle, "RpcChmodPath");
 
@@ -293,6 +421,9 @@ int proxyfs_chmod_path(mount_handle_t* in_mount_handle,
 
     // Call RPC
     int rsp_status = jsonrpc_exec_request_blocking(ctx);
+
+    // Without the inode number(s) affected, drop all cached attributes
+    attr_cache_invalidate_all(in_mount_handle->attr_cache);
     if (rsp_status != 0) {
         handle_rsp_error(__FUNCTION__, &rsp_status, in_mount_handle);
     }
@@ -330,6 +461,9 @@ int proxyfs_chown(mount_handle_t* in_mount_handle,
 
     // Call RPC
     int rsp_status = jsonrpc_exec_request_blocking(ctx);
+
+    // The inode's attributes have changed
+    attr_cache_invalidate(in_mount_handle->attr_cache, in_inode_number);
     if (rsp_status != 0) {
         handle_rsp_error(__FUNCTION__, &rsp_status, in_mount_handle);
     }
@@ -353,6 +487,13 @@ int proxyfs_chown_path(mount_handle_t* in_mount_handle,
         return EINVAL;
     }
 
+    // Resolved on the client if path walking is on
+    uint64_t inode_number;
+    int      walk_status = path_walk_resolve(in_mount_handle, in_fullpath, &inode_number);
+    if (walk_status != PATH_WALK_SKIPPED) {
+        return (walk_status == 0) ? proxyfs_chown(in_mount_handle, inode_number, in_owner, in_group) : walk_status;
+    }
+
     // Get context and set the method
     jsonrpc_context_t* ctx = jsonrpc_open(in_mount_handle->rpc_handle, "RpcChownPath");
 
@@ -364,6 +505,9 @@ int proxyfs_chown_path(mount_handle_t* in_mount_handle,
 
     // Call RPC
     int rsp_status = jsonrpc_exec_request_blocking(ctx);
+
+    // Without the inode number(s) affected, drop all cached attributes
+    attr_cache_invalidate_all(in_mount_handle->attr_cache);
     if (rsp_status != 0) {
         handle_rsp_error(__FUNCTION__, &rsp_status, in_mount_handle);
     }
@@ -398,10 +542,15 @@ int proxyfs_create(mount_handle_t* in_mount_handle,
 
     // Call RPC
     int rsp_status = jsonrpc_exec_request_blocking(ctx);
+
+    // The parent directory's size, link count and times have changed
+    attr_cache_invalidate(in_mount_handle->attr_cache, in_inode_number);
     if (rsp_status == 0) {
         // Success; Set the values to be returned
         *out_inode_number = jsonrpc_get_resp_uint64(ctx, ptable[INODE_NUM]);
+        dentry_cache_update(in_mount_handle->dentry_cache, in_inode_number, in_basename, *out_inode_number);
     } else {
+        dentry_cache_invalidate(in_mount_handle->dentry_cache, in_inode_number, in_basename);
         handle_rsp_error(__FUNCTION__, &rsp_status, in_mount_handle);
     }
 
@@ -421,6 +570,16 @@ int proxyfs_create_path(mount_handle_t* in_mount_handle,
         return EINVAL;
     }
 
+    // Resolved on the client if path walking is on
+    uint64_t dir_inode_number;
+    char*    basename;
+    int      walk_status = path_walk_resolve_parent(in_mount_handle, in_fullpath, &dir_inode_number, &basename);
+    if (walk_status != PATH_WALK_SKIPPED) {
+        return (walk_status == 0) ? proxyfs_create(in_mount_handle, dir_inode_number, basename, in_uid, in_gid,
+                                                   in_mode, out_inode_number)
+                                  : walk_status;
+    }
+
     // Get context and set the method
     jsonrpc_context_t* ctx = jsonrpc_open(in_mount_handle->rpc_handle, "RpcCreatePath");
 
@@ -433,6 +592,10 @@ int proxyfs_create_path(mount_handle_t* in_mount_handle,
 
     // Call RPC
     int rsp_status = jsonrpc_exec_request_blocking(ctx);
+
+    // Without the inode number(s) affected, drop all cached attributes and names
+    attr_cache_invalidate_all(in_mount_handle->attr_cache);
+    dentry_cache_invalidate_all(in_mount_handle->dentry_cache);
     if (rsp_status == 0) {
         // Success; Set the values to be returned
         *out_inode_number = jsonrpc_get_resp_uint64(ctx, ptable[INODE_NUM]);
@@ -516,6 +679,9 @@ int proxyfs_flush(mount_handle_t* in_mount_handle,
 
     // Call RPC
     int rsp_status = jsonrpc_exec_request_blocking(ctx);
+
+    // Flushed writes can change the size and times
+    attr_cache_invalidate(in_mount_handle->attr_cache, in_inode_number);
     struct timespec respTimeUnix;
     clock_gettime(CLOCK_REALTIME, &respTimeUnix);
 
@@ -580,37 +746,51 @@ uint64_t timespec_to_nanosec(proxyfs_timespec_t* timespec)
     return nanoSinceEpoch;
 }
 
-// For non-array response structures, call with array_key = NULL.
-void stat_resp_to_struct(jsonrpc_context_t* ctx, proxyfs_stat_t* stat, char* array_key, int array_index)
-{
-    // File mode
-    stat->mode = jsonrpc_get_resp_array_int(ctx, array_key, array_index, ptable[MODE]);
+// Where the fields of a stat response go. Device containing file doesn't
+// really mean anything here, so dev is left zero.
+static const jsonrpc_field_t stat_fields[] = {
+    JSONRPC_FIELD(&ptable[MODE],      JSONRPC_FIELD_INT,  proxyfs_stat_t, mode),
+    JSONRPC_FIELD(&ptable[STAT_INUM], JSONRPC_FIELD_INT,  proxyfs_stat_t, ino),
+    JSONRPC_FIELD(&ptable[NUM_LINKS], JSONRPC_FIELD_INT,  proxyfs_stat_t, nlink),
+    JSONRPC_FIELD(&ptable[USERID],    JSONRPC_FIELD_INT,  proxyfs_stat_t, uid),
+    JSONRPC_FIELD(&ptable[GROUPID],   JSONRPC_FIELD_INT,  proxyfs_stat_t, gid),
+    JSONRPC_FIELD(&ptable[SIZE],      JSONRPC_FIELD_INT,  proxyfs_stat_t, size),
+    JSONRPC_FIELD(&ptable[CTIME],     JSONRPC_FIELD_NSEC, proxyfs_stat_t, ctim),
+    JSONRPC_FIELD(&ptable[CRTIME],    JSONRPC_FIELD_NSEC, proxyfs_stat_t, crtim),
+    JSONRPC_FIELD(&ptable[MTIME],     JSONRPC_FIELD_NSEC, proxyfs_stat_t, mtim),
+    JSONRPC_FIELD(&ptable[ATIME],     JSONRPC_FIELD_NSEC, proxyfs_stat_t, atim),
+};
+#define NUM_STAT_FIELDS (sizeof(stat_fields) / sizeof(stat_fields[0]))
 
-    // Inode number
-    stat->ino = jsonrpc_get_resp_array_uint64(ctx, array_key, array_index, ptable[STAT_INUM]);
+void stat_resp_to_struct(jsonrpc_context_t* ctx, proxyfs_stat_t* stat)
+{
+    bzero(stat, sizeof(proxyfs_stat_t));
+    jsonrpc_get_resp_fields(ctx, stat_fields, NUM_STAT_FIELDS, stat);
+}
 
-    // Device containing file doesn't really mean anything here, so
-    // default to zero.
-    stat->dev    = 0;
 
-    // Number of hard links
-    stat->nlink  = jsonrpc_get_resp_array_uint64(ctx, array_key, array_index, ptable[NUM_LINKS]);
+int proxyfs_get_attr_cache_stats(mount_handle_t*             in_mount_handle,
+                                 proxyfs_attr_cache_stats_t* out_stats)
+{
+    if ((in_mount_handle == NULL) || (out_stats == NULL)) {
+        return EINVAL;
+    }
 
-    // User and group id. We are defaulting these to 0 (superuser).
-    stat->uid = jsonrpc_get_resp_array_int(ctx, array_key, array_index, ptable[USERID]);
-    stat->gid = jsonrpc_get_resp_array_int(ctx, array_key, array_index, ptable[GROUPID]);
+    attr_cache_get_stats(in_mount_handle->attr_cache, out_stats);
+    return 0;
+}
 
-    // File size
-    stat->size   = jsonrpc_get_resp_array_uint64(ctx, array_key, array_index, ptable[SIZE]);
+int proxyfs_get_dentry_cache_stats(mount_handle_t*               in_mount_handle,
+                                   proxyfs_dentry_cache_stats_t* out_stats)
+{
+    if ((in_mount_handle == NULL) || (out_stats == NULL)) {
+        return EINVAL;
+    }
 
-    // Set time-related values
-    nanosec_to_timespec(jsonrpc_get_resp_array_uint64(ctx, array_key, array_index, ptable[CTIME]),  &stat->ctim);
-    nanosec_to_timespec(jsonrpc_get_resp_array_uint64(ctx, array_key, array_index, ptable[CRTIME]), &stat->crtim);
-    nanosec_to_timespec(jsonrpc_get_resp_array_uint64(ctx, array_key, array_index, ptable[MTIME]),  &stat->mtim);
-    nanosec_to_timespec(jsonrpc_get_resp_array_uint64(ctx, array_key, array_index, ptable[ATIME]),  &stat->atim);
+    dentry_cache_get_stats(in_mount_handle->dentry_cache, out_stats);
+    return 0;
 }
 
-
 int proxyfs_get_stat(mount_handle_t*  in_mount_handle,
                      uint64_t         in_inode_number,
                      proxyfs_stat_t** out_stat)
@@ -619,6 +799,19 @@ int proxyfs_get_stat(mount_handle_t*  in_mount_handle,
         return EINVAL;
     }
 
+    // Served locally if the attributes are cached
+    proxyfs_stat_t cached_stat;
+    if (attr_cache_lookup(in_mount_handle->attr_cache, in_inode_number, &cached_stat)) {
+        proxyfs_stat_t* stat = (proxyfs_stat_t*)malloc(sizeof(proxyfs_stat_t));
+        if (stat == NULL) {
+            return ENOMEM;
+        }
+        *stat     = cached_stat;
+        *out_stat = stat;
+        return 0;
+    }
+    uint64_t cache_generation = attr_cache_generation(in_mount_handle->attr_cache);
+
     // Get context and set the method
     jsonrpc_context_t* ctx = jsonrpc_open(in_mount_handle->rpc_handle, "RpcGetStat");
 
@@ -636,7 +829,8 @@ int proxyfs_get_stat(mount_handle_t*  in_mount_handle,
         *out_stat = stat;
 
         // Now fill in the struct
-        stat_resp_to_struct(ctx, stat, NULL, 0);
+        stat_resp_to_struct(ctx, stat);
+        attr_cache_insert(in_mount_handle->attr_cache, stat, cache_generation);
 
     } else {
         handle_rsp_error(__FUNCTION__, &rsp_status, in_mount_handle);
@@ -655,6 +849,15 @@ int proxyfs_get_stat_path(mount_handle_t*  in_mount_handle,
         return EINVAL;
     }
 
+    // Resolved on the client if path walking is on
+    uint64_t inode_number;
+    int      walk_status = path_walk_resolve(in_mount_handle, in_fullpath, &inode_number);
+    if (walk_status != PATH_WALK_SKIPPED) {
+        return (walk_status == 0) ? proxyfs_get_stat(in_mount_handle, inode_number, out_stat) : walk_status;
+    }
+
+    uint64_t cache_generation = attr_cache_generation(in_mount_handle->attr_cache);
+
     // Get context and set the method
     jsonrpc_context_t* ctx = jsonrpc_open(in_mount_handle->rpc_handle, "RpcGetStatPath");
 
@@ -672,7 +875,8 @@ int proxyfs_get_stat_path(mount_handle_t*  in_mount_handle,
         *out_stat = stat;
 
         // Now fill in the struct
-        stat_resp_to_struct(ctx, stat, NULL, 0);
+        stat_resp_to_struct(ctx, stat);
+        attr_cache_insert(in_mount_handle->attr_cache, stat, cache_generation);
 
     } else {
         handle_rsp_error(__FUNCTION__, &rsp_status, in_mount_handle);
@@ -746,7 +950,9 @@ static int proxyfs_get_xattr1(mount_handle_t* in_mount_handle,
         }
 
         size_t bytes_written;
-        jsonrpc_get_resp_buf(ctx, ptable[ATTRVALUE], out_attr_value, *out_attr_value_size, &bytes_written);
+        if (jsonrpc_get_resp_buf(ctx, ptable[ATTRVALUE], out_attr_value, *out_attr_value_size, &bytes_written) != 0) {
+            rsp_status = EIO;
+        }
     } else {
         handle_rsp_error(__FUNCTION__, &rsp_status, in_mount_handle);
     }
@@ -776,6 +982,15 @@ int proxyfs_get_xattr_path(mount_handle_t* in_mount_handle,
         return EINVAL;
     }
 
+    // Resolved on the client if path walking is on
+    uint64_t inode_number;
+    int      walk_status = path_walk_resolve(in_mount_handle, in_fullpath, &inode_number);
+    if (walk_status != PATH_WALK_SKIPPED) {
+        return (walk_status == 0) ? proxyfs_get_xattr(in_mount_handle, inode_number, in_attr_name, out_attr_value,
+                                                      out_attr_value_size)
+                                  : walk_status;
+    }
+
     return proxyfs_get_xattr1(in_mount_handle, in_fullpath, 0, in_attr_name, out_attr_value, out_attr_value_size);
 }
 
@@ -799,7 +1014,14 @@ int proxyfs_link(mount_handle_t* in_mount_handle,
 
     // Call RPC
     int rsp_status = jsonrpc_exec_request_blocking(ctx);
-    if (rsp_status != 0) {
+
+    // The directory and the target's link count have changed
+    attr_cache_invalidate(in_mount_handle->attr_cache, in_inode_number);
+    attr_cache_invalidate(in_mount_handle->attr_cache, in_target_inode_number);
+    if (rsp_status == 0) {
+        dentry_cache_update(in_mount_handle->dentry_cache, in_inode_number, in_basename, in_target_inode_number);
+    } else {
+        dentry_cache_invalidate(in_mount_handle->dentry_cache, in_inode_number, in_basename);
         handle_rsp_error(__FUNCTION__, &rsp_status, in_mount_handle);
     }
 
@@ -816,6 +1038,20 @@ int proxyfs_link_path(mount_handle_t* in_mount_handle,
         return EINVAL;
     }
 
+    // Resolved on the client if path walking is on. in_src_fullpath is the
+    // new name and in_tgt_fullpath the existing file it links to.
+    uint64_t dir_inode_number;
+    uint64_t target_inode_number;
+    char*    basename;
+    int      walk_status = path_walk_resolve(in_mount_handle, in_tgt_fullpath, &target_inode_number);
+    if (walk_status == 0) {
+        walk_status = path_walk_resolve_parent(in_mount_handle, in_src_fullpath, &dir_inode_number, &basename);
+    }
+    if (walk_status != PATH_WALK_SKIPPED) {
+        return (walk_status == 0) ? proxyfs_link(in_mount_handle, dir_inode_number, basename, target_inode_number)
+                                  : walk_status;
+    }
+
     // Get context and set the method
     jsonrpc_context_t* ctx = jsonrpc_open(in_mount_handle->rpc_handle, "RpcLinkPath");
 
@@ -826,6 +1062,10 @@ int proxyfs_link_path(mount_handle_t* in_mount_handle,
 
     // Call RPC
     int rsp_status = jsonrpc_exec_request_blocking(ctx);
+
+    // Without the inode number(s) affected, drop all cached attributes and names
+    attr_cache_invalidate_all(in_mount_handle->attr_cache);
+    dentry_cache_invalidate_all(in_mount_handle->dentry_cache);
     if (rsp_status != 0) {
         handle_rsp_error(__FUNCTION__, &rsp_status, in_mount_handle);
     }
@@ -901,6 +1141,15 @@ int proxyfs_list_xattr_path(mount_handle_t* in_mount_handle,
     if (in_fullpath == NULL) {
         return EINVAL;
     }
+
+    // Resolved on the client if path walking is on
+    uint64_t inode_number;
+    int      walk_status = path_walk_resolve(in_mount_handle, in_fullpath, &inode_number);
+    if (walk_status != PATH_WALK_SKIPPED) {
+        return (walk_status == 0) ? proxyfs_list_xattr(in_mount_handle, inode_number, out_attr_list, out_attr_list_size)
+                                  : walk_status;
+    }
+
     return proxyfs_list_xattr1(in_mount_handle, in_fullpath, 0, out_attr_list, out_attr_list_size);
 }
 
@@ -938,6 +1187,17 @@ int proxyfs_lookup(mount_handle_t* in_mount_handle,
         return EINVAL;
     }
 
+    // Served locally if the name is cached, including names known not to exist
+    switch (dentry_cache_lookup(in_mount_handle->dentry_cache, in_inode_number, in_basename, out_inode_number)) {
+    case DENTRY_CACHE_HIT:
+        return 0;
+    case DENTRY_CACHE_NEGATIVE:
+        return ENOENT;
+    default:
+        break;
+    }
+    uint64_t cache_generation = dentry_cache_generation(in_mount_handle->dentry_cache);
+
     // Get context and set the method
     jsonrpc_context_t* ctx = jsonrpc_open(in_mount_handle->rpc_handle, "RpcLookup");
 
@@ -951,7 +1211,13 @@ int proxyfs_lookup(mount_handle_t* in_mount_handle,
     if (rsp_status == 0) {
         // Success; Set the values to be returned
         *out_inode_number = jsonrpc_get_resp_uint64(ctx, ptable[INODE_NUM]);
+        dentry_cache_insert(in_mount_handle->dentry_cache, in_inode_number, in_basename, *out_inode_number,
+                            cache_generation);
     } else {
+        if (rsp_status == ENOENT) {
+            dentry_cache_insert_negative(in_mount_handle->dentry_cache, in_inode_number, in_basename,
+                                         cache_generation);
+        }
         handle_rsp_error(__FUNCTION__, &rsp_status, in_mount_handle);
     }
 
@@ -968,6 +1234,12 @@ int proxyfs_lookup_path(mount_handle_t* in_mount_handle,
         return EINVAL;
     }
 
+    // Resolved on the client if path walking is on
+    int walk_status = path_walk_resolve(in_mount_handle, in_fullpath, out_inode_number);
+    if (walk_status != PATH_WALK_SKIPPED) {
+        return walk_status;
+    }
+
     // Get context and set the method
     jsonrpc_context_t* ctx = jsonrpc_open(in_mount_handle->rpc_handle, "RpcLookupPath");
 
@@ -1014,12 +1286,17 @@ int proxyfs_mkdir(mount_handle_t* in_mount_handle,
 
     // Call RPC
     int rsp_status = jsonrpc_exec_request_blocking(ctx);
+
+    // The parent directory's size, link count and times have changed
+    attr_cache_invalidate(in_mount_handle->attr_cache, in_inode_number);
     if (rsp_status == 0) {
         // Success; Set the values to be returned
         *out_inode_number = jsonrpc_get_resp_uint64(ctx, ptable[INODE_NUM]);
         DPRINTF("Returned %s: %" PRIu64 "\n", ptable[INODE_NUM], *out_inode_number);
+        dentry_cache_update(in_mount_handle->dentry_cache, in_inode_number, in_basename, *out_inode_number);
 
     } else {
+        dentry_cache_invalidate(in_mount_handle->dentry_cache, in_inode_number, in_basename);
         handle_rsp_error(__FUNCTION__, &rsp_status, in_mount_handle);
     }
 
@@ -1034,6 +1311,17 @@ int proxyfs_mkdir_path(mount_handle_t* in_mount_handle,
                        gid_t           in_gid,
                        mode_t          in_mode)
 {
+    // Resolved on the client if path walking is on
+    uint64_t dir_inode_number;
+    uint64_t inode_number;
+    char*    basename;
+    int      walk_status = path_walk_resolve_parent(in_mount_handle, in_fullpath, &dir_inode_number, &basename);
+    if (walk_status != PATH_WALK_SKIPPED) {
+        return (walk_status == 0) ? proxyfs_mkdir(in_mount_handle, dir_inode_number, basename, in_uid, in_gid, in_mode,
+                                                  &inode_number)
+                                  : walk_status;
+    }
+
     // Get context and set the method
     jsonrpc_context_t* ctx = jsonrpc_open(in_mount_handle->rpc_handle, "RpcMkdirPath");
 
@@ -1046,6 +1334,10 @@ int proxyfs_mkdir_path(mount_handle_t* in_mount_handle,
 
     // Call RPC
     int rsp_status = jsonrpc_exec_request_blocking(ctx);
+
+    // Without the inode number(s) affected, drop all cached attributes and names
+    attr_cache_invalidate_all(in_mount_handle->attr_cache);
+    dentry_cache_invalidate_all(in_mount_handle->dentry_cache);
     if (rsp_status != 0) {
         handle_rsp_error(__FUNCTION__, &rsp_status, in_mount_handle);
     }
@@ -1081,6 +1373,9 @@ int proxyfs_mount(char*            in_volume_name,
     handle->mount_options      = in_mount_options;
     handle->auth_user_id       = in_auth_user_id;
     handle->auth_group_id      = in_auth_group_id;
+    handle->attr_cache         = attr_cache_create(attr_cache_ttl_ms, attr_cache_max_entries);
+    handle->dentry_cache       = dentry_cache_create(dentry_cache_ttl_ms, dentry_cache_negative_ttl_ms,
+                                                     dentry_cache_max_entries);
 
     strncpy(handle->volume_name, in_volume_name, MAX_VOL_NAME_LENGTH);
     handle->volume_name[MAX_VOL_NAME_LENGTH-1] = 0;
@@ -1090,6 +1385,8 @@ int proxyfs_mount(char*            in_volume_name,
         DPRINTF("error opening RPC connection to server.\n");
 
         // Free the memory we allocated since we won't be using it
+        attr_cache_destroy(handle->attr_cache);
+        dentry_cache_destroy(handle->dentry_cache);
         free(handle);
 
         // Set mount handle to null and return
@@ -1139,9 +1436,13 @@ int proxyfs_remount(mount_handle_t* in_mount_handle)
 
     // Call RPC
     int rsp_status = jsonrpc_exec_request_blocking(ctx);
+
+    // A new mount ID usually means the server restarted; don't trust what we cached
+    attr_cache_invalidate_all(in_mount_handle->attr_cache);
+    dentry_cache_invalidate_all(in_mount_handle->dentry_cache);
     if (rsp_status == 0) {
         // Success; Set the return values (assuming .mount_id_as_str decodes)
-        in_mount_handle->mount_id_as_str    = strdup(jsonrpc_get_resp_str(ctx, ptable[MOUNT_ID]));
+        in_mount_handle->mount_id_as_str    = jsonrpc_get_resp_strdup(ctx, ptable[MOUNT_ID]);
         in_mount_handle->root_dir_inode_num = jsonrpc_get_resp_uint64(ctx, ptable[ROOT_DIR_INODE_NUM]);
 
         rsp_status = proxyfs_decode_mount_id(in_mount_handle);
@@ -1309,13 +1610,13 @@ int read_from_socket(int sockfd, void *bufptr, int length) {
 //
 // Returns either:
 //   0: requested number of bytes copied from bufptr to sockfd
-//   otherwise: errno
+//   otherwise: errno (EPIPE rather than SIGPIPE if the socket is broken)
 int write_to_socket(int sockfd, void *bufptr, int length) {
     int ret = 0;
     int total = 0;
     while (total < length) {
         char *addr = bufptr + total;
-        ret = write(sockfd, addr, length - total);
+        ret = send(sockfd, addr, length - total, MSG_NOSIGNAL);
         if (ret < 0) {
             if (errno == EAGAIN) {
                 continue;
@@ -1328,6 +1629,27 @@ int write_to_socket(int sockfd, void *bufptr, int length) {
     return 0;
 }
 
+// Total number of bytes described by an iovec array
+size_t iov_length(const struct iovec* iov, int iovcnt)
+{
+    size_t total = 0;
+    int    i     = 0;
+    for (i = 0; i < iovcnt; i++) {
+        total += iov[i].iov_len;
+    }
+    return total;
+}
+
+// A request's buffer is either data, or iov/iovcnt if iov is set, in which case the segments must add
+// up to exactly length bytes
+bool io_req_has_buffer(proxyfs_io_request_t* req)
+{
+    if (req->iov != NULL) {
+        return (req->iovcnt > 0) && (iov_length(req->iov, req->iovcnt) == req->length);
+    }
+    return (req->data != NULL);
+}
+
 void dump_io_req(proxyfs_io_request_t req, const char* prefix)
 {
     DPRINTF("%s: req is:\n", prefix);
@@ -1337,6 +1659,8 @@ void dump_io_req(proxyfs_io_request_t req, const char* prefix)
     DPRINTF("    .offset       = %ld\n", req.offset);
     DPRINTF("    .length       = %ld\n", req.length);
     DPRINTF("    .data         = %p\n",  req.data);
+    DPRINTF("    .iov          = %p\n",  req.iov);
+    DPRINTF("    .iovcnt       = %d\n",  req.iovcnt);
     DPRINTF("    .error        = %d\n",  req.error);
     DPRINTF("    .out_size     = %ld\n", req.out_size);
 }
@@ -1383,7 +1707,7 @@ int proxyfs_read(mount_handle_t* in_mount_handle,
         DPRINTF("%s: calling proxyfs_read_req.\n", __FUNCTION__);
 
         // Call the read request handler
-        rsp_status = proxyfs_read_req(&req, io_sock_fd);
+        rsp_status = proxyfs_sync_io(&req);
 
         // Get the status and size out of the response
         //
@@ -1428,10 +1752,11 @@ int proxyfs_read(mount_handle_t* in_mount_handle,
         if (rsp_status == 0) {
             // Success; Set the values to be returned
             //
-            jsonrpc_get_resp_buf(ctx, ptable[BUF], in_bufptr, in_bufsize, out_bufsize);
-            if (in_bufsize < *out_bufsize) {
-                DPRINTF("ERROR, wrote %ld bytes in a buffer of size %ld!\n",
+            // Decoded straight into the caller's buffer, which it won't overrun
+            if (jsonrpc_get_resp_buf(ctx, ptable[BUF], in_bufptr, in_bufsize, out_bufsize) != 0) {
+                DPRINTF("ERROR, unable to decode a read of %ld bytes into a buffer of size %ld!\n",
                         *out_bufsize, in_bufsize);
+                rsp_status = EIO;
             }
 
             rspSendTime.tv_sec  = jsonrpc_get_resp_int64(ctx, ptable[SEND_TIME_SEC]);
@@ -1484,6 +1809,7 @@ done:
 int proxyfs_read_req(proxyfs_io_request_t *req, int sock_fd)
 {
     int           sock_ret;
+    bool          broken = false;
     io_req_hdr_t  req_hdr = {
             .op_type      = 1002,
             .inode_number = req->inode_number,
@@ -1494,7 +1820,7 @@ int proxyfs_read_req(proxyfs_io_request_t *req, int sock_fd)
 
     (void)memcpy(req_hdr.mount_id, req->mount_handle->mount_id_as_bytes, MOUNT_ID_SIZE);
 
-    if ((req == NULL) || (req->mount_handle == NULL) || (req->data == NULL)) {
+    if ((req == NULL) || (req->mount_handle == NULL) || !io_req_has_buffer(req)) {
         return EINVAL;
     }
 
@@ -1511,26 +1837,46 @@ int proxyfs_read_req(proxyfs_io_request_t *req, int sock_fd)
     sock_ret = write_to_socket(sock_fd, &req_hdr, sizeof(req_hdr));
     if (0 != sock_ret) {
         req->error = EIO;
+        broken     = true;
         goto done;
     }
 
-    // Receive response header
-    sock_ret = read_from_socket(sock_fd, &resp_hdr, sizeof(resp_hdr));
-    if (0 != sock_ret) {
-        req->error = EIO;
-        goto done;
-    }
+    if (coalesce_fastpath_io || (req->iov != NULL)) {
+        // Receive response header and read data together, the data going
+        // straight into the caller's buffer or segments
+        struct iovec        data_iov = { .iov_base = req->data, .iov_len = req->length };
+        const struct iovec *iov      = (req->iov != NULL) ? req->iov : &data_iov;
+        int                 iovcnt   = (req->iov != NULL) ? req->iovcnt : 1;
 
-    // Receive read data (if any)
-    if (0 < resp_hdr.io_size) {
-        sock_ret = read_from_socket(sock_fd, req->data, resp_hdr.io_size);
+        sock_ret = sock_recv_hdr_iov(sock_fd, &resp_hdr, sizeof(resp_hdr), iov, iovcnt, io_resp_read_size);
         if (0 != sock_ret) {
-            int err = -sock_ret;
-            if ((err == EPIPE) || (err == ENODEV) || (err = EBADF)) {
-                // TBD: Build a proper error handling mechanism to retry the operation.
-                PANIC("Failed to read response from proxyfsd <-> rpc client socket\n");
-            }
-            req->error = EIO;
+            // Part of the response may still be on the socket, so it can't carry another request.
+            // Shut it down so every later request on it fails instead of reading the leftovers, and
+            // have the caller close it.
+            DPRINTF("Failed to read response from proxyfsd <-> rpc client socket, err=%d\n", sock_ret);
+            shutdown(sock_fd, SHUT_RDWR);
+            req->error    = EIO;
+            req->out_size = 0;
+            broken        = true;
+            goto done;
+        }
+    } else {
+        // Receive response header, then read data (if any), which has to fit the buffer. Failing part way,
+        // like the coalesced receive, leaves the socket unusable.
+        sock_ret = read_from_socket(sock_fd, &resp_hdr, sizeof(resp_hdr));
+        if ((0 == sock_ret) && (resp_hdr.io_size > req->length)) {
+            DPRINTF("Read response of %lu bytes for a %lu byte request\n", resp_hdr.io_size, req->length);
+            sock_ret = -EPROTO;
+        }
+        if ((0 == sock_ret) && (0 < resp_hdr.io_size)) {
+            sock_ret = read_from_socket(sock_fd, req->data, resp_hdr.io_size);
+        }
+        if (0 != sock_ret) {
+            DPRINTF("Failed to read response from proxyfsd <-> rpc client socket, err=%d\n", sock_ret);
+            shutdown(sock_fd, SHUT_RDWR);
+            req->error    = EIO;
+            req->out_size = 0;
+            broken        = true;
             goto done;
         }
     }
@@ -1555,46 +1901,108 @@ done:
         req->error = EBADF;
     }
 
-    // XXX TODO: why return anything here if it's always zero?
-    return 0;
+    // Nonzero only if the socket is broken and has to be closed
+    return broken ? EIO : 0;
 }
 
-struct dirent* proxyfs_get_dirents(jsonrpc_context_t* ctx, int num_entries)
+int proxyfs_readv(mount_handle_t*     in_mount_handle,
+                  uint64_t            in_inode_number,
+                  uint64_t            in_offset,
+                  const struct iovec* in_iov,
+                  int                 in_iovcnt,
+                  size_t*             out_size)
 {
-    if (0 == jsonrpc_get_resp_array_length(ctx, ptable[DIRENTS])) {
-        return (struct dirent *) NULL;
+    if ((in_mount_handle == NULL) || (in_iov == NULL) || (in_iovcnt <= 0) || (out_size == NULL)) {
+        return EINVAL;
     }
+    size_t length = iov_length(in_iov, in_iovcnt);
+    int    rsp_status = 0;
 
-    // NOTE: The caller is responsible for freeing this memory.
-    struct dirent* dirents = (struct dirent*)malloc(sizeof(struct dirent) * (num_entries));
+    if (!use_fastpath_for_read) {
+        // The JSON RPC read returns one buffer, so bounce it into the segments
+        uint8_t* buf = (uint8_t*)malloc(length > 0 ? length : 1);
+        if (buf == NULL) {
+            return ENOMEM;
+        }
+        rsp_status = proxyfs_read(in_mount_handle, in_inode_number, in_offset, length, buf, length, out_size);
+        if (rsp_status == 0) {
+            size_t copied = 0;
+            int    i      = 0;
+            for (i = 0; (i < in_iovcnt) && (copied < *out_size); i++) {
+                size_t len = MIN(in_iov[i].iov_len, *out_size - copied);
+                memcpy(in_iov[i].iov_base, buf + copied, len);
+                copied += len;
+            }
+        }
+        free(buf);
+        return rsp_status;
+    }
+
+    proxyfs_io_request_t req = {
+        .op           = IO_READ,
+        .mount_handle = in_mount_handle,
+        .inode_number = in_inode_number,
+        .offset       = in_offset,
+        .length       = length,
+        .data         = NULL,
+        .error        = 0,
+        .out_size     = 0,
+        .done_cb      = NULL,
+        .done_cb_arg  = NULL,
+        .done_cb_fd   = 0,
+        .iov          = in_iov,
+        .iovcnt       = in_iovcnt,
+    };
 
-    int i=0;
-    const char* name = NULL;
-    for (i=0; i < num_entries; i++) {
-        struct dirent* ent = &dirents[i];
-        name = NULL;
+    rsp_status = proxyfs_sync_io(&req);
+    if (rsp_status == 0) {
+        rsp_status = req.error;
+    }
+    *out_size = req.out_size;
 
-        // Get the values for this entry
-        //
-        ent->d_ino  = jsonrpc_get_resp_array_uint64(ctx, ptable[DIRENTS], i, ptable[INODE_NUM]);
-        name        = jsonrpc_get_resp_array_str   (ctx, ptable[DIRENTS], i, ptable[BASENAME]);
-        if (name != NULL) {
-            strncpy(ent->d_name, name, NAME_MAX);
-            // dirent->d_name is NAME_MAX+1 long
-            ent->d_name[NAME_MAX] = 0;
-        } else {
-            DPRINTF("Error getting basename for entry %d!\n",i);
-        }
+    return rsp_status;
+}
 
+// Where the fields of a directory entry go
+static const jsonrpc_field_t dirent_fields[] = {
+    JSONRPC_FIELD(&ptable[INODE_NUM],         JSONRPC_FIELD_INT, struct dirent, d_ino),
+    JSONRPC_FIELD(&ptable[BASENAME],          JSONRPC_FIELD_STR, struct dirent, d_name),
 #ifdef _DIRENT_HAVE_D_OFF
-        // Directory entry location
-        ent->d_off = (int)jsonrpc_get_resp_array_int64(ctx, ptable[DIRENTS], i, ptable[NEXT_DIR_LOCATION]);
+    JSONRPC_FIELD(&ptable[NEXT_DIR_LOCATION], JSONRPC_FIELD_INT, struct dirent, d_off),
 #endif
-
 #ifdef _DIRENT_HAVE_D_TYPE
-        // File type
-        ent->d_type = (int)jsonrpc_get_resp_array_int(ctx, ptable[DIRENTS], i, ptable[FILE_TYPE]);
+    JSONRPC_FIELD(&ptable[FILE_TYPE],         JSONRPC_FIELD_INT, struct dirent, d_type),
 #endif
+};
+#define NUM_DIRENT_FIELDS (sizeof(dirent_fields) / sizeof(dirent_fields[0]))
+
+struct dirent* proxyfs_get_dirents(jsonrpc_context_t* ctx, int num_entries)
+{
+    if (num_entries == 0) {
+        return (struct dirent *) NULL;
+    }
+
+    // NOTE: The caller is responsible for freeing this memory.
+    struct dirent* dirents = (struct dirent*)calloc(num_entries, sizeof(struct dirent));
+    if (dirents == NULL) {
+        return NULL;
+    }
+
+    // Get the values for all entries in one pass; none means the end of the
+    // directory
+    int decoded = jsonrpc_get_resp_array_fields(ctx, ptable[DIRENTS], dirent_fields, NUM_DIRENT_FIELDS,
+                                                dirents, sizeof(struct dirent), num_entries);
+    if (decoded == 0) {
+        free(dirents);
+        return NULL;
+    }
+    if (decoded != num_entries) {
+        DPRINTF("Error, decoded %d of %d entries!\n", decoded, num_entries);
+    }
+
+    int i=0;
+    for (i=0; i < num_entries; i++) {
+        struct dirent* ent = &dirents[i];
 
 #ifdef _DIRENT_HAVE_D_NAMLEN
         ent->d_namlen = strlen(ent->d_name);
@@ -1607,6 +2015,52 @@ struct dirent* proxyfs_get_dirents(jsonrpc_context_t* ctx, int num_entries)
     return dirents;
 }
 
+// Attributes of the entries in a readdir_plus response, which are also
+// added to the attribute cache
+proxyfs_stat_t* proxyfs_get_statents(mount_handle_t*    in_mount_handle,
+                                     jsonrpc_context_t* ctx,
+                                     int                num_entries,
+                                     uint64_t           cache_generation)
+{
+    // NOTE: The caller is responsible for freeing this memory.
+    proxyfs_stat_t* statents = (proxyfs_stat_t*)malloc(sizeof(proxyfs_stat_t) * (num_entries));
+    if (statents == NULL) {
+        return NULL;
+    }
+
+    // Get the values for all entries in one pass
+    bzero(statents, sizeof(proxyfs_stat_t) * num_entries);
+    jsonrpc_get_resp_array_fields(ctx, ptable[STATENTS], stat_fields, NUM_STAT_FIELDS,
+                                  statents, sizeof(proxyfs_stat_t), num_entries);
+
+    int i=0;
+    for (i=0; i < num_entries; i++) {
+        attr_cache_insert(in_mount_handle->attr_cache, &statents[i], cache_generation);
+    }
+
+    return statents;
+}
+
+// Add the names in a readdir response to the dentry cache. "." and ".." are
+// left out: nothing keeps a directory's ".." entry coherent when it is
+// renamed into another directory.
+void proxyfs_prime_dentries(mount_handle_t* in_mount_handle,
+                            uint64_t        in_dir_inode_number,
+                            struct dirent*  dir_ents,
+                            int             num_entries,
+                            uint64_t        cache_generation)
+{
+    int i;
+    for (i = 0; i < num_entries; i++) {
+        const char* name = dir_ents[i].d_name;
+        if ((strcmp(name, ".") == 0) || (strcmp(name, "..") == 0)) {
+            continue;
+        }
+        dentry_cache_insert(in_mount_handle->dentry_cache, in_dir_inode_number, name,
+                            dir_ents[i].d_ino, cache_generation);
+    }
+}
+
 int proxyfs_readdir_helper(mount_handle_t* in_mount_handle,
                            jsonrpc_context_t* ctx,
                            struct dirent** out_dir_ent)
@@ -1680,11 +2134,14 @@ int proxyfs_readdir_by_loc(mount_handle_t* in_mount_handle,
 }
 
 int proxyfs_readdir_plus_helper(mount_handle_t *in_mount_handle,
+                                uint64_t in_inode_number,
                                 jsonrpc_context_t *ctx,
                                 struct dirent**  out_dir_ent,
                                 proxyfs_stat_t** out_dir_ent_stats)
 {
-    int out_num_entries = 1;
+    int      out_num_entries   = 1;
+    uint64_t cache_generation  = attr_cache_generation(in_mount_handle->attr_cache);
+    uint64_t dentry_generation = dentry_cache_generation(in_mount_handle->dentry_cache);
 
     int rsp_status = jsonrpc_exec_request_blocking(ctx);
     if (rsp_status == 0) {
@@ -1704,20 +2161,8 @@ int proxyfs_readdir_plus_helper(mount_handle_t *in_mount_handle,
         // Alloc and fill in the stat entry info
         //
         // NOTE: The caller is responsible for freeing this memory.
-        proxyfs_stat_t* statents = (proxyfs_stat_t*)malloc(sizeof(proxyfs_stat_t) * (out_num_entries));
-        *out_dir_ent_stats = statents;
-
-        int i=0;
-        for (i=0; i < out_num_entries; i++) {
-            // Fill in the stat entry info
-            //
-            //
-            proxyfs_stat_t* stat = &statents[i];
-
-            // Get the values for this entry
-            //
-            stat_resp_to_struct(ctx, stat, ptable[STATENTS], i);
-        }
+        *out_dir_ent_stats = proxyfs_get_statents(in_mount_handle, ctx, out_num_entries, cache_generation);
+        proxyfs_prime_dentries(in_mount_handle, in_inode_number, *out_dir_ent, out_num_entries, dentry_generation);
     } else {
         handle_rsp_error(__FUNCTION__, &rsp_status, in_mount_handle);
     }
@@ -1747,7 +2192,7 @@ int proxyfs_readdir_plus(mount_handle_t*  in_mount_handle,
     jsonrpc_set_req_param_uint64(ctx, ptable[MAX_ENTRIES],       1);
     jsonrpc_set_req_param_str   (ctx, ptable[PREV_DIR_ENT_NAME], in_prev_dir_ent_name);
 
-    return proxyfs_readdir_plus_helper(in_mount_handle, ctx, out_dir_ent, out_dir_ent_stats);
+    return proxyfs_readdir_plus_helper(in_mount_handle, in_inode_number, ctx, out_dir_ent, out_dir_ent_stats);
 }
 
 // NOTE: Unlike readdir(3), caller is responsible for freeing the out_dir_ent and out_dir_ent_stats.
@@ -1772,7 +2217,264 @@ int proxyfs_readdir_plus_by_loc(mount_handle_t*  in_mount_handle,
     jsonrpc_set_req_param_uint64(ctx, ptable[MAX_ENTRIES],           1);
     jsonrpc_set_req_param_int64 (ctx, ptable[PREV_DIR_ENT_LOCATION], in_prev_dir_ent_loc);
 
-    return proxyfs_readdir_plus_helper(in_mount_handle, ctx, out_dir_ent, out_dir_ent_stats);
+    return proxyfs_readdir_plus_helper(in_mount_handle, in_inode_number, ctx, out_dir_ent, out_dir_ent_stats);
+}
+
+// Directory streams
+//
+// This breaks our alphabetical ordering convention, but it's good to have
+// these APIs together, next to the readdir calls they batch up.
+//
+// A stream always reads by location: it remembers the location of the last
+// entry it handed out and asks for the batch after it. With prefetching on,
+// the request for the next batch is sent as soon as a batch arrives, so the
+// server works on it while the caller consumes the current one.
+//
+typedef struct proxyfs_dir_request_s {
+    jsonrpc_context_t* ctx;              // NULL if no request is outstanding
+    int64_t            prev_location;    // the batch follows this location
+    uint64_t           attr_generation;  // cache generations when it was sent
+    uint64_t           dentry_generation;
+} proxyfs_dir_request_t;
+
+struct proxyfs_dir_s {
+    mount_handle_t*        mount_handle;
+    uint64_t               inode_number;
+    bool                   plus;
+    uint64_t               max_entries;
+    uint64_t               max_bufsize;
+    bool                   prefetch;
+    int64_t                prev_location;  // of the last entry returned, -1 for none
+    struct dirent*         dir_ents;       // current batch
+    proxyfs_stat_t*        dir_ent_stats;  // plus streams only
+    int                    num_entries;
+    int                    next_entry;
+    bool                   at_end;         // nothing follows the current batch
+    proxyfs_dir_request_t  next_batch;     // prefetch of the batch after this one
+};
+
+void proxyfs_set_readdir_batch(uint64_t max_entries, uint64_t max_bufsize)
+{
+    readdir_batch_max_entries = (max_entries > 0) ? max_entries : 1;
+    readdir_batch_max_bufsize = max_bufsize;
+}
+
+void proxyfs_set_readdir_prefetch(bool enable)
+{
+    readdir_prefetch_enabled = enable;
+}
+
+static void proxyfs_dir_drop_batch(proxyfs_dir_t* dir)
+{
+    free(dir->dir_ents);
+    free(dir->dir_ent_stats);
+    dir->dir_ents      = NULL;
+    dir->dir_ent_stats = NULL;
+    dir->num_entries   = 0;
+    dir->next_entry    = 0;
+}
+
+// Ask for the batch following prev_location, without waiting for it
+static int proxyfs_dir_send(proxyfs_dir_t* dir, int64_t prev_location)
+{
+    mount_handle_t*        mh  = dir->mount_handle;
+    proxyfs_dir_request_t* req = &dir->next_batch;
+
+    req->prev_location     = prev_location;
+    req->attr_generation   = attr_cache_generation(mh->attr_cache);
+    req->dentry_generation = dentry_cache_generation(mh->dentry_cache);
+
+    // Get context and set the method
+    req->ctx = jsonrpc_open(mh->rpc_handle, dir->plus ? "RpcReaddirPlusByLoc" : "RpcReaddirByLoc");
+
+    // Set the params based on what was passed in
+    jsonrpc_set_req_param_str   (req->ctx, ptable[MOUNT_ID],              mh->mount_id_as_str);
+    jsonrpc_set_req_param_uint64(req->ctx, ptable[INODE_NUM],             dir->inode_number);
+    jsonrpc_set_req_param_uint64(req->ctx, ptable[MAX_ENTRIES],           dir->max_entries);
+    if (dir->max_bufsize > 0) {
+        jsonrpc_set_req_param_uint64(req->ctx, ptable[MAX_BUFSIZE],       dir->max_bufsize);
+    }
+    jsonrpc_set_req_param_int64 (req->ctx, ptable[PREV_DIR_ENT_LOCATION], prev_location);
+
+    int rsp_status = jsonrpc_send_request(req->ctx);
+    if (rsp_status != 0) {
+        jsonrpc_close(req->ctx);
+        req->ctx = NULL;
+    }
+    return rsp_status;
+}
+
+// Forget an outstanding request; its response still has to arrive before
+// the context can be closed
+static void proxyfs_dir_cancel(proxyfs_dir_t* dir)
+{
+    if (dir->next_batch.ctx != NULL) {
+        jsonrpc_wait_for_response(dir->next_batch.ctx);
+        jsonrpc_close(dir->next_batch.ctx);
+        dir->next_batch.ctx = NULL;
+    }
+}
+
+// Make the outstanding request's batch the current one, caching the
+// entries (and, for a plus stream, their attributes) on the way
+static int proxyfs_dir_receive(proxyfs_dir_t* dir)
+{
+    mount_handle_t*        mh  = dir->mount_handle;
+    proxyfs_dir_request_t* req = &dir->next_batch;
+    jsonrpc_context_t*     ctx = req->ctx;
+
+    proxyfs_dir_drop_batch(dir);
+    req->ctx = NULL;
+
+    int rsp_status = jsonrpc_wait_for_response(ctx);
+    if (rsp_status == 0) {
+        int num_entries = jsonrpc_get_resp_array_length(ctx, ptable[DIRENTS]);
+        if (num_entries > 0) {
+            dir->dir_ents = proxyfs_get_dirents(ctx, num_entries);
+            if (dir->plus) {
+                dir->dir_ent_stats = proxyfs_get_statents(mh, ctx, num_entries, req->attr_generation);
+            }
+            if ((dir->dir_ents == NULL) || (dir->plus && (dir->dir_ent_stats == NULL))) {
+                proxyfs_dir_drop_batch(dir);
+                rsp_status = ENOMEM;
+            } else {
+                dir->num_entries = num_entries;
+                proxyfs_prime_dentries(mh, dir->inode_number, dir->dir_ents, num_entries,
+                                       req->dentry_generation);
+            }
+        }
+
+        // A short batch is the end of the directory, unless the server may
+        // have cut it short to stay within max_bufsize
+        if ((rsp_status == 0) && (num_entries < dir->max_entries) &&
+            ((dir->max_bufsize == 0) || (num_entries == 0))) {
+            dir->at_end = true;
+        }
+    } else {
+        handle_rsp_error(__FUNCTION__, &rsp_status, mh);
+    }
+
+    // Clean up jsonrpc context
+    jsonrpc_close(ctx);
+
+    // Start on the next batch while this one is consumed; if that can't be
+    // sent, proxyfs_dir_fetch() will try again when it is needed
+    if ((rsp_status == 0) && !dir->at_end && dir->prefetch) {
+        proxyfs_dir_send(dir, dir->dir_ents[dir->num_entries - 1].d_off);
+    }
+    return rsp_status;
+}
+
+// Replace the current batch with the entries following dir->prev_location
+static int proxyfs_dir_fetch(proxyfs_dir_t* dir)
+{
+    if ((dir->next_batch.ctx != NULL) && (dir->next_batch.prev_location != dir->prev_location)) {
+        proxyfs_dir_cancel(dir);
+    }
+    if (dir->next_batch.ctx == NULL) {
+        int rsp_status = proxyfs_dir_send(dir, dir->prev_location);
+        if (rsp_status != 0) {
+            proxyfs_dir_drop_batch(dir);
+            return rsp_status;
+        }
+    }
+    return proxyfs_dir_receive(dir);
+}
+
+int proxyfs_opendir(mount_handle_t* in_mount_handle,
+                    uint64_t        in_inode_number,
+                    bool            in_plus,
+                    proxyfs_dir_t** out_dir)
+{
+    if ((in_mount_handle == NULL) || (out_dir == NULL)) {
+        return EINVAL;
+    }
+
+    proxyfs_dir_t* dir = (proxyfs_dir_t*)calloc(1, sizeof(proxyfs_dir_t));
+    if (dir == NULL) {
+        return ENOMEM;
+    }
+    dir->mount_handle  = in_mount_handle;
+    dir->inode_number  = in_inode_number;
+    dir->plus          = in_plus;
+    dir->max_entries   = readdir_batch_max_entries;
+    dir->max_bufsize   = readdir_batch_max_bufsize;
+    dir->prefetch      = readdir_prefetch_enabled;
+    dir->prev_location = -1;
+
+    // Read the first batch now, so that errors such as ENOTDIR show up here
+    int rsp_status = proxyfs_dir_fetch(dir);
+    if (rsp_status != 0) {
+        proxyfs_closedir(dir);
+        return rsp_status;
+    }
+
+    *out_dir = dir;
+    return 0;
+}
+
+int proxyfs_readdir_next(proxyfs_dir_t*  in_dir,
+                         struct dirent*  out_dir_ent,
+                         proxyfs_stat_t* out_dir_ent_stat)
+{
+    if ((in_dir == NULL) || (out_dir_ent == NULL) || (in_dir->plus && (out_dir_ent_stat == NULL))) {
+        return EINVAL;
+    }
+
+    while (in_dir->next_entry == in_dir->num_entries) {
+        if (in_dir->at_end) {
+            return ENOENT;
+        }
+        int rsp_status = proxyfs_dir_fetch(in_dir);
+        if (rsp_status != 0) {
+            return rsp_status;
+        }
+    }
+
+    int i = in_dir->next_entry++;
+    *out_dir_ent = in_dir->dir_ents[i];
+    if (in_dir->plus) {
+        *out_dir_ent_stat = in_dir->dir_ent_stats[i];
+    }
+    in_dir->prev_location = in_dir->dir_ents[i].d_off;
+    return 0;
+}
+
+int proxyfs_seekdir(proxyfs_dir_t* in_dir,
+                    int64_t        in_prev_dir_ent_loc)
+{
+    if (in_dir == NULL) {
+        return EINVAL;
+    }
+
+    // Entries still buffered from the current batch can be reused
+    int i;
+    for (i = 0; i < in_dir->num_entries; i++) {
+        if (in_dir->dir_ents[i].d_off == in_prev_dir_ent_loc) {
+            in_dir->next_entry    = i + 1;
+            in_dir->prev_location = in_prev_dir_ent_loc;
+            return 0;
+        }
+    }
+
+    // Otherwise the next read starts a new batch. A prefetch that doesn't
+    // follow in_prev_dir_ent_loc is dropped then.
+    proxyfs_dir_drop_batch(in_dir);
+    in_dir->prev_location = in_prev_dir_ent_loc;
+    in_dir->at_end        = false;
+    return 0;
+}
+
+int proxyfs_closedir(proxyfs_dir_t* in_dir)
+{
+    if (in_dir == NULL) {
+        return EINVAL;
+    }
+
+    proxyfs_dir_cancel(in_dir);
+    proxyfs_dir_drop_batch(in_dir);
+    free(in_dir);
+    return 0;
 }
 
 int proxyfs_read_symlink(mount_handle_t* in_mount_handle,
@@ -1799,7 +2501,7 @@ int proxyfs_read_symlink(mount_handle_t* in_mount_handle,
         // cleaned up when we close the jsonrpc context. This
         // means that we need to strdup here if we want the
         // returned value to live after this function returns.
-        *out_target = strdup(jsonrpc_get_resp_str(ctx, ptable[TARGET]));
+        *out_target = jsonrpc_get_resp_strdup(ctx, ptable[TARGET]);
     } else {
         handle_rsp_error(__FUNCTION__, &rsp_status, in_mount_handle);
     }
@@ -1817,6 +2519,13 @@ int proxyfs_read_symlink_path(mount_handle_t* in_mount_handle,
         return EINVAL;
     }
 
+    // Resolved on the client if path walking is on
+    uint64_t inode_number;
+    int      walk_status = path_walk_resolve(in_mount_handle, in_fullpath, &inode_number);
+    if (walk_status != PATH_WALK_SKIPPED) {
+        return (walk_status == 0) ? proxyfs_read_symlink(in_mount_handle, inode_number, out_target) : walk_status;
+    }
+
     // Get context and set the method
     jsonrpc_context_t* ctx = jsonrpc_open(in_mount_handle->rpc_handle, "RpcReadSymlinkPath");
 
@@ -1828,7 +2537,7 @@ int proxyfs_read_symlink_path(mount_handle_t* in_mount_handle,
     int rsp_status = jsonrpc_exec_request_blocking(ctx);
     if (rsp_status == 0) {
         // Success; Set the values to be returned
-        *out_target = strdup(jsonrpc_get_resp_str(ctx, ptable[TARGET]));
+        *out_target = jsonrpc_get_resp_strdup(ctx, ptable[TARGET]);
     } else {
         handle_rsp_error(__FUNCTION__, &rsp_status, in_mount_handle);
     }
@@ -1864,6 +2573,13 @@ static int proxyfs_remove_xattr1(mount_handle_t* in_mount_handle,
     // Call RPC
     int rsp_status = jsonrpc_exec_request_blocking(ctx);
 
+    // The inode's ctime has changed
+    if (in_fullpath == NULL) {
+        attr_cache_invalidate(in_mount_handle->attr_cache, in_inode_number);
+    } else {
+        attr_cache_invalidate_all(in_mount_handle->attr_cache);
+    }
+
     // Clean up jsonrpc context and return
     jsonrpc_close(ctx);
     return rsp_status;
@@ -1880,6 +2596,13 @@ int proxyfs_remove_xattr_path(mount_handle_t* in_mount_handle,
                               char*           in_fullpath,
                               const char*     in_attr_name)
 {
+    // Resolved on the client if path walking is on
+    uint64_t inode_number;
+    int      walk_status = path_walk_resolve(in_mount_handle, in_fullpath, &inode_number);
+    if (walk_status != PATH_WALK_SKIPPED) {
+        return (walk_status == 0) ? proxyfs_remove_xattr(in_mount_handle, inode_number, in_attr_name) : walk_status;
+    }
+
     return proxyfs_remove_xattr1(in_mount_handle, in_fullpath, 0, in_attr_name);
 }
 
@@ -1903,9 +2626,27 @@ int proxyfs_rename(mount_handle_t* in_mount_handle,
     jsonrpc_set_req_param_uint64(ctx, ptable[DEST_INODE_NUM], in_dst_dir_inode_number);
     jsonrpc_set_req_param_str   (ctx, ptable[DEST_BASENAME],  in_dst_basename);
 
+    // The inode being moved, if we know which one it is
+    uint64_t src_inode_number;
+    bool     src_known = dentry_cache_peek(in_mount_handle->dentry_cache, in_src_dir_inode_number, in_src_basename,
+                                           &src_inode_number);
+
     // Call RPC
     int rsp_status = jsonrpc_exec_request_blocking(ctx);
-    if (rsp_status != 0) {
+
+    // Without the inode number(s) affected, drop all cached attributes
+    attr_cache_invalidate_all(in_mount_handle->attr_cache);
+    if (rsp_status == 0) {
+        dentry_cache_remove(in_mount_handle->dentry_cache, in_src_dir_inode_number, in_src_basename);
+        if (src_known) {
+            dentry_cache_update(in_mount_handle->dentry_cache, in_dst_dir_inode_number, in_dst_basename,
+                                src_inode_number);
+        } else {
+            dentry_cache_invalidate(in_mount_handle->dentry_cache, in_dst_dir_inode_number, in_dst_basename);
+        }
+    } else {
+        dentry_cache_invalidate(in_mount_handle->dentry_cache, in_src_dir_inode_number, in_src_basename);
+        dentry_cache_invalidate(in_mount_handle->dentry_cache, in_dst_dir_inode_number, in_dst_basename);
         handle_rsp_error(__FUNCTION__, &rsp_status, in_mount_handle);
     }
 
@@ -1922,6 +2663,22 @@ int proxyfs_rename_path(mount_handle_t* in_mount_handle,
         return EINVAL;
     }
 
+    // Resolved on the client if path walking is on
+    uint64_t src_dir_inode_number;
+    uint64_t dst_dir_inode_number;
+    char*    src_basename;
+    char*    dst_basename;
+    int      walk_status = path_walk_resolve_parent(in_mount_handle, in_src_fullpath, &src_dir_inode_number,
+                                                    &src_basename);
+    if (walk_status == 0) {
+        walk_status = path_walk_resolve_parent(in_mount_handle, in_dst_fullpath, &dst_dir_inode_number, &dst_basename);
+    }
+    if (walk_status != PATH_WALK_SKIPPED) {
+        return (walk_status == 0) ? proxyfs_rename(in_mount_handle, src_dir_inode_number, src_basename,
+                                                   dst_dir_inode_number, dst_basename)
+                                  : walk_status;
+    }
+
     // Get context and set the method
     jsonrpc_context_t* ctx = jsonrpc_open(in_mount_handle->rpc_handle, "RpcRenamePath");
 
@@ -1932,6 +2689,10 @@ int proxyfs_rename_path(mount_handle_t* in_mount_handle,
 
     // Call RPC
     int rsp_status = jsonrpc_exec_request_blocking(ctx);
+
+    // Without the inode number(s) affected, drop all cached attributes and names
+    attr_cache_invalidate_all(in_mount_handle->attr_cache);
+    dentry_cache_invalidate_all(in_mount_handle->dentry_cache);
     if (rsp_status != 0) {
         handle_rsp_error(__FUNCTION__, &rsp_status, in_mount_handle);
     }
@@ -1959,6 +2720,9 @@ int proxyfs_resize(mount_handle_t* in_mount_handle,
 
     // Call RPC
     int rsp_status = jsonrpc_exec_request_blocking(ctx);
+
+    // The inode's attributes have changed
+    attr_cache_invalidate(in_mount_handle->attr_cache, in_inode_number);
     if (rsp_status != 0) {
         handle_rsp_error(__FUNCTION__, &rsp_status, in_mount_handle);
     }
@@ -1984,9 +2748,25 @@ int proxyfs_rmdir(mount_handle_t* in_mount_handle,
     jsonrpc_set_req_param_uint64(ctx, ptable[INODE_NUM], in_inode_number);
     jsonrpc_set_req_param_str   (ctx, ptable[BASENAME],  in_basename);
 
+    // The inode the name refers to loses a link, if we know which one it is
+    uint64_t child_inode_number;
+    bool     child_known = dentry_cache_peek(in_mount_handle->dentry_cache, in_inode_number, in_basename,
+                                             &child_inode_number);
+
     // Call RPC
     int rsp_status = jsonrpc_exec_request_blocking(ctx);
-    if (rsp_status != 0) {
+
+    if (child_known) {
+        attr_cache_invalidate(in_mount_handle->attr_cache, in_inode_number);
+        attr_cache_invalidate(in_mount_handle->attr_cache, child_inode_number);
+    } else {
+        // Without the inode number(s) affected, drop all cached attributes
+        attr_cache_invalidate_all(in_mount_handle->attr_cache);
+    }
+    if (rsp_status == 0) {
+        dentry_cache_remove(in_mount_handle->dentry_cache, in_inode_number, in_basename);
+    } else {
+        dentry_cache_invalidate(in_mount_handle->dentry_cache, in_inode_number, in_basename);
         handle_rsp_error(__FUNCTION__, &rsp_status, in_mount_handle);
     }
 
@@ -2002,6 +2782,14 @@ int proxyfs_rmdir_path(mount_handle_t* in_mount_handle,
         return EINVAL;
     }
 
+    // Resolved on the client if path walking is on
+    uint64_t dir_inode_number;
+    char*    basename;
+    int      walk_status = path_walk_resolve_parent(in_mount_handle, in_fullpath, &dir_inode_number, &basename);
+    if (walk_status != PATH_WALK_SKIPPED) {
+        return (walk_status == 0) ? proxyfs_rmdir(in_mount_handle, dir_inode_number, basename) : walk_status;
+    }
+
     // Get context and set the method
     jsonrpc_context_t* ctx = jsonrpc_open(in_mount_handle->rpc_handle, "RpcRmdirPath");
 
@@ -2011,6 +2799,10 @@ int proxyfs_rmdir_path(mount_handle_t* in_mount_handle,
 
     // Call RPC
     int rsp_status = jsonrpc_exec_request_blocking(ctx);
+
+    // Without the inode number(s) affected, drop all cached attributes and names
+    attr_cache_invalidate_all(in_mount_handle->attr_cache);
+    dentry_cache_invalidate_all(in_mount_handle->dentry_cache);
     if (rsp_status != 0) {
         handle_rsp_error(__FUNCTION__, &rsp_status, in_mount_handle);
     }
@@ -2020,6 +2812,24 @@ int proxyfs_rmdir_path(mount_handle_t* in_mount_handle,
     return rsp_status;
 }
 
+void proxyfs_set_attr_cache(uint64_t ttl_ms, size_t max_entries)
+{
+    attr_cache_ttl_ms      = ttl_ms;
+    attr_cache_max_entries = max_entries;
+}
+
+void proxyfs_set_dentry_cache(uint64_t ttl_ms, uint64_t negative_ttl_ms, size_t max_entries)
+{
+    dentry_cache_ttl_ms          = ttl_ms;
+    dentry_cache_negative_ttl_ms = negative_ttl_ms;
+    dentry_cache_max_entries     = max_entries;
+}
+
+void proxyfs_set_path_walk(bool enable)
+{
+    path_walk_enabled = enable;
+}
+
 int proxyfs_setstat(mount_handle_t* in_mount_handle,
                     uint64_t        in_inode_number,
                     uint64_t        in_stat_ctime,
@@ -2046,6 +2856,9 @@ int proxyfs_setstat(mount_handle_t* in_mount_handle,
 
     // Call RPC
     int rsp_status = jsonrpc_exec_request_blocking(ctx);
+
+    // The inode's attributes have changed
+    attr_cache_invalidate(in_mount_handle->attr_cache, in_inode_number);
     if (rsp_status != 0) {
         handle_rsp_error(__FUNCTION__, &rsp_status, in_mount_handle);
     }
@@ -2086,6 +2899,9 @@ int proxyfs_settime(mount_handle_t*      in_mount_handle,
 
     // Call RPC
     int rsp_status = jsonrpc_exec_request_blocking(ctx);
+
+    // The inode's attributes have changed
+    attr_cache_invalidate(in_mount_handle->attr_cache, in_inode_number);
     if (rsp_status != 0) {
         handle_rsp_error(__FUNCTION__, &rsp_status, in_mount_handle);
     }
@@ -2104,6 +2920,14 @@ int proxyfs_settime_path(mount_handle_t*      in_mount_handle,
         return EINVAL;
     }
 
+    // Resolved on the client if path walking is on
+    uint64_t inode_number;
+    int      walk_status = path_walk_resolve(in_mount_handle, in_fullpath, &inode_number);
+    if (walk_status != PATH_WALK_SKIPPED) {
+        return (walk_status == 0) ? proxyfs_settime(in_mount_handle, inode_number, in_stat_atime, in_stat_mtime)
+                                  : walk_status;
+    }
+
     // Get context and set the method
     jsonrpc_context_t* ctx = jsonrpc_open(in_mount_handle->rpc_handle, "RpcSetTimePath");
 
@@ -2117,6 +2941,9 @@ int proxyfs_settime_path(mount_handle_t*      in_mount_handle,
 
     // Call RPC
     int rsp_status = jsonrpc_exec_request_blocking(ctx);
+
+    // Without the inode number(s) affected, drop all cached attributes
+    attr_cache_invalidate_all(in_mount_handle->attr_cache);
     if (rsp_status != 0) {
         handle_rsp_error(__FUNCTION__, &rsp_status, in_mount_handle);
     }
@@ -2157,6 +2984,13 @@ static int proxyfs_set_xattr1(mount_handle_t* in_mount_handle,
     // Call RPC
     int rsp_status = jsonrpc_exec_request_blocking(ctx);
 
+    // The inode's ctime has changed
+    if (in_fullpath == NULL) {
+        attr_cache_invalidate(in_mount_handle->attr_cache, in_inode_number);
+    } else {
+        attr_cache_invalidate_all(in_mount_handle->attr_cache);
+    }
+
     // Clean up jsonrpc context and return
     jsonrpc_close(ctx);
     return rsp_status;
@@ -2180,27 +3014,45 @@ int proxyfs_set_xattr_path(mount_handle_t* in_mount_handle,
                            size_t          in_attr_size,
                            int             in_attr_flags)
 {
+    // Resolved on the client if path walking is on
+    uint64_t inode_number;
+    int      walk_status = path_walk_resolve(in_mount_handle, in_fullpath, &inode_number);
+    if (walk_status != PATH_WALK_SKIPPED) {
+        return (walk_status == 0) ? proxyfs_set_xattr(in_mount_handle, inode_number, in_attr_name, in_attr_value,
+                                                      in_attr_size, in_attr_flags)
+                                  : walk_status;
+    }
+
     return proxyfs_set_xattr1(in_mount_handle, in_fullpath, 0, in_attr_name, in_attr_value, in_attr_size, in_attr_flags);
 }
 
+// Where the fields of a statvfs response go
+static const jsonrpc_field_t statvfs_fields[] = {
+    JSONRPC_FIELD(&ptable[BLOCK_SIZE],       JSONRPC_FIELD_INT, struct statvfs, f_bsize),
+    JSONRPC_FIELD(&ptable[FRAGMENT_SIZE],    JSONRPC_FIELD_INT, struct statvfs, f_frsize),
+    JSONRPC_FIELD(&ptable[TOTAL_BLOCKS],     JSONRPC_FIELD_INT, struct statvfs, f_blocks),
+    JSONRPC_FIELD(&ptable[FREE_BLOCKS],      JSONRPC_FIELD_INT, struct statvfs, f_bfree),
+    JSONRPC_FIELD(&ptable[AVAIL_BLOCKS],     JSONRPC_FIELD_INT, struct statvfs, f_bavail),
+    JSONRPC_FIELD(&ptable[TOTAL_INODES],     JSONRPC_FIELD_INT, struct statvfs, f_files),
+    JSONRPC_FIELD(&ptable[FREE_INODES],      JSONRPC_FIELD_INT, struct statvfs, f_ffree),
+    JSONRPC_FIELD(&ptable[AVAIL_INODES],     JSONRPC_FIELD_INT, struct statvfs, f_favail),
+    JSONRPC_FIELD(&ptable[FILESYSTEM_ID],    JSONRPC_FIELD_INT, struct statvfs, f_fsid),
+    JSONRPC_FIELD(&ptable[MOUNT_FLAGS],      JSONRPC_FIELD_INT, struct statvfs, f_flag),
+    JSONRPC_FIELD(&ptable[MAX_FILENAME_LEN], JSONRPC_FIELD_INT, struct statvfs, f_namemax),
+};
+#define NUM_STATVFS_FIELDS (sizeof(statvfs_fields) / sizeof(statvfs_fields[0]))
+
 struct statvfs* statvfs_resp_to_struct(jsonrpc_context_t* ctx, mount_handle_t* mount_handle)
 {
     // First alloc a struct to fill in
     //
     // NOTE: The caller is responsible for freeing this memory.
-    struct statvfs* stat = (struct statvfs*)malloc(sizeof(struct statvfs));
-
-    stat->f_bsize   = jsonrpc_get_resp_uint64(ctx, ptable[BLOCK_SIZE]);
-    stat->f_frsize  = jsonrpc_get_resp_uint64(ctx, ptable[FRAGMENT_SIZE]);
-    stat->f_blocks  = jsonrpc_get_resp_uint64(ctx, ptable[TOTAL_BLOCKS]);
-    stat->f_bfree   = jsonrpc_get_resp_uint64(ctx, ptable[FREE_BLOCKS]);
-    stat->f_bavail  = jsonrpc_get_resp_uint64(ctx, ptable[AVAIL_BLOCKS]);
-    stat->f_files   = jsonrpc_get_resp_uint64(ctx, ptable[TOTAL_INODES]);
-    stat->f_ffree   = jsonrpc_get_resp_uint64(ctx, ptable[FREE_INODES]);
-    stat->f_favail  = jsonrpc_get_resp_uint64(ctx, ptable[AVAIL_INODES]);
-    stat->f_fsid    = jsonrpc_get_resp_uint64(ctx, ptable[FILESYSTEM_ID]);
-    stat->f_flag    = jsonrpc_get_resp_uint64(ctx, ptable[MOUNT_FLAGS]);
-    stat->f_namemax = jsonrpc_get_resp_uint64(ctx, ptable[MAX_FILENAME_LEN]);
+    struct statvfs* stat = (struct statvfs*)calloc(1, sizeof(struct statvfs));
+    if (stat == NULL) {
+        return NULL;
+    }
+
+    jsonrpc_get_resp_fields(ctx, statvfs_fields, NUM_STATVFS_FIELDS, stat);
 
     return stat;
 }
@@ -2261,6 +3113,11 @@ int proxyfs_symlink(mount_handle_t* in_mount_handle,
 
     // Call RPC
     int rsp_status = jsonrpc_exec_request_blocking(ctx);
+
+    // The parent directory's size, link count and times have changed. The
+    // new link's inode number isn't returned, so just forget the name.
+    attr_cache_invalidate(in_mount_handle->attr_cache, in_inode_number);
+    dentry_cache_invalidate(in_mount_handle->dentry_cache, in_inode_number, in_basename);
     if (rsp_status != 0) {
         handle_rsp_error(__FUNCTION__, &rsp_status, in_mount_handle);
     }
@@ -2280,6 +3137,16 @@ int proxyfs_symlink_path(mount_handle_t* in_mount_handle,
         return EINVAL;
     }
 
+    // Resolved on the client if path walking is on
+    uint64_t dir_inode_number;
+    char*    basename;
+    int      walk_status = path_walk_resolve_parent(in_mount_handle, in_fullpath, &dir_inode_number, &basename);
+    if (walk_status != PATH_WALK_SKIPPED) {
+        return (walk_status == 0) ? proxyfs_symlink(in_mount_handle, dir_inode_number, basename, in_target_fullpath,
+                                                    in_uid, in_gid)
+                                  : walk_status;
+    }
+
     // Get context and set the method
     jsonrpc_context_t* ctx = jsonrpc_open(in_mount_handle->rpc_handle, "RpcSymlinkPath");
 
@@ -2292,6 +3159,10 @@ int proxyfs_symlink_path(mount_handle_t* in_mount_handle,
 
     // Call RPC
     int rsp_status = jsonrpc_exec_request_blocking(ctx);
+
+    // Without the inode number(s) affected, drop all cached attributes and names
+    attr_cache_invalidate_all(in_mount_handle->attr_cache);
+    dentry_cache_invalidate_all(in_mount_handle->dentry_cache);
     if (rsp_status != 0) {
         handle_rsp_error(__FUNCTION__, &rsp_status, in_mount_handle);
     }
@@ -2303,26 +3174,47 @@ int proxyfs_symlink_path(mount_handle_t* in_mount_handle,
 
 int proxyfs_async_send(proxyfs_io_request_t *req)
 {
+    int err;
+
     if ((req == NULL) || (req->mount_handle == NULL)) {
         return EINVAL;
     }
+    if (((req->op == IO_READ) || (req->op == IO_WRITE)) && !io_req_has_buffer(req)) {
+        return EINVAL;
+    }
+    err = io_req_reserve_completion(req);
+    if (err != 0) {
+        return err;
+    }
 
-    // Schedule the work and return
-    return schedule_io_work(req);
+    // Pipelined on the tagged connections if they're up, driven by io_uring if that's running, otherwise
+    // schedule the work and return
+    if (fastpath_enabled()) {
+        err = fastpath_submit(req);
+    } else if (uring_enabled() && ((req->op == IO_READ) || (req->op == IO_WRITE))) {
+        err = uring_submit(req);
+    } else {
+        err = schedule_io_work(req);
+    }
+    if (err != 0) {
+        io_req_cancel_completion(req);
+    }
+    return err;
 }
 
 int proxyfs_sync_io(proxyfs_io_request_t *req)
 {
     // XXX TODO: make sure callback is null because we won't be calling it?
     //
-    int ret = 0;
+    int ret     = 0;
+    int sock_fd = io_sock_fd;
 
     switch (req->op) {
         case IO_READ:
-            ret = proxyfs_read_req(req, io_sock_fd);
+            ret = proxyfs_read_req(req, sock_fd);
             break;
         case IO_WRITE:
-            ret = proxyfs_write_req(req, io_sock_fd);
+            ret = proxyfs_write_req(req, sock_fd);
             break;
         default:
             req->error = EINVAL;
@@ -2330,6 +3222,12 @@ int proxyfs_sync_io(proxyfs_io_request_t *req)
             break;
     }
 
+    // Part of the request or response may be left on the socket: replace it for the next caller, as the
+    // I/O workers do with theirs
+    if (ret == EIO) {
+        io_sock_reconnect(sock_fd);
+    }
+
     return ret;
 }
 
@@ -2379,9 +3277,25 @@ int proxyfs_unlink(mount_handle_t* in_mount_handle,
     jsonrpc_set_req_param_uint64(ctx, ptable[INODE_NUM], in_inode_number);
     jsonrpc_set_req_param_str   (ctx, ptable[BASENAME],  in_basename);
 
+    // The inode the name refers to loses a link, if we know which one it is
+    uint64_t child_inode_number;
+    bool     child_known = dentry_cache_peek(in_mount_handle->dentry_cache, in_inode_number, in_basename,
+                                             &child_inode_number);
+
     // Call RPC
     int rsp_status = jsonrpc_exec_request_blocking(ctx);
-    if (rsp_status != 0) {
+
+    if (child_known) {
+        attr_cache_invalidate(in_mount_handle->attr_cache, in_inode_number);
+        attr_cache_invalidate(in_mount_handle->attr_cache, child_inode_number);
+    } else {
+        // Without the inode number(s) affected, drop all cached attributes
+        attr_cache_invalidate_all(in_mount_handle->attr_cache);
+    }
+    if (rsp_status == 0) {
+        dentry_cache_remove(in_mount_handle->dentry_cache, in_inode_number, in_basename);
+    } else {
+        dentry_cache_invalidate(in_mount_handle->dentry_cache, in_inode_number, in_basename);
         handle_rsp_error(__FUNCTION__, &rsp_status, in_mount_handle);
     }
 
@@ -2397,6 +3311,14 @@ int proxyfs_unlink_path(mount_handle_t* in_mount_handle,
         return EINVAL;
     }
 
+    // Resolved on the client if path walking is on
+    uint64_t dir_inode_number;
+    char*    basename;
+    int      walk_status = path_walk_resolve_parent(in_mount_handle, in_fullpath, &dir_inode_number, &basename);
+    if (walk_status != PATH_WALK_SKIPPED) {
+        return (walk_status == 0) ? proxyfs_unlink(in_mount_handle, dir_inode_number, basename) : walk_status;
+    }
+
     // Get context and set the method
     jsonrpc_context_t* ctx = jsonrpc_open(in_mount_handle->rpc_handle, "RpcUnlinkPath");
 
@@ -2406,6 +3328,10 @@ int proxyfs_unlink_path(mount_handle_t* in_mount_handle,
 
     // Call RPC
     int rsp_status = jsonrpc_exec_request_blocking(ctx);
+
+    // Without the inode number(s) affected, drop all cached attributes and names
+    attr_cache_invalidate_all(in_mount_handle->attr_cache);
+    dentry_cache_invalidate_all(in_mount_handle->dentry_cache);
     if (rsp_status != 0) {
         handle_rsp_error(__FUNCTION__, &rsp_status, in_mount_handle);
     }
@@ -2422,6 +3348,8 @@ int proxyfs_unmount(mount_handle_t* in_mount_handle)
         if (in_mount_handle->mount_id_as_str != NULL) {
             free(in_mount_handle->mount_id_as_str);
         }
+        attr_cache_destroy(in_mount_handle->attr_cache);
+        dentry_cache_destroy(in_mount_handle->dentry_cache);
         free(in_mount_handle);
     }
     // XXX TODO: remove this!
@@ -2473,7 +3401,7 @@ int proxyfs_write(mount_handle_t* in_mount_handle,
         DPRINTF("calling proxyfs_write_req.\n");
 
         // Call the write request handler
-        rsp_status = proxyfs_write_req(&req, io_sock_fd);
+        rsp_status = proxyfs_sync_io(&req);
 
         // Get the status and size out of the response
         //
@@ -2515,6 +3443,9 @@ int proxyfs_write(mount_handle_t* in_mount_handle,
         // Call RPC
         //AddProfilerEvent(profiler, BEFORE_RPC_CALL);
         rsp_status = jsonrpc_exec_request_blocking(ctx);
+
+        // The file's size and times have changed
+        attr_cache_invalidate(in_mount_handle->attr_cache, in_inode_number);
         struct timespec respTimeUnix;
         clock_gettime(CLOCK_REALTIME, &respTimeUnix);
 
@@ -2574,6 +3505,7 @@ done:
 int proxyfs_write_req(proxyfs_io_request_t *req, int sock_fd)
 {
     int           sock_ret;
+    bool          broken = false;
     io_req_hdr_t  req_hdr = {
             .op_type      = 1001,
             .inode_number = req->inode_number,
@@ -2584,7 +3516,7 @@ int proxyfs_write_req(proxyfs_io_request_t *req, int sock_fd)
 
     (void)memcpy(req_hdr.mount_id, req->mount_handle->mount_id_as_bytes, MOUNT_ID_SIZE);
 
-    if ((req == NULL) || (req->mount_handle == NULL) || (req->data == NULL)) {
+    if ((req == NULL) || (req->mount_handle == NULL) || !io_req_has_buffer(req)) {
         return EINVAL;
     }
 
@@ -2601,29 +3533,44 @@ int proxyfs_write_req(proxyfs_io_request_t *req, int sock_fd)
         goto done;
     }
 
-    // Send request
-    sock_ret = write_to_socket(sock_fd, &req_hdr, sizeof(req_hdr));
-    if (0 != sock_ret) {
-        req->error = EIO;
-        goto done;
-    }
+    if (coalesce_fastpath_io || (req->iov != NULL)) {
+        // Header and write data (contiguous or every segment) go out in one system call
+        struct iovec        data_iov = { .iov_base = req->data, .iov_len = req->length };
+        const struct iovec *iov      = (req->iov != NULL) ? req->iov : &data_iov;
+        int                 iovcnt   = (req->iov != NULL) ? req->iovcnt : 1;
 
-    // Send write data
-    sock_ret = write_to_socket(sock_fd, req->data, req->length);
-    if (0 != sock_ret) {
-        req->error = EIO;
-        goto done;
+        sock_ret = sock_send_iov(sock_fd, &req_hdr, sizeof(req_hdr), iov, iovcnt);
+        if (0 != sock_ret) {
+            req->error = EIO;
+            broken     = true;
+            goto done;
+        }
+    } else {
+        // Send request
+        sock_ret = write_to_socket(sock_fd, &req_hdr, sizeof(req_hdr));
+        if (0 != sock_ret) {
+            req->error = EIO;
+            broken     = true;
+            goto done;
+        }
+
+        // Send write data
+        sock_ret = write_to_socket(sock_fd, req->data, req->length);
+        if (0 != sock_ret) {
+            req->error = EIO;
+            broken     = true;
+            goto done;
+        }
     }
 
-    // Receive response header
+    // Receive response header; part of it may be left on the socket if that fails
     sock_ret = read_from_socket(sock_fd, &resp_hdr, sizeof(resp_hdr));
     if (0 != sock_ret) {
-        int err = -sock_ret;
-        if ((err == EPIPE) || (err == ENODEV) || (err = EBADF)) {
-            // TBD: Build a proper error handling mechanism to retry the operation.
-            PANIC("Failed to read response from proxyfsd <-> rpc client socket\n");
-        }
-        req->error = EIO;
+        DPRINTF("Failed to read response from proxyfsd <-> rpc client socket, err=%d\n", sock_ret);
+        shutdown(sock_fd, SHUT_RDWR);
+        req->error    = EIO;
+        req->out_size = 0;
+        broken        = true;
         goto done;
     }
 
@@ -2637,6 +3584,9 @@ int proxyfs_write_req(proxyfs_io_request_t *req, int sock_fd)
     req->out_size = resp_hdr.io_size;
 
 done:
+    // The file's size and times may have changed, even if something failed
+    attr_cache_invalidate(req->mount_handle->attr_cache, req->inode_number);
+
     // Stop timing and print latency
     StopProfiler(profiler);
     DumpProfiler(profiler);
@@ -2647,7 +3597,68 @@ done:
         req->error = EBADF;
     }
 
-    return 0;
+    // Nonzero only if the socket is broken and has to be closed
+    return broken ? EIO : 0;
+}
+
+int proxyfs_writev(mount_handle_t*     in_mount_handle,
+                   uint64_t            in_inode_number,
+                   uint64_t            in_offset,
+                   const struct iovec* in_iov,
+                   int                 in_iovcnt,
+                   uint64_t*           out_size)
+{
+    if ((in_mount_handle == NULL) || (in_iov == NULL) || (in_iovcnt <= 0) || (out_size == NULL)) {
+        return EINVAL;
+    }
+    size_t length     = iov_length(in_iov, in_iovcnt);
+    int    rsp_status = 0;
+
+    if (length == 0) {
+        *out_size = 0;
+        return 0;
+    }
+
+    if (!use_fastpath_for_write) {
+        // The JSON RPC write takes one buffer, so gather the segments into it
+        uint8_t* buf = (uint8_t*)malloc(length);
+        if (buf == NULL) {
+            return ENOMEM;
+        }
+        size_t copied = 0;
+        int    i      = 0;
+        for (i = 0; i < in_iovcnt; i++) {
+            memcpy(buf + copied, in_iov[i].iov_base, in_iov[i].iov_len);
+            copied += in_iov[i].iov_len;
+        }
+        rsp_status = proxyfs_write(in_mount_handle, in_inode_number, in_offset, buf, length, out_size);
+        free(buf);
+        return rsp_status;
+    }
+
+    proxyfs_io_request_t req = {
+        .op           = IO_WRITE,
+        .mount_handle = in_mount_handle,
+        .inode_number = in_inode_number,
+        .offset       = in_offset,
+        .length       = length,
+        .data         = NULL,
+        .error        = 0,
+        .out_size     = 0,
+        .done_cb      = NULL,
+        .done_cb_arg  = NULL,
+        .done_cb_fd   = 0,
+        .iov          = in_iov,
+        .iovcnt       = in_iovcnt,
+    };
+
+    rsp_status = proxyfs_sync_io(&req);
+    if (rsp_status == 0) {
+        rsp_status = req.error;
+    }
+    *out_size = req.out_size;
+
+    return rsp_status;
 }
 
 // Flag to control debug prints. Defaulted to on for now.
@@ -1,12 +1,15 @@
 // Copyright (c) 2015-2021, NVIDIA CORPORATION.
 // SPDX-License-Identifier: Apache-2.0
 
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <pthread.h>
 #include <errno.h>
 #include <stdint.h>
 #include <ioworker.h>
+#include <fastpath.h>
+#include <uring.h>
 #include <proxyfs_jsonrpc.h>
 #include <json_utils_internal.h>
 #include <proxyfs_req_resp.h>
@@ -15,10 +18,22 @@
 #include <fault_inj.h>
 #include <string.h>
 #include <syslog.h>
+#include <unistd.h>
 
 static char rpc_server[128];
 static int  rpc_port;
 static int  rpc_fast_port;
+static int  rpc_response_threads   = 0;
+static int  rpc_inflight_window    = GLOBAL_SOCK_POOL_WINDOW;
+static int  rpc_tagged_io_conns    = 0;
+static int  rpc_tagged_io_depth    = 0;
+static int  rpc_io_workers_min     = 4;
+static int  rpc_io_workers_max     = 128;
+static int  rpc_io_workers_idle_ms = 30000;
+static int  rpc_io_worker_shards   = 0;
+static bool rpc_io_workers_pin     = false;
+static int  rpc_io_uring_threads   = 0;
+static int  rpc_io_uring_conns     = 0;
 
 void rpc_config_set(const char *set_rpc_server, int set_rpc_port, int set_rpc_fast_port)
 {
@@ -32,6 +47,56 @@ void rpc_config_set(const char *set_rpc_server, int set_rpc_port, int set_rpc_fa
     rpc_fast_port = set_rpc_fast_port;
 }
 
+void rpc_config_set_response_threads(int count)
+{
+    rpc_response_threads = count;
+}
+
+void rpc_config_set_inflight_window(int window)
+{
+    rpc_inflight_window = (window > 0) ? window : 1;
+}
+
+void rpc_config_set_tagged_io(int connections, int depth)
+{
+    rpc_tagged_io_conns = (connections > 0) ? connections : 0;
+    rpc_tagged_io_depth = (depth > 0) ? depth : 1;
+}
+
+void rpc_config_set_io_workers(int min_workers, int max_workers, int idle_timeout_ms)
+{
+    rpc_io_workers_min     = (min_workers > 0) ? min_workers : 1;
+    rpc_io_workers_max     = (max_workers > rpc_io_workers_min) ? max_workers : rpc_io_workers_min;
+    rpc_io_workers_idle_ms = (idle_timeout_ms > 0) ? idle_timeout_ms : 0;
+}
+
+void rpc_config_set_io_worker_shards(int shards, bool pin_workers)
+{
+    rpc_io_worker_shards = (shards > 0) ? shards : 0;
+    rpc_io_workers_pin   = pin_workers;
+}
+
+void rpc_config_set_io_merge(uint64_t max_bytes, int window_us)
+{
+    io_workers_set_merge(max_bytes, window_us);
+}
+
+void rpc_config_set_io_fair_queuing(bool enable)
+{
+    io_workers_set_fair_queuing(enable);
+}
+
+void rpc_config_set_io_request_classes(bool enable)
+{
+    io_workers_set_request_classes(enable);
+}
+
+void rpc_config_set_io_uring(int threads, int connections)
+{
+    rpc_io_uring_threads = (threads > 0) ? threads : 0;
+    rpc_io_uring_conns   = (connections > 0) ? connections : 1;
+}
+
 void rpc_config_parse(const char *rpc_config_string)
 {
     int  colon_pos;
@@ -77,6 +142,36 @@ struct rpc_handle_t {
 //           Should we keep it in case we use different sockets for different mounts later,
 //           or remove it because it's confusing to fetch and store it and not use it?
 
+// Where io_sock_fd was opened to, so that it can be opened again
+static char            io_sock_server[128];
+static int             io_sock_port;
+static pthread_mutex_t io_sock_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Open io_sock_fd to server:port; -1 if that fails
+static void io_sock_connect(char* server, int port)
+{
+    pthread_mutex_lock(&io_sock_lock);
+    (void)snprintf(io_sock_server, sizeof(io_sock_server), "%s", server);
+    io_sock_port = port;
+    io_sock_fd   = sock_open(io_sock_server, io_sock_port);
+    pthread_mutex_unlock(&io_sock_lock);
+}
+
+void io_sock_reconnect(int broken_fd)
+{
+    pthread_mutex_lock(&io_sock_lock);
+    if ((io_sock_fd == broken_fd) && (io_sock_server[0] != '\0')) {
+        if (broken_fd >= 0) {
+            sock_close(broken_fd);
+        }
+        io_sock_fd = sock_open(io_sock_server, io_sock_port);
+        if (io_sock_fd < 0) {
+            DPRINTF("Failed to reopen the io socket to %s:%d\n", io_sock_server, io_sock_port);
+        }
+    }
+    pthread_mutex_unlock(&io_sock_lock);
+}
+
 // Open proxyfs RPC context. If successful, returns non-null handle.
 //
 // Implementation notes:
@@ -93,7 +188,8 @@ jsonrpc_handle_t* pfs_rpc_open()
     // Alloc memory for handle to return
     jsonrpc_handle_t* handle = (jsonrpc_handle_t*)malloc(sizeof(jsonrpc_handle_t));
 
-    int ret = io_workers_start(rpc_server, rpc_fast_port, 128);
+    int ret = io_workers_start(rpc_server, rpc_fast_port, rpc_io_workers_min, rpc_io_workers_max,
+                               rpc_io_workers_idle_ms, rpc_io_worker_shards, rpc_io_workers_pin);
     if (ret != 0) {
         free(handle);
         handle = NULL;
@@ -103,7 +199,7 @@ jsonrpc_handle_t* pfs_rpc_open()
 
     // Open the IO socket, if it's not already open
     if (io_sock_fd < 0) {
-        io_sock_fd = sock_open(rpc_server, rpc_fast_port);
+        io_sock_connect(rpc_server, rpc_fast_port);
         if (io_sock_fd < 0) {
             free(handle);
             handle = NULL;
@@ -114,9 +210,28 @@ jsonrpc_handle_t* pfs_rpc_open()
         DPRINTF("pfs_rpc_open: no need to open io_sock_fd=%d, already open.\n", io_sock_fd);
     }
 
+    // Tagged I/O connections, if configured; fastpath_start() is a no-op once running
+    if (rpc_tagged_io_conns > 0) {
+        ret = fastpath_start(rpc_server, rpc_fast_port, rpc_tagged_io_conns, rpc_tagged_io_depth);
+        if (ret != 0) {
+            free(handle);
+            printf("Failed to open tagged io connections to %s port: %d\n", rpc_server, rpc_fast_port);
+            return NULL;
+        }
+    }
+
+    // io_uring engine, if configured; uring_start() is a no-op once running. Without it, reads and writes
+    // stay with the worker pool.
+    if (rpc_io_uring_threads > 0) {
+        ret = uring_start(rpc_server, rpc_fast_port, rpc_io_uring_threads, rpc_io_uring_conns);
+        if (ret != 0) {
+            printf("Failed to start io_uring engine (error %d), using the io worker pool\n", ret);
+        }
+    }
+
     // TODO: NOT using any lock to test. Can cause issue in concurrent mounts.
     if (global_sock_pool == NULL) {
-        global_sock_pool = sock_pool_create(rpc_server, rpc_port, GLOBAL_SOCK_POOL_COUNT);
+        global_sock_pool = sock_pool_create(rpc_server, rpc_port, GLOBAL_SOCK_POOL_COUNT, rpc_inflight_window);
         if (global_sock_pool == NULL) {
             free(handle);
             handle = NULL;
@@ -129,6 +244,28 @@ jsonrpc_handle_t* pfs_rpc_open()
 }
 
 
+// Test hooks, see proxyfs_testing.h
+void proxyfs_test_io_disconnect()
+{
+    pthread_mutex_lock(&io_sock_lock);
+    if (io_sock_fd >= 0) {
+        sock_close(io_sock_fd);
+        io_sock_fd = -1;
+    }
+    pthread_mutex_unlock(&io_sock_lock);
+}
+
+int proxyfs_test_io_connect(char* server, int port)
+{
+    proxyfs_test_io_disconnect();
+
+    io_sock_connect(server, port);
+    if (io_sock_fd < 0) {
+        return (errno != 0) ? errno : EIO;
+    }
+    return 0;
+}
+
 // Close proxyfs RPC context. Returns errno indicating success/failure.
 void pfs_rpc_close(jsonrpc_handle_t* handle)
 {
@@ -151,15 +288,6 @@ void pfs_rpc_close(jsonrpc_handle_t* handle)
     free(handle);
 }
 
-void jsonrpc_free_read_buf(jsonrpc_context_t* ctx)
-{
-    // Free the buffer; the data is all in the json response now.
-    if (ctx->resp.readBuf != NULL) {
-        free(ctx->resp.readBuf);
-        ctx->resp.readBuf = NULL;
-    }
-}
-
 // NOTE on response handling:
 //
 // rpc_lock is primarily used to ensure that we serialize sending of requests
@@ -179,7 +307,6 @@ pthread_mutex_t rpc_lock                     = PTHREAD_MUTEX_INITIALIZER;
 int32_t         responses_needed             = 0;
 bool            response_work_thread_running = false;
 pthread_cond_t  response_work_to_do          = PTHREAD_COND_INITIALIZER;
-pthread_t       response_work_thread;
 
 // TODO: With socket pool and select mechanism for event notificaiton when a reply arrives, we may not
 // need request send triggering the worker thread to look for a reply and work complete handshake:
@@ -212,13 +339,13 @@ void wait_for_response_work()
 //
 // NOTE: This API must be called with rpc_lock held.
 //
-void record_resp_work_locked(int response_id)
+void record_resp_work_locked(uint64_t response_id)
 {
     // Record that there's a response needed. This number is incremented
     // here and decremented by rpc_get_response
     responses_needed++;
 
-    DPRINTF("resp_id:%d responses_needed incremented, now=%d\n", response_id, responses_needed);
+    DPRINTF("resp_id:%" PRIu64 " responses_needed incremented, now=%d\n", response_id, responses_needed);
 
     // XXX TODO: add response_id to the list of responses we're expecting,
     //           so that we can make sure we get what we're looking for.
@@ -226,13 +353,13 @@ void record_resp_work_locked(int response_id)
     // Wake up the waiter
     pthread_cond_signal(&response_work_to_do);
 
-    DPRINTF("resp_id:%d Unblocking of response work waiter done\n", response_id);
+    DPRINTF("resp_id:%" PRIu64 " Unblocking of response work waiter done\n", response_id);
 }
 
 // Decrement responses_needed, indicating that the response processing is complete.
-void complete_response_work(int response_id)
+void complete_response_work(uint64_t response_id)
 {
-    DPRINTF("resp_id:%d Decrementing responses_needed.\n", response_id);
+    DPRINTF("resp_id:%" PRIu64 " Decrementing responses_needed.\n", response_id);
 
     // Lock around response work control
     pthread_mutex_lock(&rpc_lock);
@@ -243,14 +370,15 @@ void complete_response_work(int response_id)
         responses_needed--;
     } else {
         // We've had some sort of race condition. PANIC so that we can find the logic problem.
-        DPANIC("FATAL, called to decrement responses_needed for response_id=%d but it's already %d!\n", response_id, responses_needed);
+        DPANIC("FATAL, called to decrement responses_needed for response_id=%" PRIu64 " but it's already %d!\n",
+               response_id, responses_needed);
         return;
     }
 
     // XXX TODO: remove response_id from the list of responses we're expecting,
     //           so that we can make sure we get what we're looking for.
 
-    DPRINTF("resp_id:%d responses_needed decremented, now=%d\n", response_id, responses_needed);
+    DPRINTF("resp_id:%" PRIu64 " responses_needed decremented, now=%d\n", response_id, responses_needed);
 
     // release response work control
     pthread_mutex_unlock(&rpc_lock);
@@ -269,9 +397,14 @@ int rpc_send_request(jsonrpc_context_t* ctx)
     int rc = 0;
 
     // Send something
-    const char* writeBuf = json_object_to_json_string_ext(ctx->req.request, JSON_C_TO_STRING_PLAIN);
+    size_t      writeLen = 0;
+    const char* writeBuf = jsonrpc_finish_req(&ctx->req, &writeLen);
+    if (writeBuf == NULL) {
+        DPRINTF("Error, ran out of memory rendering request for ctx=%p.\n", ctx);
+        return ENOMEM;
+    }
     if (debug_flag > 0) {
-        if (strlen(writeBuf) <= MAX_PRINT_SIZE) {
+        if (writeLen <= MAX_PRINT_SIZE) {
             DPRINTF("Sending data: %s\n",writeBuf);
         } else {
             // Emit a truncated version
@@ -284,29 +417,46 @@ int rpc_send_request(jsonrpc_context_t* ctx)
     }
     AddProfilerEvent(profiler, RPC_SEND_AFTER_JSON);
 
+    // Take the request text out of ctx: once it is sent, the response (and
+    // with it the ctx) can be finished with before sock_write returns
+    jsonrpc_request_t sent = ctx->req;
+    ctx->req.buf   = NULL;
+    ctx->req.owner = NULL;
+
     // Store request before sending so that it's available if we get a response before we return.
     jsonrpc_store_request(ctx);
 
     // sock_write success is 0, all else is an error
-    rc = sock_write(writeBuf);
+    rc = sock_write(writeBuf, writeLen, &ctx->sock_generation);
+    jsonrpc_release_req(&sent);
     // NOTE: This one is commented out since it races with delivery timestamps
     //AddProfilerEvent(profiler, RPC_SEND_AFTER_SOCK_WRITE);
     if (rc != 0) {
         DPRINTF("Error %d writing to socket.\n", rc);
-        jsonrpc_remove_request(ctx);
+
+        // If the sockets were closed under us, another sender failing the
+        // requests on them may have taken this one already; it can't be
+        // closed until that is done with it
+        if (!jsonrpc_remove_request(ctx)) {
+            jsonrpc_block_for_response(ctx);
+        }
+
+        // A failed send closes all the sockets, and the requests
+        // outstanding on them will never be answered
+        jsonrpc_fail_requests(sock_pool_generation(global_sock_pool), EIO);
         goto done;
     }
 
-    DPRINTF("Calling rpc_schedule_resp_work_locked, ctx=%p\n", ctx);
+    DPRINTF("Calling rpc_schedule_resp_work, ctx=%p\n", ctx);
 
     // Read response (response locking is in rpc_get_response)
-    rc = rpc_schedule_resp_work_locked(ctx->req.request_id);
+    rc = rpc_schedule_resp_work(ctx->req.request_id);
     if (rc != 0) {
-        DPRINTF("Error %d from rpc_schedule_resp_work_locked for ctx=%p\n", rc, ctx);
+        DPRINTF("Error %d from rpc_schedule_resp_work for ctx=%p\n", rc, ctx);
         goto done;
     }
 
-    DPRINTF("Returned %d from rpc_schedule_resp_work_locked for ctx=%p\n", rc, ctx);
+    DPRINTF("Returned %d from rpc_schedule_resp_work for ctx=%p\n", rc, ctx);
 
 done:
     //AddProfilerEvent(profiler, AFTER_RPC_SEND);
@@ -314,25 +464,16 @@ done:
     return rc;
 }
 
-// XXX TODO: Fix this limitation
-#define MAX_CONCURRENT_RESPONSES 16
-
 // Generically read a response from the socket.
 // This API can be called directly, or spawned with pthread_create.
 //
-// Returns the response_id, for request/response matching
+// Since connections are pipelined, one read can return any number of
+// complete responses (or none, if only part of one has arrived).
 //
 void rpc_get_response(int sockfd)
 {
     int num_responses = 0;
 
-    // Lock around request/response block
-
-    // Array of response structures, just init the first one for now
-    jsonrpc_response_t resp[MAX_CONCURRENT_RESPONSES];
-    jsonrpc_context_t* ctx[MAX_CONCURRENT_RESPONSES] = { NULL };
-    jsonrpc_init_response(&resp[0]);
-
     //DPRINTF("Reading from socket.\n");
     // sock_read returns bytes read, negative values or non-zero rtnError are errors
 
@@ -340,22 +481,47 @@ void rpc_get_response(int sockfd)
     //       spent waiting for a response to come over the socket.
     //
     //AddProfilerEvent(profiler, BEFORE_SOCK_READ);
-    int bytesRead = sock_read(sockfd, &resp[0].readBuf, &resp[0].rsp_err);
+    char*    readBuf    = NULL;
+    int      rsp_err    = 0;
+    uint64_t generation = 0;
+    int      bytesRead  = sock_read(sockfd, &readBuf, &rsp_err, &generation);
+
+    if ((rsp_err == 0) && (bytesRead < 0)) {
+        rsp_err = EIO;
+        DPRINTF("Error, read %d bytes from socket, returning error=%d.\n", bytesRead, rsp_err);
+    }
+
+    if (rsp_err != 0) {
+        DPRINTF("Error %d reading from socket.\n", rsp_err);
+        syslog(LOG_ERR, "ProxyfsRpcClient: Error reading from Swift Proxyfs server, exiting...\n");
+        exit(1);
+    }
+
+    if (bytesRead == 0) {
+        DPRINTF("No complete response on socket %d yet.\n", sockfd);
+        return;
+    }
 
     // Start timing
     profiler_t* profiler = NewProfiler(SOCK_RECEIVE);
     AddProfilerEvent(profiler, AFTER_SOCK_READ);
 
-    if ((resp[0].rsp_err == 0) && (bytesRead < 0)) {
-        resp[0].rsp_err = EIO;
-        DPRINTF("Error, read %d bytes from socket, returning error=%d.\n", bytesRead, resp[0].rsp_err);
+    // Every response ends in a newline, so that bounds how many we can have
+    int max_responses = 0;
+    char* nl;
+    for (nl = readBuf; (nl = strchr(nl, '\n')) != NULL; nl++) {
+        max_responses++;
     }
 
-    if (resp[0].rsp_err != 0) {
-        DPRINTF("Error %d reading from socket.\n", resp[0].rsp_err);
-        syslog(LOG_ERR, "ProxyfsRpcClient: Error reading from Swift Proxyfs server, exiting...\n");
-        exit(1);
+    // Array of response structures, just init the first one for now
+    jsonrpc_response_t* resp = (jsonrpc_response_t*)calloc(max_responses, sizeof(jsonrpc_response_t));
+    jsonrpc_context_t** ctx  = (jsonrpc_context_t**)calloc(max_responses, sizeof(jsonrpc_context_t*));
+    if ((resp == NULL) || (ctx == NULL)) {
+        DPANIC("FATAL: unable to allocate space for %d responses!\n", max_responses);
+        return;
     }
+    jsonrpc_init_response(&resp[0]);
+    resp[0].readBuf = readBuf;
 
     DPRINTF("Read %ld bytes into resp[0].readBuf %p from socket.\n", strlen(resp[0].readBuf),resp[0].readBuf);
     if (bytesRead != strlen(resp[0].readBuf)) {
@@ -392,7 +558,7 @@ void rpc_get_response(int sockfd)
         // Else we have multiple responses.
 
         // Range check for our response structures
-        if (num_responses > MAX_CONCURRENT_RESPONSES) {
+        if (num_responses > max_responses) {
             // Oops, can't handle this one!
             DPANIC("FATAL: received more responses (%d) than we can handle!\n", num_responses);
             return;
@@ -433,29 +599,34 @@ void rpc_get_response(int sockfd)
 #endif
     }
 
+    // These requests are no longer outstanding on the connection; let other
+    // senders use their slots in its in-flight window.
+    for (resp_index = 0; resp_index < num_responses; resp_index++) {
+        sock_pool_put(global_sock_pool, sockfd, generation);
+    }
+
     AddProfilerEvent(profiler, AFTER_GET_RESPONSES);
 
     // Now handle all our responses
     for (resp_index = 0, resp_ptr = &resp[0]; resp_index < num_responses; resp_index++, resp_ptr = &resp[resp_index]) {
 
-        resp_ptr->response = json_tokener_parse(resp_ptr->readBuf);
-        //DPRINTF("response:\n---\n%s\n---\n", json_object_to_json_string_ext(resp_ptr->response,
-        //        JSON_C_TO_STRING_SPACED | JSON_C_TO_STRING_PRETTY));
-
-        // Get id from response
-        resp_ptr->response_id = jsonrpc_get_resp_id(resp_ptr);
+        // Find the id, error and result; the result is left in the text
+        // for the caller to decode
+        jsonrpc_parse_response(resp_ptr);
 
-        // use the resp.response_id to find the request ctx
-        ctx[resp_index] = jsonrpc_get_request(resp_ptr);
+        // use the resp.response_id to find the request ctx; blocking ones
+        // are taken out of the registry, so nothing else completes them
+        ctx[resp_index] = jsonrpc_take_request(resp_ptr);
         if (ctx[resp_index] == NULL) {
-            PRINTF("ERROR, unable to find context for id=%d\n",resp_ptr->response_id);
-            goto done;
+            PRINTF("ERROR, unable to find context for id=%" PRIu64 "\n",resp_ptr->response_id);
+            continue;
         }
-        //DPRINTF("Found ctx[%d]=%p for id=%d\n", resp_index, ctx[resp_index], resp_ptr->response_id);
+        //DPRINTF("Found ctx[%d]=%p for id=%" PRIu64 "\n", resp_index, ctx[resp_index], resp_ptr->response_id);
 
         if (resp_ptr->response_id != ctx[resp_index]->req.request_id) {
             // This shouldn't happen, since we specifically looked for this id
-            PRINTF("ERROR, expected id=%d, received id=%d\n", ctx[resp_index]->req.request_id, resp_ptr->response_id);
+            PRINTF("ERROR, expected id=%" PRIu64 ", received id=%" PRIu64 "\n",
+                   ctx[resp_index]->req.request_id, resp_ptr->response_id);
 
             // Tell the caller we've been disconnected from the far end
             // XXX TODO: this isn't really true though...
@@ -464,14 +635,12 @@ void rpc_get_response(int sockfd)
             // XXX TODO: need to do the request/response handling even in this case...
             goto done;
         } else {
-            DPRINTF("Response id = %d\n",resp_ptr->response_id);
+            DPRINTF("Response id = %" PRIu64 "\n",resp_ptr->response_id);
         }
 
         // Was there an error?
-        const char* err_str = NULL;
-        resp_ptr->rsp_err = jsonrpc_get_resp_error(resp_ptr, &err_str);
         if (resp_ptr->rsp_err != 0) {
-            DPRINTF("error=%d (%s) was returned.\n",resp_ptr->rsp_err, err_str);
+            DPRINTF("error=%d was returned.\n",resp_ptr->rsp_err);
         }
     }
 
@@ -480,16 +649,14 @@ void rpc_get_response(int sockfd)
 done:
     for (resp_index = 0, resp_ptr = &resp[0]; resp_index < num_responses; resp_index++, resp_ptr = &resp[resp_index]) {
 
-        // Set the response result
-        resp_ptr->response_result = get_jrpc_result(resp_ptr->response);
-
         // Logic to skip ctx-related stuff if we failed to get ctx above
         if (ctx[resp_index] != NULL) {
-            // Save the response in the context
+            // Save the response in the context; it owns readBuf from here on,
+            // since the result is decoded straight out of it
             jsonrpc_copy_response(ctx[resp_index], resp_ptr);
-
-            // Free the buffer; the data is all in the json response now.
-            jsonrpc_free_read_buf(ctx[resp_index]);
+        } else {
+            // Nobody is waiting for this one
+            free(resp_ptr->readBuf);
         }
     }
 
@@ -498,7 +665,7 @@ done:
     for (resp_index = 0, resp_ptr = &resp[0]; resp_index < num_responses; resp_index++, resp_ptr = &resp[resp_index]) {
 
         if (ctx[resp_index] == NULL) {
-            goto really_done;
+            continue;
         }
 
         // Add profiler events to this op's context, now that we know what it is
@@ -514,8 +681,7 @@ done:
         if (internal_cb == NULL) {
             DPRINTF("ctx=%p No callback to call for blocking call; signal waiter.\n", ctx[resp_index]);
 
-            // Remove request context from outstanding request list
-            jsonrpc_remove_request(ctx[resp_index]);
+            // Already out of the outstanding request list (see jsonrpc_take_request)
 
             // Find the cv and signal it
             jsonrpc_unblock_for_response(ctx[resp_index]);
@@ -531,17 +697,19 @@ done:
 
     AddProfilerEvent(profiler, AFTER_RESPONSE_CALLBACKS);
 
-really_done:
     // Stop timing and print latency
     StopProfiler(profiler);
     // NOTE: Not dumping here since we've folded the events into the appropriate operation's profile
     //DumpProfiler(profiler);
     DeleteProfiler(profiler);
 
+    free(resp);
+    free(ctx);
+
     return;
 }
 
-// Response thread main loop
+// Response thread main loop; there are rpc_response_thread_count() of these
 void* jsonrpc_response_thread(void* not_used)
 {
     DPRINTF("Spawned thread.\n");
@@ -554,9 +722,7 @@ void* jsonrpc_response_thread(void* not_used)
         //DPRINTF("sock_pool_select returned sockfd=%d.\n",sockfd);
 
         if (sockfd < 0) {
-            // This can happen if sock_pool_put_badfd() is called and closes
-            // file desctriptors which causes select() to fail and return EBADF
-            DPRINTF("ERROR: faild to select on a socket\n");
+            DPRINTF("ERROR: faild to select on a socket: %s\n", strerror(errno));
             continue;
         }
 
@@ -581,71 +747,144 @@ void* jsonrpc_response_thread(void* not_used)
 
 // Request/response threading:
 //
-// We have a single thread for response handling. When we finish sending a request
-// and thus have a response to get, rpc_send_request calls rpc_schedule_resp_work_locked,
-// who manages work for the thread.
+// Responses are handled by a pool of receiver threads that all wait on the
+// socket pool's epoll set. Each ready socket is handed to exactly one thread,
+// which reads and dispatches its responses, so completions for different
+// sockets are processed in parallel. The threads are started the first time
+// rpc_send_request calls rpc_schedule_resp_work.
+//
+// The number of threads is set with rpc_config_set_response_threads():
+//   0 (default): one thread per socket in the pool
+//   < 0:         one thread per online CPU
+//   > 0:         exactly that many threads
 //
 
 // XXX TODO future performance improvements:
 //  - buffer pool?
 
+int rpc_response_thread_count()
+{
+    if (rpc_response_threads > 0) {
+        return rpc_response_threads;
+    }
+
+    if (rpc_response_threads < 0) {
+        long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        if (num_cpus > 0) {
+            return (int)num_cpus;
+        }
+    }
+
+    return GLOBAL_SOCK_POOL_COUNT;
+}
+
+// What the response threads run; the tests swap it out
+static void* (*rpc_response_thread_fn)(void*) = jsonrpc_response_thread;
+
 // Trigger response handling.
 //
-// TODO: With socket pool we don't neet the rpc_lock anymore.
+// Starts the response threads the first time, under rpc_lock. After that the flag, which is only set
+// once the threads are running, is all there is to check.
 //
-int rpc_schedule_resp_work_locked(int expected_response_id)
+int rpc_schedule_resp_work(uint64_t expected_response_id)
 {
     int rc = 0;
 
     // Record that response handling is required
     //record_resp_work_locked(expected_response_id);
 
+    if (__atomic_load_n(&response_work_thread_running, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&rpc_lock);
+
+    // Somebody else may have started the threads while we waited for the lock
     if (!response_work_thread_running) {
-        rc = pthread_create(&response_work_thread, NULL, &jsonrpc_response_thread, NULL);
-        if (rc != 0) {
-            DPRINTF("Error %d spawning thread to get the response\n", rc);
-        } else {
-            DPRINTF("Spawned thread %p to read the response\n",(void*)response_work_thread);
+        int num_threads = rpc_response_thread_count();
+        int i;
+
+        for (i = 0; i < num_threads; i++) {
+            pthread_t response_work_thread;
 
-            response_work_thread_running = true;
+            rc = pthread_create(&response_work_thread, NULL, rpc_response_thread_fn, NULL);
+            if (rc != 0) {
+                DPRINTF("Error %d spawning response thread %d of %d\n", rc, i, num_threads);
+
+                // As long as one thread is running responses will be processed
+                if (i > 0) {
+                    rc = 0;
+                }
+                break;
+            }
+            DPRINTF("Spawned thread %p to read responses\n",(void*)response_work_thread);
 
             // Set thread to be detached, so that the memory is cleaned up when it exits.
             // Otherwise the thread's memory shows as leaked if there is no pthread_join.
-            rc = pthread_detach(response_work_thread);
-            if (rc != 0) {
-                DPRINTF("Error %d detaching thread %p\n", rc, (void*)response_work_thread);
-            } else {
-                DPRINTF("Detached thread %p to read the response\n",(void*)response_work_thread);
+            if (pthread_detach(response_work_thread) != 0) {
+                DPRINTF("Error detaching thread %p\n", (void*)response_work_thread);
             }
         }
+
+        if (rc == 0) {
+            __atomic_store_n(&response_work_thread_running, true, __ATOMIC_RELEASE);
+        }
     }
 
-done:
+    pthread_mutex_unlock(&rpc_lock);
 
     return rc;
 }
 
-int jsonrpc_exec_request_blocking(jsonrpc_context_t* ctx)
+// Test hooks, see proxyfs_testing.h
+void jsonrpc_test_set_response_thread(void* (*thread_fn)(void*))
 {
-    profiler_t* profiler = jsonrpc_get_profiler(ctx);
+    pthread_mutex_lock(&rpc_lock);
+    rpc_response_thread_fn = (thread_fn != NULL) ? thread_fn : jsonrpc_response_thread;
+    pthread_mutex_unlock(&rpc_lock);
+}
 
+bool jsonrpc_test_set_response_threads_running(bool running)
+{
+    pthread_mutex_lock(&rpc_lock);
+    bool was_running = response_work_thread_running;
+    __atomic_store_n(&response_work_thread_running, running, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&rpc_lock);
+
+    return was_running;
+}
+
+int jsonrpc_exec_request_blocking(jsonrpc_context_t* ctx)
+{
     // Send request
-    int rc = rpc_send_request(ctx);
+    int rc = jsonrpc_send_request(ctx);
     if (rc != 0) {
-        DPRINTF("Error %d sending request.\n", rc);
         return rc;
     }
-    // else rc == 0
 
     // Block until we get this response
+    return jsonrpc_wait_for_response(ctx);
+}
+
+int jsonrpc_send_request(jsonrpc_context_t* ctx)
+{
+    int rc = rpc_send_request(ctx);
+    if (rc != 0) {
+        DPRINTF("Error %d sending request.\n", rc);
+    }
+    return rc;
+}
+
+int jsonrpc_wait_for_response(jsonrpc_context_t* ctx)
+{
+    profiler_t* profiler = jsonrpc_get_profiler(ctx);
+
     //AddProfilerEvent(profiler, BEFORE_RPC_RX);
     jsonrpc_block_for_response(ctx);
     //AddProfilerEvent(profiler, AFTER_RPC_RX);
 
     // Extract status to return
-    rc = ctx->resp.rsp_err;
-
-    return rc;
+    return ctx->resp.rsp_err;
 }
 
 int jsonrpc_exec_request_nonblocking(jsonrpc_context_t* ctx, jsonrpc_internal_callback_t internal_cb)
@@ -15,9 +15,19 @@ void pfs_rpc_close(jsonrpc_handle_t* handle);
 // Execute a JSON request, blocking for the response.
 int jsonrpc_exec_request_blocking(jsonrpc_context_t* ctx);
 
+// The two halves of jsonrpc_exec_request_blocking, for callers that have
+// something to do while the request is outstanding. Once sent, a request
+// must be waited for before its context is closed.
+int jsonrpc_send_request(jsonrpc_context_t* ctx);
+int jsonrpc_wait_for_response(jsonrpc_context_t* ctx);
+
 // Execute a JSON request, non-blocking. Callback is provided for handling the response.
 int jsonrpc_exec_request_nonblocking(jsonrpc_context_t* ctx, jsonrpc_internal_callback_t internal_cb);
 
+// Replace io_sock_fd, which a request left broken_fd unusable, with a new connection to the same place.
+// Once for however many callers saw it fail; if it fails, io_sock_fd is -1 until a later call succeeds.
+void io_sock_reconnect(int broken_fd);
+
 // In proxyfs_req_resp.c; here because exported to proxyfs_api.c
 jsonrpc_context_t* jsonrpc_get_request_by_cookie(void* cookie);
 
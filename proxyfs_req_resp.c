@@ -6,6 +6,7 @@
 #include <pthread.h>
 #include <errno.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <proxyfs_jsonrpc.h>
 #include <json_utils_internal.h>
 #include <socket.h>
@@ -15,107 +16,59 @@
 // Set to nonzero to enable LIST_PRINTFs
 int list_debug_flag = 0;
 
-// Global for JSON RPC request ID.
+// Global for JSON RPC request ID. It's 64 bits so that it never wraps, and
+// taken with an atomic add rather than under a lock.
 //
-static int jsonrpc_request_id = 0;
+static uint64_t jsonrpc_request_id = 0;
 
-// Lock to protect request ID
-pthread_mutex_t request_id_lock = PTHREAD_MUTEX_INITIALIZER;
-
-int get_request_id()
+uint64_t get_request_id()
 {
-    int reqId = 0;
-
-    pthread_mutex_lock(&request_id_lock);
-    reqId = jsonrpc_request_id++;
-    pthread_mutex_unlock(&request_id_lock);
-
-    return reqId;
+    return __sync_fetch_and_add(&jsonrpc_request_id, 1);
 }
 
 void jsonrpc_init_request(jsonrpc_request_t* req, const char* method)
 {
-    // Alloc JSON object for request
-    req->request         = json_object_new_object();
-    req->request_params  = NULL;
-
     // Create request ID
     req->request_id = get_request_id();
 
-    // Set the request method
+    // Start rendering the request, with the method
     jsonrpc_set_req_method(req, method);
 }
 
 void jsonrpc_init_response(jsonrpc_response_t* resp)
 {
-    resp->response_id     = -1;
+    resp->response_id     = JSONRPC_NO_ID;
     resp->response        = NULL;
     resp->response_result = NULL;
     resp->rsp_err         = -1;
+    resp->result.start    = NULL;
+    resp->result.end      = NULL;
     resp->readBuf         = NULL;
 }
 
 void jsonrpc_print_response(char* prefix, jsonrpc_response_t* resp)
 {
-    DPRINTF("%s\n response_id=%d\n response=%p\n response_result=%p\n rsp_err=%d\n readBuf=%p\n\n",
+    DPRINTF("%s\n response_id=%" PRIu64 "\n response=%p\n response_result=%p\n rsp_err=%d\n readBuf=%p\n\n",
             prefix, resp->response_id, resp->response, resp->response_result, resp->rsp_err, resp->readBuf);
 }
 
-void jsonrpc_init_cv_info(jsonrpc_cv_info_t* cv_info)
-{
-    pthread_mutex_init(&cv_info->mutex, NULL);
-    pthread_cond_init(&cv_info->got_resp, NULL);
-    cv_info->have_response = false;
-}
-
-void jsonrpc_cleanup_cv_info(jsonrpc_cv_info_t* cv_info)
-{
-    pthread_mutex_destroy(&cv_info->mutex);
-    pthread_cond_destroy(&cv_info->got_resp);
-}
-
-// Wait on cv until we get the response
+// Wait until we get the response
 void jsonrpc_block_for_response(jsonrpc_context_t* ctx)
 {
     DPRINTF("Blocking until we get the response for ctx=%p.\n",ctx);
 
-    // protect have_response flag
-    pthread_mutex_lock(&ctx->cv_info.mutex);
-
-    // If we don't have a response, then wait
-    while (!ctx->cv_info.have_response) {
-        pthread_cond_wait(&ctx->cv_info.got_resp, &ctx->cv_info.mutex);
-    }
-
-    //DPRINTF("Blocking until we get the response for ctx=%p (pre-unlock).\n",ctx);
-
-    // release have_response flag
-    pthread_mutex_unlock(&ctx->cv_info.mutex);
+    completion_wait(&ctx->response_done);
 
-    DPRINTF("Finished blocking until we get the response for ctx=%p (post-unlock), have_response=%s.\n",
-            ctx,(ctx->cv_info.have_response?"true":"false"));
+    DPRINTF("Finished blocking until we get the response for ctx=%p.\n",ctx);
 }
 
-// Unblock whoever is waiting for the response
+// Wake up whoever is waiting for the response
 void jsonrpc_unblock_for_response(jsonrpc_context_t* ctx)
 {
     DPRINTF("Unblocking whoever is waiting for the response for ctx=%p.\n",ctx);
 
-    // protect have_response flag
-    pthread_mutex_lock(&ctx->cv_info.mutex);
-
-    // Set the have_response flag
-    ctx->cv_info.have_response = true;
-
-    // Wake up the waiter
-    pthread_cond_signal(&ctx->cv_info.got_resp);
-
-    //DPRINTF("Unblocking whoever is waiting for the response for ctx=%p (pre-unlock).\n",ctx);
-
-    // release have_response flag
-    pthread_mutex_unlock(&ctx->cv_info.mutex);
-
-    DPRINTF("Unblocking done. for ctx=%p (post-unlock)\n",ctx);
+    // Once signalled, the waiter may close ctx at any moment
+    completion_signal(&ctx->response_done);
 }
 
 // Copy response info into ctx
@@ -125,6 +78,7 @@ void jsonrpc_copy_response(jsonrpc_context_t* ctx, jsonrpc_response_t* resp)
     ctx->resp.response        = resp->response;
     ctx->resp.response_result = resp->response_result;
     ctx->resp.rsp_err         = resp->rsp_err;
+    ctx->resp.result          = resp->result;
     ctx->resp.readBuf         = resp->readBuf;
 }
 
@@ -286,13 +240,105 @@ profiler_t* jsonrpc_get_profiler(jsonrpc_context_t* ctx)
     return ctx->profiler;
 }
 
-// XXX TODO: create a ctx pool so that we don't have to alloc/free these on the fly?
+// Context pool
 //
-jsonrpc_context_t* construct_ctx(jsonrpc_handle_t* handle, const char* method)
+// Closed contexts go on a free list belonging to the thread that closes them,
+// with a spare request buffer kept in their request, so that opening a
+// context on the metadata path doesn't call malloc. The thread that
+// closes a context needn't be the one that opened it; each list holds at
+// most CTX_POOL_MAX_FREE contexts and frees any beyond that, and is freed
+// when its thread exits.
+
+#define CTX_POOL_MAX_FREE  64
+
+typedef struct {
+    jsonrpc_context_t* free_list;
+    int                num_free;
+} jsonrpc_ctx_pool_t;
+
+static pthread_key_t  ctx_pool_key;
+static pthread_once_t ctx_pool_once   = PTHREAD_ONCE_INIT;
+static uint64_t       ctx_alloc_count = 0;
+
+static void ctx_free(jsonrpc_context_t* ctx)
+{
+    jsonrpc_free_req(&ctx->req);
+    free(ctx);
+}
+
+static void ctx_pool_free(void* arg)
 {
-    // Alloc memory for context to return
-    jsonrpc_context_t* ctx = (jsonrpc_context_t*)malloc(sizeof(jsonrpc_context_t));
+    jsonrpc_ctx_pool_t* pool = (jsonrpc_ctx_pool_t*)arg;
+    while (pool->free_list != NULL) {
+        jsonrpc_context_t* ctx = pool->free_list;
+        pool->free_list = ctx->pool_next;
+        ctx_free(ctx);
+    }
+    free(pool);
+}
+
+static void ctx_pool_init()
+{
+    pthread_key_create(&ctx_pool_key, ctx_pool_free);
+}
+
+// This thread's pool, or NULL if it couldn't be made
+static jsonrpc_ctx_pool_t* ctx_pool_thread()
+{
+    pthread_once(&ctx_pool_once, ctx_pool_init);
+    jsonrpc_ctx_pool_t* pool = (jsonrpc_ctx_pool_t*)pthread_getspecific(ctx_pool_key);
+    if (pool == NULL) {
+        pool = (jsonrpc_ctx_pool_t*)calloc(1, sizeof(jsonrpc_ctx_pool_t));
+        if ((pool == NULL) || (pthread_setspecific(ctx_pool_key, pool) != 0)) {
+            free(pool);
+            return NULL;
+        }
+    }
+    return pool;
+}
+
+static jsonrpc_context_t* ctx_pool_get()
+{
+    jsonrpc_ctx_pool_t* pool = ctx_pool_thread();
+    jsonrpc_context_t*  ctx  = NULL;
+
+    if ((pool != NULL) && (pool->free_list != NULL)) {
+        ctx = pool->free_list;
+        pool->free_list = ctx->pool_next;
+        pool->num_free--;
+        return ctx;
+    }
+
+    ctx = (jsonrpc_context_t*)malloc(sizeof(jsonrpc_context_t));
+    if (ctx == NULL) {
+        return NULL;
+    }
     bzero(ctx, sizeof(jsonrpc_context_t));
+    __sync_fetch_and_add(&ctx_alloc_count, 1);
+    return ctx;
+}
+
+static void ctx_pool_put(jsonrpc_context_t* ctx)
+{
+    jsonrpc_ctx_pool_t* pool = ctx_pool_thread();
+
+    if ((pool == NULL) || (pool->num_free >= CTX_POOL_MAX_FREE)) {
+        ctx_free(ctx);
+        return;
+    }
+    ctx->pool_next  = pool->free_list;
+    pool->free_list = ctx;
+    pool->num_free++;
+}
+
+jsonrpc_context_t* construct_ctx(jsonrpc_handle_t* handle, const char* method)
+{
+    // Get a context to return, from the pool if there's one there
+    jsonrpc_context_t* ctx = ctx_pool_get();
+    if (ctx == NULL) {
+        return NULL;
+    }
+    ctx->pool_next = NULL;
 
     // Set RPC handle
     ctx->rpc_handle = handle;
@@ -300,7 +346,8 @@ jsonrpc_context_t* construct_ctx(jsonrpc_handle_t* handle, const char* method)
     // Initialize request and response
     jsonrpc_init_request(&ctx->req, method);
     jsonrpc_init_response(&ctx->resp);
-    jsonrpc_init_cv_info(&ctx->cv_info);
+    completion_init(&ctx->response_done);
+    ctx->sock_generation = 0;
 
     // Initialize callback stuff
     jsonrpc_init_user_callback(&ctx->user_callback);
@@ -308,9 +355,6 @@ jsonrpc_context_t* construct_ctx(jsonrpc_handle_t* handle, const char* method)
     // Initialize internal callback
     ctx->internal_callback = NULL;
 
-    // Initialize next pointer
-    ctx->next = NULL;
-
     // Initialize timing profiler
     ctx->profiler = NULL;
 
@@ -321,18 +365,25 @@ void destruct_ctx(jsonrpc_context_t* ctx)
 {
     if (ctx == NULL) return;
 
-    // Free json objects
-    json_object_put(ctx->req.request);
+    // Give back the request buffer, if the request wasn't sent, and free
+    // the response's text and json objects
+    jsonrpc_release_req(&ctx->req);
     json_object_put(ctx->resp.response);
+    free(ctx->resp.readBuf);
+    ctx->resp.response = NULL;
+    ctx->resp.readBuf  = NULL;
 
     // Initialize timing profiler
     ctx->profiler = NULL;
 
-    //DPRINTF("Freeing ctx=%p (post-lock).\n",ctx);
+    // Return context to the pool. Note that we don't free the rpc_handle,
+    // because we didn't allocate it.
+    ctx_pool_put(ctx);
+}
 
-    // Free context. Note that we don't free the rpc_handle, because
-    // we didn't allocate it.
-    free(ctx);
+uint64_t jsonrpc_ctx_allocs()
+{
+    return ctx_alloc_count;
 }
 
 // Create a jsonrpc context and set the request method
@@ -346,165 +397,497 @@ void jsonrpc_close(jsonrpc_context_t* ctx)
     destruct_ctx(ctx);
 }
 
-int jsonrpc_num_in_list(jsonrpc_context_t* head, pthread_mutex_t* lock)
+// Outstanding request registry
+//
+// Requests that have been sent but not yet answered are kept in a hash table
+// keyed by request id, so that the response thread can match a response to
+// its context in constant time no matter how many requests are in flight.
+// A second table indexes the same contexts by the caller's cookie.
+//
+// Each table is split into REGISTRY_SHARD_COUNT shards, each with its own
+// lock, so that senders storing requests and the response thread looking
+// them up rarely contend on the same mutex. Within a shard we use open
+// addressing with linear probing; removal uses backward-shift deletion so
+// that no tombstones accumulate.
+//
+#define REGISTRY_SHARD_COUNT  64   // must be a power of 2
+#define REGISTRY_MIN_SLOTS    16   // must be a power of 2
+
+typedef uint64_t (*registry_key_fn_t)(jsonrpc_context_t* ctx);
+
+typedef struct {
+    pthread_mutex_t     lock;
+    int                 num_entries;
+    int                 num_slots;
+    jsonrpc_context_t** slots;
+} registry_shard_t;
+
+typedef struct {
+    char*             name;
+    registry_key_fn_t key_of;
+    registry_shard_t  shards[REGISTRY_SHARD_COUNT];
+} registry_t;
+
+uint64_t registry_id_key(jsonrpc_context_t* ctx)
+{
+    return ctx->req.request_id;
+}
+
+uint64_t registry_cookie_key(jsonrpc_context_t* ctx)
 {
-    int num_items= 0;
+    return (uint64_t)ctx->user_callback.cookie;
+}
+
+// Global tables of outstanding requests
+registry_t requests_by_id     = { "requests_by_id",     registry_id_key };
+registry_t requests_by_cookie = { "requests_by_cookie", registry_cookie_key };
 
-    // Not locking here; if enabled and you call this function while holding
-    // the lock, it hangs.
-    pthread_mutex_lock(lock);
+pthread_once_t registry_once = PTHREAD_ONCE_INIT;
+
+void registry_init_table(registry_t* table)
+{
+    int i;
+    for (i = 0; i < REGISTRY_SHARD_COUNT; i++) {
+        registry_shard_t* shard = &table->shards[i];
 
-    jsonrpc_context_t* currPtr = head;
-    while (currPtr != NULL) {
-        num_items++;
-        currPtr = currPtr->next;
+        pthread_mutex_init(&shard->lock, NULL);
+        shard->num_entries = 0;
+        shard->num_slots   = REGISTRY_MIN_SLOTS;
+        shard->slots       = (jsonrpc_context_t**)calloc(REGISTRY_MIN_SLOTS, sizeof(jsonrpc_context_t*));
+        if (shard->slots == NULL) {
+            PANIC("registry_init_table(): could not malloc %d slots for %s", REGISTRY_MIN_SLOTS, table->name);
+        }
     }
+}
 
-	pthread_mutex_unlock(lock);
+void registry_init()
+{
+    registry_init_table(&requests_by_id);
+    registry_init_table(&requests_by_cookie);
+}
 
-    return num_items;
+// Scramble the key so that sequential request ids and aligned cookie pointers
+// spread evenly across shards and slots.
+uint64_t registry_hash(uint64_t key)
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return key;
 }
 
-// Save the request context somewhere
-void jsonrpc_store_in_list(jsonrpc_context_t* ctx, jsonrpc_context_t** head, pthread_mutex_t* lock, char* list_name)
+registry_shard_t* registry_shard(registry_t* table, uint64_t hash)
 {
-    pthread_mutex_lock(lock);
+    return &table->shards[hash & (REGISTRY_SHARD_COUNT - 1)];
+}
 
-    LIST_PRINTF("%s: current head is %p\n", list_name, *head);
+int registry_home_slot(registry_shard_t* shard, uint64_t hash)
+{
+    // The low bits picked the shard; use the ones above them for the slot.
+    return (int)((hash >> 6) & (shard->num_slots - 1));
+}
 
-    // Store the request at the head of the list
-    if (*head != NULL) {
-        ctx->next = *head;
-    } else {
-        ctx->next = NULL;
+// Insert without checking the load factor. Must be called with the shard lock held.
+void registry_insert_locked(registry_t* table, registry_shard_t* shard, jsonrpc_context_t* ctx)
+{
+    int mask = shard->num_slots - 1;
+    int slot = registry_home_slot(shard, registry_hash(table->key_of(ctx)));
+
+    while (shard->slots[slot] != NULL) {
+        slot = (slot + 1) & mask;
+    }
+    shard->slots[slot] = ctx;
+    shard->num_entries++;
+}
+
+// Double the number of slots in the shard and rehash. Must be called with the shard lock held.
+void registry_grow_locked(registry_t* table, registry_shard_t* shard)
+{
+    int                 old_num_slots = shard->num_slots;
+    jsonrpc_context_t** old_slots     = shard->slots;
+
+    shard->slots = (jsonrpc_context_t**)calloc(old_num_slots * 2, sizeof(jsonrpc_context_t*));
+    if (shard->slots == NULL) {
+        PANIC("registry_grow_locked(): could not malloc %d slots for %s", old_num_slots * 2, table->name);
     }
-    *head = ctx;
-    LIST_PRINTF("%s: setting %p->next to %p; new head is %p\n", list_name, ctx, ctx->next, *head);
+    shard->num_slots   = old_num_slots * 2;
+    shard->num_entries = 0;
 
-    pthread_mutex_unlock(lock);
+    int i;
+    for (i = 0; i < old_num_slots; i++) {
+        if (old_slots[i] != NULL) {
+            registry_insert_locked(table, shard, old_slots[i]);
+        }
+    }
 
-    LIST_PRINTF("%s: stored request %p with id %d; list size is %d\n", list_name, ctx, ctx->req.request_id, jsonrpc_num_in_list(*head, lock));
+    free(old_slots);
 }
 
-// remove the request from the list
-// caller still must free the ctx.
-void jsonrpc_remove_from_list(jsonrpc_context_t* ctx, jsonrpc_context_t** head, pthread_mutex_t* lock, char* list_name)
+void registry_store(registry_t* table, jsonrpc_context_t* ctx)
 {
-    if (ctx == NULL) return;
+    registry_shard_t* shard = registry_shard(table, registry_hash(table->key_of(ctx)));
 
-    pthread_mutex_lock(lock);
+    pthread_mutex_lock(&shard->lock);
 
-    jsonrpc_context_t* currPtr = *head;
-    jsonrpc_context_t* prevPtr = NULL;
-    bool request_found = false;
+    // Keep the load factor at or below 3/4 so probe sequences stay short
+    if ((shard->num_entries + 1) * 4 > shard->num_slots * 3) {
+        registry_grow_locked(table, shard);
+    }
+    registry_insert_locked(table, shard, ctx);
 
-    int count = 0;
-    for (; currPtr != NULL; count++, prevPtr = currPtr, currPtr = currPtr->next) {
+    pthread_mutex_unlock(&shard->lock);
 
-        if (currPtr == ctx) {
-            // Found it
-            if (prevPtr == NULL) {
-                // Need to update the head of the list
-                *head = currPtr->next;
-            } else {
-                // Make previous node point to next one
-                prevPtr->next = currPtr->next;
-            }
-            request_found = true;
-            ctx->next = NULL;
+    LIST_PRINTF("%s: stored request %p with id %" PRIu64 "\n", table->name, ctx, ctx->req.request_id);
+}
 
+// Empty the slot. Must be called with the shard lock held.
+//
+// Backward-shift deletion: walk the rest of the probe run and pull back any
+// entry whose home slot is not between the hole and itself. Entries only
+// move into the slot or into slots after it (or, wrapping around, from the
+// start of the table to its end).
+void registry_remove_slot_locked(registry_t* table, registry_shard_t* shard, int slot)
+{
+    int mask = shard->num_slots - 1;
+    int hole = slot;
+    int next = slot;
+    while (1) {
+        next = (next + 1) & mask;
+        if (shard->slots[next] == NULL) {
             break;
         }
+
+        int home = registry_home_slot(shard, registry_hash(table->key_of(shard->slots[next])));
+        bool stays = (hole <= next) ? ((hole < home) && (home <= next))
+                                    : ((hole < home) || (home <= next));
+        if (!stays) {
+            shard->slots[hole] = shard->slots[next];
+            hole = next;
+        }
     }
+    shard->slots[hole] = NULL;
+    shard->num_entries--;
+}
 
-    pthread_mutex_unlock(lock);
+// Remove this exact ctx (several contexts may share a key in the cookie table).
+bool registry_remove(registry_t* table, jsonrpc_context_t* ctx)
+{
+    uint64_t          hash  = registry_hash(table->key_of(ctx));
+    registry_shard_t* shard = registry_shard(table, hash);
+    bool              found = false;
 
-    if (request_found) {
-        LIST_PRINTF("removed request %p with id %d from list %s; list size is %d\n", ctx, ctx->req.request_id, list_name, jsonrpc_num_in_list(*head, lock));
-    } else {
-        LIST_PRINTF("could not find request %p with id %d in the list\n", ctx, ctx->req.request_id);
+    pthread_mutex_lock(&shard->lock);
+
+    int mask = shard->num_slots - 1;
+    int slot = registry_home_slot(shard, hash);
+
+    for (; shard->slots[slot] != NULL; slot = (slot + 1) & mask) {
+        if (shard->slots[slot] == ctx) {
+            found = true;
+            break;
+        }
+    }
+
+    if (found) {
+        registry_remove_slot_locked(table, shard, slot);
     }
+
+    pthread_mutex_unlock(&shard->lock);
+
+    return found;
 }
 
-// Return the request context that corresponds to the response_id
-jsonrpc_context_t* jsonrpc_find_in_list_by_id(int request_id, jsonrpc_context_t** head, pthread_mutex_t* lock, char* list_name)
+// Find the ctx for key and, if it is a blocking request (one without an
+// internal callback), remove it in the same go, so that whoever gets it here
+// is the only one to complete it.
+jsonrpc_context_t* registry_take_blocking(registry_t* table, uint64_t key)
 {
-    jsonrpc_context_t* currPtr = *head;
+    uint64_t           hash  = registry_hash(key);
+    registry_shard_t*  shard = registry_shard(table, hash);
+    jsonrpc_context_t* ctx   = NULL;
 
-    pthread_mutex_lock(lock);
+    pthread_mutex_lock(&shard->lock);
 
-    int count = 0;
-    for (; currPtr != NULL; count++, currPtr = currPtr->next) {
-        if (currPtr->req.request_id == request_id) {
-            pthread_mutex_unlock(lock);
+    int mask = shard->num_slots - 1;
+    int slot = registry_home_slot(shard, hash);
 
-            // Found it
-            return currPtr;
+    for (; shard->slots[slot] != NULL; slot = (slot + 1) & mask) {
+        if (table->key_of(shard->slots[slot]) == key) {
+            ctx = shard->slots[slot];
+            if (ctx->internal_callback == NULL) {
+                registry_remove_slot_locked(table, shard, slot);
+            }
+            break;
         }
     }
 
-    DPRINTF("Did not find the request in list - find by id: %d\n", request_id);
-    pthread_mutex_unlock(lock);
+    pthread_mutex_unlock(&shard->lock);
 
-    // If we get here, we didn't find it
-    return NULL;
+    return ctx;
 }
 
-// Return the request context that corresponds to the cookie
-jsonrpc_context_t* jsonrpc_find_in_list_by_cookie(void* cookie, jsonrpc_context_t** head, pthread_mutex_t* lock, char* list_name)
+jsonrpc_context_t* registry_find(registry_t* table, uint64_t key)
 {
-    jsonrpc_context_t* currPtr = *head;
+    uint64_t           hash  = registry_hash(key);
+    registry_shard_t*  shard = registry_shard(table, hash);
+    jsonrpc_context_t* ctx   = NULL;
+
+    pthread_mutex_lock(&shard->lock);
 
-    pthread_mutex_lock(lock);
+    int mask = shard->num_slots - 1;
+    int slot = registry_home_slot(shard, hash);
 
-    int count = 0;
-    for (; currPtr != NULL; count++, currPtr = currPtr->next) {
-        if (currPtr->user_callback.cookie == cookie) {
-            pthread_mutex_unlock(lock);
-            // Found it
-            return currPtr;
+    for (; shard->slots[slot] != NULL; slot = (slot + 1) & mask) {
+        if (table->key_of(shard->slots[slot]) == key) {
+            ctx = shard->slots[slot];
+            break;
         }
     }
 
-    pthread_mutex_unlock(lock);
+    pthread_mutex_unlock(&shard->lock);
 
-    // If we get here, we didn't find it
-    LIST_PRINTF("Unable to find cookie %p in list. List size: %d\n", cookie, jsonrpc_num_in_list(*head, lock));
-    return NULL;
+    return ctx;
 }
 
-// Global pointer to linked list of outstanding requests
-jsonrpc_context_t* requests_in_progress = NULL;
-pthread_mutex_t    requests_in_progress_lock = PTHREAD_MUTEX_INITIALIZER;
-char               request_list_name[]  = "request_list";
+int registry_count(registry_t* table)
+{
+    int num_items = 0;
+
+    int i;
+    for (i = 0; i < REGISTRY_SHARD_COUNT; i++) {
+        registry_shard_t* shard = &table->shards[i];
+
+        pthread_mutex_lock(&shard->lock);
+        num_items += shard->num_entries;
+        pthread_mutex_unlock(&shard->lock);
+    }
+
+    return num_items;
+}
 
 // Return the number of outstanding requests
 int jsonrpc_num_requests()
 {
-    return jsonrpc_num_in_list(requests_in_progress, &requests_in_progress_lock);
+    pthread_once(&registry_once, registry_init);
+
+    return registry_count(&requests_by_id);
 }
 
 // Save the request context somewhere
 void jsonrpc_store_request(jsonrpc_context_t* ctx)
 {
-    jsonrpc_store_in_list(ctx, &requests_in_progress, &requests_in_progress_lock, request_list_name);
+    pthread_once(&registry_once, registry_init);
+
+    registry_store(&requests_by_id, ctx);
+
+    // Only async requests carry a cookie; blocking ones are never looked up by it.
+    if (ctx->user_callback.cookie != NULL) {
+        registry_store(&requests_by_cookie, ctx);
+    }
 }
 
-// remove the request from the list
+// remove the request from the registry
 // caller still must free the ctx.
-void jsonrpc_remove_request(jsonrpc_context_t* ctx)
+bool jsonrpc_remove_request(jsonrpc_context_t* ctx)
 {
-    jsonrpc_remove_from_list(ctx, &requests_in_progress, &requests_in_progress_lock, request_list_name);
+    bool found;
+
+    if (ctx == NULL) return false;
+
+    pthread_once(&registry_once, registry_init);
+
+    found = registry_remove(&requests_by_id, ctx);
+    if (found) {
+        LIST_PRINTF("removed request %p with id %" PRIu64 "\n", ctx, ctx->req.request_id);
+    } else {
+        LIST_PRINTF("could not find request %p with id %" PRIu64 "\n", ctx, ctx->req.request_id);
+    }
+
+    if (ctx->user_callback.cookie != NULL) {
+        registry_remove(&requests_by_cookie, ctx);
+    }
+
+    return found;
+}
+
+// Take the request a response is for; see proxyfs_req_resp.h
+jsonrpc_context_t* jsonrpc_take_request_by_id(uint64_t request_id)
+{
+    pthread_once(&registry_once, registry_init);
+
+    jsonrpc_context_t* ctx = registry_take_blocking(&requests_by_id, request_id);
+    if (ctx == NULL) {
+        DPRINTF("Did not find the request in registry - find by id: %" PRIu64 "\n", request_id);
+    } else if ((ctx->internal_callback == NULL) && (ctx->user_callback.cookie != NULL)) {
+        registry_remove(&requests_by_cookie, ctx);
+    }
+    return ctx;
+}
+
+jsonrpc_context_t* jsonrpc_take_request(jsonrpc_response_t* resp)
+{
+    return jsonrpc_take_request_by_id(resp->response_id);
+}
+
+// Fail the blocking requests lost with the pool's sockets; see proxyfs_req_resp.h
+int jsonrpc_fail_requests(uint64_t generation, int err)
+{
+    jsonrpc_context_t** failed     = NULL;
+    int                 num_failed = 0;
+    int                 max_failed = 0;
+    int                 i;
+
+    pthread_once(&registry_once, registry_init);
+
+    for (i = 0; i < REGISTRY_SHARD_COUNT; i++) {
+        registry_shard_t* shard = &requests_by_id.shards[i];
+        int               slot  = 0;
+
+        pthread_mutex_lock(&shard->lock);
+        while (slot < shard->num_slots) {
+            jsonrpc_context_t* ctx  = shard->slots[slot];
+            uint64_t           sent = (ctx != NULL) ? __atomic_load_n(&ctx->sock_generation, __ATOMIC_RELAXED) : 0;
+
+            if ((ctx == NULL) || (ctx->internal_callback != NULL) || (sent == 0) || (sent >= generation)) {
+                slot++;
+                continue;
+            }
+
+            if (num_failed == max_failed) {
+                max_failed = (max_failed > 0) ? max_failed * 2 : 16;
+                failed     = (jsonrpc_context_t**)realloc(failed, max_failed * sizeof(jsonrpc_context_t*));
+                if (failed == NULL) {
+                    PANIC("jsonrpc_fail_requests(): could not malloc %d contexts", max_failed);
+                }
+            }
+            failed[num_failed++] = ctx;
+
+            // Whatever moves into the slot hasn't been looked at yet
+            registry_remove_slot_locked(&requests_by_id, shard, slot);
+        }
+        pthread_mutex_unlock(&shard->lock);
+    }
+
+    // Nobody else can find them now, so they're ours to complete
+    for (i = 0; i < num_failed; i++) {
+        jsonrpc_context_t* ctx = failed[i];
+
+        DPRINTF("Failing request %" PRIu64 " sent in pool generation %" PRIu64 " with %d\n",
+                ctx->req.request_id, ctx->sock_generation, err);
+        if (ctx->user_callback.cookie != NULL) {
+            registry_remove(&requests_by_cookie, ctx);
+        }
+        ctx->resp.rsp_err = err;
+        jsonrpc_unblock_for_response(ctx);
+    }
+
+    free(failed);
+
+    return num_failed;
 }
 
 // Return the request context that corresponds to the request_id
+jsonrpc_context_t* jsonrpc_get_request_by_id(uint64_t request_id)
+{
+    pthread_once(&registry_once, registry_init);
+
+    jsonrpc_context_t* ctx = registry_find(&requests_by_id, request_id);
+    if (ctx == NULL) {
+        DPRINTF("Did not find the request in registry - find by id: %" PRIu64 "\n", request_id);
+    }
+    return ctx;
+}
+
+// Return the request context that corresponds to the response_id
 jsonrpc_context_t* jsonrpc_get_request(jsonrpc_response_t* resp)
 {
-    return jsonrpc_find_in_list_by_id(resp->response_id, &requests_in_progress, &requests_in_progress_lock, request_list_name);
+    return jsonrpc_get_request_by_id(resp->response_id);
 }
 
 // Return the request context that corresponds to the caller-provided cookie
 jsonrpc_context_t* jsonrpc_get_request_by_cookie(void* cookie)
 {
-    return jsonrpc_find_in_list_by_cookie(cookie, &requests_in_progress, &requests_in_progress_lock, request_list_name);
+    if (cookie == NULL) return NULL;
+
+    pthread_once(&registry_once, registry_init);
+
+    jsonrpc_context_t* ctx = registry_find(&requests_by_cookie, (uint64_t)cookie);
+    if (ctx == NULL) {
+        LIST_PRINTF("Unable to find cookie %p in registry.\n", cookie);
+    }
+    return ctx;
+}
+
+// Create a bare request context for the registry tests; see proxyfs_testing.h
+jsonrpc_context_t* jsonrpc_test_ctx_create(uint64_t request_id, void* cookie)
+{
+    jsonrpc_context_t* ctx = (jsonrpc_context_t*)calloc(1, sizeof(jsonrpc_context_t));
+    if (ctx == NULL) {
+        return NULL;
+    }
+    ctx->req.request_id       = request_id;
+    ctx->user_callback.cookie = cookie;
+    return ctx;
+}
+
+void jsonrpc_test_ctx_set_sent(jsonrpc_context_t* ctx, uint64_t generation)
+{
+    __atomic_store_n(&ctx->sock_generation, generation, __ATOMIC_RELAXED);
+}
+
+void jsonrpc_test_ctx_destroy(jsonrpc_context_t* ctx)
+{
+    free(ctx);
+}
+
+void jsonrpc_test_set_next_request_id(uint64_t request_id)
+{
+    __sync_lock_test_and_set(&jsonrpc_request_id, request_id);
+}
+
+uint64_t jsonrpc_test_get_request_id()
+{
+    return get_request_id();
+}
+
+// Render requests without sending them; see proxyfs_testing.h
+jsonrpc_context_t* jsonrpc_test_req_open(const char* method)
+{
+    return construct_ctx(NULL, method);
+}
+
+uint64_t jsonrpc_test_req_id(jsonrpc_context_t* ctx)
+{
+    return ctx->req.request_id;
+}
+
+const char* jsonrpc_test_req_text(jsonrpc_context_t* ctx, size_t* out_len)
+{
+    return jsonrpc_finish_req(&ctx->req, out_len);
+}
+
+void jsonrpc_test_req_close(jsonrpc_context_t* ctx)
+{
+    destruct_ctx(ctx);
+}
+
+// Decode responses that never came over a socket; see proxyfs_testing.h
+jsonrpc_context_t* jsonrpc_test_resp_open(const char* text)
+{
+    jsonrpc_context_t* ctx = construct_ctx(NULL, "RpcTest");
+    ctx->resp.readBuf = strdup(text);
+    jsonrpc_parse_response(&ctx->resp);
+    return ctx;
+}
+
+uint64_t jsonrpc_test_resp_id(jsonrpc_context_t* ctx)
+{
+    return ctx->resp.response_id;
+}
+
+void jsonrpc_test_resp_close(jsonrpc_context_t* ctx)
+{
+    destruct_ctx(ctx);
 }
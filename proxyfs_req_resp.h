@@ -14,12 +14,31 @@ jsonrpc_internal_callback_t jsonrpc_get_internal_callback(jsonrpc_context_t* ctx
 // Save the request context somewhere
 void jsonrpc_store_request(jsonrpc_context_t* ctx);
 
-// Remove the request from the list. caller still must free the ctx.
-void jsonrpc_remove_request(jsonrpc_context_t* ctx);
+// Remove the request from the registry. caller still must free the ctx.
+// Returns false if it wasn't there (any more).
+bool jsonrpc_remove_request(jsonrpc_context_t* ctx);
+
+// Return the number of requests in the registry
+int jsonrpc_num_requests();
+
+// Return the request context that corresponds to the request_id
+jsonrpc_context_t* jsonrpc_get_request_by_id(uint64_t request_id);
 
 // Return the request context that corresponds to the request_id in the response
 jsonrpc_context_t* jsonrpc_get_request(jsonrpc_response_t* resp);
 
+// Same, but a blocking request is also taken out of the registry, so that
+// the caller is the only one to complete it. Requests with an internal
+// callback stay until they are done with, as with jsonrpc_get_request.
+jsonrpc_context_t* jsonrpc_take_request(jsonrpc_response_t* resp);
+jsonrpc_context_t* jsonrpc_take_request_by_id(uint64_t request_id);
+
+// Fail the blocking requests sent in a socket pool generation before
+// <generation> with <err>: their sockets have been closed, so their
+// responses will never come. Each is taken out of the registry before it is
+// completed, like jsonrpc_take_request does. Returns how many there were.
+int jsonrpc_fail_requests(uint64_t generation, int err);
+
 // Callback-related
 //
 // API to save read-callback-related stuff for later
@@ -12,4 +12,81 @@
 void proxyfs_set_verbose();
 void proxyfs_unset_verbose();
 
+// Outstanding request registry, exposed so that it can be exercised
+// without a server. Test contexts carry only a request id and cookie
+// and are never sent.
+#include <json_utils.h>
+
+jsonrpc_context_t* jsonrpc_test_ctx_create(uint64_t request_id, void* cookie);
+void               jsonrpc_test_ctx_destroy(jsonrpc_context_t* ctx);
+
+// Mark a test context as sent in the given socket pool generation, for
+// jsonrpc_fail_requests
+void               jsonrpc_test_ctx_set_sent(jsonrpc_context_t* ctx, uint64_t generation);
+
+// Where request ids carry on from, e.g. close to 32-bit limits, and taking
+// one the way requests do
+void               jsonrpc_test_set_next_request_id(uint64_t request_id);
+uint64_t           jsonrpc_test_get_request_id();
+
+// Request contexts that are rendered but never sent, for checking the
+// request text; the text stays valid until the next param is set or the
+// context is closed.
+jsonrpc_context_t* jsonrpc_test_req_open(const char* method);
+uint64_t           jsonrpc_test_req_id(jsonrpc_context_t* ctx);
+const char*        jsonrpc_test_req_text(jsonrpc_context_t* ctx, size_t* out_len);
+void               jsonrpc_test_req_close(jsonrpc_context_t* ctx);
+
+// Response contexts made from the text of a single response line, for
+// checking how responses are decoded, and the decoders in proxyfs_api.c
+jsonrpc_context_t* jsonrpc_test_resp_open(const char* text);
+uint64_t           jsonrpc_test_resp_id(jsonrpc_context_t* ctx);
+void               jsonrpc_test_resp_close(jsonrpc_context_t* ctx);
+
+// How many contexts and request buffers have been allocated (or, for
+// buffers, grown) so far, rather than reused from a pool
+uint64_t           jsonrpc_ctx_allocs();
+uint64_t           jsonrpc_req_buf_allocs();
+
+// The wait for a response that blocking calls do on their context
+void               jsonrpc_block_for_response(jsonrpc_context_t* ctx);
+void               jsonrpc_unblock_for_response(jsonrpc_context_t* ctx);
+
+void               stat_resp_to_struct(jsonrpc_context_t* ctx, proxyfs_stat_t* stat);
+struct dirent*     proxyfs_get_dirents(jsonrpc_context_t* ctx, int num_entries);
+proxyfs_stat_t*    proxyfs_get_statents(mount_handle_t* in_mount_handle, jsonrpc_context_t* ctx, int num_entries,
+                                        uint64_t cache_generation);
+struct statvfs*    statvfs_resp_to_struct(jsonrpc_context_t* ctx, mount_handle_t* mount_handle);
+
+int                jsonrpc_num_requests();
+void               jsonrpc_store_request(jsonrpc_context_t* ctx);
+bool               jsonrpc_remove_request(jsonrpc_context_t* ctx);
+jsonrpc_context_t* jsonrpc_get_request_by_id(uint64_t request_id);
+jsonrpc_context_t* jsonrpc_get_request_by_cookie(void* cookie);
+jsonrpc_context_t* jsonrpc_take_request_by_id(uint64_t request_id);
+int                jsonrpc_fail_requests(uint64_t generation, int err);
+int                jsonrpc_wait_for_response(jsonrpc_context_t* ctx);
+
+// Start the response threads the way the first request sent does. The
+// threads can run <thread_fn> instead of waiting for responses (NULL puts
+// back the real thing), and the record of them having been started can be
+// cleared so that the next call starts them again; it returns the old one.
+int                rpc_schedule_resp_work(uint64_t expected_response_id);
+int                rpc_response_thread_count();
+void               jsonrpc_test_set_response_thread(void* (*thread_fn)(void*));
+bool               jsonrpc_test_set_response_threads_running(bool running);
+
+// Point the synchronous fast-path I/O socket at a test server (e.g. the
+// mock server) instead of the one opened by proxyfs_mount. Returns 0 or an errno.
+int                proxyfs_test_io_connect(char* server, int port);
+void               proxyfs_test_io_disconnect();
+
+// Have sock_read() call <hook> (NULL: nothing) with the connection locked,
+// before it receives anything
+void               sock_test_set_read_hook(void (*hook)(int sockfd));
+
+// Turn off (or back on) sending and receiving fast-path headers and data in
+// one system call, to measure the difference. On by default.
+void               proxyfs_test_set_io_coalescing(bool enable);
+
 #endif // __PROXYFS_TESTING_H__
@@ -7,10 +7,12 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <netdb.h>
 #include <errno.h>
+#include <stdint.h>
 #include <pthread.h>
 #include "fault_inj.h"
 #include "debug.h"
@@ -30,6 +32,14 @@ int set_err_return()
 sock_pool_t *global_sock_pool = NULL;
 int io_sock_fd = -1;
 
+// Called by sock_read() once it has the connection locked, for tests
+static void (*sock_read_hook)(int sockfd) = NULL;
+
+void sock_test_set_read_hook(void (*hook)(int sockfd))
+{
+    sock_read_hook = hook;
+}
+
 int sock_open(char* rpc_server, int rpc_port)
 {
     char* hostname = rpc_server;
@@ -106,6 +116,215 @@ void sock_close(int sockfd)
     close(sockfd);
 }
 
+// Segments handed to the kernel per sendmsg()/recvmsg(); bounded so that a
+// caller's iovec array is never copied to the heap and never exceeds IOV_MAX.
+#define SOCK_IOV_BATCH  64
+
+// Cursor over an optional header segment followed by a caller's iovec array.
+typedef struct {
+    const void         *hdr;
+    size_t             hdr_len;
+    const struct iovec *iov;
+    int                iovcnt;
+    int                index;    // 0 is the header, i > 0 is iov[i - 1]
+    size_t             skip;     // bytes of the current segment already done
+} sock_iov_cursor_t;
+
+static struct iovec sock_iov_segment(sock_iov_cursor_t *cur, int index)
+{
+    struct iovec seg;
+    if (index == 0) {
+        seg.iov_base = (void *)cur->hdr;
+        seg.iov_len  = (cur->hdr != NULL) ? cur->hdr_len : 0;
+    } else {
+        seg = cur->iov[index - 1];
+    }
+    return seg;
+}
+
+// Fill batch with up to max bytes of the segments left at the cursor.
+// Returns the number of entries used, 0 once nothing is left.
+static int sock_iov_fill(sock_iov_cursor_t *cur, struct iovec *batch, size_t max)
+{
+    int n = 0;
+    int i = cur->index;
+    size_t skip = cur->skip;
+
+    while ((i <= cur->iovcnt) && (n < SOCK_IOV_BATCH) && (max > 0)) {
+        struct iovec seg = sock_iov_segment(cur, i);
+        if (seg.iov_len > skip) {
+            size_t len = seg.iov_len - skip;
+            batch[n].iov_base = (char *)seg.iov_base + skip;
+            batch[n].iov_len  = (len < max) ? len : max;
+            max -= batch[n].iov_len;
+            n++;
+        }
+        skip = 0;
+        i++;
+    }
+    return n;
+}
+
+static void sock_iov_advance(sock_iov_cursor_t *cur, size_t done)
+{
+    while ((done > 0) && (cur->index <= cur->iovcnt)) {
+        size_t left = sock_iov_segment(cur, cur->index).iov_len - cur->skip;
+        if (done < left) {
+            cur->skip += done;
+            return;
+        }
+        done -= left;
+        cur->index++;
+        cur->skip = 0;
+    }
+}
+
+// Send hdr (if not NULL) followed by the iov segments, in as few system
+// calls as the socket allows.
+//
+// Returns 0 or an errno. A dead peer is EPIPE rather than SIGPIPE.
+int sock_send_iov(int sockfd, const void *hdr, size_t hdr_len, const struct iovec *iov, int iovcnt)
+{
+    sock_iov_cursor_t cur = { .hdr = hdr, .hdr_len = hdr_len, .iov = iov, .iovcnt = iovcnt };
+    struct iovec      batch[SOCK_IOV_BATCH];
+    int               n;
+
+    while ((n = sock_iov_fill(&cur, batch, SIZE_MAX)) > 0) {
+        struct msghdr msg;
+        bzero(&msg, sizeof(msg));
+        msg.msg_iov    = batch;
+        msg.msg_iovlen = n;
+
+        ssize_t ret = sendmsg(sockfd, &msg, MSG_NOSIGNAL);
+        if (ret < 0) {
+            if ((errno == EINTR) || (errno == EAGAIN)) {
+                continue;
+            }
+            return errno;
+        }
+        sock_iov_advance(&cur, ret);
+    }
+    return 0;
+}
+
+// Receive exactly length bytes into the iov segments, starting offset bytes
+// in. The segments must have room for them.
+//
+// Returns 0 or an errno; EPIPE if the peer closed the connection.
+int sock_recv_iov(int sockfd, const struct iovec *iov, int iovcnt, size_t offset, size_t length)
+{
+    sock_iov_cursor_t cur = { .hdr = NULL, .hdr_len = 0, .iov = iov, .iovcnt = iovcnt };
+    struct iovec      batch[SOCK_IOV_BATCH];
+    int               n;
+
+    sock_iov_advance(&cur, offset);
+
+    while (length > 0) {
+        n = sock_iov_fill(&cur, batch, length);
+        if (n == 0) {
+            return EINVAL;  // segments too small
+        }
+
+        struct msghdr msg;
+        bzero(&msg, sizeof(msg));
+        msg.msg_iov    = batch;
+        msg.msg_iovlen = n;
+
+        ssize_t ret = recvmsg(sockfd, &msg, 0);
+        if (ret < 0) {
+            if ((errno == EINTR) || (errno == EAGAIN)) {
+                continue;
+            }
+            return errno;
+        }
+        if (ret == 0) {
+            return EPIPE;
+        }
+        sock_iov_advance(&cur, ret);
+        length -= ret;
+    }
+    return 0;
+}
+
+// Receive a response made of a fixed-size header and a payload whose size is
+// in the header, with the payload going straight into the iov segments.
+//
+// The first recvmsg() asks for the header and as much payload as the
+// segments can hold, so a small response arrives in one system call. That
+// is only safe when nothing can follow the response on the socket before
+// the caller sends its next request, i.e. on a strict request/response
+// connection. payload_len() is called once the header is complete.
+//
+// Returns 0 or an errno; EPIPE if the peer closed the connection, EINVAL if
+// the payload doesn't fit.
+int sock_recv_hdr_iov(int sockfd, void *hdr, size_t hdr_len, const struct iovec *iov, int iovcnt,
+                      size_t (*payload_len)(const void *hdr))
+{
+    sock_iov_cursor_t cur      = { .hdr = hdr, .hdr_len = hdr_len, .iov = iov, .iovcnt = iovcnt };
+    struct iovec      batch[SOCK_IOV_BATCH];
+    size_t            received = 0;
+    size_t            expected = SIZE_MAX;  // until the header is in
+    int               n;
+
+    while (received < expected) {
+        n = sock_iov_fill(&cur, batch, expected - received);
+        if (n == 0) {
+            return EINVAL;  // segments too small
+        }
+
+        struct msghdr msg;
+        bzero(&msg, sizeof(msg));
+        msg.msg_iov    = batch;
+        msg.msg_iovlen = n;
+
+        ssize_t ret = recvmsg(sockfd, &msg, 0);
+        if (ret < 0) {
+            if ((errno == EINTR) || (errno == EAGAIN)) {
+                continue;
+            }
+            return errno;
+        }
+        if (ret == 0) {
+            return EPIPE;
+        }
+        sock_iov_advance(&cur, ret);
+        received += ret;
+
+        if ((expected == SIZE_MAX) && (received >= hdr_len)) {
+            expected = hdr_len + payload_len(hdr);
+            if (received > expected) {
+                return EPROTO;  // the peer sent more than it said
+            }
+        }
+    }
+    return 0;
+}
+
+// Copy length bytes from buf into the iov segments, starting offset bytes in.
+// Returns 0, or EINVAL if the segments are too small.
+int sock_iov_copy_in(const struct iovec *iov, int iovcnt, size_t offset, const void *buf, size_t length)
+{
+    sock_iov_cursor_t cur = { .hdr = NULL, .hdr_len = 0, .iov = iov, .iovcnt = iovcnt };
+    struct iovec      batch[SOCK_IOV_BATCH];
+    int               n, i;
+
+    sock_iov_advance(&cur, offset);
+
+    while (length > 0) {
+        n = sock_iov_fill(&cur, batch, length);
+        if (n == 0) {
+            return EINVAL;
+        }
+        for (i = 0; i < n; i++) {
+            memcpy(batch[i].iov_base, buf, batch[i].iov_len);
+            buf     = (const char *)buf + batch[i].iov_len;
+            length -= batch[i].iov_len;
+            sock_iov_advance(&cur, batch[i].iov_len);
+        }
+    }
+    return 0;
+}
+
 // NOTE on buffer sizes for reading from our socket:
 //
 // NORMAL_REQUEST_SIZE:
@@ -135,101 +354,143 @@ int alloc_read_buf(char** bufPtr)
     return readSize;
 }
 
-// NOTE: This is the largest socket read buffer we support right now.
-int big_buffer_size = 128 * 1024 * 4/3; // *4/3 is to account for base64 encoding
-
-int sock_read(int sockfd, char** bufPtr, int* error)
+// Drain whatever the server has sent on sockfd and return the complete
+// responses received so far.
+//
+// Connections are pipelined, so a read may end in the middle of a response
+// or contain several of them. Everything up to and including the last
+// newline is returned in a freshly allocated, null-terminated *bufPtr; the
+// remainder is kept in the connection's receive buffer for the next call.
+// Returns 0 (with *bufPtr NULL) if no complete response has arrived yet.
+// *generation is the pool generation the responses were read in, for
+// releasing their slots with sock_pool_put().
+//
+// Only the receiver thread that sock_pool_select() handed sockfd to may call
+// this; the socket is re-armed in the epoll set before returning. The
+// connection is locked while it is read, so the pool can't close the socket
+// or drop its receive buffer in the middle.
+int sock_read(int sockfd, char** bufPtr, int* error, uint64_t* generation)
 {
-    size_t allBytesRecd  = 0;
-    size_t bytesRecd     = 0;
-    int    max_read_size = alloc_read_buf(bufPtr);
-    char*  buf           = *bufPtr;
+    sock_conn_t* conn = sock_pool_lock_rx(global_sock_pool, sockfd, generation);
+
+    *bufPtr = NULL;
 
     // Set errno to zero to start
     *error = 0;
 
-    while (1) {
-        bytesRecd = read(sockfd, buf + allBytesRecd, max_read_size - allBytesRecd);
-        if (bytesRecd <= 0) {
-
-            if (bytesRecd < 0) {
-                // we should never see EGAIN(?)
-                if (errno == EAGAIN) {
-                    continue;
-                }
-
-                if (errno == 0) {
-                    DPRINTF("ERROR reading from socket - no errno set, setting errno to EIO.\n");
-                    *error = EIO;
-                } else {
-                    DPRINTF("ERROR %s reading from socket\n", strerror(errno));
-                    *error = errno;
-                }
-            } else {
-                DPRINTF("far end disconnected while reading from socket.\n");
-                *error = EPIPE;
-            }
+    if (conn == NULL) {
+        // The pool was reset since epoll reported this socket; nothing to read
+        DPRINTF("socket %d is no longer in the pool.\n", sockfd);
+        return 0;
+    }
 
-            // We got the socket in sock_write() and since we are done with it,
-            // lets put it back to pool.  Mark it bad so the pool gets re-opened.
-            sock_pool_put_badfd(global_sock_pool, sockfd);
-            free(*bufPtr);
+    if (conn->rx_buf == NULL) {
+        int readSize = alloc_read_buf(&conn->rx_buf);
+        if (readSize < 0) {
+            sock_pool_unlock_rx(conn);
+            *error = ENOMEM;
             return -1;
         }
+        conn->rx_size = readSize;
+        conn->rx_len  = 0;
+    }
 
-        // otherwise data is good
-        allBytesRecd += bytesRecd;
+    if (sock_read_hook != NULL) {
+        sock_read_hook(sockfd);
+    }
 
-        // Are we done? Check for CR as last character.
-        if (buf[allBytesRecd-1] == 0xa) {
-            // Read terminates in a CR; we're done.
-            DPRINTF("read %ld/%ld bytes from socket; found CR, done. (max=%d).\n",
-                    bytesRecd,allBytesRecd, max_read_size);
-            break;
-        } else {
-            DPRINTF("read %ld/%ld bytes from socket; keep trying. (max=%d, last-char=0x%x).\n",
-                    bytesRecd,allBytesRecd, max_read_size,buf[allBytesRecd-1]);
-
-            if (allBytesRecd == max_read_size) {
-                // We've run out of buffer space but aren't done reading.
-                // Let's realloc to a bigger buffer size.
-                //
-                // XXX TODO: If we end up needing a buffer larger than big_buffer_size,
-                //           we are hosed. If that happens, we trigger a panic here.
-                //
-                // Let's make sure we haven't already reallocated...
-                if (max_read_size == big_buffer_size) {
-                    // Uh oh, we ran out of space in our biggest buffer.
-                    DPANIC("FATAL: Ran out of buffer space when reading socket! Bytes read: %d\n", max_read_size);
-                    return -1;
-                }
-
-                // XXX TODO: can we make this more efficient?
-                //
-                DPRINTF("Ran out of buffer space at size %d but not done reading. "
-                        "Reallocating to bigger size %d.\n", max_read_size, big_buffer_size);
-                *bufPtr = realloc(*bufPtr, big_buffer_size);
-                DPRINTF("Old bufPtr was %p, new one is %p.\n", buf, *bufPtr);
-                buf = *bufPtr;
-                max_read_size = big_buffer_size;
+    while (1) {
+        // Always leave room for a terminating null
+        if (conn->rx_len + 1 >= conn->rx_size) {
+            size_t new_size = conn->rx_size * 2;
+            char*  new_buf  = realloc(conn->rx_buf, new_size);
+            if (new_buf == NULL) {
+                DPANIC("FATAL: unable to grow socket receive buffer to %ld bytes!\n", new_size);
+                sock_pool_unlock_rx(conn);
+                *error = ENOMEM;
+                return -1;
             }
+            DPRINTF("Grew receive buffer for socket %d from %ld to %ld bytes.\n", sockfd, conn->rx_size, new_size);
+            conn->rx_buf  = new_buf;
+            conn->rx_size = new_size;
+        }
+
+        ssize_t bytesRecd = recv(sockfd, conn->rx_buf + conn->rx_len, conn->rx_size - conn->rx_len - 1, MSG_DONTWAIT);
+        if (bytesRecd > 0) {
+            conn->rx_len += bytesRecd;
             continue;
         }
+
+        if (bytesRecd < 0) {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+                // Drained everything that has arrived so far
+                break;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+
+            DPRINTF("ERROR %s reading from socket\n", strerror(errno));
+            *error = errno;
+        } else {
+            DPRINTF("far end disconnected while reading from socket.\n");
+            *error = EPIPE;
+        }
+
+        // The pool shuts its sockets down before taking their rx_lock to close them, so a reset (after
+        // some other connection failed) ends our read too. That's no failure of this socket's: whoever
+        // reset the pool fails the requests that were outstanding.
+        if (__atomic_load_n(&global_sock_pool->generation, __ATOMIC_ACQUIRE) != *generation) {
+            DPRINTF("socket %d was shut down by a reset of the pool.\n", sockfd);
+            sock_pool_unlock_rx(conn);
+            *error = 0;
+            return 0;
+        }
+
+        // Responses to requests outstanding on this socket will never
+        // arrive, so there is no point waiting for their slots to be
+        // released here; the caller treats this as fatal.
+        sock_pool_unlock_rx(conn);
+        return -1;
+    }
+
+    // Find the end of the last complete response
+    size_t complete = conn->rx_len;
+    while ((complete > 0) && (conn->rx_buf[complete-1] != 0xa)) {
+        complete--;
+    }
+
+    if (complete > 0) {
+        *bufPtr = malloc(complete + 1);
+        if (*bufPtr == NULL) {
+            DPANIC("FATAL: unable to allocate %ld bytes for socket read!\n", complete + 1);
+            sock_pool_unlock_rx(conn);
+            *error = ENOMEM;
+            return -1;
+        }
+        memcpy(*bufPtr, conn->rx_buf, complete);
+        (*bufPtr)[complete] = 0;
+
+        // Keep the start of any partial response for next time
+        memmove(conn->rx_buf, conn->rx_buf + complete, conn->rx_len - complete);
+        conn->rx_len -= complete;
     }
 
-    // We got the socket in sock_write() and since we are done with it, lets put it back to pool.
-    sock_pool_put(global_sock_pool, sockfd);
+    DPRINTF("returning %ld bytes read (%ld bytes pending), error=%d.\n", complete, conn->rx_len, *error);
+
+    sock_pool_unlock_rx(conn);
 
-    // Just in case, make sure the buffer we return is null-terminated.
-    buf[allBytesRecd] = 0;
+    // Let the next data on this socket wake a receiver thread
+    sock_pool_rearm(global_sock_pool, sockfd);
 
-    DPRINTF("returning %ld bytes read, error=%d.\n",allBytesRecd, *error);
-    return allBytesRecd;
+    return complete;
 }
 
-int sock_write(const char* buf) {
+// Send a request on one of the pooled connections. *generation is set, before
+// anything is sent, to the pool generation the request goes out in; see
+// sock_pool_get().
+int sock_write(const char* buf, size_t len, uint64_t* generation) {
     int rtnVal = 0; // success
-    int n = 0;
 
     if (global_sock_pool == NULL) {
         return ENODEV;
@@ -240,28 +501,22 @@ int sock_write(const char* buf) {
         goto errout;
     }
 
-    int         sockfd = sock_pool_get(global_sock_pool);
+    // Reserve a slot in some connection's in-flight window
+    int         sockfd = sock_pool_get(global_sock_pool, generation);
     if (sockfd == -1) {
         errno = ENODEV;
         goto errout;
     }
 
     DPRINTF("Sending data on socket: %d\n", sockfd);
-    n = write(sockfd, buf, strlen(buf));
-    if (n != strlen(buf)) {
-
-        // the socket is "broken" but still needs to be returned to the pool
-        sock_pool_put_badfd(global_sock_pool, sockfd);
+    if (sock_pool_send(global_sock_pool, sockfd, *generation, buf, len) != 0) {
 
-        if (n >= 0) {
-            DPRINTF("ERROR wrote %d bytes to socket but only %d were sent", n, strlen(buf));
-            errno = 0;
-        }
+        // the socket is "broken" but the slot still needs to be released
+        sock_pool_put_badfd(global_sock_pool, sockfd, *generation);
         goto errout;
     }
 
-    // The socket will be returned to free pool after getting the response in
-    // read path.
+    // The slot will be released after getting the response in the read path.
     return 0;
 
 errout:
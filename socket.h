@@ -6,14 +6,25 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/uio.h>
 #include "pool.h"
 
 int  sock_open(char* rpc_server, int rpc_port);
 void sock_close(int sockfd);
-int  sock_read(int sock_read, char** buf, int* error);
-int  sock_write(const char* buf);
+int  sock_read(int sock_read, char** buf, int* error, uint64_t* generation);
+int  sock_write(const char* buf, size_t len, uint64_t* generation);
+
+// Scatter-gather helpers for the fast path; both return 0 or an errno
+int  sock_send_iov(int sockfd, const void *hdr, size_t hdr_len, const struct iovec *iov, int iovcnt);
+int  sock_recv_iov(int sockfd, const struct iovec *iov, int iovcnt, size_t offset, size_t length);
+int  sock_recv_hdr_iov(int sockfd, void *hdr, size_t hdr_len, const struct iovec *iov, int iovcnt,
+                       size_t (*payload_len)(const void *hdr));
+int  sock_iov_copy_in(const struct iovec *iov, int iovcnt, size_t offset, const void *buf, size_t length);
 
 #define GLOBAL_SOCK_POOL_COUNT 2
+
+// Default number of requests that may be outstanding on each pooled connection
+#define GLOBAL_SOCK_POOL_WINDOW 64
 extern sock_pool_t *global_sock_pool;
 extern int io_sock_fd;
 
@@ -1,6 +1,8 @@
 // Copyright (c) 2015-2021, NVIDIA CORPORATION.
 // SPDX-License-Identifier: Apache-2.0
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -8,13 +10,33 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/resource.h>
 #include <netinet/in.h>
 #include <netdb.h>
 #include <json-c/json.h>
 #include <pthread.h>
+#include <time.h>
+#include <sys/queue.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <sched.h>
+#include <poll.h>
 #include <proxyfs.h>
 #include <proxyfs_testing.h>
 #include "fault_inj.h"
+#include "fastpath.h"
+#include "mock_server.h"
+#include "attr_cache.h"
+#include "dentry_cache.h"
+#include "base64.h"
+#include "completion.h"
+#include "mpmc_queue.h"
+#include "ioworker.h"
+#include "io_sched.h"
+#include "completion_queue.h"
+#include "uring.h"
+#include "pool.h"
+#include "socket.h"
 
 // Flag that can be set from a command line arg to make tests less chatty
 static bool quiet = true;
@@ -145,6 +167,26 @@ char* funcs[] = {
     TEST_GROUP(READPASTEOF_TEST)         \
     TEST_GROUP(SYSLOGWRITE_TEST)         \
     TEST_GROUP(ASYNC_READWRITE_TESTS)    \
+    TEST_GROUP(REGISTRY_TESTS)           \
+    TEST_GROUP(TAGGED_IO_TESTS)          \
+    TEST_GROUP(VECTORED_IO_TESTS)        \
+    TEST_GROUP(FASTPATH_IO_BENCH)        \
+    TEST_GROUP(ATTR_CACHE_TESTS)         \
+    TEST_GROUP(DENTRY_CACHE_TESTS)       \
+    TEST_GROUP(PATH_WALK_TESTS)          \
+    TEST_GROUP(DIR_STREAM_TESTS)         \
+    TEST_GROUP(REQUEST_WRITER_TESTS)     \
+    TEST_GROUP(RESPONSE_PARSER_TESTS)    \
+    TEST_GROUP(BASE64_TESTS)             \
+    TEST_GROUP(CTX_POOL_TESTS)           \
+    TEST_GROUP(COMPLETION_TESTS)         \
+    TEST_GROUP(IO_QUEUE_TESTS)           \
+    TEST_GROUP(IO_WORKERS_TESTS)         \
+    TEST_GROUP(IO_MERGE_TESTS)           \
+    TEST_GROUP(IO_SCHED_TESTS)           \
+    TEST_GROUP(COMPLETION_QUEUE_TESTS)   \
+    TEST_GROUP(IO_URING_TESTS)           \
+    TEST_GROUP(RPC_POOL_TESTS)           \
     TEST_GROUP(__MAX_TEST_GROUPS__)
 
 // Generate the test group enum from FOREACH_TEST_GROUP above
@@ -189,6 +231,46 @@ bool isEnabled(test_groups_t test) {
     return enabledTests[test];
 }
 
+// Local tests exercise client-side code only and don't need a ProxyFS server
+bool isLocalTest(test_groups_t test) {
+    switch (test) {
+        case REGISTRY_TESTS:
+        case TAGGED_IO_TESTS:
+        case VECTORED_IO_TESTS:
+        case FASTPATH_IO_BENCH:
+        case ATTR_CACHE_TESTS:
+        case DENTRY_CACHE_TESTS:
+        case PATH_WALK_TESTS:
+        case DIR_STREAM_TESTS:
+        case REQUEST_WRITER_TESTS:
+        case RESPONSE_PARSER_TESTS:
+        case BASE64_TESTS:
+        case CTX_POOL_TESTS:
+        case COMPLETION_TESTS:
+        case IO_QUEUE_TESTS:
+        case IO_WORKERS_TESTS:
+        case IO_MERGE_TESTS:
+        case IO_SCHED_TESTS:
+        case COMPLETION_QUEUE_TESTS:
+        case IO_URING_TESTS:
+        case RPC_POOL_TESTS:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Returns true if any enabled test needs to talk to a ProxyFS server
+bool serverTestsEnabled() {
+    int i = 0;
+    for (i=0; i < __MAX_TEST_GROUPS__; i++) {
+        if (enabledTests[i] && !isLocalTest(i)) {
+            return true;
+        }
+    }
+    return false;
+}
+
 void print_test_settings() {
     printf("\nTest enable/disable settings:\n");
     int i = 0;
@@ -3284,214 +3366,5031 @@ void statvfs_tests()
     test_statvfs(-1, 0);
 }
 
-// XXX TODO - Tests to be added:
-//
-// + 65M read/write
-// + truncate tests (both when not yet flushed and when flushed)
-// + read beyond end of file
-// + write causing holes
+int64_t registry_now_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
 
-void print_usage() {
-    printf("Run ProxyFS RPC client-side tests.\n\n");
-    printf("Usage: test [-h|-v|-s|-r <JSON:RPC/tuple>|-t <test_name>]\n");
-    printf("       When called with no parameters, the entire suite of tests is run.\n");
-    printf("       -h: print this message.\n");
-    printf("       -v: verbose mode; more test output.\n");
-    printf("       -s: silent mode; no test output. Intended for performance testing.\n");
-    printf("       -r: specify JSON RPC server info as <ipaddr>:<port>/<fast_port> to use.\n");
-    printf("       -p: print the tests that will be run\n");
-    printf("       -t: run a subset of tests, intended to reproduce specific issues.\n");
-    printf("           Test subsets supported are:\n");
-    printf("            4kread\n");
-    printf("            65kread\n");
-    printf("            read-past-eof\n");
-    printf("            syslog-write\n");
-    printf("            mount\n");
-    printf("            chown\n");
-    printf("            mkdir\n");
-    printf("            readdir\n");
-    printf("            async\n");
-    printf("            parallel\n");
-    printf("            statvfs\n");
-    printf("            fake_hang\n");
+// Store/find/remove correctness, including removal from the middle of probe runs
+void registry_basic_tests()
+{
+    char*    funcToTest = "registry store/find/remove";
+    int      numCtx     = 1000;
+    uint64_t baseId     = ((uint64_t)1 << 32) - 500;    // straddling 32 bits
+    bool     failed     = false;
+    int      i          = 0;
+
+    jsonrpc_context_t** ctxs = (jsonrpc_context_t**)malloc(numCtx * sizeof(jsonrpc_context_t*));
+    for (i=0; i < numCtx; i++) {
+        // Give every other request a cookie, like a mix of async and blocking calls
+        ctxs[i] = jsonrpc_test_ctx_create(baseId + i, ((i % 2) == 0) ? (void*)&ctxs[i] : NULL);
+        jsonrpc_store_request(ctxs[i]);
+    }
+
+    if (jsonrpc_num_requests() != numCtx) {
+        TLOG("%s: expected %d requests, found %d.\n", funcToTest, numCtx, jsonrpc_num_requests());
+        failed = true;
+    }
+
+    // Remove every third request, then make sure everything else is still there
+    for (i=0; i < numCtx; i += 3) {
+        jsonrpc_remove_request(ctxs[i]);
+    }
+    for (i=0; i < numCtx; i++) {
+        jsonrpc_context_t* expected = ((i % 3) == 0) ? NULL : ctxs[i];
+        if (jsonrpc_get_request_by_id(baseId + i) != expected) {
+            TLOG("%s: lookup of id %" PRIu64 " returned the wrong request.\n", funcToTest, baseId + i);
+            failed = true;
+        }
+        if ((i % 2) == 0) {
+            if (jsonrpc_get_request_by_cookie(&ctxs[i]) != expected) {
+                TLOG("%s: lookup of cookie %p returned the wrong request.\n", funcToTest, &ctxs[i]);
+                failed = true;
+            }
+        }
+    }
+
+    for (i=0; i < numCtx; i++) {
+        if ((i % 3) != 0) {
+            jsonrpc_remove_request(ctxs[i]);
+        }
+        jsonrpc_test_ctx_destroy(ctxs[i]);
+    }
+    free(ctxs);
+
+    if (jsonrpc_num_requests() != 0) {
+        TLOG("%s: expected empty registry, found %d requests.\n", funcToTest, jsonrpc_num_requests());
+        failed = true;
+    }
+
+    if (failed) {
+        test_failed(funcToTest);
+    } else {
+        test_passed();
+    }
 }
 
-int main(int argc, char *argv[])
+// Measure the cost of a lookup with a varying number of outstanding requests;
+// it should stay roughly flat as the registry grows.
+void registry_lookup_bench()
 {
-    int c = 0;
-    char* tvalue = NULL;
-    opterr = 0;
-    bool testsSuiteAborted    = false;
-    bool fakeHang             = false;
-    bool rpc_config_specified = false;
-    bool print_tests = false;
+    int  sizes[]    = { 1, 10, 100, 1000, 10000 };
+    int  numSizes   = sizeof(sizes) / sizeof(sizes[0]);
+    int  numLookups = 1000000;
+    int  baseId     = 1 << 30;
+    int  s          = 0;
+    int  i          = 0;
+
+    for (s=0; s < numSizes; s++) {
+        int numCtx = sizes[s];
+        jsonrpc_context_t** ctxs = (jsonrpc_context_t**)malloc(numCtx * sizeof(jsonrpc_context_t*));
+        for (i=0; i < numCtx; i++) {
+            ctxs[i] = jsonrpc_test_ctx_create(baseId + i, NULL);
+            jsonrpc_store_request(ctxs[i]);
+        }
 
-    // See if the caller passed in any flags
-    while ((c = getopt(argc, argv, "hvspr:t:")) != -1) {
-        switch (c)
-        {
-            case 'h':
-                print_usage();
-                return 0;
-                break;
-            case 'v':
-                // Caller wants debug prints from proxyfs code
-                quiet = false;
-                break;
-            case 's':
-                // Caller silent mode, no prints at all
-                silent = true;
-                quiet  = true;
-                disable_fault_prints();
-                break;
-            case 'r':
-                // Caller specified JSON:RPC/tuple (as required)
-                rpc_config_parse(optarg);
-                rpc_config_specified = true;
-                break;
-            case 'p':
-                print_tests = true;
-                break;
-            case 't':
-                // Caller wants to run a specific test
-                //
-                tvalue = optarg;
+        int misses = 0;
+        int64_t startNs = registry_now_ns();
+        for (i=0; i < numLookups; i++) {
+            if (jsonrpc_get_request_by_id(baseId + (i % numCtx)) == NULL) {
+                misses++;
+            }
+        }
+        int64_t elapsedNs = registry_now_ns() - startNs;
 
-                if (strcmp(tvalue,"4kread") == 0) {
-                    enableTest(WRITEREAD4K_TEST);
+        if (misses != 0) {
+            TLOG("registry lookup bench: %d lookups failed with %d outstanding requests.\n", misses, numCtx);
+            test_failed("registry lookup bench");
+        } else {
+            test_passed();
+        }
+        if (!silent) {
+            printf("  registry lookup: %5d outstanding requests, %6.1f ns/lookup\n",
+                   numCtx, (double)elapsedNs / numLookups);
+        }
 
-                    // Disable some of the other tests to get to the one we want quicker
-                    disableTest(ERROR_TESTS);
-                    disableTest(LOOKUP_TESTS);
-                    disableTest(READSYMLINK_TESTS);
-                    disableTest(READDIR_TESTS);
-                    disableTest(STATSIZE_TESTS);
+        for (i=0; i < numCtx; i++) {
+            jsonrpc_remove_request(ctxs[i]);
+            jsonrpc_test_ctx_destroy(ctxs[i]);
+        }
+        free(ctxs);
+    }
+}
 
-                } else if ((strcmp(tvalue,"65kread") == 0) || (strcmp(tvalue,"parallel") == 0)) {
-                    disableAllTests();
+// Request ids from many threads at once: each must be unique. Compared with
+// taking them under a mutex, the way they used to be.
 
-                    enableTest(MOUNT_TESTS);
-                    enableTest(WRITEREAD65K_TEST);
-                    enableTest(MKDIRCREATE_TESTS);
-                    enableTest(UNLINKRMDIR_TESTS);
+#define REQUEST_ID_MAX_THREADS  128
 
-                    disable_all_files();
-                    enable_file(FILE2);
+static pthread_mutex_t request_id_bench_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t        request_id_bench_next = 0;
 
-                } else if (strcmp(tvalue,"read-past-eof") == 0) {
-                    disableAllTests();
+typedef struct {
+    bool      use_lock;
+    int       num_ids;
+    uint64_t* ids;
+} request_id_thread_t;
 
-                    enableTest(READWRITE_TESTS);
-                    enableTest(READPASTEOF_TEST);
-                    enableTest(MOUNT_TESTS);
-                    enableTest(ERROR_TESTS);
-                    enableTest(MKDIRCREATE_TESTS);
-                    enableTest(UNLINKRMDIR_TESTS);
+void* request_id_thread(void* arg)
+{
+    request_id_thread_t* info = (request_id_thread_t*)arg;
+    int                  i;
+
+    for (i = 0; i < info->num_ids; i++) {
+        if (info->use_lock) {
+            pthread_mutex_lock(&request_id_bench_lock);
+            info->ids[i] = request_id_bench_next++;
+            pthread_mutex_unlock(&request_id_bench_lock);
+        } else {
+            info->ids[i] = jsonrpc_test_get_request_id();
+        }
+    }
+    return NULL;
+}
 
-                    disable_all_files();
-                    enable_file(FILE1);
-                    enable_file(SUBDIR1);
-                    enable_file(SUBDIR_FILE1);
+int request_id_compare(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return (x < y) ? -1 : (x > y);
+}
 
-                } else if (strcmp(tvalue,"syslog-write") == 0) {
-                    enableTest(SYSLOGWRITE_TEST);
+// Take num_ids ids on each of num_threads threads; returns ns per id, and
+// whether any id was handed out twice
+int64_t request_id_run(bool use_lock, int num_threads, int num_ids, bool* duplicates)
+{
+    pthread_t           threads[REQUEST_ID_MAX_THREADS];
+    request_id_thread_t info[REQUEST_ID_MAX_THREADS];
+    uint64_t*           ids = (uint64_t*)malloc((size_t)num_threads * num_ids * sizeof(uint64_t));
+    int                 t;
+    int                 i;
+
+    int64_t start_ns = registry_now_ns();
+    for (t = 0; t < num_threads; t++) {
+        info[t].use_lock = use_lock;
+        info[t].num_ids  = num_ids;
+        info[t].ids      = ids + (size_t)t * num_ids;
+        pthread_create(&threads[t], NULL, request_id_thread, &info[t]);
+    }
+    for (t = 0; t < num_threads; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    int64_t elapsed_ns = registry_now_ns() - start_ns;
+
+    qsort(ids, (size_t)num_threads * num_ids, sizeof(uint64_t), request_id_compare);
+    *duplicates = false;
+    for (i = 1; i < num_threads * num_ids; i++) {
+        if (ids[i] == ids[i - 1]) {
+            *duplicates = true;
+        }
+    }
+    free(ids);
+    return elapsed_ns / ((int64_t)num_threads * num_ids);
+}
 
-                    // Disable some of the other tests to get to the one we want quicker
-                    disableTest(ERROR_TESTS);
-                    disableTest(LOOKUP_TESTS);
-                    disableTest(READSYMLINK_TESTS);
-                    disableTest(READDIR_TESTS);
-                    disableTest(STATSIZE_TESTS);
+void request_id_tests()
+{
+    char* funcToTest      = "request ids";
+    int   thread_counts[] = { 1, 8, 64, 128 };
+    int   num_ids         = 20000;
+    bool  failed          = false;
+    bool  duplicates;
+    int   i;
+
+    // Carry on past the 32-bit limits
+    jsonrpc_test_set_next_request_id(((uint64_t)1 << 32) - 1000);
+    for (i = 0; i < sizeof(thread_counts) / sizeof(thread_counts[0]); i++) {
+        int     num_threads = thread_counts[i];
+        int64_t lock_ns     = request_id_run(true, num_threads, num_ids, &duplicates);
+        int64_t atomic_ns   = request_id_run(false, num_threads, num_ids, &duplicates);
+        if (duplicates) {
+            TLOG("%s: an id was handed out twice with %d threads.\n", funcToTest, num_threads);
+            failed = true;
+        }
+        if (!silent) {
+            printf("  request ids, %3d threads: %6.1f ns/id under a mutex, %6.1f ns/id atomically\n",
+                   num_threads, (double)lock_ns, (double)atomic_ns);
+        }
+    }
+    uint64_t next = jsonrpc_test_get_request_id();
+    if (next <= ((uint64_t)1 << 32)) {
+        TLOG("%s: ids wrapped, next is %" PRIu64 ".\n", funcToTest, next);
+        failed = true;
+    }
 
-                } else if (strcmp(tvalue,"mount") == 0) {
-                    disableAllTests();
-                    enableTest(MOUNT_TESTS);
-                    enableTest(ERROR_TESTS);
+    if (failed) {
+        test_failed(funcToTest);
+    } else {
+        test_passed();
+    }
+}
 
-                    disable_all_files();
+void registry_tests()
+{
+    registry_basic_tests();
+    registry_lookup_bench();
+    request_id_tests();
+}
 
-                } else if (strcmp(tvalue,"chown") == 0) {
-                    disableAllTests();
-                    enableTest(CHOWNCHMOD_TESTS);
-                    enableTest(ERROR_TESTS);
-                    enableTest(MOUNT_TESTS);
-                    enableTest(MKDIRCREATE_TESTS);
-                    enableTest(LINK_TESTS);
-                    enableTest(UNLINKRMDIR_TESTS);
+// Tagged fast-path I/O against the local mock server
 
-                } else if (strcmp(tvalue,"mkdir") == 0) {
-                    disableAllTests();
-                    enableTest(MOUNT_TESTS);
-                    enableTest(ERROR_TESTS);
-                    enableTest(MKDIRCREATE_TESTS);
-                    enableTest(UNLINKRMDIR_TESTS);
+#define TAGGED_IO_BLOCKS      256
+#define TAGGED_IO_BLOCK_SIZE  4096
+#define TAGGED_IO_INODES      4
 
-                } else if (strcmp(tvalue,"readdir") == 0) {
-                    disableAllTests();
-                    enableTest(READDIR_TESTS);
-                    enableTest(MOUNT_TESTS);
-                    enableTest(ERROR_TESTS);
-                    enableTest(MKDIRCREATE_TESTS);
-                    enableTest(LINK_TESTS);
-                    enableTest(UNLINKRMDIR_TESTS);
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t  cv;
+    int             outstanding;
+    int             errors;
+    int             completed;
+    int             out_of_order;   // completions that overtook an earlier submission
+} tagged_io_state_t;
 
-                } else if (strcmp(tvalue,"async") == 0) {
-                    disableAllTests();
-                    enableTest(ASYNC_READWRITE_TESTS);
-                    enableTest(MOUNT_TESTS);
-                    enableTest(ERROR_TESTS);
-                    enableTest(MKDIRCREATE_TESTS);
-                    enableTest(LINK_TESTS);
-                    enableTest(UNLINKRMDIR_TESTS);
+typedef struct {
+    proxyfs_io_request_t req;
+    tagged_io_state_t*   state;
+    int                  index;
+} tagged_io_t;
 
-                    disable_all_files();
-                    enable_file(FILE1);
-                    enable_file(SUBDIR1);
-                    enable_file(SUBDIR_FILE1);
-                    enable_file(SYMLINK1);
-                    enable_file(BAD_INODE);
+void tagged_io_callback(proxyfs_io_request_t* req)
+{
+    tagged_io_t*       io    = (tagged_io_t*)req->done_cb_arg;
+    tagged_io_state_t* state = io->state;
 
-                } else if (strcmp(tvalue,"statvfs") == 0) {
-                    disableAllTests();
-                    enableTest(MOUNT_TESTS);
-                    //enableTest(ERROR_TESTS);
-                    enableTest(STATVFS_TESTS);
+    pthread_mutex_lock(&state->lock);
+    if ((req->error != 0) || (req->out_size != req->length)) {
+        state->errors++;
+    }
+    if (io->index < state->completed) {
+        state->out_of_order++;
+    }
+    state->completed = (io->index + 1 > state->completed) ? io->index + 1 : state->completed;
+    state->outstanding--;
+    pthread_cond_signal(&state->cv);
+    pthread_mutex_unlock(&state->lock);
+}
 
-                } else if (strcmp(tvalue,"fake_hang") == 0) {
-                    fakeHang = true;
+void tagged_io_fill(uint8_t* buf, int block)
+{
+    int i;
+    for (i=0; i < TAGGED_IO_BLOCK_SIZE; i++) {
+        buf[i] = (uint8_t)(block * 31 + i);
+    }
+}
 
-                } else {
-                    printf("Unknown test supplied: %s\n\n",tvalue);
-                    print_usage();
-                    return -1;
-                }
-                break;
-            case '?':
-                if ((optopt == 'r') || (optopt == 't')) {
-                    printf("Option -%c requires an argument.\n", optopt);
-                } else if (isprint(optopt)) {
-                    printf("Unknown option `-%c'.\n", optopt);
-                } else {
-                    printf("Unknown option character `\\x%x'.\n", optopt);
-                }
-                return 1;
-            default:
-                abort ();
+// Submit one request per block and wait for them all; returns the number that failed
+int tagged_io_run(mount_handle_t* mh, io_op_t op, tagged_io_t* ios, uint8_t* data, tagged_io_state_t* state)
+{
+    int i;
+
+    state->outstanding  = TAGGED_IO_BLOCKS;
+    state->errors       = 0;
+    state->completed    = 0;
+    state->out_of_order = 0;
+
+    for (i=0; i < TAGGED_IO_BLOCKS; i++) {
+        ios[i].state = state;
+        ios[i].index = i;
+        bzero(&ios[i].req, sizeof(ios[i].req));
+        ios[i].req.op           = op;
+        ios[i].req.mount_handle = mh;
+        ios[i].req.inode_number = 1 + (i % TAGGED_IO_INODES);
+        ios[i].req.offset       = (uint64_t)(i / TAGGED_IO_INODES) * TAGGED_IO_BLOCK_SIZE;
+        ios[i].req.length       = TAGGED_IO_BLOCK_SIZE;
+        ios[i].req.data         = data + (size_t)i * TAGGED_IO_BLOCK_SIZE;
+        ios[i].req.done_cb      = tagged_io_callback;
+        ios[i].req.done_cb_arg  = &ios[i];
+
+        int err = proxyfs_async_send(&ios[i].req);
+        if (err != 0) {
+            TLOG("tagged io: submit of block %d failed, err=%d.\n", i, err);
+            pthread_mutex_lock(&state->lock);
+            state->outstanding--;
+            state->errors++;
+            pthread_mutex_unlock(&state->lock);
         }
     }
 
-    if (!rpc_config_specified) {
-        printf("-r <JSON:RPC/tuple> must be specified.\n");
-        return 1;
+    pthread_mutex_lock(&state->lock);
+    while (state->outstanding > 0) {
+        pthread_cond_wait(&state->cv, &state->lock);
     }
+    pthread_mutex_unlock(&state->lock);
 
-    // print the tests to run; note that this must be done after
-    // after all the "-t" options have been parsed
-    if (print_tests) {
-        print_test_settings();
-    }
+    return state->errors;
+}
 
-    // Caller doesn't want debug prints from proxyfs code
+void tagged_io_tests()
+{
+    char*             funcToTest = "tagged io";
+    mount_handle_t    mh;
+    tagged_io_state_t state;
+    int               i;
+
+    int port = mock_fastpath_server_start(8);
+    if (port < 0) {
+        TLOG("%s: failed to start mock server.\n", funcToTest);
+        test_failed(funcToTest);
+        return;
+    }
+
+    int err = fastpath_start("127.0.0.1", port, 2, 32);
+    if (err != 0) {
+        TLOG("%s: fastpath_start failed, err=%d.\n", funcToTest, err);
+        test_failed(funcToTest);
+        mock_fastpath_server_stop();
+        return;
+    }
+
+    bzero(&mh, sizeof(mh));
+    pthread_mutex_init(&state.lock, NULL);
+    pthread_cond_init(&state.cv, NULL);
+
+    tagged_io_t* ios      = (tagged_io_t*)calloc(TAGGED_IO_BLOCKS, sizeof(tagged_io_t));
+    uint8_t*     expected = (uint8_t*)malloc(TAGGED_IO_BLOCKS * TAGGED_IO_BLOCK_SIZE);
+    uint8_t*     readback = (uint8_t*)malloc(TAGGED_IO_BLOCKS * TAGGED_IO_BLOCK_SIZE);
+    for (i=0; i < TAGGED_IO_BLOCKS; i++) {
+        tagged_io_fill(expected + (size_t)i * TAGGED_IO_BLOCK_SIZE, i);
+    }
+    memset(readback, 0xff, TAGGED_IO_BLOCKS * TAGGED_IO_BLOCK_SIZE);
+
+    bool failed = false;
+    if (tagged_io_run(&mh, IO_WRITE, ios, expected, &state) != 0) {
+        TLOG("%s: %d writes failed.\n", funcToTest, state.errors);
+        failed = true;
+    }
+    int writesReordered = state.out_of_order;
+
+    if (tagged_io_run(&mh, IO_READ, ios, readback, &state) != 0) {
+        TLOG("%s: %d reads failed.\n", funcToTest, state.errors);
+        failed = true;
+    }
+    int readsReordered = state.out_of_order;
+
+    for (i=0; i < TAGGED_IO_BLOCKS; i++) {
+        size_t off = (size_t)i * TAGGED_IO_BLOCK_SIZE;
+        if (memcmp(expected + off, readback + off, TAGGED_IO_BLOCK_SIZE) != 0) {
+            TLOG("%s: block %d read back wrong data.\n", funcToTest, i);
+            failed = true;
+        }
+    }
+
+    // The mock server answers in reverse batches, so completions must have been reordered
+    if ((writesReordered + readsReordered) == 0) {
+        TLOG("%s: expected out-of-order completions, saw none.\n", funcToTest);
+        failed = true;
+    }
+    if (!silent) {
+        printf("  tagged io: %d blocks, %d writes and %d reads completed out of order\n",
+               TAGGED_IO_BLOCKS, writesReordered, readsReordered);
+    }
+
+    // Tags that index past the slots, either way, fail the connection
+    // rather than being looked up
+    mock_fastpath_server_set_tag_xor(0x80000000ULL);
+    if (tagged_io_run(&mh, IO_READ, ios, readback, &state) != TAGGED_IO_BLOCKS) {
+        TLOG("%s: %d of %d reads with bad tags failed.\n", funcToTest, state.errors, TAGGED_IO_BLOCKS);
+        failed = true;
+    }
+    mock_fastpath_server_set_tag_xor(0);
+
+    if (failed) {
+        test_failed(funcToTest);
+    } else {
+        test_passed();
+    }
+
+    fastpath_stop();
+    mock_fastpath_server_stop();
+
+    free(ios);
+    free(expected);
+    free(readback);
+    pthread_cond_destroy(&state.cv);
+    pthread_mutex_destroy(&state.lock);
+}
+
+// Vectored reads and writes against the local mock server
+
+#define VECTORED_IO_SEGMENTS  100   // more than the socket layer hands the kernel at once
+#define VECTORED_IO_INODE     7
+
+// Split buf into segments of varying sizes; returns the number used
+int vectored_io_split(uint8_t* buf, size_t len, struct iovec* iov, int maxSegments, int seed)
+{
+    int    n   = 0;
+    size_t off = 0;
+    while ((off < len) && (n < maxSegments)) {
+        size_t segLen = (n == maxSegments - 1) ? (len - off) : (size_t)(1 + ((n * 37 + seed) % 97));
+        segLen = (segLen > len - off) ? (len - off) : segLen;
+        iov[n].iov_base = buf + off;
+        iov[n].iov_len  = segLen;
+        off += segLen;
+        n++;
+    }
+    return n;
+}
+
+void vectored_io_callback(proxyfs_io_request_t* req)
+{
+    tagged_io_state_t* state = (tagged_io_state_t*)req->done_cb_arg;
+
+    pthread_mutex_lock(&state->lock);
+    if ((req->error != 0) || (req->out_size != req->length)) {
+        state->errors++;
+    }
+    state->outstanding--;
+    pthread_cond_signal(&state->cv);
+    pthread_mutex_unlock(&state->lock);
+}
+
+// Send one vectored request through proxyfs_async_send and wait for it
+int vectored_io_async(mount_handle_t* mh, io_op_t op, uint64_t offset, struct iovec* iov, int iovcnt,
+                      size_t len, tagged_io_state_t* state)
+{
+    proxyfs_io_request_t req;
+    bzero(&req, sizeof(req));
+    req.op           = op;
+    req.mount_handle = mh;
+    req.inode_number = VECTORED_IO_INODE;
+    req.offset       = offset;
+    req.length       = len;
+    req.iov          = iov;
+    req.iovcnt       = iovcnt;
+    req.done_cb      = vectored_io_callback;
+    req.done_cb_arg  = state;
+
+    state->outstanding = 1;
+    state->errors      = 0;
+    int err = proxyfs_async_send(&req);
+    if (err != 0) {
+        return err;
+    }
+
+    pthread_mutex_lock(&state->lock);
+    while (state->outstanding > 0) {
+        pthread_cond_wait(&state->cv, &state->lock);
+    }
+    pthread_mutex_unlock(&state->lock);
+
+    return (state->errors == 0) ? 0 : EIO;
+}
+
+void vectored_io_tests()
+{
+    char*             funcToTest = "vectored io";
+    mount_handle_t    mh;
+    tagged_io_state_t state;
+    struct iovec      wiov[VECTORED_IO_SEGMENTS];
+    struct iovec      riov[VECTORED_IO_SEGMENTS];
+    size_t            len = 64 * 1024 + 123;
+    size_t            outSize = 0;
+    uint64_t          written = 0;
+    bool              failed  = false;
+    size_t            i;
+
+    int port = mock_fastpath_server_start(4);
+    if (port < 0) {
+        TLOG("%s: failed to start mock server.\n", funcToTest);
+        test_failed(funcToTest);
+        return;
+    }
+
+    bzero(&mh, sizeof(mh));
+    pthread_mutex_init(&state.lock, NULL);
+    pthread_cond_init(&state.cv, NULL);
+
+    uint8_t* expected = (uint8_t*)malloc(len);
+    uint8_t* readback = (uint8_t*)malloc(len);
+    for (i=0; i < len; i++) {
+        expected[i] = (uint8_t)(i * 7 + (i >> 8));
+    }
+
+    // Synchronous readv/writev over the untagged protocol
+    int err = proxyfs_test_io_connect("127.0.0.1", port);
+    if (err != 0) {
+        TLOG("%s: failed to connect to mock server, err=%d.\n", funcToTest, err);
+        failed = true;
+    } else {
+        int wcnt = vectored_io_split(expected, len, wiov, VECTORED_IO_SEGMENTS, 3);
+        err = proxyfs_writev(&mh, VECTORED_IO_INODE, 0, wiov, wcnt, &written);
+        if ((err != 0) || (written != len)) {
+            TLOG("%s: proxyfs_writev of %d segments returned %d, wrote %ld of %ld bytes.\n",
+                 funcToTest, wcnt, err, written, len);
+            failed = true;
+        }
+
+        memset(readback, 0, len);
+        int rcnt = vectored_io_split(readback, len, riov, VECTORED_IO_SEGMENTS, 11);
+        err = proxyfs_readv(&mh, VECTORED_IO_INODE, 0, riov, rcnt, &outSize);
+        if ((err != 0) || (outSize != len) || (memcmp(expected, readback, len) != 0)) {
+            TLOG("%s: proxyfs_readv of %d segments returned %d, read %ld of %ld bytes.\n",
+                 funcToTest, rcnt, err, outSize, len);
+            failed = true;
+        }
+
+        // Segments that don't add up to the request length are rejected before anything is sent
+        proxyfs_io_request_t req;
+        bzero(&req, sizeof(req));
+        req.op           = IO_WRITE;
+        req.mount_handle = &mh;
+        req.inode_number = VECTORED_IO_INODE;
+        req.length       = len + 1;
+        req.iov          = wiov;
+        req.iovcnt       = wcnt;
+        err = proxyfs_sync_io(&req);
+        if (err != EINVAL) {
+            TLOG("%s: sync write of %ld bytes from %ld bytes of segments returned %d, expected EINVAL.\n",
+                 funcToTest, req.length, len, err);
+            failed = true;
+        }
+        proxyfs_test_io_disconnect();
+    }
+
+    // Async vectored requests over the tagged protocol, at a different offset
+    err = fastpath_start("127.0.0.1", port, 1, 8);
+    if (err != 0) {
+        TLOG("%s: fastpath_start failed, err=%d.\n", funcToTest, err);
+        failed = true;
+    } else {
+        int wcnt = vectored_io_split(expected, len, wiov, VECTORED_IO_SEGMENTS, 5);
+        err = vectored_io_async(&mh, IO_WRITE, 4096, wiov, wcnt, len, &state);
+        if (err != 0) {
+            TLOG("%s: async vectored write failed, err=%d.\n", funcToTest, err);
+            failed = true;
+        }
+
+        memset(readback, 0, len);
+        int rcnt = vectored_io_split(readback, len, riov, VECTORED_IO_SEGMENTS, 17);
+        err = vectored_io_async(&mh, IO_READ, 4096, riov, rcnt, len, &state);
+        if ((err != 0) || (memcmp(expected, readback, len) != 0)) {
+            TLOG("%s: async vectored read failed, err=%d.\n", funcToTest, err);
+            failed = true;
+        }
+
+        err = vectored_io_async(&mh, IO_READ, 4096, riov, rcnt, len - 1, &state);
+        if (err != EINVAL) {
+            TLOG("%s: async read of %ld bytes into %ld bytes of segments returned %d, expected EINVAL.\n",
+                 funcToTest, len - 1, len, err);
+            failed = true;
+        }
+        fastpath_stop();
+    }
+
+    if (failed) {
+        test_failed(funcToTest);
+    } else {
+        test_passed();
+    }
+
+    mock_fastpath_server_stop();
+    free(expected);
+    free(readback);
+    pthread_cond_destroy(&state.cv);
+    pthread_mutex_destroy(&state.lock);
+}
+
+// 4K synchronous fast-path IOPS against the local mock server, with header
+// and data sent/received in one system call and, for comparison, separately.
+
+#define FASTPATH_BENCH_OPS    10000
+#define FASTPATH_BENCH_SIZE   4096
+#define FASTPATH_BENCH_INODE  9
+#define FASTPATH_BENCH_ROUNDS 3
+
+// Returns ops/sec, or -1 if an operation failed
+double fastpath_bench_run(mount_handle_t* mh, io_op_t op, uint8_t* buf)
+{
+    int     i       = 0;
+    int64_t startNs = registry_now_ns();
+
+    for (i=0; i < FASTPATH_BENCH_OPS; i++) {
+        uint64_t offset = (uint64_t)(i % 256) * FASTPATH_BENCH_SIZE;
+        int      err    = 0;
+        if (op == IO_WRITE) {
+            uint64_t written = 0;
+            buf[0] = (uint8_t)i;
+            err = proxyfs_write(mh, FASTPATH_BENCH_INODE, offset, buf, FASTPATH_BENCH_SIZE, &written);
+            err = ((err == 0) && (written != FASTPATH_BENCH_SIZE)) ? EIO : err;
+        } else {
+            size_t readSize = 0;
+            err = proxyfs_read(mh, FASTPATH_BENCH_INODE, offset, FASTPATH_BENCH_SIZE, buf, FASTPATH_BENCH_SIZE, &readSize);
+            err = ((err == 0) && (readSize != FASTPATH_BENCH_SIZE)) ? EIO : err;
+        }
+        if (err != 0) {
+            TLOG("fastpath io bench: op %d at offset %ld failed, err=%d.\n", i, offset, err);
+            return -1;
+        }
+    }
+
+    int64_t elapsedNs = registry_now_ns() - startNs;
+    return (double)FASTPATH_BENCH_OPS * 1000000000.0 / (double)elapsedNs;
+}
+
+void fastpath_io_bench()
+{
+    char*          funcToTest = "fastpath io bench";
+    mount_handle_t mh;
+    uint8_t        buf[FASTPATH_BENCH_SIZE];
+    double         iops[2][2];   // [coalesced][write, read]
+    bool           failed = false;
+    int            coalesce, op, round;
+
+    int port = mock_fastpath_server_start(1);
+    if ((port < 0) || (proxyfs_test_io_connect("127.0.0.1", port) != 0)) {
+        TLOG("%s: failed to start or connect to mock server.\n", funcToTest);
+        test_failed(funcToTest);
+        mock_fastpath_server_stop();
+        return;
+    }
+
+    bzero(&mh, sizeof(mh));
+    memset(buf, 0x5a, sizeof(buf));
+
+    // Alternate the two modes a few times and keep the best of each, so that
+    // a burst of noise on the machine doesn't decide the comparison
+    bzero(iops, sizeof(iops));
+    for (round=0; round < FASTPATH_BENCH_ROUNDS; round++) {
+        for (coalesce=0; coalesce <= 1; coalesce++) {
+            proxyfs_test_set_io_coalescing(coalesce);
+            for (op=0; op <= 1; op++) {
+                double result = fastpath_bench_run(&mh, (op == 0) ? IO_WRITE : IO_READ, buf);
+                if (result < 0) {
+                    failed = true;
+                }
+                iops[coalesce][op] = (result > iops[coalesce][op]) ? result : iops[coalesce][op];
+            }
+        }
+    }
+    proxyfs_test_set_io_coalescing(true);
+
+    // A response bigger than the buffer fails the read and leaves the rest of it on the socket. The
+    // socket is shut down, so nothing else is read from it, and the caller is told to close it.
+    proxyfs_io_request_t req;
+    bzero(&req, sizeof(req));
+    req.op           = IO_READ;
+    req.mount_handle = &mh;
+    req.inode_number = FASTPATH_BENCH_INODE;
+    req.length       = FASTPATH_BENCH_SIZE;
+    req.data         = buf;
+
+    int fd = sock_open("127.0.0.1", port);
+    mock_fastpath_server_set_read_extra(100);
+    int err = proxyfs_read_req(&req, fd);
+    mock_fastpath_server_set_read_extra(0);
+    if ((err != EIO) || (req.error != EIO)) {
+        TLOG("%s: oversized read response returned %d, error %d, expected EIO.\n", funcToTest, err, req.error);
+        failed = true;
+    }
+    req.error = 0;
+    err = proxyfs_read_req(&req, fd);
+    if ((err != EIO) || (req.error != EIO)) {
+        TLOG("%s: read after a broken response returned %d, error %d, expected EIO.\n", funcToTest, err, req.error);
+        failed = true;
+    }
+    sock_close(fd);
+
+    // The sync API replaces its broken socket, so the next read goes through, in either receive mode
+    for (coalesce=0; coalesce <= 1; coalesce++) {
+        proxyfs_test_set_io_coalescing(coalesce);
+        mock_fastpath_server_set_read_extra(100);
+        req.error = 0;
+        err = proxyfs_sync_io(&req);
+        mock_fastpath_server_set_read_extra(0);
+        if (err != EIO) {
+            TLOG("%s: oversized sync read (coalesce %d) returned %d, expected EIO.\n", funcToTest, coalesce, err);
+            failed = true;
+        }
+        req.error    = 0;
+        req.out_size = 0;
+        err = proxyfs_sync_io(&req);
+        if ((err != 0) || (req.error != 0) || (req.out_size != FASTPATH_BENCH_SIZE)) {
+            TLOG("%s: sync read (coalesce %d) after a broken response returned %d, error %d, size %zu.\n",
+                 funcToTest, coalesce, err, req.error, (size_t)req.out_size);
+            failed = true;
+        }
+    }
+    proxyfs_test_set_io_coalescing(true);
+
+    if (failed) {
+        test_failed(funcToTest);
+    } else {
+        test_passed();
+    }
+    if (!silent && !failed) {
+        printf("  4K sync write: %8.0f IOPS separate syscalls, %8.0f IOPS coalesced\n", iops[0][0], iops[1][0]);
+        printf("  4K sync read:  %8.0f IOPS separate syscalls, %8.0f IOPS coalesced\n", iops[0][1], iops[1][1]);
+    }
+
+    proxyfs_test_io_disconnect();
+    mock_fastpath_server_stop();
+}
+
+// Client-side attribute cache
+
+proxyfs_stat_t attr_cache_test_stat(uint64_t ino)
+{
+    proxyfs_stat_t stat;
+    bzero(&stat, sizeof(stat));
+    stat.ino   = ino;
+    stat.size  = ino * 100;
+    stat.nlink = 1;
+    stat.mode  = S_IFREG;
+    return stat;
+}
+
+void attr_cache_tests()
+{
+    char*                      funcToTest = "attr cache";
+    proxyfs_attr_cache_stats_t stats;
+    proxyfs_stat_t             stat;
+    proxyfs_stat_t             cached;
+    bool                       failed = false;
+    uint64_t                   ino;
+
+    // Caching off: everything is a no-op and every lookup misses
+    attr_cache_t* cache = attr_cache_create(0, 100);
+    stat = attr_cache_test_stat(1);
+    attr_cache_insert(cache, &stat, attr_cache_generation(cache));
+    if ((cache != NULL) || attr_cache_lookup(cache, 1, &cached)) {
+        TLOG("%s: a cache with a ttl of 0 should be off.\n", funcToTest);
+        failed = true;
+    }
+
+    // Hits, and LRU eviction once over capacity
+    cache = attr_cache_create(60000, 4);
+    for (ino=1; ino <= 4; ino++) {
+        stat = attr_cache_test_stat(ino);
+        attr_cache_insert(cache, &stat, attr_cache_generation(cache));
+    }
+    for (ino=4; ino >= 1; ino--) {
+        // 1 ends up most recently used, 4 least
+        if (!attr_cache_lookup(cache, ino, &cached) || (cached.size != ino * 100)) {
+            TLOG("%s: inode %ld should have been cached.\n", funcToTest, ino);
+            failed = true;
+        }
+    }
+    stat = attr_cache_test_stat(5);
+    attr_cache_insert(cache, &stat, attr_cache_generation(cache));
+    if (attr_cache_lookup(cache, 4, &cached) || !attr_cache_lookup(cache, 1, &cached)) {
+        TLOG("%s: inserting past capacity should evict the least recently used inode.\n", funcToTest);
+        failed = true;
+    }
+
+    // Replacing an entry, and invalidation
+    stat = attr_cache_test_stat(1);
+    stat.size = 12345;
+    attr_cache_insert(cache, &stat, attr_cache_generation(cache));
+    if (!attr_cache_lookup(cache, 1, &cached) || (cached.size != 12345)) {
+        TLOG("%s: a second insert should replace the cached attributes.\n", funcToTest);
+        failed = true;
+    }
+    attr_cache_invalidate(cache, 1);
+    if (attr_cache_lookup(cache, 1, &cached)) {
+        TLOG("%s: inode 1 should have been invalidated.\n", funcToTest);
+        failed = true;
+    }
+
+    // Attributes fetched before an invalidation are not cached
+    uint64_t generation = attr_cache_generation(cache);
+    attr_cache_invalidate(cache, 2);
+    stat = attr_cache_test_stat(2);
+    attr_cache_insert(cache, &stat, generation);
+    if (attr_cache_lookup(cache, 2, &cached)) {
+        TLOG("%s: attributes that raced with an invalidation should not be cached.\n", funcToTest);
+        failed = true;
+    }
+
+    attr_cache_get_stats(cache, &stats);
+    if ((stats.hits != 6) || (stats.misses != 3) || (stats.evictions != 1) || (stats.invalidations != 2) ||
+        (stats.stale_insertions != 1) || (stats.insertions != 6) || (stats.entries != 2)) {
+        TLOG("%s: unexpected counters: hits=%ld misses=%ld evictions=%ld invalidations=%ld stale=%ld "
+             "insertions=%ld entries=%ld.\n", funcToTest, stats.hits, stats.misses, stats.evictions,
+             stats.invalidations, stats.stale_insertions, stats.insertions, stats.entries);
+        failed = true;
+    }
+
+    attr_cache_invalidate_all(cache);
+    attr_cache_get_stats(cache, &stats);
+    if (stats.entries != 0) {
+        TLOG("%s: %ld entries left after invalidating everything.\n", funcToTest, stats.entries);
+        failed = true;
+    }
+    attr_cache_destroy(cache);
+
+    // Entries expire after the ttl
+    cache = attr_cache_create(20, 10);
+    stat = attr_cache_test_stat(7);
+    attr_cache_insert(cache, &stat, attr_cache_generation(cache));
+    if (!attr_cache_lookup(cache, 7, &cached)) {
+        TLOG("%s: inode 7 should be cached before its ttl.\n", funcToTest);
+        failed = true;
+    }
+    usleep(40 * 1000);
+    if (attr_cache_lookup(cache, 7, &cached)) {
+        TLOG("%s: inode 7 should have expired.\n", funcToTest);
+        failed = true;
+    }
+    attr_cache_get_stats(cache, &stats);
+    if (stats.expirations != 1) {
+        TLOG("%s: expected 1 expiration, got %ld.\n", funcToTest, stats.expirations);
+        failed = true;
+    }
+    attr_cache_destroy(cache);
+
+    if (failed) {
+        test_failed(funcToTest);
+    } else {
+        test_passed();
+    }
+}
+
+// Client-side directory entry cache
+
+void dentry_cache_tests()
+{
+    char*                        funcToTest = "dentry cache";
+    proxyfs_dentry_cache_stats_t stats;
+    bool                         failed = false;
+    uint64_t                     ino    = 0;
+    char                         name[32];
+    int                          i;
+
+    // Caching off: everything is a no-op and every lookup misses
+    dentry_cache_t* cache = dentry_cache_create(0, 1000, 100);
+    dentry_cache_insert(cache, 1, "a", 2, dentry_cache_generation(cache));
+    if ((cache != NULL) || (dentry_cache_lookup(cache, 1, "a", &ino) != DENTRY_CACHE_MISS)) {
+        TLOG("%s: a cache with a ttl of 0 should be off.\n", funcToTest);
+        failed = true;
+    }
+
+    // Positive and negative entries; the same name in another directory is a different entry
+    cache = dentry_cache_create(60000, 60000, 4);
+    dentry_cache_insert(cache, 1, "a", 10, dentry_cache_generation(cache));
+    dentry_cache_insert_negative(cache, 1, "desktop.ini", dentry_cache_generation(cache));
+    if ((dentry_cache_lookup(cache, 1, "a", &ino) != DENTRY_CACHE_HIT) || (ino != 10)) {
+        TLOG("%s: (1, a) should have been cached.\n", funcToTest);
+        failed = true;
+    }
+    if (dentry_cache_lookup(cache, 1, "desktop.ini", &ino) != DENTRY_CACHE_NEGATIVE) {
+        TLOG("%s: (1, desktop.ini) should have been cached as missing.\n", funcToTest);
+        failed = true;
+    }
+    if ((dentry_cache_lookup(cache, 2, "a", &ino) != DENTRY_CACHE_MISS) ||
+        (dentry_cache_lookup(cache, 1, "A", &ino) != DENTRY_CACHE_MISS)) {
+        TLOG("%s: lookups should match both the directory and the exact name.\n", funcToTest);
+        failed = true;
+    }
+
+    // Local changes: create replaces a negative entry, unlink leaves one, rename moves the inode
+    dentry_cache_update(cache, 1, "desktop.ini", 11);
+    if ((dentry_cache_lookup(cache, 1, "desktop.ini", &ino) != DENTRY_CACHE_HIT) || (ino != 11)) {
+        TLOG("%s: a local create should replace the negative entry.\n", funcToTest);
+        failed = true;
+    }
+    dentry_cache_remove(cache, 1, "a");
+    if (dentry_cache_lookup(cache, 1, "a", &ino) != DENTRY_CACHE_NEGATIVE) {
+        TLOG("%s: a local unlink should leave a negative entry.\n", funcToTest);
+        failed = true;
+    }
+    if (!dentry_cache_peek(cache, 1, "desktop.ini", &ino) || (ino != 11) || dentry_cache_peek(cache, 1, "a", &ino)) {
+        TLOG("%s: peek should only report names that exist.\n", funcToTest);
+        failed = true;
+    }
+    dentry_cache_invalidate(cache, 1, "a");
+    if (dentry_cache_lookup(cache, 1, "a", &ino) != DENTRY_CACHE_MISS) {
+        TLOG("%s: (1, a) should have been invalidated.\n", funcToTest);
+        failed = true;
+    }
+
+    // An answer from the server that raced with a local change is not cached
+    uint64_t generation = dentry_cache_generation(cache);
+    dentry_cache_update(cache, 1, "b", 12);
+    dentry_cache_insert_negative(cache, 1, "b", generation);
+    if ((dentry_cache_lookup(cache, 1, "b", &ino) != DENTRY_CACHE_HIT) || (ino != 12)) {
+        TLOG("%s: a lookup that raced with a local create should not be cached.\n", funcToTest);
+        failed = true;
+    }
+
+    // LRU eviction once over capacity: (1, desktop.ini) and (1, b) are cached, add 3 more
+    for (i=0; i < 3; i++) {
+        sprintf(name, "file%d", i);
+        dentry_cache_insert(cache, 3, name, 100 + i, dentry_cache_generation(cache));
+    }
+    if ((dentry_cache_lookup(cache, 1, "desktop.ini", &ino) != DENTRY_CACHE_MISS) ||
+        (dentry_cache_lookup(cache, 3, "file2", &ino) != DENTRY_CACHE_HIT) || (ino != 102)) {
+        TLOG("%s: inserting past capacity should evict the least recently used name.\n", funcToTest);
+        failed = true;
+    }
+
+    dentry_cache_get_stats(cache, &stats);
+    if ((stats.hits != 4) || (stats.negative_hits != 2) || (stats.misses != 4) || (stats.insertions != 6) ||
+        (stats.negative_insertions != 2) || (stats.stale_insertions != 1) || (stats.evictions != 1) ||
+        (stats.invalidations != 1) || (stats.entries != 4)) {
+        TLOG("%s: unexpected counters: hits=%ld negative_hits=%ld misses=%ld insertions=%ld negative_insertions=%ld "
+             "stale=%ld evictions=%ld invalidations=%ld entries=%ld.\n", funcToTest, stats.hits, stats.negative_hits,
+             stats.misses, stats.insertions, stats.negative_insertions, stats.stale_insertions, stats.evictions,
+             stats.invalidations, stats.entries);
+        failed = true;
+    }
+
+    dentry_cache_invalidate_all(cache);
+    dentry_cache_get_stats(cache, &stats);
+    if (stats.entries != 0) {
+        TLOG("%s: %ld entries left after invalidating everything.\n", funcToTest, stats.entries);
+        failed = true;
+    }
+    dentry_cache_destroy(cache);
+
+    // Negative entries expire after their own, shorter ttl; a negative ttl of 0 doesn't keep them
+    cache = dentry_cache_create(60000, 20, 10);
+    dentry_cache_insert(cache, 1, "found", 5, dentry_cache_generation(cache));
+    dentry_cache_insert_negative(cache, 1, "missing", dentry_cache_generation(cache));
+    usleep(40 * 1000);
+    if ((dentry_cache_lookup(cache, 1, "found", &ino) != DENTRY_CACHE_HIT) ||
+        (dentry_cache_lookup(cache, 1, "missing", &ino) != DENTRY_CACHE_MISS)) {
+        TLOG("%s: only the negative entry should have expired.\n", funcToTest);
+        failed = true;
+    }
+    dentry_cache_destroy(cache);
+
+    cache = dentry_cache_create(60000, 0, 10);
+    dentry_cache_insert_negative(cache, 1, "missing", dentry_cache_generation(cache));
+    dentry_cache_remove(cache, 1, "missing");
+    if (dentry_cache_lookup(cache, 1, "missing", &ino) != DENTRY_CACHE_MISS) {
+        TLOG("%s: negative entries should not be kept with a negative ttl of 0.\n", funcToTest);
+        failed = true;
+    }
+    dentry_cache_destroy(cache);
+
+    if (failed) {
+        test_failed(funcToTest);
+    } else {
+        test_passed();
+    }
+}
+
+// Client-side path walking. Everything the walks need is put in the caches
+// up front, so no request ever reaches a server.
+
+void path_walk_tests()
+{
+    char*                        funcToTest = "path walk";
+    proxyfs_dentry_cache_stats_t stats;
+    proxyfs_stat_t               stat;
+    proxyfs_stat_t*              out_stat = NULL;
+    mount_handle_t               mh;
+    bool                         failed   = false;
+    uint64_t                     ino      = 0;
+    int                          err;
+
+    bzero(&mh, sizeof(mh));
+    mh.root_dir_inode_num = 1;
+    mh.attr_cache         = attr_cache_create(60000, 100);
+    mh.dentry_cache       = dentry_cache_create(60000, 60000, 100);
+
+    // /a/b/c is inode 4; /a/missing is known not to exist
+    dentry_cache_insert(mh.dentry_cache, 1, "a", 2, dentry_cache_generation(mh.dentry_cache));
+    dentry_cache_insert(mh.dentry_cache, 2, "b", 3, dentry_cache_generation(mh.dentry_cache));
+    dentry_cache_insert(mh.dentry_cache, 3, "c", 4, dentry_cache_generation(mh.dentry_cache));
+    dentry_cache_insert_negative(mh.dentry_cache, 2, "missing", dentry_cache_generation(mh.dentry_cache));
+    bzero(&stat, sizeof(stat));
+    stat.ino  = 4;
+    stat.size = 4444;
+    attr_cache_insert(mh.attr_cache, &stat, attr_cache_generation(mh.attr_cache));
+
+    proxyfs_set_path_walk(true);
+
+    err = proxyfs_lookup_path(&mh, "/a/b/c", &ino);
+    if ((err != 0) || (ino != 4)) {
+        TLOG("%s: /a/b/c resolved to inode %ld with err=%d, expected inode 4.\n", funcToTest, ino, err);
+        failed = true;
+    }
+    err = proxyfs_lookup_path(&mh, "a//b/./c/", &ino);
+    if ((err != 0) || (ino != 4)) {
+        TLOG("%s: a//b/./c/ resolved to inode %ld with err=%d, expected inode 4.\n", funcToTest, ino, err);
+        failed = true;
+    }
+    err = proxyfs_lookup_path(&mh, "/", &ino);
+    if ((err != 0) || (ino != 1)) {
+        TLOG("%s: / resolved to inode %ld with err=%d, expected the root.\n", funcToTest, ino, err);
+        failed = true;
+    }
+    err = proxyfs_lookup_path(&mh, "/a/missing/c", &ino);
+    if (err != ENOENT) {
+        TLOG("%s: /a/missing/c returned err=%d, expected ENOENT.\n", funcToTest, err);
+        failed = true;
+    }
+
+    // The inode-based call the walk turns into is served from the attribute cache
+    err = proxyfs_get_stat_path(&mh, "/a/b/c", &out_stat);
+    if ((err != 0) || (out_stat == NULL) || (out_stat->size != 4444)) {
+        TLOG("%s: get_stat_path(/a/b/c) returned err=%d.\n", funcToTest, err);
+        failed = true;
+    }
+    free(out_stat);
+
+    dentry_cache_get_stats(mh.dentry_cache, &stats);
+    if ((stats.hits != 10) || (stats.negative_hits != 1) || (stats.misses != 0)) {
+        TLOG("%s: unexpected counters: hits=%ld negative_hits=%ld misses=%ld.\n", funcToTest, stats.hits,
+             stats.negative_hits, stats.misses);
+        failed = true;
+    }
+
+    // Calls that take two paths fail without a request if either is known not to exist
+    err = proxyfs_link_path(&mh, "/a/missing/new", "/a/b/c");
+    if (err != ENOENT) {
+        TLOG("%s: link_path into /a/missing returned err=%d, expected ENOENT.\n", funcToTest, err);
+        failed = true;
+    }
+    err = proxyfs_link_path(&mh, "/a/b/new", "/a/missing/c");
+    if (err != ENOENT) {
+        TLOG("%s: link_path to /a/missing/c returned err=%d, expected ENOENT.\n", funcToTest, err);
+        failed = true;
+    }
+    err = proxyfs_rename_path(&mh, "/a/b/c", "/a/missing/c");
+    if (err != ENOENT) {
+        TLOG("%s: rename_path into /a/missing returned err=%d, expected ENOENT.\n", funcToTest, err);
+        failed = true;
+    }
+
+    proxyfs_set_path_walk(false);
+    attr_cache_destroy(mh.attr_cache);
+    dentry_cache_destroy(mh.dentry_cache);
+
+    if (failed) {
+        test_failed(funcToTest);
+    } else {
+        test_passed();
+    }
+}
+
+// Directory streams, against the mock server's generated directory
+
+#define DIR_STREAM_INODE    2
+#define DIR_STREAM_ENTRIES  100000
+#define DIR_STREAM_UNBATCHED_ENTRIES 5000   // one RPC each, so keep it short
+#define DIR_STREAM_CACHED_ENTRIES    2000
+
+// List the first max_entries entries of the mock directory, checking each
+// one. Returns the number listed, or -1 on error.
+int dir_stream_list(mount_handle_t* mh, bool plus, int max_entries)
+{
+    proxyfs_dir_t* dir = NULL;
+    struct dirent  dir_ent;
+    proxyfs_stat_t stat;
+    char           expected[32];
+    int            count = 0;
+
+    int err = proxyfs_opendir(mh, DIR_STREAM_INODE, plus, &dir);
+    if (err != 0) {
+        TLOG("proxyfs_opendir returned err=%d.\n", err);
+        return -1;
+    }
+    while ((count < max_entries) && ((err = proxyfs_readdir_next(dir, &dir_ent, &stat)) == 0)) {
+        snprintf(expected, sizeof(expected), "entry%07d", count);
+        if ((strcmp(dir_ent.d_name, expected) != 0) || (dir_ent.d_ino != 1000 + count) ||
+            (plus && ((stat.ino != dir_ent.d_ino) || (stat.size != count)))) {
+            TLOG("entry %d is %s (inode %ld), expected %s.\n", count, dir_ent.d_name, dir_ent.d_ino, expected);
+            proxyfs_closedir(dir);
+            return -1;
+        }
+        count++;
+    }
+    proxyfs_closedir(dir);
+
+    if ((err != 0) && (err != ENOENT)) {
+        TLOG("proxyfs_readdir_next returned err=%d after %d entries.\n", err, count);
+        return -1;
+    }
+    return count;
+}
+
+void dir_stream_tests()
+{
+    char*           funcToTest = "dir stream";
+    mount_handle_t* mh         = NULL;
+    proxyfs_dir_t*  dir        = NULL;
+    struct dirent   dir_ent;
+    bool            failed     = false;
+    int             count, err, i;
+
+    int port = mock_fastpath_server_start(1);
+    if (port > 0) {
+        rpc_config_set("127.0.0.1", port, port);
+        err = proxyfs_mount("mock", 0, 0, 0, &mh);
+    }
+    if ((port < 0) || (mh == NULL)) {
+        TLOG("%s: failed to start or mount the mock server.\n", funcToTest);
+        test_failed(funcToTest);
+        return;
+    }
+    mock_server_set_dir(DIR_STREAM_INODE, DIR_STREAM_ENTRIES);
+
+    // Whole directory, by entry count and by buffer size
+    proxyfs_set_readdir_batch(256, 0);
+    count = dir_stream_list(mh, false, DIR_STREAM_ENTRIES + 1);
+    if (count != DIR_STREAM_ENTRIES) {
+        TLOG("%s: listed %d entries, expected %d.\n", funcToTest, count, DIR_STREAM_ENTRIES);
+        failed = true;
+    }
+    proxyfs_set_readdir_batch(1000, 64 * 1024);
+    count = dir_stream_list(mh, true, DIR_STREAM_ENTRIES + 1);
+    if (count != DIR_STREAM_ENTRIES) {
+        TLOG("%s: plus listed %d entries, expected %d.\n", funcToTest, count, DIR_STREAM_ENTRIES);
+        failed = true;
+    }
+
+    // Seeking within the current batch and past it
+    proxyfs_set_readdir_batch(256, 0);
+    if ((proxyfs_opendir(mh, DIR_STREAM_INODE, false, &dir) != 0) ||
+        (proxyfs_seekdir(dir, 99) != 0) || (proxyfs_readdir_next(dir, &dir_ent, NULL) != 0) ||
+        (strcmp(dir_ent.d_name, "entry0000100") != 0) ||
+        (proxyfs_seekdir(dir, 4999) != 0) || (proxyfs_readdir_next(dir, &dir_ent, NULL) != 0) ||
+        (strcmp(dir_ent.d_name, "entry0005000") != 0) ||
+        (proxyfs_seekdir(dir, DIR_STREAM_ENTRIES - 1) != 0) ||
+        (proxyfs_readdir_next(dir, &dir_ent, NULL) != ENOENT)) {
+        TLOG("%s: seekdir did not continue after the requested location.\n", funcToTest);
+        failed = true;
+    }
+    proxyfs_closedir(dir);
+
+    // Not a directory (as far as the mock is concerned)
+    dir = NULL;
+    if ((proxyfs_opendir(mh, DIR_STREAM_INODE + 1, false, &dir) != ENOTDIR) || (dir != NULL)) {
+        TLOG("%s: opendir of a non-directory should fail with ENOTDIR.\n", funcToTest);
+        failed = true;
+    }
+
+    // A plus listing primes the caches, so looking up and stat'ing what was
+    // listed doesn't go to the server (the mock doesn't even implement it)
+    mount_handle_t* cached_mh = NULL;
+    proxyfs_set_attr_cache(60000, 2 * DIR_STREAM_CACHED_ENTRIES);
+    proxyfs_set_dentry_cache(60000, 0, 2 * DIR_STREAM_CACHED_ENTRIES);
+    err = proxyfs_mount("mock", 0, 0, 0, &cached_mh);
+    proxyfs_set_attr_cache(0, 0);
+    proxyfs_set_dentry_cache(0, 0, 0);
+    if ((err != 0) || (dir_stream_list(cached_mh, true, DIR_STREAM_CACHED_ENTRIES) != DIR_STREAM_CACHED_ENTRIES)) {
+        TLOG("%s: mounting with caches or listing failed.\n", funcToTest);
+        failed = true;
+    } else {
+        uint64_t rpcs = mock_server_rpcs();
+        for (i = 0; i < DIR_STREAM_CACHED_ENTRIES; i++) {
+            char            name[32];
+            uint64_t        ino  = 0;
+            proxyfs_stat_t* stat = NULL;
+
+            snprintf(name, sizeof(name), "entry%07d", i);
+            if ((proxyfs_lookup(cached_mh, DIR_STREAM_INODE, name, &ino) != 0) || (ino != 1000 + i) ||
+                (proxyfs_get_stat(cached_mh, ino, &stat) != 0) || (stat->size != i)) {
+                TLOG("%s: %s was not answered from the caches.\n", funcToTest, name);
+                failed = true;
+                free(stat);
+                break;
+            }
+            free(stat);
+        }
+        if (mock_server_rpcs() != rpcs) {
+            TLOG("%s: %ld RPCs were sent for listed entries.\n", funcToTest, mock_server_rpcs() - rpcs);
+            failed = true;
+        }
+    }
+
+    if (failed) {
+        test_failed(funcToTest);
+    } else {
+        test_passed();
+    }
+
+    // Benchmark: one entry per RPC, as proxyfs_readdir_by_loc does, against batches
+    int64_t        prev_loc = -1;
+    uint64_t       rpcs     = mock_server_rpcs();
+    uint64_t       start    = registry_now_ns();
+    struct dirent* ent      = NULL;
+    for (i = 0; i < DIR_STREAM_UNBATCHED_ENTRIES; i++) {
+        if (proxyfs_readdir_by_loc(mh, DIR_STREAM_INODE, prev_loc, &ent) != 0) {
+            break;
+        }
+        prev_loc = ent->d_off;
+        free(ent);
+    }
+    double secs = (registry_now_ns() - start) / 1e9;
+    if (!silent) {
+        printf("  readdir_by_loc:        %8.0f entries/s, %5.2f entries/RPC (%d entries)\n",
+               i / secs, (double)i / (mock_server_rpcs() - rpcs), i);
+    }
+
+    uint64_t batches[] = { 16, 256, 4096 };
+    for (i = 0; i < sizeof(batches) / sizeof(batches[0]); i++) {
+        proxyfs_set_readdir_batch(batches[i], 0);
+        rpcs  = mock_server_rpcs();
+        start = registry_now_ns();
+        count = dir_stream_list(mh, false, DIR_STREAM_ENTRIES);
+        secs  = (registry_now_ns() - start) / 1e9;
+        if (!silent && (count > 0)) {
+            printf("  stream, batch %5ld:   %8.0f entries/s, %5.0f entries/RPC (%d entries)\n",
+                   batches[i], count / secs, (double)count / (mock_server_rpcs() - rpcs), count);
+        }
+    }
+
+    // How much of the next round trip prefetching hides
+    proxyfs_set_readdir_batch(256, 0);
+    for (i = 0; i < 2; i++) {
+        proxyfs_set_readdir_prefetch(i == 1);
+        rpcs  = mock_server_rpcs();
+        start = registry_now_ns();
+        count = dir_stream_list(mh, true, DIR_STREAM_ENTRIES);
+        secs  = (registry_now_ns() - start) / 1e9;
+        if (!silent && (count > 0)) {
+            printf("  plus stream, batch 256, prefetch %-3s: %8.0f entries/s (%d entries)\n",
+                   (i == 1) ? "on" : "off", count / secs, count);
+        }
+    }
+
+    // NOTE: The mock server is left running; see mock_server.h.
+}
+
+// Request rendering, compared with what json-c makes of the same request
+
+// Start the request both ways; expected gets the params object to add to
+json_object* request_writer_expected(jsonrpc_context_t* ctx, const char* method, json_object** params)
+{
+    char full_method[80];
+    snprintf(full_method, sizeof(full_method), "Server.%s", method);
+
+    json_object* request = json_object_new_object();
+    json_object* array   = json_object_new_array();
+    *params = json_object_new_object();
+    json_object_object_add(request, "id",      json_object_new_int64((int64_t)jsonrpc_test_req_id(ctx)));
+    json_object_object_add(request, "method",  json_object_new_string(full_method));
+    json_object_object_add(request, "jsonrpc", json_object_new_string("2.0"));
+    json_object_array_add(array, *params);
+    json_object_object_add(request, "params",  array);
+    return request;
+}
+
+// Check the rendered request against expected as json-c renders it with
+// flags, and free both
+bool request_writer_check_ext(char* funcToTest, jsonrpc_context_t* ctx, json_object* expected, int flags)
+{
+    size_t      len           = 0;
+    const char* text          = jsonrpc_test_req_text(ctx, &len);
+    const char* expected_text = json_object_to_json_string_ext(expected, flags);
+    bool        ok            = (text != NULL) && (len == strlen(text)) && (strcmp(text, expected_text) == 0);
+
+    if (!ok) {
+        TLOG("%s: rendered %.200s, expected %.200s.\n", funcToTest, (text != NULL) ? text : "(null)", expected_text);
+    }
+    json_object_put(expected);
+    jsonrpc_test_req_close(ctx);
+    return ok;
+}
+
+bool request_writer_check(char* funcToTest, jsonrpc_context_t* ctx, json_object* expected)
+{
+    return request_writer_check_ext(funcToTest, ctx, expected, JSON_C_TO_STRING_PLAIN);
+}
+
+// Start a request on a thread of its own, which exits while the request still holds its buffer
+void* request_writer_orphan(void* arg)
+{
+    jsonrpc_context_t** ctx = (jsonrpc_context_t**)arg;
+    *ctx = jsonrpc_test_req_open("RpcOrphan");
+    jsonrpc_set_req_param_uint64(*ctx, "InodeNumber", 1);
+    return NULL;
+}
+
+void request_writer_tests()
+{
+    char*        funcToTest = "request writer";
+    bool         failed     = false;
+    json_object* params     = NULL;
+    json_object* expected   = NULL;
+    int          i;
+
+    // No params
+    jsonrpc_context_t* ctx = jsonrpc_test_req_open("RpcPing");
+    expected = request_writer_expected(ctx, "RpcPing", &params);
+    failed |= !request_writer_check(funcToTest, ctx, expected);
+
+    // Ids past 32 bits
+    jsonrpc_test_set_next_request_id(((uint64_t)1 << 32) + 5);
+    ctx = jsonrpc_test_req_open("RpcPing");
+    expected = request_writer_expected(ctx, "RpcPing", &params);
+    failed |= !request_writer_check(funcToTest, ctx, expected);
+
+    // Every param type, with values that need escaping or are at the limits
+    char*   awkward = "quote\" back\\slash /path/ \b\f\n\r\t \x01\x1f \x7f caf\xc3\xa9";
+    uint8_t bytes[1000];
+    for (i = 0; i < sizeof(bytes); i++) {
+        bytes[i] = (uint8_t)(i * 7 + 3);
+    }
+    char* encoded = encode_binary(bytes, sizeof(bytes));
+
+    ctx = jsonrpc_test_req_open("RpcEverything");
+    expected = request_writer_expected(ctx, "RpcEverything", &params);
+    jsonrpc_set_req_param_str   (ctx, "Str",       awkward);
+    json_object_object_add(params, "Str",          json_object_new_string(awkward));
+    jsonrpc_set_req_param_str   (ctx, "Empty",     "");
+    json_object_object_add(params, "Empty",        json_object_new_string(""));
+    jsonrpc_set_req_param_str   (ctx, "Null",      NULL);
+    json_object_object_add(params, "Null",         NULL);
+    jsonrpc_set_req_param_int   (ctx, "IntMin",    INT32_MIN);
+    json_object_object_add(params, "IntMin",       json_object_new_int(INT32_MIN));
+    jsonrpc_set_req_param_int   (ctx, "IntMax",    INT32_MAX);
+    json_object_object_add(params, "IntMax",       json_object_new_int(INT32_MAX));
+    jsonrpc_set_req_param_int64 (ctx, "Int64Min",  INT64_MIN);
+    json_object_object_add(params, "Int64Min",     json_object_new_int64(INT64_MIN));
+    jsonrpc_set_req_param_int64 (ctx, "Zero",      0);
+    json_object_object_add(params, "Zero",         json_object_new_int64(0));
+    jsonrpc_set_req_param_uint64(ctx, "Uint64Max", UINT64_MAX);
+    json_object_object_add(params, "Uint64Max",    json_object_new_int64((int64_t)UINT64_MAX));
+    failed |= !request_writer_check(funcToTest, ctx, expected);
+
+    // Two requests rendered at once on one thread, the second one large
+    size_t big_len = 200000;
+    char*  big     = (char*)malloc(big_len + 1);
+    memset(big, '/', big_len);
+    big[big_len] = 0;
+
+    jsonrpc_context_t* first  = jsonrpc_test_req_open("RpcFirst");
+    json_object*       first_params   = NULL;
+    json_object*       first_expected = request_writer_expected(first, "RpcFirst", &first_params);
+    jsonrpc_set_req_param_uint64(first, "InodeNumber", 12345);
+    json_object_object_add(first_params, "InodeNumber", json_object_new_int64(12345));
+
+    ctx = jsonrpc_test_req_open("RpcSecond");
+    expected = request_writer_expected(ctx, "RpcSecond", &params);
+    jsonrpc_set_req_param_str(ctx, "Big", big);
+    json_object_object_add(params, "Big", json_object_new_string(big));
+
+    jsonrpc_set_req_param_str(first, "Basename", "after");
+    json_object_object_add(first_params, "Basename", json_object_new_string("after"));
+    failed |= !request_writer_check(funcToTest, ctx, expected);
+    failed |= !request_writer_check(funcToTest, first, first_expected);
+    free(big);
+
+    // Buffers are encoded straight into the request, and unlike json-c
+    // that leaves the slashes in base64 unescaped
+    ctx      = jsonrpc_test_req_open("RpcBuf");
+    expected = request_writer_expected(ctx, "RpcBuf", &params);
+    jsonrpc_set_req_param_buf   (ctx, "Buf",       bytes, sizeof(bytes));
+    json_object_object_add(params, "Buf",          json_object_new_string(encoded));
+    failed |= !request_writer_check_ext(funcToTest, ctx, expected, JSON_C_TO_STRING_NOSLASHESCAPE);
+    free(encoded);
+
+    // Including a 64 KiB write
+    size_t   write_len   = 65536 + 1;
+    uint8_t* write_bytes = (uint8_t*)malloc(write_len);
+    for (i = 0; i < write_len; i++) {
+        write_bytes[i] = (uint8_t)(i * 31 + (i >> 10));
+    }
+    encoded  = encode_binary(write_bytes, write_len);
+    ctx      = jsonrpc_test_req_open("RpcWrite");
+    expected = request_writer_expected(ctx, "RpcWrite", &params);
+    jsonrpc_set_req_param_uint64(ctx, "Offset", 4096);
+    json_object_object_add(params, "Offset", json_object_new_int64(4096));
+    jsonrpc_set_req_param_buf   (ctx, "Buf",    write_bytes, write_len);
+    json_object_object_add(params, "Buf",    json_object_new_string(encoded));
+    failed |= !request_writer_check_ext(funcToTest, ctx, expected, JSON_C_TO_STRING_NOSLASHESCAPE);
+    free(encoded);
+
+    // Finished and released after the thread that started it has exited, growing the thread's buffer
+    // on the way
+    pthread_t orphan_thread;
+    ctx = NULL;
+    pthread_create(&orphan_thread, NULL, request_writer_orphan, &ctx);
+    pthread_join(orphan_thread, NULL);
+    big = (char*)malloc(big_len + 1);
+    memset(big, 'x', big_len);
+    big[big_len] = 0;
+    expected = request_writer_expected(ctx, "RpcOrphan", &params);
+    json_object_object_add(params, "InodeNumber", json_object_new_int64(1));
+    jsonrpc_set_req_param_str(ctx, "Big", big);
+    json_object_object_add(params, "Big", json_object_new_string(big));
+    failed |= !request_writer_check(funcToTest, ctx, expected);
+    free(big);
+
+    if (failed) {
+        test_failed(funcToTest);
+    } else {
+        test_passed();
+    }
+
+    // Benchmark: a typical lookup request, both ways
+    int     num_requests = 200000;
+    int64_t start_ns     = registry_now_ns();
+    for (i = 0; i < num_requests; i++) {
+        size_t len;
+        ctx = jsonrpc_test_req_open("RpcLookup");
+        jsonrpc_set_req_param_str   (ctx, "MountID",     "AAAAAAAAAAAAAAAAAAAAAA==");
+        jsonrpc_set_req_param_uint64(ctx, "InodeNumber", 1000 + i);
+        jsonrpc_set_req_param_str   (ctx, "Basename",    "some-file.txt");
+        jsonrpc_test_req_text(ctx, &len);
+        jsonrpc_test_req_close(ctx);
+    }
+    int64_t writer_ns = registry_now_ns() - start_ns;
+
+    start_ns = registry_now_ns();
+    for (i = 0; i < num_requests; i++) {
+        ctx = jsonrpc_test_req_open("RpcLookup");
+        expected = request_writer_expected(ctx, "RpcLookup", &params);
+        json_object_object_add(params, "MountID",     json_object_new_string("AAAAAAAAAAAAAAAAAAAAAA=="));
+        json_object_object_add(params, "InodeNumber", json_object_new_int64(1000 + i));
+        json_object_object_add(params, "Basename",    json_object_new_string("some-file.txt"));
+        json_object_to_json_string_ext(expected, JSON_C_TO_STRING_PLAIN);
+        json_object_put(expected);
+        jsonrpc_test_req_close(ctx);
+    }
+    int64_t dom_ns = registry_now_ns() - start_ns;
+
+    if (!silent) {
+        printf("  lookup request: %6.1f ns rendered directly, %6.1f ns through json-c objects\n",
+               (double)writer_ns / num_requests, (double)dom_ns / num_requests);
+    }
+
+    // Benchmark: a 64 KiB write request, both ways
+    num_requests = 2000;
+    start_ns     = registry_now_ns();
+    for (i = 0; i < num_requests; i++) {
+        size_t len;
+        ctx = jsonrpc_test_req_open("RpcWrite");
+        jsonrpc_set_req_param_uint64(ctx, "Offset", 4096);
+        jsonrpc_set_req_param_buf   (ctx, "Buf",    write_bytes, write_len);
+        jsonrpc_test_req_text(ctx, &len);
+        jsonrpc_test_req_close(ctx);
+    }
+    writer_ns = registry_now_ns() - start_ns;
+
+    start_ns = registry_now_ns();
+    for (i = 0; i < num_requests; i++) {
+        ctx = jsonrpc_test_req_open("RpcWrite");
+        expected = request_writer_expected(ctx, "RpcWrite", &params);
+        encoded  = encode_binary(write_bytes, write_len);
+        json_object_object_add(params, "Offset", json_object_new_int64(4096));
+        json_object_object_add(params, "Buf",    json_object_new_string(encoded));
+        json_object_to_json_string_ext(expected, JSON_C_TO_STRING_PLAIN);
+        free(encoded);
+        json_object_put(expected);
+        jsonrpc_test_req_close(ctx);
+    }
+    dom_ns = registry_now_ns() - start_ns;
+
+    if (!silent) {
+        printf("  64 KiB write request: %6.1f us rendered directly, %6.1f us through json-c objects\n",
+               (double)writer_ns / num_requests / 1000, (double)dom_ns / num_requests / 1000);
+    }
+    free(write_bytes);
+}
+
+// Response decoding, compared with what json-c makes of the same response
+
+// A response line with result (and a null error), rendered by json-c; frees result
+char* response_parser_text(int id, json_object* result)
+{
+    json_object* response = json_object_new_object();
+    json_object_object_add(response, "id",     json_object_new_int(id));
+    json_object_object_add(response, "error",  NULL);
+    json_object_object_add(response, "result", result);
+    char* text = strdup(json_object_to_json_string_ext(response, JSON_C_TO_STRING_PLAIN));
+    json_object_put(response);
+    return text;
+}
+
+uint64_t response_parser_ns(proxyfs_timespec_t* ts)
+{
+    return ts->sec * 1000000000ULL + ts->nsec;
+}
+
+// The attributes of entry i of a readdir_plus response, also filling in what
+// they should decode to
+json_object* response_parser_stat(int i, proxyfs_stat_t* stat)
+{
+    bzero(stat, sizeof(proxyfs_stat_t));
+    stat->mode         = 0100644 + i;
+    stat->ino          = 0x100000000ULL + i;
+    stat->nlink        = 1 + i;
+    stat->uid          = 1000;
+    stat->gid          = 4294967295U;
+    stat->size         = (1ULL << 40) + i;
+    stat->ctim.sec     = 1600000000 + i;
+    stat->ctim.nsec    = 999999999;
+    stat->crtim.sec    = 1500000000;
+    stat->crtim.nsec   = 1;
+    stat->mtim.sec     = 1600000000 + i;
+    stat->atim.sec     = 1700000000;
+    stat->atim.nsec    = i;
+
+    json_object* statent = json_object_new_object();
+    json_object_object_add(statent, "CTimeNs",         json_object_new_int64(response_parser_ns(&stat->ctim)));
+    json_object_object_add(statent, "CRTimeNs",        json_object_new_int64(response_parser_ns(&stat->crtim)));
+    json_object_object_add(statent, "MTimeNs",         json_object_new_int64(response_parser_ns(&stat->mtim)));
+    json_object_object_add(statent, "ATimeNs",         json_object_new_int64(response_parser_ns(&stat->atim)));
+    json_object_object_add(statent, "Size",            json_object_new_int64(stat->size));
+    json_object_object_add(statent, "NumLinks",        json_object_new_int64(stat->nlink));
+    json_object_object_add(statent, "StatInodeNumber", json_object_new_int64(stat->ino));
+    json_object_object_add(statent, "FileMode",        json_object_new_int(stat->mode));
+    json_object_object_add(statent, "UserID",          json_object_new_int64(stat->uid));
+    json_object_object_add(statent, "GroupID",         json_object_new_int64(stat->gid));
+    return statent;
+}
+
+// Directory entry i of a readdir_plus response, also filling in what it
+// should decode to
+json_object* response_parser_dirent(int i, struct dirent* ent)
+{
+    bzero(ent, sizeof(struct dirent));
+    ent->d_ino  = 0x100000000ULL + i;
+    ent->d_off  = i + 1;
+    ent->d_type = (i % 2) ? DT_DIR : DT_REG;
+    snprintf(ent->d_name, sizeof(ent->d_name), "entry-%d \"quoted\" caf\xc3\xa9 \xf0\x9f\x98\x80", i);
+
+    json_object* dirent = json_object_new_object();
+    json_object_object_add(dirent, "Basename",        json_object_new_string(ent->d_name));
+    json_object_object_add(dirent, "InodeNumber",     json_object_new_int64(ent->d_ino));
+    json_object_object_add(dirent, "FileType",        json_object_new_int(ent->d_type));
+    json_object_object_add(dirent, "NextDirLocation", json_object_new_int64(ent->d_off));
+    return dirent;
+}
+
+// A readdir_plus response with num_entries entries and what they decode to
+char* response_parser_readdir_plus(int num_entries, struct dirent* ents, proxyfs_stat_t* stats)
+{
+    json_object* result   = json_object_new_object();
+    json_object* dirents  = json_object_new_array();
+    json_object* statents = json_object_new_array();
+    int          i;
+
+    for (i = 0; i < num_entries; i++) {
+        json_object_array_add(dirents,  response_parser_dirent(i, &ents[i]));
+        json_object_array_add(statents, response_parser_stat(i, &stats[i]));
+    }
+    json_object_object_add(result, "DirEnts",  dirents);
+    json_object_object_add(result, "StatEnts", statents);
+    return response_parser_text(100, result);
+}
+
+bool response_parser_check(char* funcToTest, bool ok, const char* what)
+{
+    if (!ok) {
+        TLOG("%s: %s was not decoded as expected.\n", funcToTest, what);
+    }
+    return ok;
+}
+
+void response_parser_tests()
+{
+    char*              funcToTest = "response parser";
+    bool               failed     = false;
+    jsonrpc_context_t* ctx        = NULL;
+    int                i;
+
+    // Envelope: members in any order, with whitespace, and errors
+    ctx = jsonrpc_test_resp_open(" { \"result\" : { \"InodeNumber\" : 12345 } , \"error\" : null , \"id\" : 42 } ");
+    failed |= !response_parser_check(funcToTest, (jsonrpc_test_resp_id(ctx) == 42) &&
+                                                 (jsonrpc_get_resp_status(ctx) == 0) &&
+                                                 (jsonrpc_get_resp_uint64(ctx, "InodeNumber") == 12345), "success");
+    jsonrpc_test_resp_close(ctx);
+
+    ctx = jsonrpc_test_resp_open("{\"id\":8589934593,\"result\":{},\"error\":null}");
+    failed |= !response_parser_check(funcToTest, jsonrpc_test_resp_id(ctx) == 8589934593ULL, "64-bit id");
+    jsonrpc_test_resp_close(ctx);
+
+    ctx = jsonrpc_test_resp_open("{\"id\":7,\"result\":null,\"error\":\"errno: 2\\nhttpStatus: 404\"}");
+    failed |= !response_parser_check(funcToTest, (jsonrpc_test_resp_id(ctx) == 7) &&
+                                                 (jsonrpc_get_resp_status(ctx) == ENOENT) &&
+                                                 (jsonrpc_get_resp_uint64(ctx, "InodeNumber") == UINT64_MAX), "error");
+    jsonrpc_test_resp_close(ctx);
+
+    // Scalars, skipping members that nest and strings that look like JSON
+    uint8_t bytes[300];
+    uint8_t decoded[300];
+    size_t  decoded_len = 0;
+    for (i = 0; i < sizeof(bytes); i++) {
+        bytes[i] = (uint8_t)(i * 13 + 5);
+    }
+    char*        awkward = "quote\" back\\slash {\"not\": [1, 2]} \t caf\xc3\xa9";
+    char*        encoded = encode_binary(bytes, sizeof(bytes));
+    json_object* result  = json_object_new_object();
+    json_object* nested  = json_tokener_parse("{\"a\": [1, {\"b\": \"}]\"}, [[], {}]], \"c\": true}");
+    json_object* names   = json_object_new_array();
+    json_object_object_add(result, "Nested",  nested);
+    json_object_object_add(result, "Str",     json_object_new_string(awkward));
+    json_object_object_add(result, "Neg",     json_object_new_int64(INT64_MIN + 1));
+    json_object_object_add(result, "Big",     json_object_new_int64((int64_t)0xfedcba9876543210ULL));
+    json_object_object_add(result, "Flag",    json_object_new_boolean(true));
+    json_object_object_add(result, "Buf",     json_object_new_string(encoded));
+    json_object_array_add(names, json_object_new_string("user.one"));
+    json_object_array_add(names, json_object_new_string("user.two"));
+    json_object_object_add(result, "Names",   names);
+    char* text = response_parser_text(3, result);
+    free(encoded);
+
+    ctx = jsonrpc_test_resp_open(text);
+    char* dup = jsonrpc_get_resp_strdup(ctx, "Str");
+    failed |= !response_parser_check(funcToTest, (dup != NULL) && (strcmp(dup, awkward) == 0), "strdup");
+    free(dup);
+    failed |= !response_parser_check(funcToTest, jsonrpc_get_resp_int64(ctx, "Neg") == INT64_MIN + 1, "int64");
+    failed |= !response_parser_check(funcToTest, jsonrpc_get_resp_uint64(ctx, "Big") == 0xfedcba9876543210ULL, "uint64");
+    failed |= !response_parser_check(funcToTest, jsonrpc_get_resp_bool(ctx, "Flag"), "bool");
+    failed |= !response_parser_check(funcToTest, jsonrpc_get_resp_buf(ctx, "Buf", decoded, sizeof(decoded), &decoded_len) == 0, "buf status");
+    failed |= !response_parser_check(funcToTest, (decoded_len == sizeof(bytes)) &&
+                                                 (memcmp(decoded, bytes, sizeof(bytes)) == 0), "buf");
+    failed |= !response_parser_check(funcToTest, jsonrpc_get_resp_buf(ctx, "Buf", decoded, sizeof(bytes) - 1,
+                                                                       &decoded_len) == EOVERFLOW, "buf too small");
+    failed |= !response_parser_check(funcToTest, jsonrpc_get_resp_buf(ctx, "Str", decoded, sizeof(decoded),
+                                                                       &decoded_len) == EINVAL, "buf not base64");
+    failed |= !response_parser_check(funcToTest, jsonrpc_get_resp_buf(ctx, "Missing", decoded, sizeof(decoded),
+                                                                       &decoded_len) == ENOENT, "buf missing");
+    failed |= !response_parser_check(funcToTest, jsonrpc_get_resp_array_length(ctx, "Names") == 2, "array length");
+
+    // The getters that go through json-c objects still agree once those exist
+    const char* str = jsonrpc_get_resp_str(ctx, "Str");
+    failed |= !response_parser_check(funcToTest, (str != NULL) && (strcmp(str, awkward) == 0), "str");
+    const char* name = jsonrpc_get_resp_array_str_value(ctx, "Names", 1);
+    failed |= !response_parser_check(funcToTest, (name != NULL) && (strcmp(name, "user.two") == 0), "array str");
+    failed |= !response_parser_check(funcToTest, jsonrpc_get_resp_int64(ctx, "Neg") == INT64_MIN + 1, "int64 after");
+    jsonrpc_test_resp_close(ctx);
+    free(text);
+
+    // Integers only as plain digits, and only in range; anything else reads as 0
+    ctx = jsonrpc_test_resp_open("{\"id\":9,\"error\":null,\"result\":{\"Frac\":1.5,\"Exp\":1e3,\"True\":true,"
+                                 "\"Over\":18446744073709551616,\"NegOver\":-9223372036854775809,"
+                                 "\"Max\":18446744073709551615,\"Min\":-9223372036854775808,\"Str\":\"7\"}}");
+    failed |= !response_parser_check(funcToTest, jsonrpc_get_resp_int64(ctx, "Frac") == 0, "fraction");
+    failed |= !response_parser_check(funcToTest, jsonrpc_get_resp_int64(ctx, "Exp") == 0, "exponent");
+    failed |= !response_parser_check(funcToTest, jsonrpc_get_resp_int64(ctx, "True") == 0, "true as int");
+    failed |= !response_parser_check(funcToTest, jsonrpc_get_resp_int64(ctx, "Over") == 0, "uint64 overflow");
+    failed |= !response_parser_check(funcToTest, jsonrpc_get_resp_int64(ctx, "NegOver") == 0, "int64 underflow");
+    failed |= !response_parser_check(funcToTest, jsonrpc_get_resp_int64(ctx, "Str") == 0, "string as int");
+    failed |= !response_parser_check(funcToTest, jsonrpc_get_resp_uint64(ctx, "Max") == UINT64_MAX, "uint64 max");
+    failed |= !response_parser_check(funcToTest, jsonrpc_get_resp_int64(ctx, "Min") == INT64_MIN, "int64 min");
+    failed |= !response_parser_check(funcToTest, jsonrpc_get_resp_bool(ctx, "True"), "true");
+    jsonrpc_test_resp_close(ctx);
+
+    // statvfs, with a field missing
+    result = json_object_new_object();
+    json_object_object_add(result, "BlockSize",         json_object_new_int64(4096));
+    json_object_object_add(result, "FragmentSize",      json_object_new_int64(512));
+    json_object_object_add(result, "TotalBlocks",       json_object_new_int64(1ULL << 40));
+    json_object_object_add(result, "FreeBlocks",        json_object_new_int64(12345));
+    json_object_object_add(result, "AvailBlocks",       json_object_new_int64(12000));
+    json_object_object_add(result, "TotalInodes",       json_object_new_int64(1000000));
+    json_object_object_add(result, "FreeInodes",        json_object_new_int64(999));
+    json_object_object_add(result, "AvailInodes",       json_object_new_int64(998));
+    json_object_object_add(result, "FileSystemID",      json_object_new_int64(77));
+    json_object_object_add(result, "MountFlags",        json_object_new_int64(0));
+    text = response_parser_text(4, result);
+    ctx = jsonrpc_test_resp_open(text);
+    struct statvfs* vfs = statvfs_resp_to_struct(ctx, NULL);
+    failed |= !response_parser_check(funcToTest, (vfs != NULL) && (vfs->f_bsize == 4096) && (vfs->f_frsize == 512) &&
+                                                 (vfs->f_blocks == (1ULL << 40)) && (vfs->f_bfree == 12345) &&
+                                                 (vfs->f_bavail == 12000) && (vfs->f_files == 1000000) &&
+                                                 (vfs->f_ffree == 999) && (vfs->f_favail == 998) &&
+                                                 (vfs->f_fsid == 77) && (vfs->f_flag == 0) &&
+                                                 (vfs->f_namemax == 0), "statvfs");
+    free(vfs);
+    jsonrpc_test_resp_close(ctx);
+    free(text);
+
+    // readdir_plus, including a name longer than NAME_MAX
+    int             num_entries = 8;
+    struct dirent*  ents        = (struct dirent*)calloc(num_entries, sizeof(struct dirent));
+    proxyfs_stat_t* stats       = (proxyfs_stat_t*)calloc(num_entries, sizeof(proxyfs_stat_t));
+    text = response_parser_readdir_plus(num_entries, ents, stats);
+    ctx  = jsonrpc_test_resp_open(text);
+
+    struct dirent* got = proxyfs_get_dirents(ctx, jsonrpc_get_resp_array_length(ctx, "DirEnts"));
+    for (i = 0; i < num_entries; i++) {
+        failed |= !response_parser_check(funcToTest, (got != NULL) && (got[i].d_ino == ents[i].d_ino) &&
+                                                     (got[i].d_off == ents[i].d_off) &&
+                                                     (got[i].d_type == ents[i].d_type) &&
+                                                     (strcmp(got[i].d_name, ents[i].d_name) == 0), "dirent");
+    }
+    free(got);
+
+    mount_handle_t  mount_handle;
+    bzero(&mount_handle, sizeof(mount_handle));
+    proxyfs_stat_t* got_stats = proxyfs_get_statents(&mount_handle, ctx, num_entries, 0);
+    failed |= !response_parser_check(funcToTest, (got_stats != NULL) &&
+                                                 (memcmp(got_stats, stats, num_entries * sizeof(proxyfs_stat_t)) == 0),
+                                     "statents");
+    free(got_stats);
+    jsonrpc_test_resp_close(ctx);
+    free(text);
+
+    char long_name[NAME_MAX + 100];
+    memset(long_name, 'x', sizeof(long_name) - 1);
+    long_name[sizeof(long_name) - 1] = 0;
+    result = json_object_new_object();
+    json_object* dirents = json_object_new_array();
+    json_object* dirent  = json_object_new_object();
+    json_object_object_add(dirent, "Basename", json_object_new_string(long_name));
+    json_object_array_add(dirents, dirent);
+    json_object_object_add(result, "DirEnts", dirents);
+    text = response_parser_text(5, result);
+    ctx  = jsonrpc_test_resp_open(text);
+    got  = proxyfs_get_dirents(ctx, 1);
+    failed |= !response_parser_check(funcToTest, (got != NULL) && (strlen(got[0].d_name) == NAME_MAX) &&
+                                                 (strncmp(got[0].d_name, long_name, NAME_MAX) == 0), "long name");
+    free(got);
+    jsonrpc_test_resp_close(ctx);
+    free(text);
+
+    // A single stat
+    proxyfs_stat_t expected;
+    proxyfs_stat_t stat;
+    text = response_parser_text(6, response_parser_stat(3, &expected));
+    ctx  = jsonrpc_test_resp_open(text);
+    memset(&stat, 0xff, sizeof(stat));
+    stat_resp_to_struct(ctx, &stat);
+    failed |= !response_parser_check(funcToTest, memcmp(&stat, &expected, sizeof(stat)) == 0, "stat");
+    jsonrpc_test_resp_close(ctx);
+    free(text);
+    free(ents);
+    free(stats);
+
+    if (failed) {
+        test_failed(funcToTest);
+    } else {
+        test_passed();
+    }
+
+    // Benchmark: a 256-entry readdir_plus response, decoded in one pass and
+    // field by field through json-c objects
+    num_entries = 256;
+    ents  = (struct dirent*)calloc(num_entries, sizeof(struct dirent));
+    stats = (proxyfs_stat_t*)calloc(num_entries, sizeof(proxyfs_stat_t));
+    text  = response_parser_readdir_plus(num_entries, ents, stats);
+
+    int     num_responses = 200;
+    int64_t start_ns      = registry_now_ns();
+    for (i = 0; i < num_responses; i++) {
+        ctx = jsonrpc_test_resp_open(text);
+        int n = jsonrpc_get_resp_array_length(ctx, "DirEnts");
+        free(proxyfs_get_dirents(ctx, n));
+        free(proxyfs_get_statents(&mount_handle, ctx, n, 0));
+        jsonrpc_test_resp_close(ctx);
+    }
+    int64_t scan_ns = registry_now_ns() - start_ns;
+
+    start_ns = registry_now_ns();
+    for (i = 0; i < num_responses; i++) {
+        ctx = jsonrpc_test_resp_open(text);
+        int n = jsonrpc_get_resp_array_length(ctx, "DirEnts");
+        struct dirent*  dom_ents  = (struct dirent*)calloc(n, sizeof(struct dirent));
+        proxyfs_stat_t* dom_stats = (proxyfs_stat_t*)calloc(n, sizeof(proxyfs_stat_t));
+        int j;
+        for (j = 0; j < n; j++) {
+            dom_ents[j].d_ino  = jsonrpc_get_resp_array_uint64(ctx, "DirEnts", j, "InodeNumber");
+            strncpy(dom_ents[j].d_name, jsonrpc_get_resp_array_str(ctx, "DirEnts", j, "Basename"), NAME_MAX);
+            dom_ents[j].d_off  = jsonrpc_get_resp_array_int64(ctx, "DirEnts", j, "NextDirLocation");
+            dom_ents[j].d_type = jsonrpc_get_resp_array_int(ctx, "DirEnts", j, "FileType");
+            dom_stats[j].mode  = jsonrpc_get_resp_array_int(ctx, "StatEnts", j, "FileMode");
+            dom_stats[j].ino   = jsonrpc_get_resp_array_uint64(ctx, "StatEnts", j, "StatInodeNumber");
+            dom_stats[j].nlink = jsonrpc_get_resp_array_uint64(ctx, "StatEnts", j, "NumLinks");
+            dom_stats[j].uid   = jsonrpc_get_resp_array_int(ctx, "StatEnts", j, "UserID");
+            dom_stats[j].gid   = jsonrpc_get_resp_array_int(ctx, "StatEnts", j, "GroupID");
+            dom_stats[j].size  = jsonrpc_get_resp_array_uint64(ctx, "StatEnts", j, "Size");
+            dom_stats[j].ctim.sec    = jsonrpc_get_resp_array_uint64(ctx, "StatEnts", j, "CTimeNs") / 1000000000ULL;
+            dom_stats[j].crtim.sec   = jsonrpc_get_resp_array_uint64(ctx, "StatEnts", j, "CRTimeNs") / 1000000000ULL;
+            dom_stats[j].mtim.sec    = jsonrpc_get_resp_array_uint64(ctx, "StatEnts", j, "MTimeNs") / 1000000000ULL;
+            dom_stats[j].atim.sec    = jsonrpc_get_resp_array_uint64(ctx, "StatEnts", j, "ATimeNs") / 1000000000ULL;
+        }
+        free(dom_ents);
+        free(dom_stats);
+        jsonrpc_test_resp_close(ctx);
+    }
+    int64_t dom_ns = registry_now_ns() - start_ns;
+
+    if (!silent) {
+        printf("  readdir_plus response of %d entries: %8.1f us scanned in one pass, %8.1f us through json-c objects\n",
+               num_entries, (double)scan_ns / num_responses / 1000, (double)dom_ns / num_responses / 1000);
+    }
+    free(text);
+    free(ents);
+    free(stats);
+}
+
+bool base64_check(char* funcToTest, bool ok, base64_impl_t impl, const char* what, size_t size)
+{
+    if (!ok) {
+        TLOG("%s: %s %s failed for %zu bytes.\n", funcToTest, base64_impl_name(impl), what, size);
+    }
+    return ok;
+}
+
+void base64_tests()
+{
+    char*         funcToTest = "base64";
+    bool          failed     = false;
+    base64_impl_t best       = base64_get_impl();
+    size_t        max_size   = 1024 * 1024;
+    uint8_t*      bytes      = (uint8_t*)malloc(max_size);
+    uint8_t*      decoded    = (uint8_t*)malloc(max_size);
+    char*         expected   = (char*)malloc(base64_encoded_len(max_size));
+    char*         encoded    = (char*)malloc(base64_encoded_len(max_size));
+    size_t        large_sizes[] = {4096 + 7, 65536 + 1, 65536 + 2};
+    size_t        decoded_len;
+    size_t        size;
+    int           i;
+    int           err;
+    base64_impl_t impl;
+
+    for (i = 0; i < max_size; i++) {
+        bytes[i] = (uint8_t)(i * 7 + (i >> 8));
+    }
+
+    // Round trips through every implementation, which have to agree with
+    // the scalar one; sizes below 300 cover every tail and block boundary
+    for (i = 0; i < 300 + sizeof(large_sizes) / sizeof(large_sizes[0]); i++) {
+        size = (i < 300) ? i : large_sizes[i - 300];
+        base64_set_impl(BASE64_IMPL_SCALAR);
+        base64_encode(bytes, size, expected);
+
+        for (impl = BASE64_IMPL_SCALAR; impl < BASE64_IMPL_COUNT; impl++) {
+            if (!base64_set_impl(impl)) {
+                continue;
+            }
+            memset(encoded, 0, base64_encoded_len(size) + 1);
+            base64_encode(bytes, size, encoded);
+            failed |= !base64_check(funcToTest, (memcmp(encoded, expected, base64_encoded_len(size)) == 0) &&
+                                                (encoded[base64_encoded_len(size)] == 0), impl, "encode", size);
+
+            err = base64_decode(encoded, base64_encoded_len(size), decoded, size, &decoded_len);
+            failed |= !base64_check(funcToTest, (err == 0) && (decoded_len == size) &&
+                                                (memcmp(decoded, bytes, size) == 0), impl, "decode", size);
+
+            // One byte short of room
+            if (size > 0) {
+                err = base64_decode(encoded, base64_encoded_len(size), decoded, size - 1, &decoded_len);
+                failed |= !base64_check(funcToTest, (err == EOVERFLOW) && (decoded_len < size), impl, "overflow", size);
+            }
+        }
+    }
+
+    // Invalid input, anywhere in the string
+    size = 200;
+    base64_encode(bytes, size, expected);
+    size_t positions[] = {0, 1, 2, 3, 15, 16, 31, 47, 100, 255, 263, 265};
+    char   bad_chars[] = {'!', '-', '_', '\0', '\n', ' ', '\x80', '\xff', '='};
+    for (impl = BASE64_IMPL_SCALAR; impl < BASE64_IMPL_COUNT; impl++) {
+        if (!base64_set_impl(impl)) {
+            continue;
+        }
+        int p;
+        int c;
+        for (p = 0; p < sizeof(positions) / sizeof(positions[0]); p++) {
+            for (c = 0; c < sizeof(bad_chars); c++) {
+                memcpy(encoded, expected, base64_encoded_len(size));
+                encoded[positions[p]] = bad_chars[c];
+                err = base64_decode(encoded, base64_encoded_len(size), decoded, size, &decoded_len);
+                failed |= !base64_check(funcToTest, (err == EINVAL) && (decoded_len <= positions[p] / 4 * 3),
+                                        impl, "invalid char", positions[p]);
+            }
+        }
+
+        err = base64_decode(expected, base64_encoded_len(size) - 1, decoded, size, &decoded_len);
+        failed |= !base64_check(funcToTest, err == EINVAL, impl, "odd length", size);
+
+        const char* bad_padding[] = {"QQ=A", "Q===", "====", "QUJD=UJD", "QUI=QUJD", "QQ==QUJD"};
+        for (p = 0; p < sizeof(bad_padding) / sizeof(bad_padding[0]); p++) {
+            err = base64_decode(bad_padding[p], strlen(bad_padding[p]), decoded, size, &decoded_len);
+            failed |= !base64_check(funcToTest, err == EINVAL, impl, "padding", p);
+        }
+    }
+
+    if (failed) {
+        test_failed(funcToTest);
+    } else {
+        test_passed();
+    }
+
+    // Benchmark: throughput of each implementation, in bytes of binary data
+    size_t bench_sizes[] = {4096, 65536, 1024 * 1024};
+    for (impl = BASE64_IMPL_SCALAR; impl < BASE64_IMPL_COUNT; impl++) {
+        if (!base64_set_impl(impl)) {
+            continue;
+        }
+        for (i = 0; i < sizeof(bench_sizes) / sizeof(bench_sizes[0]); i++) {
+            size = bench_sizes[i];
+            int iterations = (64 * 1024 * 1024) / size;
+            int j;
+
+            int64_t start_ns = registry_now_ns();
+            for (j = 0; j < iterations; j++) {
+                base64_encode(bytes, size, encoded);
+            }
+            int64_t encode_ns = registry_now_ns() - start_ns;
+
+            start_ns = registry_now_ns();
+            for (j = 0; j < iterations; j++) {
+                base64_decode(encoded, base64_encoded_len(size), decoded, size, &decoded_len);
+            }
+            int64_t decode_ns = registry_now_ns() - start_ns;
+
+            if (!silent) {
+                printf("  base64 %-6s %7zu bytes: encode %6.2f GB/s, decode %6.2f GB/s\n",
+                       base64_impl_name(impl), size, (double)size * iterations / encode_ns,
+                       (double)size * iterations / decode_ns);
+            }
+        }
+    }
+
+    base64_set_impl(best);
+    free(bytes);
+    free(decoded);
+    free(expected);
+    free(encoded);
+}
+
+// Context pool
+
+// A lookup request, rendered and then closed without being sent
+void ctx_pool_lookup(int i)
+{
+    size_t             len;
+    jsonrpc_context_t* ctx = jsonrpc_test_req_open("RpcLookup");
+    jsonrpc_set_req_param_str   (ctx, "MountID",     "AAAAAAAAAAAAAAAAAAAAAA==");
+    jsonrpc_set_req_param_uint64(ctx, "InodeNumber", 1000 + i);
+    jsonrpc_set_req_param_str   (ctx, "Basename",    "some-file.txt");
+    jsonrpc_test_req_text(ctx, &len);
+    jsonrpc_test_req_close(ctx);
+}
+
+// Two requests rendered at once, so that the second needs a buffer of its own
+void ctx_pool_nested(int i)
+{
+    size_t             len;
+    jsonrpc_context_t* outer = jsonrpc_test_req_open("RpcOuter");
+    jsonrpc_context_t* inner = jsonrpc_test_req_open("RpcInner");
+    jsonrpc_set_req_param_uint64(outer, "InodeNumber", i);
+    jsonrpc_set_req_param_uint64(inner, "InodeNumber", i);
+    jsonrpc_test_req_text(inner, &len);
+    jsonrpc_test_req_text(outer, &len);
+    jsonrpc_test_req_close(inner);
+    jsonrpc_test_req_close(outer);
+}
+
+void* ctx_pool_close_thread(void* arg)
+{
+    jsonrpc_test_req_close((jsonrpc_context_t*)arg);
+    return NULL;
+}
+
+void* ctx_pool_unblock_thread(void* arg)
+{
+    usleep(20000);
+    jsonrpc_unblock_for_response((jsonrpc_context_t*)arg);
+    return NULL;
+}
+
+bool ctx_pool_check(char* funcToTest, uint64_t ctx_allocs, uint64_t buf_allocs, const char* what)
+{
+    uint64_t new_ctx_allocs = jsonrpc_ctx_allocs() - ctx_allocs;
+    uint64_t new_buf_allocs = jsonrpc_req_buf_allocs() - buf_allocs;
+
+    if ((new_ctx_allocs != 0) || (new_buf_allocs != 0)) {
+        TLOG("%s: %s allocated %" PRIu64 " contexts and %" PRIu64 " request buffers.\n",
+             funcToTest, what, new_ctx_allocs, new_buf_allocs);
+        return false;
+    }
+    return true;
+}
+
+void ctx_pool_tests()
+{
+    char*     funcToTest = "context pool";
+    bool      failed     = false;
+    uint64_t  ctx_allocs;
+    uint64_t  buf_allocs;
+    int       i;
+    pthread_t thread;
+
+    // Once warmed up, requests one at a time allocate nothing
+    ctx_pool_lookup(0);
+    ctx_allocs = jsonrpc_ctx_allocs();
+    buf_allocs = jsonrpc_req_buf_allocs();
+    for (i = 0; i < 10000; i++) {
+        ctx_pool_lookup(i);
+    }
+    failed |= !ctx_pool_check(funcToTest, ctx_allocs, buf_allocs, "one at a time");
+
+    // Nor do two at once, once both contexts have a buffer
+    for (i = 0; i < 3; i++) {
+        ctx_pool_nested(i);
+    }
+    ctx_allocs = jsonrpc_ctx_allocs();
+    buf_allocs = jsonrpc_req_buf_allocs();
+    for (i = 0; i < 10000; i++) {
+        ctx_pool_nested(i);
+    }
+    failed |= !ctx_pool_check(funcToTest, ctx_allocs, buf_allocs, "two at once");
+
+    // A context closed on another thread goes to that thread's pool, and
+    // is freed when it exits
+    jsonrpc_context_t* ctx = jsonrpc_test_req_open("RpcElsewhere");
+    pthread_create(&thread, NULL, ctx_pool_close_thread, ctx);
+    pthread_join(thread, NULL);
+
+    // A reused context waits for its response again
+    ctx = jsonrpc_test_req_open("RpcBlocking");
+    jsonrpc_unblock_for_response(ctx);
+    jsonrpc_block_for_response(ctx);
+    jsonrpc_test_req_close(ctx);
+    ctx = jsonrpc_test_req_open("RpcBlocking");
+    int64_t start_ns = registry_now_ns();
+    pthread_create(&thread, NULL, ctx_pool_unblock_thread, ctx);
+    jsonrpc_block_for_response(ctx);
+    int64_t waited_ns = registry_now_ns() - start_ns;
+    pthread_join(thread, NULL);
+    jsonrpc_test_req_close(ctx);
+    if (waited_ns < 10000000) {
+        TLOG("%s: reused context waited only %" PRId64 " ns for its response.\n", funcToTest, waited_ns);
+        failed = true;
+    }
+
+    if (failed) {
+        test_failed(funcToTest);
+    } else {
+        test_passed();
+    }
+
+    // Benchmark: open and close from the pool, and with the pool empty
+    int                 num_contexts = 100000;
+    int                 batch        = 1000;
+    jsonrpc_context_t** open_ctxs    = (jsonrpc_context_t**)malloc(batch * sizeof(jsonrpc_context_t*));
+    int                 j;
+
+    start_ns = registry_now_ns();
+    for (i = 0; i < num_contexts; i++) {
+        jsonrpc_test_req_close(jsonrpc_test_req_open("RpcPing"));
+    }
+    int64_t pooled_ns = registry_now_ns() - start_ns;
+
+    // Open more at once than the pool keeps, so most are allocated and freed
+    start_ns = registry_now_ns();
+    for (i = 0; i < num_contexts; i += batch) {
+        for (j = 0; j < batch; j++) {
+            open_ctxs[j] = jsonrpc_test_req_open("RpcPing");
+        }
+        for (j = 0; j < batch; j++) {
+            jsonrpc_test_req_close(open_ctxs[j]);
+        }
+    }
+    int64_t unpooled_ns = registry_now_ns() - start_ns;
+    free(open_ctxs);
+
+    if (!silent) {
+        printf("  context open and close: %6.1f ns from the pool, %6.1f ns mostly allocated\n",
+               (double)pooled_ns / num_contexts, (double)unpooled_ns / num_contexts);
+    }
+}
+
+// Completions, and the mutex and condition variable they replaced for
+// blocking RPCs, for comparison
+
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    bool            done;
+} completion_cv_t;
+
+void completion_cv_wait(completion_cv_t* cv)
+{
+    pthread_mutex_lock(&cv->mutex);
+    while (!cv->done) {
+        pthread_cond_wait(&cv->cond, &cv->mutex);
+    }
+    cv->done = false;
+    pthread_mutex_unlock(&cv->mutex);
+}
+
+void completion_cv_signal(completion_cv_t* cv)
+{
+    pthread_mutex_lock(&cv->mutex);
+    cv->done = true;
+    pthread_cond_signal(&cv->cond);
+    pthread_mutex_unlock(&cv->mutex);
+}
+
+// Two threads taking turns: each waits for its own event and then signals
+// the other's, like a caller and the response thread
+typedef struct {
+    bool            use_cv;
+    int             round_trips;
+    completion_t    done[2];
+    completion_cv_t cv[2];
+    int             seen;       // written before each signal, checked after each wait
+    bool            failed;
+} completion_pingpong_t;
+
+void completion_pingpong_turn(completion_pingpong_t* pp, int side, int i)
+{
+    if (pp->use_cv) {
+        completion_cv_wait(&pp->cv[side]);
+    } else {
+        completion_wait(&pp->done[side]);
+        completion_init(&pp->done[side]);
+    }
+    if (pp->seen != 2 * i + side) {
+        pp->failed = true;
+    }
+    pp->seen++;
+    if (pp->use_cv) {
+        completion_cv_signal(&pp->cv[1 - side]);
+    } else {
+        completion_signal(&pp->done[1 - side]);
+    }
+}
+
+void* completion_pingpong_thread(void* arg)
+{
+    completion_pingpong_t* pp = (completion_pingpong_t*)arg;
+    int                    i;
+    for (i = 0; i < pp->round_trips; i++) {
+        completion_pingpong_turn(pp, 1, i);
+    }
+    return NULL;
+}
+
+// Returns ns per round trip, and the context switches they took
+int64_t completion_pingpong(completion_pingpong_t* pp, bool use_cv, int round_trips, long* switches)
+{
+    pthread_t     thread;
+    struct rusage before;
+    struct rusage after;
+    int           i;
+
+    memset(pp, 0, sizeof(*pp));
+    pp->use_cv      = use_cv;
+    pp->round_trips = round_trips;
+    for (i = 0; i < 2; i++) {
+        completion_init(&pp->done[i]);
+        pthread_mutex_init(&pp->cv[i].mutex, NULL);
+        pthread_cond_init(&pp->cv[i].cond, NULL);
+    }
+
+    getrusage(RUSAGE_SELF, &before);
+    int64_t start_ns = registry_now_ns();
+    pthread_create(&thread, NULL, completion_pingpong_thread, pp);
+    for (i = 0; i < round_trips; i++) {
+        // Side 0 starts each round trip with a signal rather than a wait
+        if (i > 0) {
+            if (use_cv) {
+                completion_cv_wait(&pp->cv[0]);
+            } else {
+                completion_wait(&pp->done[0]);
+                completion_init(&pp->done[0]);
+            }
+        }
+        if (pp->seen != 2 * i) {
+            pp->failed = true;
+        }
+        pp->seen++;
+        if (use_cv) {
+            completion_cv_signal(&pp->cv[1]);
+        } else {
+            completion_signal(&pp->done[1]);
+        }
+    }
+    if (use_cv) {
+        completion_cv_wait(&pp->cv[0]);
+    } else {
+        completion_wait(&pp->done[0]);
+    }
+    pthread_join(thread, NULL);
+    int64_t elapsed_ns = registry_now_ns() - start_ns;
+    getrusage(RUSAGE_SELF, &after);
+
+    *switches = (after.ru_nvcsw - before.ru_nvcsw) + (after.ru_nivcsw - before.ru_nivcsw);
+    for (i = 0; i < 2; i++) {
+        pthread_mutex_destroy(&pp->cv[i].mutex);
+        pthread_cond_destroy(&pp->cv[i].cond);
+    }
+    return elapsed_ns / round_trips;
+}
+
+void* completion_signal_thread(void* arg)
+{
+    usleep(20000);
+    completion_signal((completion_t*)arg);
+    return NULL;
+}
+
+void completion_tests()
+{
+    char*                  funcToTest   = "completion";
+    bool                   failed       = false;
+    uint32_t               default_spin = completion_get_max_spin();
+    completion_pingpong_t  pp;
+    completion_t           done;
+    pthread_t              thread;
+    long                   switches;
+
+    // Signalled before the wait
+    completion_init(&done);
+    failed |= completion_is_done(&done);
+    completion_signal(&done);
+    completion_wait(&done);
+    failed |= !completion_is_done(&done);
+
+    // Signalled while asleep, and reset for reuse
+    completion_set_max_spin(0);
+    completion_init(&done);
+    pthread_create(&thread, NULL, completion_signal_thread, &done);
+    completion_wait(&done);
+    failed |= !completion_is_done(&done);
+    pthread_join(thread, NULL);
+
+    // Many hand-offs, each seeing what the other side wrote, without and
+    // with spinning
+    completion_pingpong(&pp, false, 20000, &switches);
+    failed |= pp.failed;
+    completion_set_max_spin(2048);
+    completion_pingpong(&pp, false, 20000, &switches);
+    failed |= pp.failed;
+    completion_set_max_spin(default_spin);
+
+    if (failed) {
+        test_failed(funcToTest);
+    } else {
+        test_passed();
+    }
+
+    // Benchmark: wake-up latency and context switches, as round trips
+    // between two threads
+    int     round_trips = 50000;
+    int64_t cv_ns       = completion_pingpong(&pp, true, round_trips, &switches);
+    long    cv_switches = switches;
+    completion_set_max_spin(0);
+    int64_t futex_ns       = completion_pingpong(&pp, false, round_trips, &switches);
+    long    futex_switches = switches;
+    completion_set_max_spin(default_spin);
+    int64_t spin_ns        = completion_pingpong(&pp, false, round_trips, &switches);
+    long    spin_switches  = switches;
+
+    if (!silent) {
+        printf("  round trip between two threads (%ld CPUs):\n", sysconf(_SC_NPROCESSORS_ONLN));
+        printf("    mutex and condvar:  %7.1f us, %5.2f context switches\n",
+               (double)cv_ns / 1000, (double)cv_switches / round_trips);
+        printf("    futex:              %7.1f us, %5.2f context switches\n",
+               (double)futex_ns / 1000, (double)futex_switches / round_trips);
+        printf("    futex, spin <= %-4u %7.1f us, %5.2f context switches\n",
+               default_spin, (double)spin_ns / 1000, (double)spin_switches / round_trips);
+    }
+}
+
+// The io worker submission queue, and the mutex, condition variable and
+// malloc'd list entries it replaced, for comparison
+
+typedef struct io_queue_ref_entry_s {
+    void*                                item;
+    TAILQ_ENTRY(io_queue_ref_entry_s)    entries;
+} io_queue_ref_entry_t;
+
+typedef struct {
+    pthread_mutex_t                      lock;
+    pthread_cond_t                       cv;
+    TAILQ_HEAD(, io_queue_ref_entry_s)   head;
+    bool                                 closed;
+} io_queue_ref_t;
+
+void io_queue_ref_push(io_queue_ref_t* ref, void* item)
+{
+    io_queue_ref_entry_t* entry = (io_queue_ref_entry_t*)malloc(sizeof(io_queue_ref_entry_t));
+    entry->item = item;
+    pthread_mutex_lock(&ref->lock);
+    TAILQ_INSERT_TAIL(&ref->head, entry, entries);
+    pthread_cond_signal(&ref->cv);
+    pthread_mutex_unlock(&ref->lock);
+}
+
+void* io_queue_ref_pop(io_queue_ref_t* ref)
+{
+    void* item = NULL;
+
+    pthread_mutex_lock(&ref->lock);
+    while (TAILQ_EMPTY(&ref->head) && !ref->closed) {
+        pthread_cond_wait(&ref->cv, &ref->lock);
+    }
+    io_queue_ref_entry_t* entry = TAILQ_FIRST(&ref->head);
+    if (entry != NULL) {
+        TAILQ_REMOVE(&ref->head, entry, entries);
+    }
+    pthread_mutex_unlock(&ref->lock);
+
+    if (entry != NULL) {
+        item = entry->item;
+        free(entry);
+    }
+    return item;
+}
+
+void io_queue_ref_close(io_queue_ref_t* ref)
+{
+    pthread_mutex_lock(&ref->lock);
+    ref->closed = true;
+    pthread_cond_broadcast(&ref->cv);
+    pthread_mutex_unlock(&ref->lock);
+}
+
+// Producers push items numbered producer * per_producer + i (plus one, so
+// none is NULL); consumers check that every item turns up exactly once and
+// that each producer's items reach a given consumer in the order pushed.
+typedef struct {
+    bool            use_ref;
+    mpmc_queue_t    queue;
+    io_queue_ref_t  ref;
+    int             producers;
+    int             per_producer;
+    uint32_t*       seen;
+    bool            failed;
+} io_queue_run_t;
+
+typedef struct {
+    io_queue_run_t* run;
+    int             id;
+} io_queue_thread_t;
+
+void* io_queue_producer(void* arg)
+{
+    io_queue_thread_t* thread = (io_queue_thread_t*)arg;
+    io_queue_run_t*    run    = thread->run;
+    uintptr_t          base   = (uintptr_t)thread->id * run->per_producer;
+    int                i;
+
+    for (i = 0; i < run->per_producer; i++) {
+        void* item = (void*)(base + i + 1);
+        if (run->use_ref) {
+            io_queue_ref_push(&run->ref, item);
+        } else {
+            mpmc_queue_push(&run->queue, item);
+        }
+    }
+    return NULL;
+}
+
+void* io_queue_consumer(void* arg)
+{
+    io_queue_thread_t* thread = (io_queue_thread_t*)arg;
+    io_queue_run_t*    run    = thread->run;
+    int64_t*           last   = (int64_t*)malloc(run->producers * sizeof(int64_t));
+    bool               failed = false;
+    int                i;
+
+    for (i = 0; i < run->producers; i++) {
+        last[i] = -1;
+    }
+
+    for (;;) {
+        void* item = run->use_ref ? io_queue_ref_pop(&run->ref) : mpmc_queue_pop(&run->queue);
+        if (item == NULL) {
+            break;
+        }
+
+        uintptr_t n        = (uintptr_t)item - 1;
+        int       producer = n / run->per_producer;
+        int64_t   seq      = n % run->per_producer;
+
+        if ((producer >= run->producers) || (seq <= last[producer])) {
+            failed = true;
+            continue;
+        }
+        last[producer] = seq;
+        __sync_fetch_and_add(&run->seen[n], 1);
+    }
+
+    free(last);
+    if (failed) {
+        run->failed = true;
+    }
+    return NULL;
+}
+
+// Returns the time taken, from the first push to the last pop
+int64_t io_queue_run(io_queue_run_t* run, bool use_ref, int producers, int consumers, int per_producer)
+{
+    pthread_t*         threads = (pthread_t*)malloc((producers + consumers) * sizeof(pthread_t));
+    io_queue_thread_t* args    = (io_queue_thread_t*)malloc((producers + consumers) * sizeof(io_queue_thread_t));
+    size_t             total   = (size_t)producers * per_producer;
+    size_t             n;
+    int                i;
+
+    run->use_ref      = use_ref;
+    run->producers    = producers;
+    run->per_producer = per_producer;
+    run->failed       = false;
+    run->seen         = (uint32_t*)calloc(total, sizeof(uint32_t));
+    if (use_ref) {
+        pthread_mutex_init(&run->ref.lock, NULL);
+        pthread_cond_init(&run->ref.cv, NULL);
+        TAILQ_INIT(&run->ref.head);
+        run->ref.closed = false;
+    } else {
+        mpmc_queue_init(&run->queue, 1024);
+    }
+
+    int64_t start_ns = registry_now_ns();
+    for (i = 0; i < consumers; i++) {
+        args[i].run = run;
+        args[i].id  = i;
+        pthread_create(&threads[i], NULL, io_queue_consumer, &args[i]);
+    }
+    for (i = 0; i < producers; i++) {
+        args[consumers + i].run = run;
+        args[consumers + i].id  = i;
+        pthread_create(&threads[consumers + i], NULL, io_queue_producer, &args[consumers + i]);
+    }
+    for (i = 0; i < producers; i++) {
+        pthread_join(threads[consumers + i], NULL);
+    }
+
+    // Consumers drain what's left, then see the close
+    if (use_ref) {
+        io_queue_ref_close(&run->ref);
+    } else {
+        mpmc_queue_close(&run->queue);
+    }
+    for (i = 0; i < consumers; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    int64_t elapsed_ns = registry_now_ns() - start_ns;
+
+    for (n = 0; n < total; n++) {
+        if (run->seen[n] != 1) {
+            TLOG("io_queue: item %zu seen %u times.\n", n, run->seen[n]);
+            run->failed = true;
+            break;
+        }
+    }
+
+    if (use_ref) {
+        pthread_mutex_destroy(&run->ref.lock);
+        pthread_cond_destroy(&run->ref.cv);
+    } else {
+        mpmc_queue_destroy(&run->queue);
+    }
+    free(run->seen);
+    free(args);
+    free(threads);
+    return elapsed_ns;
+}
+
+void* io_queue_pop_thread(void* arg)
+{
+    return mpmc_queue_pop((mpmc_queue_t*)arg);
+}
+
+void io_queue_tests()
+{
+    char*           funcToTest = "io_queue";
+    bool            failed     = false;
+    mpmc_queue_t    queue;
+    io_queue_run_t  run;
+    pthread_t       threads[4];
+    uintptr_t       i;
+    int             lap;
+
+    // Capacity rounds up to a power of two, and a full queue refuses more
+    mpmc_queue_init(&queue, 5);
+    failed |= (mpmc_queue_try_pop(&queue) != NULL);
+    for (i = 1; i <= 8; i++) {
+        failed |= !mpmc_queue_try_push(&queue, (void*)i);
+    }
+    failed |= mpmc_queue_try_push(&queue, (void*)i);
+
+    // FIFO order, then empty
+    for (i = 1; i <= 8; i++) {
+        failed |= (mpmc_queue_try_pop(&queue) != (void*)i);
+    }
+    failed |= (mpmc_queue_try_pop(&queue) != NULL);
+
+    // Many laps around the ring, at different fill levels
+    for (lap = 0; lap < 100; lap++) {
+        uintptr_t fill = 1 + lap % 8;
+        for (i = 1; i <= fill; i++) {
+            failed |= !mpmc_queue_try_push(&queue, (void*)(lap * 8 + i));
+        }
+        for (i = 1; i <= fill; i++) {
+            failed |= (mpmc_queue_pop(&queue) != (void*)(lap * 8 + i));
+        }
+    }
+    failed |= (mpmc_queue_try_pop(&queue) != NULL);
+
+    // Closing wakes consumers asleep on an empty queue; items pushed before
+    // the close still come out
+    for (i = 0; i < 4; i++) {
+        pthread_create(&threads[i], NULL, io_queue_pop_thread, &queue);
+    }
+    usleep(10000);
+    mpmc_queue_close(&queue);
+    for (i = 0; i < 4; i++) {
+        void* item;
+        pthread_join(threads[i], &item);
+        failed |= (item != NULL);
+    }
+    failed |= !mpmc_queue_try_push(&queue, (void*)1);
+    failed |= (mpmc_queue_pop(&queue) != (void*)1);
+    failed |= (mpmc_queue_pop(&queue) != NULL);
+    mpmc_queue_destroy(&queue);
+
+    // A timed pop gives up on an open queue; queues sharing an eventcount
+    // wake a consumer waiting on the other
+    mpmc_queue_t  other;
+    eventcount_t  ec;
+    eventcount_init(&ec);
+    mpmc_queue_init(&queue, 8);
+    mpmc_queue_init(&other, 8);
+    mpmc_queue_share_eventcount(&queue, &ec);
+    mpmc_queue_share_eventcount(&other, &ec);
+    failed |= (mpmc_queue_pop_timed(&queue, 10) != NULL) || mpmc_queue_closed(&queue);
+    failed |= !mpmc_queue_try_push(&other, (void*)2);
+    failed |= (mpmc_queue_pop_timed(&other, 10) != (void*)2);
+    mpmc_queue_destroy(&queue);
+    mpmc_queue_destroy(&other);
+
+    // Every item exactly once, in order per producer, with more items than
+    // slots so producers wait for room
+    io_queue_run(&run, false, 1, 1, 20000);
+    failed |= run.failed;
+    io_queue_run(&run, false, 8, 4, 5000);
+    failed |= run.failed;
+    io_queue_run(&run, false, 64, 8, 500);
+    failed |= run.failed;
+
+    if (failed) {
+        test_failed(funcToTest);
+    } else {
+        test_passed();
+    }
+
+    // Benchmark: submissions per second from 1-128 producers to 4 consumers,
+    // the same work at every width
+    int producer_counts[] = { 1, 8, 64, 128 };
+    int total_items       = 1 << 18;
+
+    if (!silent) {
+        printf("  submission throughput, 4 consumers (%ld CPUs):\n", sysconf(_SC_NPROCESSORS_ONLN));
+        printf("    producers   mutex+condvar+malloc   lock-free ring\n");
+    }
+    for (i = 0; i < sizeof(producer_counts) / sizeof(producer_counts[0]); i++) {
+        int     producers    = producer_counts[i];
+        int     per_producer = total_items / producers;
+        int64_t ref_ns       = io_queue_run(&run, true, producers, 4, per_producer);
+        int64_t ring_ns      = io_queue_run(&run, false, producers, 4, per_producer);
+
+        if (!silent) {
+            printf("    %9d   %13.2f Mops/s   %8.2f Mops/s\n", producers,
+                   (double)total_items * 1000 / ref_ns, (double)total_items * 1000 / ring_ns);
+        }
+    }
+}
+
+// I/O worker pool sizing, against the local mock server
+
+#define IO_WORKERS_BLOCK_SIZE  4096
+
+// Hand count reads to the worker pool at once and wait for them all;
+// returns the number that failed
+int io_workers_run(mount_handle_t* mh, tagged_io_t* ios, uint8_t* data, int count, tagged_io_state_t* state)
+{
+    int i;
+
+    state->outstanding  = count;
+    state->errors       = 0;
+    state->completed    = 0;
+    state->out_of_order = 0;
+
+    for (i = 0; i < count; i++) {
+        ios[i].state = state;
+        ios[i].index = i;
+        bzero(&ios[i].req, sizeof(ios[i].req));
+        ios[i].req.op           = IO_READ;
+        ios[i].req.mount_handle = mh;
+        ios[i].req.inode_number = 1 + (i % MOCK_NUM_INODES);
+        ios[i].req.offset       = (uint64_t)(i % 64) * IO_WORKERS_BLOCK_SIZE;
+        ios[i].req.length       = IO_WORKERS_BLOCK_SIZE;
+        ios[i].req.data         = data + (size_t)i * IO_WORKERS_BLOCK_SIZE;
+        ios[i].req.done_cb      = tagged_io_callback;
+        ios[i].req.done_cb_arg  = &ios[i];
+
+        schedule_io_work(&ios[i].req);
+    }
+
+    pthread_mutex_lock(&state->lock);
+    while (state->outstanding > 0) {
+        pthread_cond_wait(&state->cv, &state->lock);
+    }
+    pthread_mutex_unlock(&state->lock);
+
+    return state->errors;
+}
+
+// A completion that keeps its worker until released, so that nothing more is taken off the queues
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t  cv;
+    bool            holding;
+    bool            release;
+} io_workers_hold_t;
+
+void io_workers_hold_callback(proxyfs_io_request_t* req)
+{
+    io_workers_hold_t* hold = (io_workers_hold_t*)req->done_cb_arg;
+
+    pthread_mutex_lock(&hold->lock);
+    hold->holding = true;
+    pthread_cond_broadcast(&hold->cv);
+    while (!hold->release) {
+        pthread_cond_wait(&hold->cv, &hold->lock);
+    }
+    pthread_mutex_unlock(&hold->lock);
+}
+
+// Schedule req, whose done_cb_arg is hold, and wait for it to hold up its worker
+int io_workers_hold(io_workers_hold_t* hold, proxyfs_io_request_t* req)
+{
+    hold->holding = false;
+    hold->release = false;
+    int err = schedule_io_work(req);
+    if (err != 0) {
+        return err;
+    }
+    pthread_mutex_lock(&hold->lock);
+    while (!hold->holding) {
+        pthread_cond_wait(&hold->cv, &hold->lock);
+    }
+    pthread_mutex_unlock(&hold->lock);
+    return 0;
+}
+
+void io_workers_release(io_workers_hold_t* hold)
+{
+    pthread_mutex_lock(&hold->lock);
+    hold->release = true;
+    pthread_cond_broadcast(&hold->cv);
+    pthread_mutex_unlock(&hold->lock);
+}
+
+// Wait for state->outstanding to reach 0
+void io_workers_wait_done(tagged_io_state_t* state)
+{
+    pthread_mutex_lock(&state->lock);
+    while (state->outstanding > 0) {
+        pthread_cond_wait(&state->cv, &state->lock);
+    }
+    pthread_mutex_unlock(&state->lock);
+}
+
+// Wait up to timeout_ms for the pool to shrink to workers threads
+bool io_workers_wait_for(int workers, int timeout_ms)
+{
+    io_workers_stats_t stats;
+    int                waited_ms;
+
+    for (waited_ms = 0; waited_ms <= timeout_ms; waited_ms += 10) {
+        io_workers_get_stats(&stats);
+        if (stats.workers == workers) {
+            return true;
+        }
+        usleep(10000);
+    }
+    return false;
+}
+
+// Benchmark: one submitter per CPU, each pinned there, keeping bursts of
+// reads going through the pool with one shared queue, one queue per CPU,
+// and one per CPU with pinned workers. Counts cache misses in the process
+// where the hardware counters can be read (not in most VMs).
+
+typedef struct {
+    mount_handle_t*   mh;
+    int               cpu;
+    int               rounds;
+    int               burst;
+    int               errors;
+} io_workers_submitter_t;
+
+void* io_workers_submitter(void* arg)
+{
+    io_workers_submitter_t* sub = (io_workers_submitter_t*)arg;
+    tagged_io_state_t       state;
+    cpu_set_t               cpus;
+    int                     round;
+
+    CPU_ZERO(&cpus);
+    CPU_SET(sub->cpu, &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+
+    tagged_io_t* ios  = (tagged_io_t*)malloc(sub->burst * sizeof(tagged_io_t));
+    uint8_t*     data = (uint8_t*)malloc((size_t)sub->burst * IO_WORKERS_BLOCK_SIZE);
+    pthread_mutex_init(&state.lock, NULL);
+    pthread_cond_init(&state.cv, NULL);
+
+    for (round = 0; round < sub->rounds; round++) {
+        sub->errors += io_workers_run(sub->mh, ios, data, sub->burst, &state);
+    }
+
+    pthread_mutex_destroy(&state.lock);
+    pthread_cond_destroy(&state.cv);
+    free(ios);
+    free(data);
+    return NULL;
+}
+
+// Cache misses of this process and the threads it starts from now on, or -1
+int io_workers_cache_miss_counter()
+{
+    struct perf_event_attr attr;
+
+    bzero(&attr, sizeof(attr));
+    attr.type           = PERF_TYPE_HARDWARE;
+    attr.size           = sizeof(attr);
+    attr.config         = PERF_COUNT_HW_CACHE_MISSES;
+    attr.inherit        = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv     = 1;
+    return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+void io_workers_placement_bench(int port, mount_handle_t* mh)
+{
+    int                     num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int                     rounds   = 16;
+    int                     burst    = 256;
+    pthread_t*              threads  = (pthread_t*)malloc(num_cpus * sizeof(pthread_t));
+    io_workers_submitter_t* subs     = (io_workers_submitter_t*)malloc(num_cpus * sizeof(io_workers_submitter_t));
+    int                     i, cpu;
+
+    if (!silent) {
+        printf("  worker placement, %d submitters with %d bursts of %d 4 KiB reads each:\n",
+               num_cpus, rounds, burst);
+    }
+    for (i = 0; i < 3; i++) {
+        int                shards = (i == 0) ? 1 : 0;
+        bool               pin    = (i == 2);
+        io_workers_stats_t stats;
+        uint64_t           misses = 0;
+
+        // Twice the workers as CPUs, as a busy pool would have
+        io_workers_start("127.0.0.1", port, 2 * num_cpus, 2 * num_cpus, 0, shards, pin);
+        int     counter  = io_workers_cache_miss_counter();
+        int64_t start_ns = registry_now_ns();
+        for (cpu = 0; cpu < num_cpus; cpu++) {
+            subs[cpu].mh     = mh;
+            subs[cpu].cpu    = cpu;
+            subs[cpu].rounds = rounds;
+            subs[cpu].burst  = burst;
+            subs[cpu].errors = 0;
+            pthread_create(&threads[cpu], NULL, io_workers_submitter, &subs[cpu]);
+        }
+        for (cpu = 0; cpu < num_cpus; cpu++) {
+            pthread_join(threads[cpu], NULL);
+        }
+        int64_t run_ns = registry_now_ns() - start_ns;
+        io_workers_get_stats(&stats);
+        io_workers_stop();
+
+        // Inherited counts are in once the workers have exited
+        if (counter >= 0) {
+            if (read(counter, &misses, sizeof(misses)) != sizeof(misses)) {
+                misses = 0;
+            }
+            close(counter);
+        }
+
+        if (!silent) {
+            double reads = (double)num_cpus * rounds * burst;
+            printf("    %-20s %7.3f Mreads/s, %5.1f%% stolen, cache misses per read: ",
+                   (i == 0) ? "one queue:" : ((i == 1) ? "queue per CPU:" : "queue per CPU, pin:"),
+                   reads * 1000 / run_ns, (double)stats.steals * 100 / reads);
+            if (counter >= 0) {
+                printf("%.0f\n", misses / reads);
+            } else {
+                printf("n/a\n");
+            }
+        }
+    }
+
+    free(threads);
+    free(subs);
+}
+
+void io_workers_tests()
+{
+    char*              funcToTest = "io workers";
+    int                burst      = 1024;
+    mount_handle_t     mh;
+    tagged_io_state_t  state;
+    io_workers_stats_t stats;
+    io_workers_stats_t before;
+    bool               failed     = false;
+    int                i;
+
+    // Only one pool per process; don't take over one a mount is using
+    io_workers_get_stats(&stats);
+    if (stats.workers > 0) {
+        TLOG("Skipping %s tests, the worker pool is already running.\n", funcToTest);
+        return;
+    }
+
+    int port = mock_fastpath_server_start(1);
+    if (port < 0) {
+        TLOG("%s: failed to start mock server.\n", funcToTest);
+        test_failed(funcToTest);
+        return;
+    }
+
+    bzero(&mh, sizeof(mh));
+    pthread_mutex_init(&state.lock, NULL);
+    pthread_cond_init(&state.cv, NULL);
+    tagged_io_t* ios  = (tagged_io_t*)malloc(burst * sizeof(tagged_io_t));
+    uint8_t*     data = (uint8_t*)malloc((size_t)burst * IO_WORKERS_BLOCK_SIZE);
+
+    // Starts with min_workers
+    io_workers_start("127.0.0.1", port, 2, 16, 100, 0, false);
+    io_workers_get_stats(&stats);
+    if ((stats.workers != 2) || (stats.spawned != 2)) {
+        TLOG("%s: started with %d workers, expected 2.\n", funcToTest, stats.workers);
+        failed = true;
+    }
+
+    // One request at a time seldom finds both workers busy, and when it
+    // does the worker it adds is idle from then on
+    for (i = 0; i < 200; i++) {
+        failed |= (io_workers_run(&mh, ios, data, 1, &state) != 0);
+    }
+    io_workers_get_stats(&stats);
+    if (stats.hwm_workers > 4) {
+        TLOG("%s: grew to %d workers for one request at a time.\n", funcToTest, stats.hwm_workers);
+        failed = true;
+    }
+
+    // A burst grows the pool, up to max_workers...
+    failed |= (io_workers_run(&mh, ios, data, burst, &state) != 0);
+    io_workers_get_stats(&stats);
+    if ((stats.hwm_workers <= 2) || (stats.hwm_workers > 16)) {
+        TLOG("%s: burst grew the pool to %d workers, expected 3-16.\n", funcToTest, stats.hwm_workers);
+        failed = true;
+    }
+
+    // ...and once idle it shrinks back to min_workers
+    if (!io_workers_wait_for(2, 2000)) {
+        io_workers_get_stats(&stats);
+        TLOG("%s: still %d workers after going idle.\n", funcToTest, stats.workers);
+        failed = true;
+    }
+    io_workers_get_stats(&stats);
+    failed |= (stats.retired != stats.spawned - 2);
+
+    // Slots of retired workers are reused when it grows again
+    before = stats;
+    failed |= (io_workers_run(&mh, ios, data, burst, &state) != 0);
+    io_workers_get_stats(&stats);
+    failed |= (stats.spawned <= before.spawned);
+    failed |= (stats.queued != 0);
+    io_workers_stop();
+
+    // min_workers at least 1, max_workers at least min_workers
+    io_workers_start("127.0.0.1", port, 0, 0, 0, 0, false);
+    io_workers_get_stats(&stats);
+    failed |= (stats.workers != 1);
+    failed |= (io_workers_run(&mh, ios, data, 64, &state) != 0);
+    io_workers_get_stats(&stats);
+    failed |= (stats.hwm_workers != 1);
+    io_workers_stop();
+
+    // Requests made on one CPU reach the workers of other shards by stealing
+    io_workers_start("127.0.0.1", port, 4, 4, 0, 4, false);
+    failed |= (io_workers_run(&mh, ios, data, burst, &state) != 0);
+    io_workers_get_stats(&stats);
+    if ((stats.shards != 4) || (stats.steals == 0)) {
+        TLOG("%s: %d shards, %" PRIu64 " requests stolen, expected 4 and some.\n", funcToTest,
+             stats.shards, stats.steals);
+        failed = true;
+    }
+    io_workers_stop();
+
+    // One shard: nothing to steal from. Pinned workers still get everything done.
+    io_workers_start("127.0.0.1", port, 4, 4, 0, 1, true);
+    failed |= (io_workers_run(&mh, ios, data, burst, &state) != 0);
+    io_workers_get_stats(&stats);
+    failed |= (stats.shards != 1) || (stats.steals != 0);
+    io_workers_stop();
+
+    // With its only worker held up, the queue fills and further requests are turned away rather than
+    // left waiting for room
+    io_workers_hold_t    hold;
+    proxyfs_io_request_t hold_req;
+    int                  max_queued = 2 * 4096;
+    int                  accepted;
+    int                  err        = 0;
+    tagged_io_t*         queued     = (tagged_io_t*)malloc(max_queued * sizeof(tagged_io_t));
+
+    pthread_mutex_init(&hold.lock, NULL);
+    pthread_cond_init(&hold.cv, NULL);
+    bzero(&hold_req, sizeof(hold_req));
+    hold_req.op           = IO_READ;
+    hold_req.mount_handle = &mh;
+    hold_req.inode_number = 1;
+    hold_req.length       = IO_WORKERS_BLOCK_SIZE;
+    hold_req.data         = data;
+    hold_req.done_cb      = io_workers_hold_callback;
+    hold_req.done_cb_arg  = &hold;
+
+    io_workers_start("127.0.0.1", port, 1, 1, 0, 1, false);
+    failed |= (io_workers_hold(&hold, &hold_req) != 0);
+
+    state.errors = 0;
+    for (accepted = 0; accepted < max_queued; accepted++) {
+        bzero(&queued[accepted].req, sizeof(queued[accepted].req));
+        queued[accepted].state            = &state;
+        queued[accepted].index            = accepted;
+        queued[accepted].req.op           = IO_READ;
+        queued[accepted].req.mount_handle = &mh;
+        queued[accepted].req.inode_number = 1;
+        queued[accepted].req.length       = IO_WORKERS_BLOCK_SIZE;
+        queued[accepted].req.data         = data + (size_t)(accepted % burst) * IO_WORKERS_BLOCK_SIZE;
+        queued[accepted].req.done_cb      = tagged_io_callback;
+        queued[accepted].req.done_cb_arg  = &queued[accepted];
+        err = schedule_io_work(&queued[accepted].req);
+        if (err != 0) {
+            break;
+        }
+    }
+    if ((err != EAGAIN) || (accepted == 0)) {
+        TLOG("%s: queueing to a full pool returned %d after %d requests, expected EAGAIN.\n", funcToTest, err,
+             accepted);
+        failed = true;
+    }
+
+    pthread_mutex_lock(&state.lock);
+    state.outstanding = accepted;
+    pthread_mutex_unlock(&state.lock);
+    io_workers_release(&hold);
+    io_workers_wait_done(&state);
+    io_workers_get_stats(&stats);
+    if ((state.errors != 0) || (stats.queued != 0)) {
+        TLOG("%s: %d of the %d queued requests failed, %" PRIu64 " still counted as queued.\n", funcToTest,
+             state.errors, accepted, stats.queued);
+        failed = true;
+    }
+    io_workers_stop();
+
+    // A request queued behind the only worker doesn't add another while requests have been getting
+    // through quickly...
+    io_workers_start("127.0.0.1", port, 1, 4, 0, 1, false);
+    failed |= (io_workers_hold(&hold, &hold_req) != 0);
+    state.outstanding      = 1;
+    queued[0].req.error    = 0;
+    queued[0].req.out_size = 0;
+    failed |= (schedule_io_work(&queued[0].req) != 0);
+    io_workers_get_stats(&stats);
+    if (stats.workers != 1) {
+        TLOG("%s: one request waiting grew the pool to %d workers.\n", funcToTest, stats.workers);
+        failed = true;
+    }
+    usleep(20000);
+    io_workers_release(&hold);
+    io_workers_wait_done(&state);
+
+    // ...but does once they have been waiting a while
+    failed |= (io_workers_hold(&hold, &hold_req) != 0);
+    state.outstanding      = 1;
+    queued[0].req.error    = 0;
+    queued[0].req.out_size = 0;
+    failed |= (schedule_io_work(&queued[0].req) != 0);
+    io_workers_get_stats(&stats);
+    if ((stats.workers != 2) || (stats.recent_wait_us < 200)) {
+        TLOG("%s: %d workers after requests waited %" PRIu64 " us lately, expected 2.\n", funcToTest,
+             stats.workers, stats.recent_wait_us);
+        failed = true;
+    }
+    io_workers_wait_done(&state);
+    io_workers_release(&hold);
+    failed |= (state.errors != 0);
+    io_workers_stop();
+    pthread_cond_destroy(&hold.cv);
+    pthread_mutex_destroy(&hold.lock);
+    free(queued);
+
+    if (failed) {
+        test_failed(funcToTest);
+    } else {
+        test_passed();
+    }
+
+    // Benchmark: threads and connections a fixed pool of 128 costs against
+    // a pool that starts at 4, for an idle mount and for bursts
+    int     rounds = 8;
+    int64_t start_ns;
+
+    if (!silent) {
+        printf("  worker pool (%ld CPUs), %d bursts of %d 4 KiB reads:\n",
+               sysconf(_SC_NPROCESSORS_ONLN), rounds, burst);
+    }
+    for (i = 0; i < 2; i++) {
+        int min_workers = (i == 0) ? 128 : 4;
+
+        start_ns = registry_now_ns();
+        io_workers_start("127.0.0.1", port, min_workers, 128, 30000, 0, false);
+        int64_t start_us = (registry_now_ns() - start_ns) / 1000;
+        io_workers_get_stats(&before);
+
+        int round;
+        start_ns = registry_now_ns();
+        for (round = 0; round < rounds; round++) {
+            io_workers_run(&mh, ios, data, burst, &state);
+        }
+        int64_t run_ns = registry_now_ns() - start_ns;
+        io_workers_get_stats(&stats);
+        io_workers_stop();
+
+        if (!silent) {
+            printf("    %-9s start %6ld us, %3d threads idle, %3d after bursts, %6.1f us per read\n",
+                   (i == 0) ? "fixed:" : "adaptive:", start_us, before.workers, stats.workers,
+                   (double)run_ns / 1000 / (rounds * burst));
+        }
+    }
+
+    io_workers_placement_bench(port, &mh);
+
+    mock_fastpath_server_stop();
+    pthread_mutex_destroy(&state.lock);
+    pthread_cond_destroy(&state.cv);
+    free(ios);
+    free(data);
+}
+
+// Merging of contiguous async reads and writes by the I/O workers, against the local mock server
+
+// Queue count 4 KiB reads or writes, request i for block first_block + i / streams of inode
+// 1 + i % streams, and wait for them all; returns the number that failed or came up short. With
+// swapped, neighbouring requests are queued in the opposite order.
+int io_merge_run(mount_handle_t* mh, io_op_t op, int streams, uint64_t first_block, bool swapped,
+                 tagged_io_t* ios, uint8_t* data, int count, tagged_io_state_t* state)
+{
+    int i;
+
+    state->outstanding  = count;
+    state->errors       = 0;
+    state->completed    = 0;
+    state->out_of_order = 0;
+
+    for (i = 0; i < count; i++) {
+        bzero(&ios[i].req, sizeof(ios[i].req));
+        ios[i].state            = state;
+        ios[i].index            = i;
+        ios[i].req.op           = op;
+        ios[i].req.mount_handle = mh;
+        ios[i].req.inode_number = 1 + (i % streams);
+        ios[i].req.offset       = (first_block + i / streams) * IO_WORKERS_BLOCK_SIZE;
+        ios[i].req.length       = IO_WORKERS_BLOCK_SIZE;
+        ios[i].req.data         = data + (size_t)i * IO_WORKERS_BLOCK_SIZE;
+        ios[i].req.done_cb      = tagged_io_callback;
+        ios[i].req.done_cb_arg  = &ios[i];
+    }
+    for (i = 0; i < count; i++) {
+        int j = (swapped && ((i ^ 1) < count)) ? (i ^ 1) : i;
+        schedule_io_work(&ios[j].req);
+    }
+
+    pthread_mutex_lock(&state->lock);
+    while (state->outstanding > 0) {
+        pthread_cond_wait(&state->cv, &state->lock);
+    }
+    pthread_mutex_unlock(&state->lock);
+
+    return state->errors;
+}
+
+void io_merge_tests()
+{
+    char*              funcToTest = "io merge";
+    int                count      = 64;
+    mount_handle_t     mh;
+    tagged_io_state_t  state;
+    io_workers_stats_t stats;
+    io_workers_stats_t before;
+    uint64_t           ios_before;
+    bool               failed     = false;
+    int                i;
+
+    // Only one pool per process; don't take over one a mount is using
+    io_workers_get_stats(&stats);
+    if (stats.workers > 0) {
+        TLOG("Skipping %s tests, the worker pool is already running.\n", funcToTest);
+        return;
+    }
+
+    int port = mock_fastpath_server_start(1);
+    if (port < 0) {
+        TLOG("%s: failed to start mock server.\n", funcToTest);
+        test_failed(funcToTest);
+        return;
+    }
+
+    bzero(&mh, sizeof(mh));
+    pthread_mutex_init(&state.lock, NULL);
+    pthread_cond_init(&state.cv, NULL);
+    tagged_io_t* ios      = (tagged_io_t*)malloc(1024 * sizeof(tagged_io_t));
+    uint8_t*     data     = (uint8_t*)malloc((size_t)1024 * IO_WORKERS_BLOCK_SIZE);
+    uint8_t*     readback = (uint8_t*)malloc((size_t)count * IO_WORKERS_BLOCK_SIZE);
+
+    // One worker, which waits a while for more requests, so they pile up behind the first
+    io_workers_start("127.0.0.1", port, 1, 1, 0, 1, false);
+    io_workers_set_merge(IO_MERGE_MAX_BYTES_DEFAULT, 20000);
+
+    // Writes queued in pairs the wrong way round still go out as a few big ones...
+    for (i = 0; i < count; i++) {
+        tagged_io_fill(data + (size_t)i * IO_WORKERS_BLOCK_SIZE, i + 7);
+    }
+    ios_before = mock_fastpath_server_ios();
+    failed |= (io_merge_run(&mh, IO_WRITE, 1, 0, true, ios, data, count, &state) != 0);
+    io_workers_get_stats(&stats);
+    if ((stats.merged_ios == 0) || (mock_fastpath_server_ios() - ios_before >= (uint64_t)count)) {
+        TLOG("%s: %d writes took %" PRIu64 " requests to the server, %" PRIu64 " merged.\n", funcToTest, count,
+             mock_fastpath_server_ios() - ios_before, stats.merged_ios);
+        failed = true;
+    }
+
+    // ...and reads each get their own block back
+    before = stats;
+    failed |= (io_merge_run(&mh, IO_READ, 1, 0, false, ios, readback, count, &state) != 0);
+    failed |= (memcmp(data, readback, (size_t)count * IO_WORKERS_BLOCK_SIZE) != 0);
+    io_workers_get_stats(&stats);
+    failed |= (stats.merged_ios == before.merged_ios);
+
+    // A short read completes the parts before the end of the file, and the rest read nothing
+    failed |= (io_merge_run(&mh, IO_READ, 1, MOCK_FILE_SIZE / IO_WORKERS_BLOCK_SIZE - 2, false,
+                            ios, readback, 4, &state) != 2);
+    for (i = 0; i < 4; i++) {
+        failed |= (ios[i].req.error != 0) || (ios[i].req.out_size != ((i < 2) ? IO_WORKERS_BLOCK_SIZE : 0));
+    }
+
+    // Nothing contiguous, nothing merged
+    io_workers_get_stats(&before);
+    failed |= (io_workers_run(&mh, ios, data, count, &state) != 0);
+    io_workers_get_stats(&stats);
+    failed |= (stats.merged_ios != before.merged_ios);
+
+    // Merged requests stay within max_bytes
+    io_workers_set_merge(2 * IO_WORKERS_BLOCK_SIZE, 20000);
+    before = stats;
+    failed |= (io_merge_run(&mh, IO_READ, 1, 0, false, ios, readback, count, &state) != 0);
+    io_workers_get_stats(&stats);
+    failed |= (stats.merged - before.merged > 2 * (stats.merged_ios - before.merged_ios));
+
+    // Off
+    io_workers_set_merge(0, 0);
+    before     = stats;
+    ios_before = mock_fastpath_server_ios();
+    failed |= (io_merge_run(&mh, IO_READ, 1, 0, false, ios, readback, count, &state) != 0);
+    io_workers_get_stats(&stats);
+    failed |= (stats.merged_ios != before.merged_ios) || (mock_fastpath_server_ios() - ios_before != (uint64_t)count);
+    io_workers_stop();
+
+    if (failed) {
+        test_failed(funcToTest);
+    } else {
+        test_passed();
+    }
+
+    // Benchmark: 4 files read sequentially at once, 4 KiB at a time, by 4 workers
+    int rounds = 8;
+    int burst  = 1024;
+
+    if (!silent) {
+        printf("  4 sequential streams, %d bursts of %d 4 KiB reads, 4 workers:\n", rounds, burst);
+    }
+    for (i = 0; i < 3; i++) {
+        int     window_us = (i == 2) ? 50 : 0;
+        int     round;
+        int64_t start_ns;
+
+        io_workers_start("127.0.0.1", port, 4, 4, 0, 1, false);
+        io_workers_set_merge((i == 0) ? 0 : IO_MERGE_MAX_BYTES_DEFAULT, window_us);
+        ios_before = mock_fastpath_server_ios();
+        start_ns   = registry_now_ns();
+        for (round = 0; round < rounds; round++) {
+            failed |= (io_merge_run(&mh, IO_READ, 4, 0, false, ios, data, burst, &state) != 0);
+        }
+        int64_t run_ns = registry_now_ns() - start_ns;
+        io_workers_get_stats(&stats);
+        io_workers_stop();
+
+        if (!silent) {
+            double reads = (double)rounds * burst;
+            printf("    %-22s %7.3f Mreads/s, %6.1f reads per server request\n",
+                   (i == 0) ? "separate:" : ((i == 1) ? "merged:" : "merged, 50 us window:"),
+                   reads * 1000 / run_ns, reads / (mock_fastpath_server_ios() - ios_before));
+        }
+    }
+    io_workers_set_merge(IO_MERGE_MAX_BYTES_DEFAULT, 0);
+
+    mock_fastpath_server_stop();
+    pthread_mutex_destroy(&state.lock);
+    pthread_cond_destroy(&state.cv);
+    free(ios);
+    free(data);
+    free(readback);
+}
+
+// Order in which the I/O workers serve waiting requests
+
+void io_sched_req(proxyfs_io_request_t* req, io_op_t op, mount_handle_t* mh, uint64_t offset, uint64_t length)
+{
+    bzero(req, sizeof(*req));
+    req->op           = op;
+    req->mount_handle = mh;
+    req->offset       = offset;
+    req->length       = length;
+}
+
+bool io_sched_match_offset(proxyfs_io_request_t* req, void* arg)
+{
+    return (req->offset == *(uint64_t*)arg);
+}
+
+// Reads of one mount behind a burst of large writes from another: how long the reads take, served in
+// order of arrival or fairly. The writes all come from the first 16 blocks of data, the reads each go
+// to one of their own after that.
+typedef struct {
+    tagged_io_state_t state;
+    int64_t           submit_ns;
+    int64_t           max_ns;
+    int64_t           total_ns;
+} io_sched_latency_t;
+
+void io_sched_read_callback(proxyfs_io_request_t* req)
+{
+    tagged_io_t*        io      = (tagged_io_t*)req->done_cb_arg;
+    io_sched_latency_t* latency = (io_sched_latency_t*)io->state;
+    int64_t             ns      = registry_now_ns() - latency->submit_ns;
+
+    pthread_mutex_lock(&latency->state.lock);
+    latency->total_ns += ns;
+    latency->max_ns    = (ns > latency->max_ns) ? ns : latency->max_ns;
+    pthread_mutex_unlock(&latency->state.lock);
+    tagged_io_callback(req);
+}
+
+void io_sched_latency_run(mount_handle_t* writer, mount_handle_t* reader, int writes, int reads,
+                          tagged_io_t* ios, uint8_t* data, tagged_io_state_t* write_state,
+                          io_sched_latency_t* latency)
+{
+    int i;
+
+    write_state->outstanding    = writes;
+    write_state->errors         = 0;
+    latency->state.outstanding  = reads;
+    latency->state.errors       = 0;
+    latency->max_ns             = 0;
+    latency->total_ns           = 0;
+
+    for (i = 0; i < writes + reads; i++) {
+        bool read = (i >= writes);
+
+        bzero(&ios[i].req, sizeof(ios[i].req));
+        ios[i].state            = read ? &latency->state : write_state;
+        ios[i].index            = i;
+        ios[i].req.op           = read ? IO_READ : IO_WRITE;
+        ios[i].req.mount_handle = read ? reader : writer;
+        ios[i].req.inode_number = read ? 2 : 1;
+        ios[i].req.offset       = read ? (uint64_t)(i - writes) * IO_WORKERS_BLOCK_SIZE : 0;
+        ios[i].req.length       = read ? IO_WORKERS_BLOCK_SIZE : 16 * IO_WORKERS_BLOCK_SIZE;
+        ios[i].req.data         = read ? data + (size_t)(16 + i - writes) * IO_WORKERS_BLOCK_SIZE : data;
+        ios[i].req.done_cb      = read ? io_sched_read_callback : tagged_io_callback;
+        ios[i].req.done_cb_arg  = &ios[i];
+    }
+
+    // All the writes, then the reads, as if a second client came along during a big copy
+    for (i = 0; i < writes; i++) {
+        schedule_io_work(&ios[i].req);
+    }
+    latency->submit_ns = registry_now_ns();
+    for (i = writes; i < writes + reads; i++) {
+        schedule_io_work(&ios[i].req);
+    }
+
+    pthread_mutex_lock(&write_state->lock);
+    while (write_state->outstanding > 0) {
+        pthread_cond_wait(&write_state->cv, &write_state->lock);
+    }
+    pthread_mutex_unlock(&write_state->lock);
+    pthread_mutex_lock(&latency->state.lock);
+    while (latency->state.outstanding > 0) {
+        pthread_cond_wait(&latency->state.cv, &latency->state.lock);
+    }
+    pthread_mutex_unlock(&latency->state.lock);
+}
+
+void io_sched_tests()
+{
+    char*                funcToTest = "io sched";
+    bool                 failed     = false;
+    io_sched_t           sched;
+    io_flow_ref_t        ref;
+    proxyfs_io_request_t reqs[128];
+    mount_handle_t       mh[2];
+    int                  i;
+
+    // Classes by op, unless the request has one and those are asked for; garbage is ignored either way
+    io_sched_req(&reqs[0], IO_READ, &mh[0], 0, 4096);
+    failed |= (io_sched_class_of(&reqs[0], true) != IO_CLASS_INTERACTIVE);
+    reqs[0].io_class = IO_CLASS_BULK;
+    failed |= (io_sched_class_of(&reqs[0], false) != IO_CLASS_INTERACTIVE);
+    failed |= (io_sched_class_of(&reqs[0], true) != IO_CLASS_BULK);
+    reqs[0].io_class = (io_class_t)0x5a5a5a5a;
+    failed |= (io_sched_class_of(&reqs[0], true) != IO_CLASS_INTERACTIVE);
+    io_sched_req(&reqs[0], IO_WRITE, &mh[0], 0, 4096);
+    failed |= (io_sched_class_of(&reqs[0], false) != IO_CLASS_BULK);
+    io_sched_req(&reqs[0], IO_FLUSH, &mh[0], 0, 0);
+    failed |= (io_sched_class_of(&reqs[0], false) != IO_CLASS_FLUSH);
+
+    // Flushes, then reads, then writes, whatever order they came in
+    io_sched_init(&sched);
+    failed |= (io_sched_next(&sched, &ref) != NULL);
+    io_sched_req(&reqs[0], IO_WRITE, &mh[0], 0, 4096);
+    io_sched_req(&reqs[1], IO_READ, &mh[0], 0, 4096);
+    io_sched_req(&reqs[2], IO_FLUSH, &mh[0], 0, 0);
+    reqs[2].inode_number = 1;
+    for (i = 0; i < 3; i++) {
+        failed |= (io_sched_add(&sched, &reqs[i], true) != 0);
+    }
+    failed |= (io_sched_queued(&sched) != 3);
+    failed |= (io_sched_next(&sched, &ref) != &reqs[2]);
+    failed |= (io_sched_next(&sched, &ref) != &reqs[1]);
+    failed |= (io_sched_next(&sched, &ref) != &reqs[0]);
+    failed |= (io_sched_next(&sched, &ref) != NULL) || (io_sched_queued(&sched) != 0);
+
+    // ...but a flush doesn't pass the writes to its file queued before it, only other mounts' and files'
+    // requests. Writes to the file that come after it still wait.
+    io_sched_req(&reqs[0], IO_WRITE, &mh[0], 0, 4096);
+    io_sched_req(&reqs[1], IO_WRITE, &mh[0], 0, 4096);
+    io_sched_req(&reqs[2], IO_WRITE, &mh[0], 4096, 4096);
+    io_sched_req(&reqs[3], IO_READ, &mh[1], 0, 4096);
+    io_sched_req(&reqs[4], IO_FLUSH, &mh[0], 0, 0);
+    io_sched_req(&reqs[5], IO_WRITE, &mh[0], 8192, 4096);
+    reqs[1].inode_number = 1;
+    for (i = 0; i < 6; i++) {
+        failed |= (io_sched_add(&sched, &reqs[i], true) != 0);
+    }
+    failed |= (io_sched_next(&sched, &ref) != &reqs[0]);
+    failed |= (io_sched_next(&sched, &ref) != &reqs[2]);
+    failed |= (io_sched_next(&sched, &ref) != &reqs[4]);
+    failed |= (io_sched_next(&sched, &ref) != &reqs[3]);
+    failed |= (io_sched_next(&sched, &ref) != &reqs[1]);
+    failed |= (io_sched_next(&sched, &ref) != &reqs[5]);
+    failed |= (io_sched_next(&sched, &ref) != NULL);
+
+    // Without fairness, in the order they came
+    for (i = 0; i < 3; i++) {
+        failed |= (io_sched_add(&sched, &reqs[i], false) != 0);
+    }
+    for (i = 0; i < 3; i++) {
+        failed |= (io_sched_next(&sched, &ref) != &reqs[i]);
+    }
+
+    // A lower class gets a turn after waiting behind IO_SCHED_STARVE_LIMIT others
+    io_sched_req(&reqs[0], IO_WRITE, &mh[0], 0, 4096);
+    failed |= (io_sched_add(&sched, &reqs[0], true) != 0);
+    for (i = 1; i <= 2 * IO_SCHED_STARVE_LIMIT; i++) {
+        io_sched_req(&reqs[i], IO_READ, &mh[0], 0, 4096);
+        failed |= (io_sched_add(&sched, &reqs[i], true) != 0);
+    }
+    for (i = 0; i < IO_SCHED_STARVE_LIMIT; i++) {
+        failed |= (io_sched_next(&sched, &ref) != &reqs[i + 1]);
+    }
+    failed |= (io_sched_next(&sched, &ref) != &reqs[0]);
+    while (io_sched_next(&sched, &ref) != NULL) {
+    }
+
+    // Within a class, mounts share by bytes: one mount's 64 small writes all get in before the other's
+    // second 1 MiB one, in order
+    for (i = 0; i < 8; i++) {
+        io_sched_req(&reqs[i], IO_WRITE, &mh[0], (uint64_t)i << 20, 1 << 20);
+        failed |= (io_sched_add(&sched, &reqs[i], true) != 0);
+    }
+    for (i = 8; i < 72; i++) {
+        io_sched_req(&reqs[i], IO_WRITE, &mh[1], (uint64_t)i * 4096, 4096);
+        failed |= (io_sched_add(&sched, &reqs[i], true) != 0);
+    }
+    int big = 0, small = 8;
+    for (i = 0; i < 72; i++) {
+        proxyfs_io_request_t* req = io_sched_next(&sched, &ref);
+        if ((req == NULL) || ((req != &reqs[big]) && (req != &reqs[small]))) {
+            failed = true;
+            break;
+        }
+        if (req == &reqs[big]) {
+            big++;
+            failed |= (big > 1) && (small < 72);
+        } else {
+            small++;
+        }
+    }
+    failed |= (io_sched_next(&sched, &ref) != NULL);
+
+    // Taking from the middle of a mount's queue leaves the rest in order
+    for (i = 0; i < 4; i++) {
+        io_sched_req(&reqs[i], IO_READ, &mh[0], (uint64_t)i * 4096, 4096);
+        failed |= (io_sched_add(&sched, &reqs[i], true) != 0);
+    }
+    uint64_t offset = 2 * 4096;
+    failed |= (io_sched_next(&sched, &ref) != &reqs[0]);
+    failed |= (io_sched_take_if(&sched, &ref, 1, io_sched_match_offset, &offset) != NULL);
+    failed |= (io_sched_take_if(&sched, &ref, 4, io_sched_match_offset, &offset) != &reqs[2]);
+    failed |= (io_sched_next(&sched, &ref) != &reqs[1]);
+    failed |= (io_sched_next(&sched, &ref) != &reqs[3]);
+    failed |= (io_sched_queued(&sched) != 0);
+
+    // A mount's queue goes once it is empty, and asking for more from it then finds nothing, even with
+    // another mount's queue moved into its place
+    for (i = 0; i < 64; i++) {
+        io_sched_req(&reqs[i], IO_WRITE, (mount_handle_t*)&reqs[64 + i], 0, 4096);
+        failed |= (io_sched_add(&sched, &reqs[i], true) != 0);
+    }
+    failed |= (sched.classes[IO_CLASS_BULK].num_flows != 64);
+    offset = 0;
+    failed |= (io_sched_next(&sched, &ref) != &reqs[0]);
+    failed |= (io_sched_take_if(&sched, &ref, 4, io_sched_match_offset, &offset) != NULL);
+    for (i = 1; i < 64; i++) {
+        failed |= (io_sched_next(&sched, &ref) != &reqs[i]);
+    }
+    for (i = 0; i < IO_CLASSES; i++) {
+        failed |= (sched.classes[i].num_flows != 0);
+    }
+    io_sched_destroy(&sched);
+
+    // Through the workers: per-class counts add up
+    io_workers_stats_t stats;
+    io_workers_get_stats(&stats);
+    if (stats.workers > 0) {
+        TLOG("Skipping %s worker tests, the worker pool is already running.\n", funcToTest);
+        if (failed) {
+            test_failed(funcToTest);
+        } else {
+            test_passed();
+        }
+        return;
+    }
+
+    int port = mock_fastpath_server_start(1);
+    if (port < 0) {
+        TLOG("%s: failed to start mock server.\n", funcToTest);
+        test_failed(funcToTest);
+        return;
+    }
+
+    int                writes = 512;
+    int                reads  = 16;
+    tagged_io_state_t  write_state;
+    io_sched_latency_t latency;
+    tagged_io_t*       ios  = (tagged_io_t*)malloc((writes + reads) * sizeof(tagged_io_t));
+    uint8_t*           data = (uint8_t*)malloc((size_t)(16 + reads) * IO_WORKERS_BLOCK_SIZE);
+
+    bzero(mh, sizeof(mh));
+    bzero(data, (size_t)(16 + reads) * IO_WORKERS_BLOCK_SIZE);
+    bzero(&latency, sizeof(latency));
+    pthread_mutex_init(&write_state.lock, NULL);
+    pthread_cond_init(&write_state.cv, NULL);
+    pthread_mutex_init(&latency.state.lock, NULL);
+    pthread_cond_init(&latency.state.cv, NULL);
+
+    io_workers_start("127.0.0.1", port, 2, 2, 0, 1, false);
+    io_workers_set_merge(0, 0);
+    io_sched_latency_run(&mh[0], &mh[1], writes, reads, ios, data, &write_state, &latency);
+    failed |= (write_state.errors != 0) || (latency.state.errors != 0);
+    io_workers_get_stats(&stats);
+    failed |= (stats.classes[IO_CLASS_BULK].dispatched != (uint64_t)writes);
+    failed |= (stats.classes[IO_CLASS_INTERACTIVE].dispatched != (uint64_t)reads);
+    failed |= (stats.classes[IO_CLASS_BULK].queued != 0) || (stats.classes[IO_CLASS_INTERACTIVE].queued != 0);
+    failed |= (stats.classes[IO_CLASS_INTERACTIVE].max_wait_us > stats.classes[IO_CLASS_BULK].max_wait_us);
+    io_workers_stop();
+
+    if (failed) {
+        test_failed(funcToTest);
+    } else {
+        test_passed();
+    }
+
+    // Benchmark: 16 4 KiB reads queued behind 512 64 KiB writes of another mount, 2 workers
+    if (!silent) {
+        printf("  %d 4 KiB reads of one mount behind %d 64 KiB writes of another, 2 workers:\n", reads, writes);
+    }
+    for (i = 0; i < 2; i++) {
+        io_workers_start("127.0.0.1", port, 2, 2, 0, 1, false);
+        io_workers_set_fair_queuing(i == 1);
+        io_sched_latency_run(&mh[0], &mh[1], writes, reads, ios, data, &write_state, &latency);
+        io_workers_get_stats(&stats);
+        io_workers_stop();
+
+        if (!silent) {
+            io_class_stats_t* bulk = &stats.classes[IO_CLASS_BULK];
+            printf("    %-16s reads done in %7.0f us on average, %7.0f us at most; writes waited %6" PRIu64
+                   " us on average\n", (i == 0) ? "in order:" : "fair queuing:",
+                   (double)latency.total_ns / reads / 1000, (double)latency.max_ns / 1000,
+                   bulk->wait_us / bulk->dispatched);
+        }
+    }
+    io_workers_set_fair_queuing(true);
+    io_workers_set_merge(IO_MERGE_MAX_BYTES_DEFAULT, 0);
+
+    mock_fastpath_server_stop();
+    pthread_mutex_destroy(&write_state.lock);
+    pthread_cond_destroy(&write_state.cv);
+    pthread_mutex_destroy(&latency.state.lock);
+    pthread_cond_destroy(&latency.state.cv);
+    free(ios);
+    free(data);
+}
+
+// Completion queues
+
+typedef struct {
+    proxyfs_io_request_t* reqs;
+    int                   count;
+} cqueue_producer_t;
+
+// Finish requests the way the I/O threads do; they were counted against the queue as if sent
+void* cqueue_producer(void* arg)
+{
+    cqueue_producer_t* producer = (cqueue_producer_t*)arg;
+    int                i;
+
+    for (i = 0; i < producer->count; i++) {
+        io_req_complete(&producer->reqs[i]);
+    }
+    return NULL;
+}
+
+// Send requests with proxyfs_async_send, retrying while their completion queue is full
+typedef struct {
+    proxyfs_io_request_t* reqs;
+    int                   count;
+    uint64_t              eagain;
+    int                   errors;
+} cqueue_sender_t;
+
+void* cqueue_sender(void* arg)
+{
+    cqueue_sender_t* sender = (cqueue_sender_t*)arg;
+    int              i, err;
+
+    for (i = 0; i < sender->count; i++) {
+        while ((err = proxyfs_async_send(&sender->reqs[i])) == EAGAIN) {
+            sender->eagain++;
+            sched_yield();
+        }
+        sender->errors += (err != 0);
+    }
+    return NULL;
+}
+
+// Wait on fd and reap up to batch at a time until count of the requests starting at reqs have come
+// back; returns how many came back more than once or not at all. *wakeups counts the waits.
+int cqueue_reap_all(int fd, proxyfs_io_request_t* reqs, int count, int batch, int* wakeups)
+{
+    proxyfs_io_request_t* reaped[64];
+    uint8_t*              seen   = (uint8_t*)calloc(count, 1);
+    int                   got    = 0;
+    int                   errors = 0;
+    int                   i, n;
+
+    *wakeups = 0;
+    while (got < count) {
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        if (poll(&pfd, 1, 5000) != 1) {
+            break;
+        }
+        (*wakeups)++;
+        do {
+            if (proxyfs_reap_completions(fd, reaped, batch, &n) != 0) {
+                n = 0;
+                errors++;
+            }
+            for (i = 0; i < n; i++) {
+                int index = reaped[i] - reqs;
+                if ((index < 0) || (index >= count) || seen[index]) {
+                    errors++;
+                } else {
+                    seen[index] = 1;
+                    got++;
+                }
+            }
+        } while (n == batch);
+    }
+
+    free(seen);
+    return errors + (count - got);
+}
+
+// Nothing to reap and the descriptor not readable
+bool cqueue_idle(int fd)
+{
+    proxyfs_io_request_t* reaped[1];
+    struct pollfd         pfd = { .fd = fd, .events = POLLIN };
+    int                   n;
+
+    proxyfs_reap_completions(fd, reaped, 1, &n);
+    return (n == 0) && (poll(&pfd, 1, 0) == 0);
+}
+
+// Benchmark: done_cb writing each request to a pipe the event loop watches, as a Samba module would, or
+// a completion queue
+typedef struct {
+    int write_fd;
+} cqueue_pipe_t;
+
+void cqueue_pipe_callback(proxyfs_io_request_t* req)
+{
+    cqueue_pipe_t* pipe_cb = (cqueue_pipe_t*)req->done_cb_arg;
+
+    if (write(pipe_cb->write_fd, &req, sizeof(req)) != sizeof(req)) {
+        TLOG("cqueue: failed to write to the completion pipe.\n");
+    }
+}
+
+void completion_queue_bench(int port, mount_handle_t* mh)
+{
+    int                   count = 4096;
+    int                   rounds = 4;
+    proxyfs_io_request_t* reqs  = (proxyfs_io_request_t*)calloc(count, sizeof(proxyfs_io_request_t));
+    uint8_t*              data  = (uint8_t*)malloc((size_t)count * IO_WORKERS_BLOCK_SIZE);
+    int                   mode, round, i;
+
+    if (!silent) {
+        printf("  %d bursts of %d 4 KiB reads, 4 workers, completions reaped by one event loop thread:\n",
+               rounds, count);
+    }
+    for (mode = 0; mode < 2; mode++) {
+        cqueue_pipe_t pipe_cb;
+        int           fds[2] = { -1, -1 };
+        int           cq_fd  = -1;
+        int           wakeups = 0, errors = 0;
+
+        if (mode == 0) {
+            if (pipe(fds) != 0) {
+                break;
+            }
+            pipe_cb.write_fd = fds[1];
+        } else if (proxyfs_completion_queue_open(count, &cq_fd) != 0) {
+            break;
+        }
+
+        io_workers_start("127.0.0.1", port, 4, 4, 0, 1, false);
+        int64_t start_ns = registry_now_ns();
+        for (round = 0; round < rounds; round++) {
+            for (i = 0; i < count; i++) {
+                bzero(&reqs[i], sizeof(reqs[i]));
+                reqs[i].op           = IO_READ;
+                reqs[i].mount_handle = mh;
+                reqs[i].inode_number = 1 + (i % MOCK_NUM_INODES);
+                reqs[i].offset       = (uint64_t)(i % 64) * IO_WORKERS_BLOCK_SIZE;
+                reqs[i].length       = IO_WORKERS_BLOCK_SIZE;
+                reqs[i].data         = data + (size_t)i * IO_WORKERS_BLOCK_SIZE;
+                reqs[i].done_cb      = (mode == 0) ? cqueue_pipe_callback : NULL;
+                reqs[i].done_cb_arg  = &pipe_cb;
+                reqs[i].done_cb_fd   = cq_fd;
+                proxyfs_async_send(&reqs[i]);
+            }
+
+            if (mode == 1) {
+                int woke;
+                errors  += cqueue_reap_all(cq_fd, reqs, count, 64, &woke);
+                wakeups += woke;
+                continue;
+            }
+
+            // Read what the callbacks wrote, as much as is there each time the pipe is readable
+            int got = 0;
+            while (got < count) {
+                proxyfs_io_request_t* done[64];
+                struct pollfd         pfd = { .fd = fds[0], .events = POLLIN };
+                if (poll(&pfd, 1, 5000) != 1) {
+                    break;
+                }
+                wakeups++;
+                ssize_t bytes = read(fds[0], done, sizeof(done));
+                if (bytes > 0) {
+                    got += bytes / sizeof(done[0]);
+                }
+            }
+            errors += count - got;
+        }
+        int64_t run_ns = registry_now_ns() - start_ns;
+        io_workers_stop();
+
+        if (!silent) {
+            printf("    %-18s %7.3f Mreads/s, %6.1f wake-ups per 1000 reads, %d lost\n",
+                   (mode == 0) ? "done_cb to pipe:" : "completion queue:",
+                   (double)rounds * count * 1000 / run_ns, (double)wakeups * 1000 / (rounds * count), errors);
+        }
+        if (mode == 0) {
+            close(fds[0]);
+            close(fds[1]);
+        } else {
+            proxyfs_completion_queue_close(cq_fd);
+        }
+    }
+
+    free(reqs);
+    free(data);
+}
+
+void completion_queue_tests()
+{
+    char*                 funcToTest = "completion queue";
+    bool                  failed     = false;
+    int                   count      = 10000;
+    int                   producers  = 4;
+    proxyfs_io_request_t* reqs       = (proxyfs_io_request_t*)calloc(count, sizeof(proxyfs_io_request_t));
+    pthread_t             threads[4];
+    cqueue_producer_t     work[4];
+    proxyfs_io_request_t* reaped[1];
+    mount_handle_t        mh;
+    int                   fd, n, wakeups, i;
+
+    bzero(&mh, sizeof(mh));
+
+    // Starts empty and quiet
+    failed |= (proxyfs_completion_queue_open(count, &fd) != 0);
+    failed |= !cqueue_idle(fd);
+    failed |= (proxyfs_reap_completions(fd, reaped, 0, &n) != 0) || (n != 0);
+
+    // Requests completed from several threads all come back once, in fewer wake-ups than requests
+    // when they pile up, and then it's quiet again
+    for (i = 0; i < count; i++) {
+        reqs[i].done_cb_fd = fd;
+        failed |= (io_req_reserve_completion(&reqs[i]) != 0);
+    }
+    for (i = 0; i < producers; i++) {
+        work[i].reqs  = reqs + i * (count / producers);
+        work[i].count = count / producers;
+        pthread_create(&threads[i], NULL, cqueue_producer, &work[i]);
+    }
+    failed |= (cqueue_reap_all(fd, reqs, count, 64, &wakeups) != 0);
+    for (i = 0; i < producers; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    failed |= (wakeups > count);
+    failed |= !cqueue_idle(fd);
+    failed |= (proxyfs_completion_queue_close(fd) != 0);
+
+    // A small queue takes no more requests than it holds until some are reaped, and isn't closed while
+    // any are left
+    failed |= (proxyfs_completion_queue_open(8, &fd) != 0);
+    for (i = 0; i < 9; i++) {
+        reqs[i].done_cb_fd = fd;
+        failed |= (io_req_reserve_completion(&reqs[i]) != ((i < 8) ? 0 : EAGAIN));
+    }
+    work[0].reqs  = reqs;
+    work[0].count = 8;
+    pthread_create(&threads[0], NULL, cqueue_producer, &work[0]);
+    pthread_join(threads[0], NULL);
+    failed |= (proxyfs_completion_queue_close(fd) != EBUSY);
+    failed |= (io_req_reserve_completion(&reqs[8]) != EAGAIN);
+    failed |= (cqueue_reap_all(fd, reqs, 8, 3, &wakeups) != 0);
+    failed |= (io_req_reserve_completion(&reqs[8]) != 0);
+    io_req_cancel_completion(&reqs[8]);
+    failed |= !cqueue_idle(fd);
+
+    // Closed as soon as the last request is reaped, while the thread that completed it may still be
+    // signaling
+    failed |= (proxyfs_completion_queue_close(fd) != 0);
+    for (i = 0; i < 1000; i++) {
+        failed |= (proxyfs_completion_queue_open(8, &fd) != 0);
+        bzero(&reqs[0], sizeof(reqs[0]));
+        reqs[0].done_cb_fd = fd;
+        failed |= (io_req_reserve_completion(&reqs[0]) != 0);
+        work[0].reqs  = reqs;
+        work[0].count = 1;
+        pthread_create(&threads[0], NULL, cqueue_producer, &work[0]);
+        do {
+            failed |= (proxyfs_reap_completions(fd, reaped, 1, &n) != 0);
+        } while (n == 0);
+        failed |= (proxyfs_completion_queue_close(fd) != 0);
+        pthread_join(threads[0], NULL);
+    }
+    failed |= (proxyfs_completion_queue_open(8, &fd) != 0);
+
+    // A request needs a done_cb or an open queue to be sent
+    bzero(&reqs[0], sizeof(reqs[0]));
+    reqs[0].op           = IO_READ;
+    reqs[0].mount_handle = &mh;
+    reqs[0].done_cb_fd   = fd;
+    failed |= !io_req_has_completion(&reqs[0]);
+    failed |= (proxyfs_completion_queue_close(fd) != 0);
+    failed |= io_req_has_completion(&reqs[0]);
+    failed |= (proxyfs_async_send(&reqs[0]) != EINVAL);
+    failed |= (proxyfs_completion_queue_close(fd) != EBADF);
+    failed |= (proxyfs_reap_completions(fd, reaped, 1, &n) != EBADF);
+
+    // Through the worker pool, against the mock server
+    io_workers_stats_t stats;
+    io_workers_get_stats(&stats);
+    int port = (stats.workers > 0) ? -1 : mock_fastpath_server_start(1);
+    if (port >= 0) {
+        uint8_t* data = (uint8_t*)malloc(256 * IO_WORKERS_BLOCK_SIZE);
+
+        failed |= (proxyfs_completion_queue_open(0, &fd) != 0);
+        io_workers_start("127.0.0.1", port, 4, 4, 0, 0, false);
+        for (i = 0; i < 256; i++) {
+            bzero(&reqs[i], sizeof(reqs[i]));
+            reqs[i].op           = IO_READ;
+            reqs[i].mount_handle = &mh;
+            reqs[i].inode_number = 1 + (i % MOCK_NUM_INODES);
+            reqs[i].offset       = (uint64_t)(i % 64) * IO_WORKERS_BLOCK_SIZE;
+            reqs[i].length       = IO_WORKERS_BLOCK_SIZE;
+            reqs[i].data         = data + (size_t)i * IO_WORKERS_BLOCK_SIZE;
+            reqs[i].done_cb_fd   = fd;
+            failed |= (proxyfs_async_send(&reqs[i]) != 0);
+        }
+        failed |= (cqueue_reap_all(fd, reqs, 256, 64, &wakeups) != 0);
+        for (i = 0; i < 256; i++) {
+            failed |= (reqs[i].error != 0) || (reqs[i].out_size != IO_WORKERS_BLOCK_SIZE);
+        }
+        failed |= (proxyfs_completion_queue_close(fd) != 0);
+        free(data);
+
+        // Several threads sending far more than a small queue holds, retrying when it's full, while it's
+        // reaped a few at a time: everything comes back once, and the workers never wait on the reaper
+        int                senders = 4;
+        int                each    = 1000;
+        cqueue_sender_t    send[4];
+        uint8_t*           blocks  = (uint8_t*)malloc((size_t)senders * each * IO_WORKERS_BLOCK_SIZE);
+        uint64_t           eagain  = 0;
+
+        failed |= (proxyfs_completion_queue_open(16, &fd) != 0);
+        for (i = 0; i < senders * each; i++) {
+            bzero(&reqs[i], sizeof(reqs[i]));
+            reqs[i].op           = IO_READ;
+            reqs[i].mount_handle = &mh;
+            reqs[i].inode_number = 1 + (i % MOCK_NUM_INODES);
+            reqs[i].offset       = (uint64_t)(i % 64) * IO_WORKERS_BLOCK_SIZE;
+            reqs[i].length       = IO_WORKERS_BLOCK_SIZE;
+            reqs[i].data         = blocks + (size_t)i * IO_WORKERS_BLOCK_SIZE;
+            reqs[i].done_cb_fd   = fd;
+        }
+        for (i = 0; i < senders; i++) {
+            send[i].reqs   = reqs + i * each;
+            send[i].count  = each;
+            send[i].eagain = 0;
+            send[i].errors = 0;
+            pthread_create(&threads[i], NULL, cqueue_sender, &send[i]);
+        }
+        failed |= (cqueue_reap_all(fd, reqs, senders * each, 5, &wakeups) != 0);
+        for (i = 0; i < senders; i++) {
+            pthread_join(threads[i], NULL);
+            failed |= (send[i].errors != 0);
+            eagain += send[i].eagain;
+        }
+        for (i = 0; i < senders * each; i++) {
+            failed |= (reqs[i].error != 0) || (reqs[i].out_size != IO_WORKERS_BLOCK_SIZE);
+        }
+        if (eagain == 0) {
+            TLOG("%s: %d requests sent to a queue of 16 were never turned away.\n", funcToTest, senders * each);
+            failed = true;
+        }
+        failed |= !cqueue_idle(fd);
+        failed |= (proxyfs_completion_queue_close(fd) != 0);
+        io_workers_stop();
+        free(blocks);
+    }
+
+    if (failed) {
+        test_failed(funcToTest);
+    } else {
+        test_passed();
+    }
+
+    if (port >= 0) {
+        completion_queue_bench(port, &mh);
+        mock_fastpath_server_stop();
+    }
+    free(reqs);
+}
+
+// io_uring engine
+
+// Send a request for every block, block i being at (i / MOCK_NUM_INODES) blocks into inode
+// 1 + i % MOCK_NUM_INODES, through proxyfs_async_send, and wait for them all; returns the number that failed
+int io_uring_run(mount_handle_t* mh, io_op_t op, tagged_io_t* ios, uint8_t* data, int count, tagged_io_state_t* state)
+{
+    int i;
+
+    state->outstanding  = count;
+    state->errors       = 0;
+    state->completed    = 0;
+    state->out_of_order = 0;
+
+    for (i = 0; i < count; i++) {
+        ios[i].state = state;
+        ios[i].index = i;
+        bzero(&ios[i].req, sizeof(ios[i].req));
+        ios[i].req.op           = op;
+        ios[i].req.mount_handle = mh;
+        ios[i].req.inode_number = 1 + (i % MOCK_NUM_INODES);
+        ios[i].req.offset       = (uint64_t)(i / MOCK_NUM_INODES) * IO_WORKERS_BLOCK_SIZE;
+        ios[i].req.length       = IO_WORKERS_BLOCK_SIZE;
+        ios[i].req.data         = data + (size_t)i * IO_WORKERS_BLOCK_SIZE;
+        ios[i].req.done_cb      = tagged_io_callback;
+        ios[i].req.done_cb_arg  = &ios[i];
+
+        int err = proxyfs_async_send(&ios[i].req);
+        if (err != 0) {
+            TLOG("io_uring: submit of block %d failed, err=%d.\n", i, err);
+            pthread_mutex_lock(&state->lock);
+            state->outstanding--;
+            state->errors++;
+            pthread_mutex_unlock(&state->lock);
+        }
+    }
+
+    pthread_mutex_lock(&state->lock);
+    while (state->outstanding > 0) {
+        pthread_cond_wait(&state->cv, &state->lock);
+    }
+    pthread_mutex_unlock(&state->lock);
+
+    return state->errors;
+}
+
+void io_uring_single_callback(proxyfs_io_request_t* req)
+{
+    tagged_io_state_t* state = (tagged_io_state_t*)req->done_cb_arg;
+
+    pthread_mutex_lock(&state->lock);
+    state->outstanding--;
+    pthread_cond_signal(&state->cv);
+    pthread_mutex_unlock(&state->lock);
+}
+
+// Send one request and wait for it, leaving its result in req
+int io_uring_single(proxyfs_io_request_t* req, mount_handle_t* mh, io_op_t op, uint64_t offset, uint64_t length,
+                    uint8_t* data, tagged_io_state_t* state)
+{
+    bzero(req, sizeof(*req));
+    req->op           = op;
+    req->mount_handle = mh;
+    req->inode_number = 1;
+    req->offset       = offset;
+    req->length       = length;
+    req->data         = data;
+    req->done_cb      = io_uring_single_callback;
+    req->done_cb_arg  = state;
+
+    state->outstanding = 1;
+    int err = proxyfs_async_send(req);
+    if (err != 0) {
+        return err;
+    }
+
+    pthread_mutex_lock(&state->lock);
+    while (state->outstanding > 0) {
+        pthread_cond_wait(&state->cv, &state->lock);
+    }
+    pthread_mutex_unlock(&state->lock);
+    return 0;
+}
+
+// Benchmark: the same bursts of reads through the worker pool and the io_uring engine, with as many
+// requests in flight in each; CPU time is the whole process's, the mock server's included
+void io_uring_bench(int port, mount_handle_t* mh, tagged_io_state_t* state)
+{
+    int          count  = 1024;
+    int          rounds = 8;
+    tagged_io_t* ios    = (tagged_io_t*)malloc(sizeof(tagged_io_t) * count);
+    uint8_t*     data   = (uint8_t*)malloc((size_t)count * IO_WORKERS_BLOCK_SIZE);
+    int          inflight, engine, round;
+
+    if (!silent) {
+        printf("  %d bursts of %d 4 KiB reads:\n", rounds, count);
+    }
+    for (inflight = 8; inflight <= 64; inflight *= 8) {
+        for (engine = 0; engine < 2; engine++) {
+            int errors = 0;
+
+            if (engine == 0) {
+                io_workers_start("127.0.0.1", port, inflight, inflight, 0, 1, false);
+            } else if (uring_start("127.0.0.1", port, 2, inflight / 2) != 0) {
+                break;
+            }
+
+            struct rusage before, after;
+            getrusage(RUSAGE_SELF, &before);
+            int64_t start_ns = registry_now_ns();
+            for (round = 0; round < rounds; round++) {
+                errors += io_uring_run(mh, IO_READ, ios, data, count, state);
+            }
+            int64_t run_ns = registry_now_ns() - start_ns;
+            getrusage(RUSAGE_SELF, &after);
+
+            uring_stats_t stats;
+            uring_get_stats(&stats);
+            if (engine == 0) {
+                io_workers_stop();
+            } else {
+                uring_stop();
+            }
+
+            if (!silent) {
+                int64_t cpu_us = (after.ru_utime.tv_sec - before.ru_utime.tv_sec) * 1000000 +
+                                 (after.ru_utime.tv_usec - before.ru_utime.tv_usec) +
+                                 (after.ru_stime.tv_sec - before.ru_stime.tv_sec) * 1000000 +
+                                 (after.ru_stime.tv_usec - before.ru_stime.tv_usec);
+                printf("    %2d in flight, %-22s %7.3f Mreads/s, %6.2f CPU us/read",
+                       inflight, (engine == 0) ? "worker pool:" : "io_uring (2 threads):",
+                       (double)rounds * count * 1000 / run_ns, (double)cpu_us / (rounds * count));
+                if (engine == 1) {
+                    printf(", %4.2f io_uring_enter()/read", (double)stats.enters / (rounds * count));
+                }
+                printf("%s\n", (errors > 0) ? " (errors)" : "");
+            }
+        }
+    }
+
+    free(ios);
+    free(data);
+}
+
+void io_uring_tests()
+{
+    char*                funcToTest = "io_uring engine";
+    int                  count      = 16 * MOCK_NUM_INODES;
+    tagged_io_t*         ios        = (tagged_io_t*)malloc(sizeof(tagged_io_t) * count);
+    uint8_t*             data       = (uint8_t*)malloc((size_t)count * IO_WORKERS_BLOCK_SIZE);
+    uint8_t*             big        = (uint8_t*)malloc(MOCK_FILE_SIZE);
+    mount_handle_t       mh;
+    tagged_io_state_t    state;
+    io_workers_stats_t   pool;
+    uring_stats_t        stats;
+    proxyfs_io_request_t req;
+    bool                 failed     = false;
+    int                  i;
+
+    // Only one pool per process; don't take over one a mount is using
+    io_workers_get_stats(&pool);
+    if ((pool.workers > 0) || uring_enabled() || fastpath_enabled()) {
+        TLOG("Skipping %s tests, async I/O is already running.\n", funcToTest);
+        return;
+    }
+
+    bzero(&mh, sizeof(mh));
+    pthread_mutex_init(&state.lock, NULL);
+    pthread_cond_init(&state.cv, NULL);
+
+    // Without io_uring it can't start, and async I/O is left to the pool
+    uring_test_disable(true);
+    failed |= (uring_start("127.0.0.1", 1, 2, 4) != ENOSYS);
+    failed |= uring_enabled();
+    uring_test_disable(false);
+
+    int port = mock_fastpath_server_start(1);
+    if (port < 0) {
+        TLOG("%s: failed to start mock server.\n", funcToTest);
+        test_failed(funcToTest);
+        return;
+    }
+
+    int ret = uring_start("127.0.0.1", port, 2, 4);
+    if (ret == ENOSYS) {
+        TLOG("%s: io_uring isn't available here, only the fallback was tested.\n", funcToTest);
+        mock_fastpath_server_stop();
+        if (failed) {
+            test_failed(funcToTest);
+        } else {
+            test_passed();
+        }
+        return;
+    }
+    failed |= (ret != 0) || !uring_enabled();
+
+    // Blocks written through the engine read back the same
+    for (i = 0; i < count; i++) {
+        tagged_io_fill(data + (size_t)i * IO_WORKERS_BLOCK_SIZE, i);
+    }
+    failed |= (io_uring_run(&mh, IO_WRITE, ios, data, count, &state) != 0);
+    bzero(data, (size_t)count * IO_WORKERS_BLOCK_SIZE);
+    failed |= (io_uring_run(&mh, IO_READ, ios, data, count, &state) != 0);
+    for (i = 0; i < count; i++) {
+        uint8_t expect[IO_WORKERS_BLOCK_SIZE];
+        tagged_io_fill(expect, i);
+        failed |= (memcmp(data + (size_t)i * IO_WORKERS_BLOCK_SIZE, expect, IO_WORKERS_BLOCK_SIZE) != 0);
+    }
+    uring_get_stats(&stats);
+    failed |= (stats.requests != 2 * count) || (stats.sqes < 4 * count);
+    failed |= (stats.connections < 1) || (stats.connections > 8);
+
+    // Segments, split differently each way
+    struct iovec iov[16];
+    uint8_t      vec_out[10000];
+    uint8_t      vec_in[10000];
+    for (i = 0; i < (int)sizeof(vec_out); i++) {
+        vec_out[i] = (uint8_t)(i * 7 + 3);
+    }
+    bzero(vec_in, sizeof(vec_in));
+    int iovcnt = vectored_io_split(vec_out, sizeof(vec_out), iov, 16, 5);
+    failed |= (vectored_io_async(&mh, IO_WRITE, 12345, iov, iovcnt, sizeof(vec_out), &state) != 0);
+    iovcnt = vectored_io_split(vec_in, sizeof(vec_in), iov, 9, 11);
+    failed |= (vectored_io_async(&mh, IO_READ, 12345, iov, iovcnt, sizeof(vec_in), &state) != 0);
+    failed |= (memcmp(vec_in, vec_out, sizeof(vec_out)) != 0);
+
+    // A whole file each way, more than one send or receive can move
+    for (i = 0; i < MOCK_FILE_SIZE; i++) {
+        big[i] = (uint8_t)(i * 13 + 1);
+    }
+    failed |= (io_uring_single(&req, &mh, IO_WRITE, 0, MOCK_FILE_SIZE, big, &state) != 0);
+    failed |= (req.error != 0) || (req.out_size != MOCK_FILE_SIZE);
+    bzero(big, MOCK_FILE_SIZE);
+    failed |= (io_uring_single(&req, &mh, IO_READ, 0, MOCK_FILE_SIZE, big, &state) != 0);
+    failed |= (req.error != 0) || (req.out_size != MOCK_FILE_SIZE);
+    for (i = 0; i < MOCK_FILE_SIZE; i++) {
+        if (big[i] != (uint8_t)(i * 13 + 1)) {
+            failed = true;
+            break;
+        }
+    }
+
+    // Short and empty reads at the end of the file, a write past it and one of nothing
+    failed |= (io_uring_single(&req, &mh, IO_READ, MOCK_FILE_SIZE - 1000, 4096, big, &state) != 0);
+    failed |= (req.error != 0) || (req.out_size != 1000);
+    failed |= (io_uring_single(&req, &mh, IO_READ, MOCK_FILE_SIZE, 4096, big, &state) != 0);
+    failed |= (req.error != 0) || (req.out_size != 0);
+    failed |= (io_uring_single(&req, &mh, IO_WRITE, MOCK_FILE_SIZE, 4096, big, &state) != 0);
+    failed |= (req.error != EFBIG) || (req.out_size != 0);
+    failed |= (io_uring_single(&req, &mh, IO_WRITE, 0, 0, big, &state) != 0);
+    failed |= (req.error != 0) || (req.out_size != 0);
+
+    // Only reads and writes
+    bzero(&req, sizeof(req));
+    req.op           = IO_FLUSH;
+    req.mount_handle = &mh;
+    req.data         = big;
+    req.done_cb      = io_uring_single_callback;
+    failed |= (uring_submit(&req) != EINVAL);
+
+    // Completed onto a completion queue
+    int cq_fd;
+    failed |= (proxyfs_completion_queue_open(0, &cq_fd) != 0);
+    for (i = 0; i < count; i++) {
+        bzero(&ios[i].req, sizeof(ios[i].req));
+        ios[i].req.op           = IO_READ;
+        ios[i].req.mount_handle = &mh;
+        ios[i].req.inode_number = 1 + (i % MOCK_NUM_INODES);
+        ios[i].req.length       = IO_WORKERS_BLOCK_SIZE;
+        ios[i].req.data         = data + (size_t)i * IO_WORKERS_BLOCK_SIZE;
+        ios[i].req.done_cb_fd   = cq_fd;
+        failed |= (proxyfs_async_send(&ios[i].req) != 0);
+    }
+    int got = 0;
+    while (got < count) {
+        proxyfs_io_request_t* reaped[64];
+        struct pollfd         pfd = { .fd = cq_fd, .events = POLLIN };
+        int                   n;
+        if (poll(&pfd, 1, 5000) != 1) {
+            failed = true;
+            break;
+        }
+        do {
+            failed |= (proxyfs_reap_completions(cq_fd, reaped, 64, &n) != 0);
+            for (i = 0; i < n; i++) {
+                failed |= (reaped[i]->error != 0) || (reaped[i]->out_size != IO_WORKERS_BLOCK_SIZE);
+            }
+            got += n;
+        } while (n == 64);
+    }
+    failed |= (proxyfs_completion_queue_close(cq_fd) != 0);
+
+    uring_stop();
+    failed |= uring_enabled();
+    uring_get_stats(&stats);
+    failed |= (stats.threads != 0);
+
+    io_uring_bench(port, &mh, &state);
+
+    // With its only thread held up in a completion callback, the queue fills and further requests are
+    // turned away rather than left waiting for room
+    io_workers_hold_t    hold;
+    proxyfs_io_request_t hold_req;
+    int                  max_queued = 2 * 4096;
+    int                  accepted;
+    int                  err        = 0;
+    tagged_io_t*         queued     = (tagged_io_t*)malloc(max_queued * sizeof(tagged_io_t));
+
+    pthread_mutex_init(&hold.lock, NULL);
+    pthread_cond_init(&hold.cv, NULL);
+    hold.holding = false;
+    hold.release = false;
+    bzero(&hold_req, sizeof(hold_req));
+    hold_req.op           = IO_READ;
+    hold_req.mount_handle = &mh;
+    hold_req.inode_number = 1;
+    hold_req.length       = IO_WORKERS_BLOCK_SIZE;
+    hold_req.data         = big;
+    hold_req.done_cb      = io_workers_hold_callback;
+    hold_req.done_cb_arg  = &hold;
+
+    failed |= (uring_start("127.0.0.1", port, 1, 1) != 0);
+    failed |= (uring_submit(&hold_req) != 0);
+    pthread_mutex_lock(&hold.lock);
+    while (!hold.holding) {
+        pthread_cond_wait(&hold.cv, &hold.lock);
+    }
+    pthread_mutex_unlock(&hold.lock);
+
+    state.outstanding = 0;
+    state.errors      = 0;
+    for (accepted = 0; accepted < max_queued; accepted++) {
+        bzero(&queued[accepted].req, sizeof(queued[accepted].req));
+        queued[accepted].state            = &state;
+        queued[accepted].index            = accepted;
+        queued[accepted].req.op           = IO_READ;
+        queued[accepted].req.mount_handle = &mh;
+        queued[accepted].req.inode_number = 1;
+        queued[accepted].req.length       = IO_WORKERS_BLOCK_SIZE;
+        queued[accepted].req.data         = big;
+        queued[accepted].req.done_cb      = tagged_io_callback;
+        queued[accepted].req.done_cb_arg  = &queued[accepted];
+        err = uring_submit(&queued[accepted].req);
+        if (err != 0) {
+            break;
+        }
+    }
+    if ((err != EAGAIN) || (accepted == 0)) {
+        TLOG("%s: queueing to a full engine returned %d after %d requests, expected EAGAIN.\n", funcToTest,
+             err, accepted);
+        failed = true;
+    }
+
+    pthread_mutex_lock(&state.lock);
+    state.outstanding = accepted;
+    pthread_mutex_unlock(&state.lock);
+    io_workers_release(&hold);
+    io_workers_wait_done(&state);
+    failed |= (state.errors != 0);
+    uring_stop();
+    pthread_cond_destroy(&hold.cv);
+    pthread_mutex_destroy(&hold.lock);
+    free(queued);
+
+    // A server that goes away fails what's in flight and what comes after
+    failed |= (uring_start("127.0.0.1", port, 1, 2) != 0);
+    failed |= (io_uring_single(&req, &mh, IO_READ, 0, 4096, big, &state) != 0);
+    failed |= (req.error != 0);
+    mock_fastpath_server_stop();
+    failed |= (io_uring_single(&req, &mh, IO_READ, 0, 4096, big, &state) != 0);
+    failed |= (req.error != EIO);
+    failed |= (io_uring_single(&req, &mh, IO_WRITE, 0, 4096, big, &state) != 0);
+    failed |= (req.error != EIO);
+    uring_stop();
+
+    if (failed) {
+        test_failed(funcToTest);
+    } else {
+        test_passed();
+    }
+
+    pthread_mutex_destroy(&state.lock);
+    pthread_cond_destroy(&state.cv);
+    free(ios);
+    free(data);
+    free(big);
+}
+
+// Response threads started, by the stand-in that the tests have them run
+static uint32_t rpc_pool_threads_started = 0;
+
+void* rpc_pool_counted_thread(void* not_used)
+{
+    __atomic_add_fetch(&rpc_pool_threads_started, 1, __ATOMIC_SEQ_CST);
+    return NULL;
+}
+
+typedef struct {
+    pthread_barrier_t* start;
+    int                rc;
+} rpc_pool_starter_t;
+
+void* rpc_pool_starter(void* arg)
+{
+    rpc_pool_starter_t* starter = (rpc_pool_starter_t*)arg;
+
+    pthread_barrier_wait(starter->start);
+    starter->rc = rpc_schedule_resp_work(0);
+    return NULL;
+}
+
+// The first requests, sent from several threads at once, start the response threads exactly once
+bool rpc_pool_lazy_start_tests(char* funcToTest)
+{
+    int                num_starters = 8;
+    int                rounds       = 200;
+    bool               failed       = false;
+    pthread_t          threads[num_starters];
+    rpc_pool_starter_t starters[num_starters];
+    pthread_barrier_t  start;
+    int                round;
+    int                i;
+
+    rpc_config_set_response_threads(3);
+    uint32_t per_start = (uint32_t)rpc_response_thread_count();
+
+    jsonrpc_test_set_response_thread(rpc_pool_counted_thread);
+    bool was_running = jsonrpc_test_set_response_threads_running(false);
+    __atomic_store_n(&rpc_pool_threads_started, 0, __ATOMIC_SEQ_CST);
+
+    pthread_barrier_init(&start, NULL, num_starters);
+    for (round = 0; (round < rounds) && !failed; round++) {
+        jsonrpc_test_set_response_threads_running(false);
+        for (i = 0; i < num_starters; i++) {
+            starters[i].start = &start;
+            starters[i].rc    = -1;
+            pthread_create(&threads[i], NULL, rpc_pool_starter, &starters[i]);
+        }
+        for (i = 0; i < num_starters; i++) {
+            pthread_join(threads[i], NULL);
+            if (starters[i].rc != 0) {
+                TLOG("%s: round %d starter %d got %d.\n", funcToTest, round, i, starters[i].rc);
+                failed = true;
+            }
+        }
+    }
+    pthread_barrier_destroy(&start);
+
+    // The threads are detached, so give the last ones a moment to run
+    uint32_t expected = per_start * round;
+    int64_t  deadline = registry_now_ns() + 5000000000LL;
+    while ((__atomic_load_n(&rpc_pool_threads_started, __ATOMIC_SEQ_CST) < expected) &&
+           (registry_now_ns() < deadline)) {
+        usleep(1000);
+    }
+    usleep(10000);
+    uint32_t started = __atomic_load_n(&rpc_pool_threads_started, __ATOMIC_SEQ_CST);
+    if (started != expected) {
+        TLOG("%s: %u response threads started in %d rounds of %u, expected %u.\n",
+             funcToTest, started, round, per_start, expected);
+        failed = true;
+    }
+
+    // Once started, nothing more is
+    if (rpc_schedule_resp_work(0) != 0) {
+        failed = true;
+    }
+    usleep(10000);
+    if (__atomic_load_n(&rpc_pool_threads_started, __ATOMIC_SEQ_CST) != expected) {
+        TLOG("%s: response threads started again once running.\n", funcToTest);
+        failed = true;
+    }
+
+    jsonrpc_test_set_response_thread(NULL);
+    jsonrpc_test_set_response_threads_running(was_running);
+    rpc_config_set_response_threads(0);
+
+    return !failed;
+}
+
+typedef struct {
+    sock_pool_t* pool;
+    int          fd;
+    uint64_t     generation;
+    bool         done;
+} rpc_pool_op_t;
+
+void* rpc_pool_get_thread(void* arg)
+{
+    rpc_pool_op_t* op = (rpc_pool_op_t*)arg;
+
+    op->fd = sock_pool_get(op->pool, &op->generation);
+    __atomic_store_n(&op->done, true, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+void* rpc_pool_badfd_thread(void* arg)
+{
+    rpc_pool_op_t* op = (rpc_pool_op_t*)arg;
+
+    sock_pool_put_badfd(op->pool, op->fd, op->generation);
+    __atomic_store_n(&op->done, true, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+// Wait up to timeout_ms for op to finish
+bool rpc_pool_op_wait(rpc_pool_op_t* op, int timeout_ms)
+{
+    int64_t deadline = registry_now_ns() + (int64_t)timeout_ms * 1000000;
+
+    while (!__atomic_load_n(&op->done, __ATOMIC_ACQUIRE)) {
+        if (registry_now_ns() >= deadline) {
+            return false;
+        }
+        usleep(1000);
+    }
+    return true;
+}
+
+// Slots in each connection's window, and a connection breaking with requests outstanding on all of them
+bool rpc_pool_window_tests(char* funcToTest, int port)
+{
+    int           count  = 2;
+    int           window = 3;
+    int           fds[count * window];
+    uint64_t      gens[count * window];
+    rpc_pool_op_t op;
+    pthread_t     thread;
+    bool          failed = false;
+    int           i;
+
+    sock_pool_t* pool = sock_pool_create("127.0.0.1", port, count, window);
+    if (pool == NULL) {
+        TLOG("%s: sock_pool_create failed, errno=%d.\n", funcToTest, errno);
+        return false;
+    }
+
+    // Requests are spread over the connections until every window is full
+    for (i = 0; i < count * window; i++) {
+        fds[i] = sock_pool_get(pool, &gens[i]);
+        failed |= (fds[i] < 0) || (gens[i] != gens[0]);
+    }
+    for (i = 0; i < count; i++) {
+        if (pool->conns[i].inflight != window) {
+            TLOG("%s: connection %d has %d requests in flight, expected %d.\n",
+                 funcToTest, i, pool->conns[i].inflight, window);
+            failed = true;
+        }
+    }
+    failed |= (pool->available_count != 0);
+
+    // The next one waits for a response to free a slot, and gets that one
+    bzero(&op, sizeof(op));
+    op.pool = pool;
+    pthread_create(&thread, NULL, rpc_pool_get_thread, &op);
+    usleep(50000);
+    if (__atomic_load_n(&op.done, __ATOMIC_ACQUIRE)) {
+        TLOG("%s: got a slot with every window full.\n", funcToTest);
+        failed = true;
+    }
+    sock_pool_put(pool, fds[0], gens[0]);
+    if (!rpc_pool_op_wait(&op, 5000)) {
+        TLOG("%s: a freed slot didn't wake the waiter.\n", funcToTest);
+        return false;
+    }
+    pthread_join(thread, NULL);
+    failed |= (op.fd != fds[0]) || (op.generation != gens[0]);
+
+    // A broken connection closes them all at once, without waiting for the
+    // responses to the requests outstanding on them
+    bzero(&op, sizeof(op));
+    op.pool       = pool;
+    op.fd         = fds[1];
+    op.generation = gens[1];
+    pthread_create(&thread, NULL, rpc_pool_badfd_thread, &op);
+    if (!rpc_pool_op_wait(&op, 5000)) {
+        TLOG("%s: sock_pool_put_badfd waited for the requests outstanding.\n", funcToTest);
+        return false;
+    }
+    pthread_join(thread, NULL);
+    if ((pool->available_count != count * window) || (sock_pool_generation(pool) != gens[0] + 1) ||
+        (pool->conns[0].fd >= 0) || (pool->conns[1].fd >= 0)) {
+        TLOG("%s: after a bad fd, %d slots free in generation %" PRIu64 ".\n",
+             funcToTest, pool->available_count, sock_pool_generation(pool));
+        failed = true;
+    }
+
+    // The sockets are opened again for the next request. A second report
+    // of the breakage, and the slots of the requests lost with it, are
+    // recognized as old even if the new sockets reuse the fds.
+    uint64_t gen;
+    int      fd = sock_pool_get(pool, &gen);
+    failed |= (fd < 0) || (gen != gens[0] + 1);
+    sock_pool_put_badfd(pool, fds[2], gens[2]);
+    for (i = 1; i < count * window; i++) {
+        sock_pool_put(pool, fds[i], gens[i]);
+    }
+    if ((sock_pool_generation(pool) != gen) || (pool->conns[0].fd < 0) ||
+        (pool->available_count != count * window - 1)) {
+        TLOG("%s: old slots changed the reopened pool.\n", funcToTest);
+        failed = true;
+    }
+    errno = 0;
+    if ((sock_pool_send(pool, fds[0], gens[0], "{}\n", 3) == 0) || ((errno != EPIPE) && (errno != EBADF))) {
+        TLOG("%s: sent on an old slot, errno=%d.\n", funcToTest, errno);
+        failed = true;
+    }
+    sock_pool_put(pool, fd, gen);
+
+    failed |= (sock_pool_destroy(pool, false) != 0);
+
+    return !failed;
+}
+
+// A pool reset by a failure on another connection, while a receiver is draining one of its sockets
+static rpc_pool_op_t rpc_pool_reset_op;
+
+void rpc_pool_reset_hook(int sockfd)
+{
+    rpc_pool_op_t* op = &rpc_pool_reset_op;
+    pthread_t      thread;
+
+    // The reset bumps the generation and shuts the sockets down, then waits for our rx_lock
+    pthread_create(&thread, NULL, rpc_pool_badfd_thread, op);
+    pthread_detach(thread);
+    while (__atomic_load_n(&op->pool->generation, __ATOMIC_ACQUIRE) == op->generation) {
+        usleep(1000);
+    }
+    usleep(50000);
+}
+
+bool rpc_pool_reset_tests(char* funcToTest, int port)
+{
+    sock_pool_t* saved  = global_sock_pool;
+    bool         failed = false;
+    char*        buf    = NULL;
+    int          err    = 0;
+    uint64_t     gen;
+
+    sock_pool_t* pool = sock_pool_create("127.0.0.1", port, 2, 2);
+    if (pool == NULL) {
+        TLOG("%s: sock_pool_create failed, errno=%d.\n", funcToTest, errno);
+        return false;
+    }
+    global_sock_pool = pool;
+
+    // Slots on both connections, the second one to report broken
+    int fd    = sock_pool_get(pool, &gen);
+    int other = sock_pool_get(pool, &gen);
+    bzero(&rpc_pool_reset_op, sizeof(rpc_pool_reset_op));
+    rpc_pool_reset_op.pool       = pool;
+    rpc_pool_reset_op.fd         = other;
+    rpc_pool_reset_op.generation = gen;
+
+    // The receiver's socket ends under it, which is no error of its own
+    sock_test_set_read_hook(rpc_pool_reset_hook);
+    int bytes = sock_read(fd, &buf, &err, &gen);
+    sock_test_set_read_hook(NULL);
+    if ((bytes != 0) || (err != 0) || (buf != NULL)) {
+        TLOG("%s: reading a socket the pool reset returned %d, error %d.\n", funcToTest, bytes, err);
+        failed = true;
+    }
+    if (!rpc_pool_op_wait(&rpc_pool_reset_op, 5000)) {
+        TLOG("%s: the reset didn't finish.\n", funcToTest);
+        return false;
+    }
+    failed |= (sock_pool_generation(pool) != gen + 1);
+
+    global_sock_pool = saved;
+    failed |= (sock_pool_destroy(pool, false) != 0);
+    return !failed;
+}
+
+typedef struct {
+    jsonrpc_context_t** ctxs;
+    bool*               taken;
+    int                 count;
+    pthread_barrier_t*  start;
+} rpc_pool_receiver_t;
+
+// Stands in for a receiver thread answering requests
+void* rpc_pool_receiver(void* arg)
+{
+    rpc_pool_receiver_t* receiver = (rpc_pool_receiver_t*)arg;
+    int                  i;
+
+    pthread_barrier_wait(receiver->start);
+    for (i = 0; i < receiver->count; i++) {
+        jsonrpc_context_t* ctx = jsonrpc_take_request_by_id(jsonrpc_test_req_id(receiver->ctxs[i]));
+        if (ctx != NULL) {
+            receiver->taken[i] = true;
+            jsonrpc_unblock_for_response(ctx);
+        }
+    }
+    return NULL;
+}
+
+void* rpc_pool_waiter(void* arg)
+{
+    jsonrpc_context_t* ctx = (jsonrpc_context_t*)arg;
+
+    return (void*)(intptr_t)jsonrpc_wait_for_response(ctx);
+}
+
+// Requests lost with the sockets they were sent on are failed, each exactly once
+bool rpc_pool_fail_tests(char* funcToTest)
+{
+    uint64_t           base_id  = 0x7000000000000000ULL;
+    int                base     = jsonrpc_num_requests();
+    bool               failed   = false;
+    jsonrpc_context_t* lost     = jsonrpc_test_ctx_create(base_id + 1, NULL);
+    jsonrpc_context_t* current  = jsonrpc_test_ctx_create(base_id + 2, NULL);
+    jsonrpc_context_t* unsent   = jsonrpc_test_ctx_create(base_id + 3, NULL);
+    pthread_t          thread;
+    void*              rc;
+    int                i;
+
+    jsonrpc_test_ctx_set_sent(lost, 1);
+    jsonrpc_test_ctx_set_sent(current, 2);
+    jsonrpc_store_request(lost);
+    jsonrpc_store_request(current);
+    jsonrpc_store_request(unsent);
+
+    pthread_create(&thread, NULL, rpc_pool_waiter, lost);
+    if (jsonrpc_fail_requests(2, EIO) != 1) {
+        TLOG("%s: failed other than the one lost request.\n", funcToTest);
+        failed = true;
+    }
+    pthread_join(thread, &rc);
+    if ((intptr_t)rc != EIO) {
+        TLOG("%s: lost request returned %d.\n", funcToTest, (int)(intptr_t)rc);
+        failed = true;
+    }
+    failed |= (jsonrpc_get_request_by_id(base_id + 1) != NULL);
+    failed |= (jsonrpc_get_request_by_id(base_id + 2) != current);
+    failed |= (jsonrpc_get_request_by_id(base_id + 3) != unsent);
+    failed |= !jsonrpc_remove_request(current) || !jsonrpc_remove_request(unsent);
+    jsonrpc_test_ctx_destroy(lost);
+    jsonrpc_test_ctx_destroy(current);
+    jsonrpc_test_ctx_destroy(unsent);
+
+    // Responses being taken while the sockets are reset: every request is
+    // completed by one or the other
+    int                 count = 4000;
+    jsonrpc_context_t** ctxs  = (jsonrpc_context_t**)malloc(count * sizeof(jsonrpc_context_t*));
+    bool*               taken = (bool*)calloc(count, sizeof(bool));
+    pthread_barrier_t   start;
+    rpc_pool_receiver_t receiver = { ctxs, taken, count, &start };
+
+    for (i = 0; i < count; i++) {
+        ctxs[i] = jsonrpc_test_ctx_create(base_id + 100 + i, NULL);
+        jsonrpc_test_ctx_set_sent(ctxs[i], 1);
+        jsonrpc_store_request(ctxs[i]);
+    }
+    pthread_barrier_init(&start, NULL, 2);
+    pthread_create(&thread, NULL, rpc_pool_receiver, &receiver);
+    pthread_barrier_wait(&start);
+    int num_failed = jsonrpc_fail_requests(2, EIO);
+    pthread_join(thread, NULL);
+    pthread_barrier_destroy(&start);
+
+    int num_taken = 0;
+    for (i = 0; i < count; i++) {
+        int err = jsonrpc_wait_for_response(ctxs[i]);
+        if (taken[i]) {
+            num_taken++;
+        }
+        if (err != (taken[i] ? 0 : EIO)) {
+            failed = true;
+        }
+        jsonrpc_test_ctx_destroy(ctxs[i]);
+    }
+    if ((num_taken + num_failed != count) || (jsonrpc_num_requests() != base)) {
+        TLOG("%s: %d of %d requests answered and %d failed, %d left.\n",
+             funcToTest, num_taken, count, num_failed, jsonrpc_num_requests() - base);
+        failed = true;
+    }
+    free(ctxs);
+    free(taken);
+
+    return !failed;
+}
+
+void rpc_pool_tests()
+{
+    char* funcToTest = "rpc pool";
+    bool  failed     = false;
+
+    failed |= !rpc_pool_lazy_start_tests(funcToTest);
+
+    int port = mock_fastpath_server_start(0);
+    if (port < 0) {
+        TLOG("%s: failed to start mock server.\n", funcToTest);
+        failed = true;
+    } else {
+        failed |= !rpc_pool_window_tests(funcToTest, port);
+        failed |= !rpc_pool_reset_tests(funcToTest, port);
+        mock_fastpath_server_stop();
+    }
+    failed |= !rpc_pool_fail_tests(funcToTest);
+
+    if (failed) {
+        test_failed(funcToTest);
+    } else {
+        test_passed();
+    }
+}
+
+// XXX TODO - Tests to be added:
+//
+// + 65M read/write
+// + truncate tests (both when not yet flushed and when flushed)
+// + read beyond end of file
+// + write causing holes
+
+void print_usage() {
+    printf("Run ProxyFS RPC client-side tests.\n\n");
+    printf("Usage: test [-h|-v|-s|-r <JSON:RPC/tuple>|-t <test_name>]\n");
+    printf("       When called with no parameters, the entire suite of tests is run.\n");
+    printf("       -h: print this message.\n");
+    printf("       -v: verbose mode; more test output.\n");
+    printf("       -s: silent mode; no test output. Intended for performance testing.\n");
+    printf("       -r: specify JSON RPC server info as <ipaddr>:<port>/<fast_port> to use.\n");
+    printf("       -p: print the tests that will be run\n");
+    printf("       -t: run a subset of tests, intended to reproduce specific issues.\n");
+    printf("           Test subsets supported are:\n");
+    printf("            4kread\n");
+    printf("            65kread\n");
+    printf("            read-past-eof\n");
+    printf("            syslog-write\n");
+    printf("            mount\n");
+    printf("            chown\n");
+    printf("            mkdir\n");
+    printf("            readdir\n");
+    printf("            async\n");
+    printf("            parallel\n");
+    printf("            statvfs\n");
+    printf("            fake_hang\n");
+    printf("            registry (client-side only; -r not needed)\n");
+    printf("            tagged (client-side only, against a mock server; -r not needed)\n");
+    printf("            vectored (client-side only, against a mock server; -r not needed)\n");
+    printf("            iobench (client-side only, against a mock server; -r not needed)\n");
+    printf("            attrcache (client-side only; -r not needed)\n");
+    printf("            dentrycache (client-side only; -r not needed)\n");
+    printf("            pathwalk (client-side only; -r not needed)\n");
+    printf("            dirstream (client-side only, against a mock server; -r not needed, runs only without server tests)\n");
+    printf("            reqwriter (client-side only; -r not needed)\n");
+    printf("            respparse (client-side only; -r not needed)\n");
+    printf("            base64 (client-side only; -r not needed)\n");
+    printf("            ctxpool (client-side only; -r not needed)\n");
+    printf("            completion (client-side only; -r not needed)\n");
+    printf("            ioqueue (client-side only; -r not needed)\n");
+    printf("            ioworkers (client-side only, against a mock server; -r not needed)\n");
+    printf("            iomerge (client-side only, against a mock server; -r not needed)\n");
+    printf("            iosched (client-side only, against a mock server; -r not needed)\n");
+    printf("            cqueue (client-side only, against a mock server; -r not needed)\n");
+    printf("            iouring (client-side only, against a mock server; -r not needed)\n");
+    printf("            rpcpool (client-side only; -r not needed)\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int c = 0;
+    char* tvalue = NULL;
+    opterr = 0;
+    bool testsSuiteAborted    = false;
+    bool fakeHang             = false;
+    bool rpc_config_specified = false;
+    bool print_tests = false;
+
+    // See if the caller passed in any flags
+    while ((c = getopt(argc, argv, "hvspr:t:")) != -1) {
+        switch (c)
+        {
+            case 'h':
+                print_usage();
+                return 0;
+                break;
+            case 'v':
+                // Caller wants debug prints from proxyfs code
+                quiet = false;
+                break;
+            case 's':
+                // Caller silent mode, no prints at all
+                silent = true;
+                quiet  = true;
+                disable_fault_prints();
+                break;
+            case 'r':
+                // Caller specified JSON:RPC/tuple (as required)
+                rpc_config_parse(optarg);
+                rpc_config_specified = true;
+                break;
+            case 'p':
+                print_tests = true;
+                break;
+            case 't':
+                // Caller wants to run a specific test
+                //
+                tvalue = optarg;
+
+                if (strcmp(tvalue,"4kread") == 0) {
+                    enableTest(WRITEREAD4K_TEST);
+
+                    // Disable some of the other tests to get to the one we want quicker
+                    disableTest(ERROR_TESTS);
+                    disableTest(LOOKUP_TESTS);
+                    disableTest(READSYMLINK_TESTS);
+                    disableTest(READDIR_TESTS);
+                    disableTest(STATSIZE_TESTS);
+
+                } else if ((strcmp(tvalue,"65kread") == 0) || (strcmp(tvalue,"parallel") == 0)) {
+                    disableAllTests();
+
+                    enableTest(MOUNT_TESTS);
+                    enableTest(WRITEREAD65K_TEST);
+                    enableTest(MKDIRCREATE_TESTS);
+                    enableTest(UNLINKRMDIR_TESTS);
+
+                    disable_all_files();
+                    enable_file(FILE2);
+
+                } else if (strcmp(tvalue,"read-past-eof") == 0) {
+                    disableAllTests();
+
+                    enableTest(READWRITE_TESTS);
+                    enableTest(READPASTEOF_TEST);
+                    enableTest(MOUNT_TESTS);
+                    enableTest(ERROR_TESTS);
+                    enableTest(MKDIRCREATE_TESTS);
+                    enableTest(UNLINKRMDIR_TESTS);
+
+                    disable_all_files();
+                    enable_file(FILE1);
+                    enable_file(SUBDIR1);
+                    enable_file(SUBDIR_FILE1);
+
+                } else if (strcmp(tvalue,"syslog-write") == 0) {
+                    enableTest(SYSLOGWRITE_TEST);
+
+                    // Disable some of the other tests to get to the one we want quicker
+                    disableTest(ERROR_TESTS);
+                    disableTest(LOOKUP_TESTS);
+                    disableTest(READSYMLINK_TESTS);
+                    disableTest(READDIR_TESTS);
+                    disableTest(STATSIZE_TESTS);
+
+                } else if (strcmp(tvalue,"mount") == 0) {
+                    disableAllTests();
+                    enableTest(MOUNT_TESTS);
+                    enableTest(ERROR_TESTS);
+
+                    disable_all_files();
+
+                } else if (strcmp(tvalue,"chown") == 0) {
+                    disableAllTests();
+                    enableTest(CHOWNCHMOD_TESTS);
+                    enableTest(ERROR_TESTS);
+                    enableTest(MOUNT_TESTS);
+                    enableTest(MKDIRCREATE_TESTS);
+                    enableTest(LINK_TESTS);
+                    enableTest(UNLINKRMDIR_TESTS);
+
+                } else if (strcmp(tvalue,"mkdir") == 0) {
+                    disableAllTests();
+                    enableTest(MOUNT_TESTS);
+                    enableTest(ERROR_TESTS);
+                    enableTest(MKDIRCREATE_TESTS);
+                    enableTest(UNLINKRMDIR_TESTS);
+
+                } else if (strcmp(tvalue,"readdir") == 0) {
+                    disableAllTests();
+                    enableTest(READDIR_TESTS);
+                    enableTest(MOUNT_TESTS);
+                    enableTest(ERROR_TESTS);
+                    enableTest(MKDIRCREATE_TESTS);
+                    enableTest(LINK_TESTS);
+                    enableTest(UNLINKRMDIR_TESTS);
+
+                } else if (strcmp(tvalue,"async") == 0) {
+                    disableAllTests();
+                    enableTest(ASYNC_READWRITE_TESTS);
+                    enableTest(MOUNT_TESTS);
+                    enableTest(ERROR_TESTS);
+                    enableTest(MKDIRCREATE_TESTS);
+                    enableTest(LINK_TESTS);
+                    enableTest(UNLINKRMDIR_TESTS);
+
+                    disable_all_files();
+                    enable_file(FILE1);
+                    enable_file(SUBDIR1);
+                    enable_file(SUBDIR_FILE1);
+                    enable_file(SYMLINK1);
+                    enable_file(BAD_INODE);
+
+                } else if (strcmp(tvalue,"statvfs") == 0) {
+                    disableAllTests();
+                    enableTest(MOUNT_TESTS);
+                    //enableTest(ERROR_TESTS);
+                    enableTest(STATVFS_TESTS);
+
+                } else if (strcmp(tvalue,"registry") == 0) {
+                    disableAllTests();
+                    enableTest(REGISTRY_TESTS);
+
+                } else if (strcmp(tvalue,"tagged") == 0) {
+                    disableAllTests();
+                    enableTest(TAGGED_IO_TESTS);
+
+                } else if (strcmp(tvalue,"vectored") == 0) {
+                    disableAllTests();
+                    enableTest(VECTORED_IO_TESTS);
+
+                } else if (strcmp(tvalue,"iobench") == 0) {
+                    disableAllTests();
+                    enableTest(FASTPATH_IO_BENCH);
+
+                } else if (strcmp(tvalue,"attrcache") == 0) {
+                    disableAllTests();
+                    enableTest(ATTR_CACHE_TESTS);
+
+                } else if (strcmp(tvalue,"dentrycache") == 0) {
+                    disableAllTests();
+                    enableTest(DENTRY_CACHE_TESTS);
+
+                } else if (strcmp(tvalue,"pathwalk") == 0) {
+                    disableAllTests();
+                    enableTest(PATH_WALK_TESTS);
+
+                } else if (strcmp(tvalue,"dirstream") == 0) {
+                    disableAllTests();
+                    enableTest(DIR_STREAM_TESTS);
+
+                } else if (strcmp(tvalue,"reqwriter") == 0) {
+                    disableAllTests();
+                    enableTest(REQUEST_WRITER_TESTS);
+
+                } else if (strcmp(tvalue,"respparse") == 0) {
+                    disableAllTests();
+                    enableTest(RESPONSE_PARSER_TESTS);
+
+                } else if (strcmp(tvalue,"base64") == 0) {
+                    disableAllTests();
+                    enableTest(BASE64_TESTS);
+
+                } else if (strcmp(tvalue,"ctxpool") == 0) {
+                    disableAllTests();
+                    enableTest(CTX_POOL_TESTS);
+
+                } else if (strcmp(tvalue,"completion") == 0) {
+                    disableAllTests();
+                    enableTest(COMPLETION_TESTS);
+
+                } else if (strcmp(tvalue,"ioqueue") == 0) {
+                    disableAllTests();
+                    enableTest(IO_QUEUE_TESTS);
+
+                } else if (strcmp(tvalue,"ioworkers") == 0) {
+                    disableAllTests();
+                    enableTest(IO_WORKERS_TESTS);
+
+                } else if (strcmp(tvalue,"iomerge") == 0) {
+                    disableAllTests();
+                    enableTest(IO_MERGE_TESTS);
+
+                } else if (strcmp(tvalue,"iosched") == 0) {
+                    disableAllTests();
+                    enableTest(IO_SCHED_TESTS);
+
+                } else if (strcmp(tvalue,"cqueue") == 0) {
+                    disableAllTests();
+                    enableTest(COMPLETION_QUEUE_TESTS);
+
+                } else if (strcmp(tvalue,"iouring") == 0) {
+                    disableAllTests();
+                    enableTest(IO_URING_TESTS);
+
+                } else if (strcmp(tvalue,"rpcpool") == 0) {
+                    disableAllTests();
+                    enableTest(RPC_POOL_TESTS);
+
+                } else if (strcmp(tvalue,"fake_hang") == 0) {
+                    fakeHang = true;
+
+                } else {
+                    printf("Unknown test supplied: %s\n\n",tvalue);
+                    print_usage();
+                    return -1;
+                }
+                break;
+            case '?':
+                if ((optopt == 'r') || (optopt == 't')) {
+                    printf("Option -%c requires an argument.\n", optopt);
+                } else if (isprint(optopt)) {
+                    printf("Unknown option `-%c'.\n", optopt);
+                } else {
+                    printf("Unknown option character `\\x%x'.\n", optopt);
+                }
+                return 1;
+            default:
+                abort ();
+        }
+    }
+
+    if (!rpc_config_specified && serverTestsEnabled()) {
+        printf("-r <JSON:RPC/tuple> must be specified.\n");
+        return 1;
+    }
+
+    // print the tests to run; note that this must be done after
+    // after all the "-t" options have been parsed
+    if (print_tests) {
+        print_test_settings();
+    }
+
+    // Caller doesn't want debug prints from proxyfs code
     if (quiet) {
         proxyfs_unset_verbose();
     } else {
@@ -3501,6 +8400,78 @@ int main(int argc, char *argv[])
     // Initialize string stuff
     init_globals();
 
+    // Run the tests that don't need a server first
+    if (isEnabled(REGISTRY_TESTS)) {
+        registry_tests();
+    }
+    if (isEnabled(TAGGED_IO_TESTS)) {
+        tagged_io_tests();
+    }
+    if (isEnabled(VECTORED_IO_TESTS)) {
+        vectored_io_tests();
+    }
+    if (isEnabled(FASTPATH_IO_BENCH)) {
+        fastpath_io_bench();
+    }
+    if (isEnabled(ATTR_CACHE_TESTS)) {
+        attr_cache_tests();
+    }
+    if (isEnabled(DENTRY_CACHE_TESTS)) {
+        dentry_cache_tests();
+    }
+    if (isEnabled(PATH_WALK_TESTS)) {
+        path_walk_tests();
+    }
+    if (isEnabled(REQUEST_WRITER_TESTS)) {
+        request_writer_tests();
+    }
+    if (isEnabled(RESPONSE_PARSER_TESTS)) {
+        response_parser_tests();
+    }
+    if (isEnabled(BASE64_TESTS)) {
+        base64_tests();
+    }
+    if (isEnabled(CTX_POOL_TESTS)) {
+        ctx_pool_tests();
+    }
+    if (isEnabled(COMPLETION_TESTS)) {
+        completion_tests();
+    }
+    if (isEnabled(IO_QUEUE_TESTS)) {
+        io_queue_tests();
+    }
+    if (isEnabled(IO_WORKERS_TESTS)) {
+        io_workers_tests();
+    }
+    if (isEnabled(IO_MERGE_TESTS)) {
+        io_merge_tests();
+    }
+    if (isEnabled(IO_SCHED_TESTS)) {
+        io_sched_tests();
+    }
+    if (isEnabled(COMPLETION_QUEUE_TESTS)) {
+        completion_queue_tests();
+    }
+    if (isEnabled(IO_URING_TESTS)) {
+        io_uring_tests();
+    }
+    if (isEnabled(RPC_POOL_TESTS)) {
+        rpc_pool_tests();
+    }
+    if (isEnabled(DIR_STREAM_TESTS)) {
+        // Mounts through the mock server, which then has to outlive the
+        // process; that would take over the connections the server tests use
+        if (serverTestsEnabled()) {
+            TLOG("Skipping dirstream tests, they can't run together with server tests.\n", "");
+        } else {
+            dir_stream_tests();
+        }
+    }
+
+    if (!serverTestsEnabled()) {
+        goto done;
+    }
+
     // XXX TODO: Add a test for ENODEV
 
     // Run mount tests
@@ -0,0 +1,990 @@
+// Copyright (c) 2015-2021, NVIDIA CORPORATION.
+// SPDX-License-Identifier: Apache-2.0
+
+// Async reads and writes over the fast port, driven by io_uring.
+//
+// The I/O worker threads (ioworker.c) block in send() and recv(), so each request in flight takes a thread
+// and a few system calls. Here a few threads each own a ring and a set of fast-port connections, and keep
+// every connection busy with one untagged request at a time, as a worker would. A request is a linked pair
+// of operations, the send of its header and write data followed by the receive of its response, so starting
+// one costs no system call of its own: a thread submits everything it has started and reaps everything that
+// has finished with one io_uring_enter(), and sleeps in it when there's nothing to do.
+//
+// Write responses are received into headers in a buffer registered with the ring. Read responses go
+// straight into the caller's buffer or segments; without MSG_WAITALL, since the data may be short, so a
+// receive, or a send, that stops part way is carried on from there.
+//
+// Submitters push onto a thread's lock-free queue, and write its eventfd, which the thread keeps a read
+// posted on, only if the thread is asleep with a connection free.
+//
+// Built without <linux/io_uring.h>, or run on a kernel without io_uring (or with it turned off),
+// uring_start() fails with ENOSYS and the caller keeps the worker pool.
+
+// API:
+// int uring_start(char *server, int port, int num_threads, int conns_per_thread);
+// void uring_stop();
+// bool uring_enabled();
+// int uring_submit(proxyfs_io_request_t *req);
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "socket.h"
+#include "debug.h"
+#include "fault_inj.h"
+#include "attr_cache.h"
+#include "fastpath.h"
+#include "ioworker.h"
+#include "mpmc_queue.h"
+#include "completion_queue.h"
+#include "uring.h"
+
+static bool uring_disabled = false;
+
+void uring_test_disable(bool disable)
+{
+    uring_disabled = disable;
+}
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING
+#endif
+#endif
+
+#ifdef HAVE_IO_URING
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <linux/io_uring.h>
+
+// Older headers
+#ifndef IORING_SETUP_COOP_TASKRUN
+#define IORING_SETUP_COOP_TASKRUN  (1U << 8)
+#endif
+#ifndef IORING_SETUP_SINGLE_ISSUER
+#define IORING_SETUP_SINGLE_ISSUER  (1U << 12)
+#endif
+#ifndef IORING_SETUP_DEFER_TASKRUN
+#define IORING_SETUP_DEFER_TASKRUN  (1U << 13)
+#endif
+#ifndef IORING_RECVSEND_POLL_FIRST
+#define IORING_RECVSEND_POLL_FIRST  (1U << 0)
+#endif
+
+// Requests waiting for a connection, per thread
+#define URING_QUEUE_SIZE  4096
+
+// user_data of the eventfd read. The others are a connection index shifted left by one, plus one for the
+// receive of the response.
+#define URING_WAKEUP  UINT64_MAX
+
+typedef struct uring_ring_s {
+    int                 fd;
+    bool                disabled;      // until the thread that submits to it enables it
+    bool                poll_first;    // receives can wait for data before trying
+
+    unsigned            *sq_head;
+    unsigned            *sq_tail;
+    unsigned            *sq_array;
+    unsigned            sq_mask;
+    unsigned            sq_entries;
+    unsigned            sq_filled;     // tail including the SQEs filled since the last io_uring_enter()
+    unsigned            to_submit;
+    struct io_uring_sqe *sqes;
+
+    unsigned            *cq_head;
+    unsigned            *cq_tail;
+    unsigned            cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void                *sq_map;
+    size_t              sq_map_len;
+    void                *cq_map;       // sq_map if the kernel maps both rings together
+    size_t              cq_map_len;
+    size_t              sqes_len;
+} uring_ring_t;
+
+// A connection's request and response headers, in the registered buffer
+typedef struct uring_hdrs_s {
+    io_req_hdr_t  req;
+    io_resp_hdr_t resp;
+} uring_hdrs_t;
+
+typedef struct uring_conn_s {
+    int                  index;
+    int                  fd;
+    proxyfs_io_request_t *req;         // NULL if idle
+    uring_hdrs_t         *hdrs;
+    size_t               send_len;     // of the header and write data
+    size_t               sent;
+    size_t               received;     // of the response header and read data
+    int                  inflight;     // operations submitted and not yet completed
+    int                  error;
+
+    // What the operations in flight send from and receive into
+    struct msghdr        send_msg;
+    struct msghdr        recv_msg;
+    struct iovec         *send_iov;
+    struct iovec         *recv_iov;
+    int                  iov_size;     // entries in each
+} uring_conn_t;
+
+typedef struct uring_thread_s {
+    int          index;
+    pthread_t    thread_id;
+    bool         started;
+    uring_ring_t ring;
+    mpmc_queue_t queue;
+    int          event_fd;
+    uint64_t     event_count;          // read from event_fd
+    uint32_t     sleeping;             // waiting in io_uring_enter() with a connection free
+
+    int          num_conns;
+    uring_conn_t *conns;
+    uring_hdrs_t *hdrs;                // one per connection, registered with the ring
+    size_t       hdrs_len;
+    int          *idle;                // stack of idle connections
+    int          num_idle;
+
+    // Submitted from this thread's own completion callbacks while every queue was full
+    proxyfs_io_request_t **backlog;
+    int          backlog_head;
+    int          backlog_len;
+    int          backlog_size;
+
+    int          open_conns;
+    uint64_t     requests;
+    uint64_t     sqes;
+    uint64_t     enters;
+} uring_thread_t;
+
+typedef struct uring_config_s {
+    char           *server;
+    int            port;
+    int            num_threads;
+    uring_thread_t *threads;
+    uint32_t       next_thread;
+    uint64_t       wakeups;
+} uring_config_t;
+
+uring_config_t *uring_config = NULL;
+
+// The engine thread we're on, if any
+static __thread uring_thread_t *uring_self = NULL;
+
+static int uring_setup(unsigned entries, struct io_uring_params *params)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+// True if the kernel has every operation we use
+static bool uring_ops_supported(int fd)
+{
+    static const int needed[] = { IORING_OP_SENDMSG, IORING_OP_RECVMSG, IORING_OP_READ_FIXED, IORING_OP_READ };
+    size_t           len      = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    bool             ok;
+    int              i;
+
+    struct io_uring_probe *probe = (struct io_uring_probe *)calloc(1, len);
+    if (probe == NULL) {
+        return false;
+    }
+
+    ok = (uring_register(fd, IORING_REGISTER_PROBE, probe, 256) == 0);
+    for (i = 0; ok && (i < (int)(sizeof(needed) / sizeof(needed[0]))); i++) {
+        ok = (needed[i] <= probe->last_op) && ((probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED) != 0);
+    }
+
+    free(probe);
+    return ok;
+}
+
+static void uring_ring_close(uring_ring_t *ring)
+{
+    if (ring->sqes != NULL) {
+        munmap(ring->sqes, ring->sqes_len);
+    }
+    if ((ring->cq_map != NULL) && (ring->cq_map != ring->sq_map)) {
+        munmap(ring->cq_map, ring->cq_map_len);
+    }
+    if (ring->sq_map != NULL) {
+        munmap(ring->sq_map, ring->sq_map_len);
+    }
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+    bzero(ring, sizeof(*ring));
+    ring->fd = -1;
+}
+
+// Returns 0 or an errno: ENOSYS if io_uring isn't there, is turned off or lacks what we need
+static int uring_ring_open(uring_ring_t *ring, unsigned entries)
+{
+    struct io_uring_params params;
+    void                   *map;
+
+    bzero(ring, sizeof(*ring));
+    ring->fd = -1;
+    if (uring_disabled) {
+        return ENOSYS;
+    }
+
+    // Only the ring's thread submits to it, and it only looks at completions when it enters the kernel
+    // anyway, so have the kernel do the work of completing operations then rather than interrupt the
+    // thread for it. Each kernel knows fewer of the flags than the one before.
+    static const unsigned flags[] = {
+        IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN | IORING_SETUP_R_DISABLED,
+        IORING_SETUP_COOP_TASKRUN,
+        0,
+    };
+    int i;
+    for (i = 0; i < (int)(sizeof(flags) / sizeof(flags[0])); i++) {
+        bzero(&params, sizeof(params));
+        params.flags = flags[i];
+        ring->fd = uring_setup(entries, &params);
+        if ((ring->fd >= 0) || (errno != EINVAL)) {
+            break;
+        }
+    }
+    if (ring->fd < 0) {
+        int err = errno;
+        return ((err == ENOSYS) || (err == EPERM)) ? ENOSYS : err;
+    }
+    if (!uring_ops_supported(ring->fd)) {
+        uring_ring_close(ring);
+        return ENOSYS;
+    }
+
+    ring->disabled   = ((params.flags & IORING_SETUP_R_DISABLED) != 0);
+    ring->poll_first = (params.flags != 0);   // kernels that know either set of flags
+
+    ring->sq_map_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_map_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if ((params.features & IORING_FEAT_SINGLE_MMAP) && (ring->cq_map_len > ring->sq_map_len)) {
+        ring->sq_map_len = ring->cq_map_len;
+    }
+
+    map = mmap(NULL, ring->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+               IORING_OFF_SQ_RING);
+    if (map == MAP_FAILED) {
+        int err = errno;
+        uring_ring_close(ring);
+        return err;
+    }
+    ring->sq_map = map;
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_map = ring->sq_map;
+    } else {
+        map = mmap(NULL, ring->cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                   IORING_OFF_CQ_RING);
+        if (map == MAP_FAILED) {
+            int err = errno;
+            uring_ring_close(ring);
+            return err;
+        }
+        ring->cq_map = map;
+    }
+
+    ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    map = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+               IORING_OFF_SQES);
+    if (map == MAP_FAILED) {
+        int err = errno;
+        uring_ring_close(ring);
+        return err;
+    }
+    ring->sqes = (struct io_uring_sqe *)map;
+
+    ring->sq_head    = (unsigned *)((char *)ring->sq_map + params.sq_off.head);
+    ring->sq_tail    = (unsigned *)((char *)ring->sq_map + params.sq_off.tail);
+    ring->sq_array   = (unsigned *)((char *)ring->sq_map + params.sq_off.array);
+    ring->sq_mask    = *(unsigned *)((char *)ring->sq_map + params.sq_off.ring_mask);
+    ring->sq_entries = params.sq_entries;
+    ring->sq_filled  = *ring->sq_tail;
+    ring->cq_head    = (unsigned *)((char *)ring->cq_map + params.cq_off.head);
+    ring->cq_tail    = (unsigned *)((char *)ring->cq_map + params.cq_off.tail);
+    ring->cq_mask    = *(unsigned *)((char *)ring->cq_map + params.cq_off.ring_mask);
+    ring->cqes       = (struct io_uring_cqe *)((char *)ring->cq_map + params.cq_off.cqes);
+
+    return 0;
+}
+
+// The next free SQE, zeroed. The ring has room for every operation a thread can have in flight.
+static struct io_uring_sqe *uring_get_sqe(uring_thread_t *thread)
+{
+    uring_ring_t *ring = &thread->ring;
+    unsigned     head  = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+    if (ring->sq_filled - head >= ring->sq_entries) {
+        PANIC("uring: thread %d submission queue full", thread->index);
+    }
+
+    unsigned            index = ring->sq_filled & ring->sq_mask;
+    struct io_uring_sqe *sqe  = &ring->sqes[index];
+
+    bzero(sqe, sizeof(*sqe));
+    ring->sq_array[index] = index;
+    ring->sq_filled++;
+    ring->to_submit++;
+    __atomic_add_fetch(&thread->sqes, 1, __ATOMIC_RELAXED);
+    return sqe;
+}
+
+// Submit what's been filled, and wait for at least one completion if wait is set
+static void uring_submit_and_wait(uring_thread_t *thread, bool wait)
+{
+    uring_ring_t *ring = &thread->ring;
+
+    if ((ring->to_submit == 0) && !wait) {
+        return;
+    }
+
+    __atomic_store_n(ring->sq_tail, ring->sq_filled, __ATOMIC_RELEASE);
+    int ret = uring_enter(ring->fd, ring->to_submit, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0);
+    __atomic_add_fetch(&thread->enters, 1, __ATOMIC_RELAXED);
+    if (ret < 0) {
+        // Interrupted, or short of memory for now: retried on the next pass
+        if ((errno != EINTR) && (errno != EAGAIN) && (errno != EBUSY)) {
+            PANIC("uring: io_uring_enter() failed on thread %d: errno %d", thread->index, errno);
+        }
+        return;
+    }
+    ring->to_submit -= ret;
+}
+
+// Keep a read posted on the eventfd, so that a submitter can wake the thread
+static void uring_arm_wakeup(uring_thread_t *thread)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(thread);
+
+    sqe->opcode    = IORING_OP_READ;
+    sqe->fd        = thread->event_fd;
+    sqe->addr      = (uint64_t)(uintptr_t)&thread->event_count;
+    sqe->len       = sizeof(thread->event_count);
+    sqe->user_data = URING_WAKEUP;
+}
+
+// Fill out with the header followed by the first data_len bytes of the request's buffer or segments,
+// leaving out the first skip bytes. Returns the number of entries.
+static int uring_iov(struct iovec *out, void *hdr, size_t hdr_len, proxyfs_io_request_t *req, size_t data_len,
+                     size_t skip)
+{
+    struct iovec        data_iov = { .iov_base = req->data, .iov_len = req->length };
+    const struct iovec *iov      = (req->iov != NULL) ? req->iov : &data_iov;
+    int                 iovcnt   = (req->iov != NULL) ? req->iovcnt : 1;
+    int                 n        = 0;
+    int                 i;
+
+    if (skip < hdr_len) {
+        out[n].iov_base  = (char *)hdr + skip;
+        out[n++].iov_len = hdr_len - skip;
+        skip = 0;
+    } else {
+        skip -= hdr_len;
+    }
+
+    for (i = 0; (i < iovcnt) && (data_len > 0); i++) {
+        size_t len = (iov[i].iov_len < data_len) ? iov[i].iov_len : data_len;
+
+        data_len -= len;
+        if (skip >= len) {
+            skip -= len;
+            continue;
+        }
+        out[n].iov_base  = (char *)iov[i].iov_base + skip;
+        out[n++].iov_len = len - skip;
+        skip = 0;
+    }
+    return n;
+}
+
+// True once the whole response, header and any read data, has been received
+static bool uring_conn_responded(uring_conn_t *conn)
+{
+    if (conn->received < sizeof(io_resp_hdr_t)) {
+        return false;
+    }
+    return (conn->req->op != IO_READ) || (conn->received >= sizeof(io_resp_hdr_t) + conn->hdrs->resp.io_size);
+}
+
+// Submit the rest of the request, if any is left to send, linked to the receive of the rest of its response
+static void uring_conn_queue(uring_thread_t *thread, uring_conn_t *conn)
+{
+    proxyfs_io_request_t *req = conn->req;
+    struct io_uring_sqe  *sqe;
+
+    if (conn->sent < conn->send_len) {
+        bzero(&conn->send_msg, sizeof(conn->send_msg));
+        conn->send_msg.msg_iov    = conn->send_iov;
+        conn->send_msg.msg_iovlen = uring_iov(conn->send_iov, &conn->hdrs->req, sizeof(io_req_hdr_t), req,
+                                              conn->send_len - sizeof(io_req_hdr_t), conn->sent);
+
+        // With MSG_WAITALL, a send that stops short fails the link rather than letting the receive wait
+        // for a response to a request the server hasn't all got
+        sqe = uring_get_sqe(thread);
+        sqe->opcode    = IORING_OP_SENDMSG;
+        sqe->fd        = conn->fd;
+        sqe->addr      = (uint64_t)(uintptr_t)&conn->send_msg;
+        sqe->len       = 1;
+        sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+        sqe->flags     = IOSQE_IO_LINK;
+        sqe->user_data = (uint64_t)conn->index << 1;
+        conn->inflight++;
+    }
+
+    sqe = uring_get_sqe(thread);
+    if ((req->op == IO_WRITE) && (conn->received == 0)) {
+        sqe->opcode    = IORING_OP_READ_FIXED;
+        sqe->fd        = conn->fd;
+        sqe->addr      = (uint64_t)(uintptr_t)&conn->hdrs->resp;
+        sqe->len       = sizeof(io_resp_hdr_t);
+        sqe->buf_index = 0;
+    } else {
+        // Up to the length asked for until the header says how much is coming
+        size_t data_len = 0;
+        if (req->op == IO_READ) {
+            data_len = (conn->received >= sizeof(io_resp_hdr_t)) ? conn->hdrs->resp.io_size : req->length;
+        }
+
+        bzero(&conn->recv_msg, sizeof(conn->recv_msg));
+        conn->recv_msg.msg_iov    = conn->recv_iov;
+        conn->recv_msg.msg_iovlen = uring_iov(conn->recv_iov, &conn->hdrs->resp, sizeof(io_resp_hdr_t), req,
+                                              data_len, conn->received);
+
+        sqe->opcode    = IORING_OP_RECVMSG;
+        sqe->fd        = conn->fd;
+        sqe->addr      = (uint64_t)(uintptr_t)&conn->recv_msg;
+        sqe->len       = 1;
+        if (thread->ring.poll_first) {
+            sqe->ioprio = IORING_RECVSEND_POLL_FIRST;
+        }
+    }
+    sqe->user_data = ((uint64_t)conn->index << 1) | 1;
+    conn->inflight++;
+}
+
+// Complete the connection's request and make it idle
+static void uring_conn_finish(uring_thread_t *thread, uring_conn_t *conn)
+{
+    proxyfs_io_request_t *req = conn->req;
+
+    if (conn->error != 0) {
+        DPRINTF("uring: error %d on connection %d of thread %d\n", conn->error, conn->index, thread->index);
+
+        // Part of a request or response may be left on it
+        if (conn->fd >= 0) {
+            sock_close(conn->fd);
+            conn->fd = -1;
+            __atomic_sub_fetch(&thread->open_conns, 1, __ATOMIC_RELAXED);
+        }
+        req->error    = EIO;
+        req->out_size = 0;
+    } else {
+        req->error    = (int)conn->hdrs->resp.error;
+        req->out_size = conn->hdrs->resp.io_size;
+    }
+
+    // Special handling for read/write/flush: translate ENOENT to EBADF
+    if (req->error == ENOENT) {
+        req->error = EBADF;
+    }
+
+    // The file's size and times may have changed, even if something failed
+    if (req->op == IO_WRITE) {
+        attr_cache_invalidate(req->mount_handle->attr_cache, req->inode_number);
+    }
+
+    conn->req = NULL;
+    thread->idle[thread->num_idle++] = conn->index;
+    __atomic_add_fetch(&thread->requests, 1, __ATOMIC_RELAXED);
+
+    // Doesn't wait for a completion queue to be reaped: proxyfs_async_send() sent no more than it holds
+    io_req_complete(req);
+}
+
+static void uring_conn_start(uring_thread_t *thread, uring_conn_t *conn, proxyfs_io_request_t *req)
+{
+    conn->req      = req;
+    conn->sent     = 0;
+    conn->received = 0;
+    conn->error    = 0;
+
+    if (conn->fd < 0) {
+        conn->fd = sock_open(uring_config->server, uring_config->port);
+        if (conn->fd < 0) {
+            DPRINTF("uring: failed to open connection %d of thread %d\n", conn->index, thread->index);
+            conn->error = EIO;
+            uring_conn_finish(thread, conn);
+            return;
+        }
+        __atomic_add_fetch(&thread->open_conns, 1, __ATOMIC_RELAXED);
+    }
+
+    // Room for the header and every segment
+    int segs = ((req->iov != NULL) ? req->iovcnt : 1) + 1;
+    if (segs > conn->iov_size) {
+        struct iovec *send_iov = (struct iovec *)realloc(conn->send_iov, sizeof(struct iovec) * segs);
+        if (send_iov != NULL) {
+            conn->send_iov = send_iov;
+        }
+        struct iovec *recv_iov = (struct iovec *)realloc(conn->recv_iov, sizeof(struct iovec) * segs);
+        if (recv_iov != NULL) {
+            conn->recv_iov = recv_iov;
+        }
+        if ((send_iov == NULL) || (recv_iov == NULL)) {
+            conn->error = ENOMEM;
+            uring_conn_finish(thread, conn);
+            return;
+        }
+        conn->iov_size = segs;
+    }
+
+    io_req_hdr_t *hdr = &conn->hdrs->req;
+    hdr->op_type      = (req->op == IO_READ) ? FASTPATH_OP_READ : FASTPATH_OP_WRITE;
+    hdr->inode_number = req->inode_number;
+    hdr->offset       = req->offset;
+    hdr->length       = req->length;
+    (void)memcpy(hdr->mount_id, req->mount_handle->mount_id_as_bytes, MOUNT_ID_SIZE);
+    conn->send_len = sizeof(io_req_hdr_t) + ((req->op == IO_WRITE) ? req->length : 0);
+
+    uring_conn_queue(thread, conn);
+}
+
+// An operation of the connection's request has completed with res
+static void uring_conn_done(uring_thread_t *thread, uring_conn_t *conn, bool is_recv, int res)
+{
+    conn->inflight--;
+    if (res == -ECANCELED) {
+        // The send before it came up short or failed; carried on below
+    } else if (res < 0) {
+        conn->error = -res;
+    } else if (!is_recv) {
+        conn->sent += res;
+    } else if (res == 0) {
+        conn->error = EPIPE;
+    } else {
+        conn->received += res;
+    }
+    if (conn->inflight > 0) {
+        return;
+    }
+
+    proxyfs_io_request_t *req = conn->req;
+    if ((conn->error == 0) && (req->op == IO_READ) && (conn->received >= sizeof(io_resp_hdr_t)) &&
+        (conn->hdrs->resp.io_size > req->length)) {
+        PRINTF("uring: read response of %lu bytes for a %lu byte request\n", conn->hdrs->resp.io_size, req->length);
+        conn->error = EPROTO;
+    }
+
+    if ((conn->error == 0) && !uring_conn_responded(conn)) {
+        uring_conn_queue(thread, conn);
+        return;
+    }
+    uring_conn_finish(thread, conn);
+}
+
+static void uring_reap(uring_thread_t *thread)
+{
+    uring_ring_t *ring = &thread->ring;
+    unsigned     head  = *ring->cq_head;
+    unsigned     tail  = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+    while (head != tail) {
+        struct io_uring_cqe *cqe       = &ring->cqes[head & ring->cq_mask];
+        uint64_t            user_data = cqe->user_data;
+        int                 res       = cqe->res;
+
+        head++;
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+        if (user_data == URING_WAKEUP) {
+            // Without a read posted, submitters couldn't wake the thread; only once it's stopping does
+            // a failed one not need replacing
+            if (res <= 0) {
+                DPRINTF("uring: eventfd read failed on thread %d: %d\n", thread->index, res);
+            }
+            if ((res > 0) || !mpmc_queue_closed(&thread->queue)) {
+                uring_arm_wakeup(thread);
+            }
+        } else {
+            uring_conn_done(thread, &thread->conns[user_data >> 1], (user_data & 1) != 0, res);
+        }
+    }
+}
+
+// The next request to start: those this thread's callbacks couldn't queue first
+static proxyfs_io_request_t *uring_next(uring_thread_t *thread)
+{
+    if (thread->backlog_head < thread->backlog_len) {
+        proxyfs_io_request_t *req = thread->backlog[thread->backlog_head++];
+        if (thread->backlog_head == thread->backlog_len) {
+            thread->backlog_head = 0;
+            thread->backlog_len  = 0;
+        }
+        return req;
+    }
+    return (proxyfs_io_request_t *)mpmc_queue_try_pop(&thread->queue);
+}
+
+void *uring_thread(void *arg)
+{
+    uring_thread_t       *thread = (uring_thread_t *)arg;
+    proxyfs_io_request_t *req;
+
+    uring_self = thread;
+    if (thread->ring.disabled && (uring_register(thread->ring.fd, IORING_REGISTER_ENABLE_RINGS, NULL, 0) != 0)) {
+        PANIC("uring: failed to enable the ring of thread %d: errno %d", thread->index, errno);
+    }
+    uring_arm_wakeup(thread);
+
+    while (1) {
+        // Start what's waiting on the free connections
+        while ((thread->num_idle > 0) && ((req = uring_next(thread)) != NULL)) {
+            uring_conn_start(thread, &thread->conns[thread->idle[--thread->num_idle]], req);
+        }
+
+        bool waiting = (mpmc_queue_depth(&thread->queue) > 0) || (thread->backlog_len > 0);
+        if (mpmc_queue_closed(&thread->queue) && !waiting && (thread->num_idle == thread->num_conns)) {
+            break;
+        }
+
+        // Wait for something to complete or, with a connection free, to be submitted. A submitter only
+        // writes the eventfd if it sees sleeping set, so look at the queue again after setting it.
+        bool wait = true;
+        if (thread->num_idle > 0) {
+            __atomic_store_n(&thread->sleeping, 1, __ATOMIC_SEQ_CST);
+            if (waiting || (mpmc_queue_depth(&thread->queue) > 0)) {
+                wait = false;
+            }
+        }
+        uring_submit_and_wait(thread, wait);
+        __atomic_store_n(&thread->sleeping, 0, __ATOMIC_SEQ_CST);
+
+        uring_reap(thread);
+    }
+
+    return NULL;
+}
+
+static void uring_thread_free(uring_thread_t *thread)
+{
+    int i;
+
+    for (i = 0; (thread->conns != NULL) && (i < thread->num_conns); i++) {
+        if (thread->conns[i].fd >= 0) {
+            sock_close(thread->conns[i].fd);
+        }
+        free(thread->conns[i].send_iov);
+        free(thread->conns[i].recv_iov);
+    }
+    uring_ring_close(&thread->ring);
+    if (thread->event_fd >= 0) {
+        close(thread->event_fd);
+    }
+    mpmc_queue_destroy(&thread->queue);
+    free(thread->conns);
+    free(thread->hdrs);
+    free(thread->idle);
+    free(thread->backlog);
+}
+
+static int uring_thread_init(uring_thread_t *thread, int index, int num_conns)
+{
+    int ret, i;
+
+    thread->index     = index;
+    thread->event_fd  = -1;
+    thread->num_conns = num_conns;
+
+    // Two operations per connection in flight, and the eventfd read
+    ret = uring_ring_open(&thread->ring, 2 * num_conns + 1);
+    if (ret != 0) {
+        return ret;
+    }
+
+    // Blocking, or io_uring would complete the read with EAGAIN rather than wait for a write
+    thread->event_fd = eventfd(0, EFD_CLOEXEC);
+    if (thread->event_fd < 0) {
+        return errno;
+    }
+    if (mpmc_queue_init(&thread->queue, URING_QUEUE_SIZE) != 0) {
+        return ENOMEM;
+    }
+
+    thread->hdrs_len = sizeof(uring_hdrs_t) * num_conns;
+    thread->conns    = (uring_conn_t *)calloc(num_conns, sizeof(uring_conn_t));
+    thread->idle     = (int *)malloc(sizeof(int) * num_conns);
+    if ((thread->conns == NULL) || (thread->idle == NULL) ||
+        (posix_memalign((void **)&thread->hdrs, sysconf(_SC_PAGESIZE), thread->hdrs_len) != 0)) {
+        thread->hdrs = NULL;
+        return ENOMEM;
+    }
+    bzero(thread->hdrs, thread->hdrs_len);
+
+    for (i = 0; i < num_conns; i++) {
+        thread->conns[i].index = i;
+        thread->conns[i].fd    = -1;
+        thread->conns[i].hdrs  = &thread->hdrs[i];
+        thread->idle[i]        = num_conns - 1 - i;
+    }
+    thread->num_idle = num_conns;
+
+    // Write responses are received straight into the headers
+    struct iovec region = { .iov_base = thread->hdrs, .iov_len = thread->hdrs_len };
+    if (uring_register(thread->ring.fd, IORING_REGISTER_BUFFERS, &region, 1) != 0) {
+        return errno;
+    }
+
+    return 0;
+}
+
+int uring_start(char *server, int port, int num_threads, int conns_per_thread)
+{
+    // Like io_workers_start(), assumes it is called from a single thread
+    if (uring_config != NULL) {
+        return 0; // already initialized..
+    }
+
+    if ((num_threads < 1) || (conns_per_thread < 1)) {
+        return EINVAL;
+    }
+    if (num_threads > URING_THREADS_LIMIT) {
+        num_threads = URING_THREADS_LIMIT;
+    }
+    if (conns_per_thread > URING_CONNS_LIMIT) {
+        conns_per_thread = URING_CONNS_LIMIT;
+    }
+
+    uring_config_t *config = (uring_config_t *)malloc(sizeof(uring_config_t));
+    if (config == NULL) {
+        return ENOMEM;
+    }
+    bzero(config, sizeof(uring_config_t));
+
+    config->server  = strdup(server);
+    config->port    = port;
+    config->threads = (uring_thread_t *)calloc(num_threads, sizeof(uring_thread_t));
+    if ((config->server == NULL) || (config->threads == NULL)) {
+        free(config->server);
+        free(config->threads);
+        free(config);
+        return ENOMEM;
+    }
+
+    int ret = 0;
+    int i;
+    for (i = 0; i < num_threads; i++) {
+        config->num_threads++;
+        ret = uring_thread_init(&config->threads[i], i, conns_per_thread);
+        if (ret != 0) {
+            break;
+        }
+    }
+
+    uring_config = config;
+    for (i = 0; (ret == 0) && (i < num_threads); i++) {
+        uring_thread_t *thread = &config->threads[i];
+
+        ret = pthread_create(&thread->thread_id, NULL, &uring_thread, thread);
+        if (ret != 0) {
+            DPRINTF("uring: failed to create thread %d: %d\n", i, ret);
+            break;
+        }
+        thread->started = true;
+    }
+
+    if (ret != 0) {
+        uring_stop();
+    }
+    return ret;
+}
+
+void uring_stop()
+{
+    uring_config_t *config = uring_config;
+    uint64_t       one     = 1;
+    int            i;
+
+    if (config == NULL) {
+        return;
+    }
+
+    // The threads finish what's queued and in flight, then exit
+    for (i = 0; i < config->num_threads; i++) {
+        uring_thread_t *thread = &config->threads[i];
+
+        if (!thread->started) {
+            continue;
+        }
+        mpmc_queue_close(&thread->queue);
+        if (write(thread->event_fd, &one, sizeof(one)) != sizeof(one)) {
+            DPRINTF("uring: failed to wake thread %d: errno %d\n", i, errno);
+        }
+    }
+    for (i = 0; i < config->num_threads; i++) {
+        if (config->threads[i].started) {
+            pthread_join(config->threads[i].thread_id, NULL);
+        }
+    }
+
+    uring_config = NULL;
+
+    for (i = 0; i < config->num_threads; i++) {
+        uring_thread_free(&config->threads[i]);
+    }
+    free(config->threads);
+    free(config->server);
+    free(config);
+}
+
+bool uring_enabled()
+{
+    return (uring_config != NULL);
+}
+
+// Queue req for this engine thread, which is completing a request and so will look at it next
+static int uring_backlog(uring_thread_t *thread, proxyfs_io_request_t *req)
+{
+    if (thread->backlog_len == thread->backlog_size) {
+        int                  size    = (thread->backlog_size > 0) ? 2 * thread->backlog_size : 64;
+        proxyfs_io_request_t **backlog = (proxyfs_io_request_t **)realloc(thread->backlog, sizeof(req) * size);
+        if (backlog == NULL) {
+            return ENOMEM;
+        }
+        thread->backlog      = backlog;
+        thread->backlog_size = size;
+    }
+    thread->backlog[thread->backlog_len++] = req;
+    return 0;
+}
+
+int uring_submit(proxyfs_io_request_t *req)
+{
+    if ((req == NULL) || (req->mount_handle == NULL) || !io_req_has_buffer(req) || !io_req_has_completion(req)) {
+        return EINVAL;
+    }
+    if ((req->op != IO_READ) && (req->op != IO_WRITE)) {
+        return EINVAL;
+    }
+    if (uring_config == NULL) {
+        return ENODEV;
+    }
+
+    if ( fail(WRITE_BROKEN_PIPE_FAULT) ) {
+        req->error = ENODEV;
+        req->out_size = 0;
+        io_req_complete(req);
+        return 0;
+    }
+
+    // Nothing to send, as with the worker pool
+    if ((req->op == IO_WRITE) && (req->length == 0)) {
+        req->error    = 0;
+        req->out_size = 0;
+        io_req_complete(req);
+        return 0;
+    }
+
+    // The next thread round robin, or the first after it with room
+    int            num_threads = uring_config->num_threads;
+    uint32_t       first       = __atomic_fetch_add(&uring_config->next_thread, 1, __ATOMIC_RELAXED);
+    uring_thread_t *thread     = NULL;
+    int            i;
+
+    for (i = 0; i < num_threads; i++) {
+        uring_thread_t *candidate = &uring_config->threads[(first + i) % num_threads];
+        if (mpmc_queue_try_push(&candidate->queue, req)) {
+            thread = candidate;
+            break;
+        }
+    }
+
+    // With every queue full, turn the request away as the worker pool does, except from a completion
+    // callback on an engine thread, which will look at its backlog next
+    if (thread == NULL) {
+        return (uring_self != NULL) ? uring_backlog(uring_self, req) : EAGAIN;
+    }
+
+    // Wake the thread if it's asleep; only one submitter gets to
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if ((__atomic_load_n(&thread->sleeping, __ATOMIC_RELAXED) != 0) &&
+        (__atomic_exchange_n(&thread->sleeping, 0, __ATOMIC_SEQ_CST) != 0)) {
+        uint64_t one = 1;
+        if (write(thread->event_fd, &one, sizeof(one)) != sizeof(one)) {
+            DPRINTF("uring: failed to wake thread %d: errno %d\n", thread->index, errno);
+        }
+        __atomic_add_fetch(&uring_config->wakeups, 1, __ATOMIC_RELAXED);
+    }
+
+    return 0;
+}
+
+void uring_get_stats(uring_stats_t *stats)
+{
+    uring_config_t *config = uring_config;
+    int            i;
+
+    bzero(stats, sizeof(*stats));
+    if (config == NULL) {
+        return;
+    }
+
+    stats->threads = config->num_threads;
+    stats->wakeups = __atomic_load_n(&config->wakeups, __ATOMIC_RELAXED);
+    for (i = 0; i < config->num_threads; i++) {
+        uring_thread_t *thread = &config->threads[i];
+
+        stats->connections += __atomic_load_n(&thread->open_conns, __ATOMIC_RELAXED);
+        stats->requests    += __atomic_load_n(&thread->requests, __ATOMIC_RELAXED);
+        stats->sqes        += __atomic_load_n(&thread->sqes, __ATOMIC_RELAXED);
+        stats->enters      += __atomic_load_n(&thread->enters, __ATOMIC_RELAXED);
+    }
+}
+
+#else // !HAVE_IO_URING
+
+int uring_start(char *server, int port, int num_threads, int conns_per_thread)
+{
+    return ENOSYS;
+}
+
+void uring_stop()
+{
+}
+
+bool uring_enabled()
+{
+    return false;
+}
+
+int uring_submit(proxyfs_io_request_t *req)
+{
+    return ENODEV;
+}
+
+void uring_get_stats(uring_stats_t *stats)
+{
+    bzero(stats, sizeof(*stats));
+}
+
+#endif // HAVE_IO_URING
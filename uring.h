@@ -0,0 +1,52 @@
+// Copyright (c) 2015-2021, NVIDIA CORPORATION.
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef __PFS_URING_H__
+#define __PFS_URING_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <proxyfs.h>
+
+// io_uring engine for async reads and writes over the fast port, an
+// alternative to the I/O worker threads (ioworker.h). A few threads each
+// drive a ring and keep up to conns_per_thread fast-port connections busy
+// with untagged requests, so it works with any server the workers do.
+
+// Most threads, and most connections per thread
+#define URING_THREADS_LIMIT  64
+#define URING_CONNS_LIMIT    1024
+
+// Start num_threads threads, each opening up to conns_per_thread connections
+// to server:port as it has work for them. Returns 0, ENOSYS if the kernel
+// (or the build) has no usable io_uring, or another errno.
+int uring_start(char *server, int port, int num_threads, int conns_per_thread);
+
+// Complete whatever is queued or in flight, then close the connections
+void uring_stop();
+
+// True once uring_start() has succeeded
+bool uring_enabled();
+
+// Queue an IO_READ or IO_WRITE request and return without waiting; it is
+// completed (see io_req_complete) from one of the engine's threads. EAGAIN,
+// without queueing it, if every thread's queue is full.
+int uring_submit(proxyfs_io_request_t *req);
+
+typedef struct {
+    int      threads;
+    int      connections;    // open now
+    uint64_t requests;       // completed
+    uint64_t sqes;           // operations submitted to the rings
+    uint64_t enters;         // io_uring_enter() calls
+    uint64_t wakeups;        // submitters waking an idle thread
+} uring_stats_t;
+
+// All zero if the engine isn't running
+void uring_get_stats(uring_stats_t *stats);
+
+// Have uring_start() fail with ENOSYS as if the kernel had no io_uring, to
+// exercise the fallback to the worker pool
+void uring_test_disable(bool disable);
+
+#endif